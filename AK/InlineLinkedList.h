@@ -118,6 +118,7 @@ public:
 
     void prepend(T*);
     void append(T*);
+    void insert_before(T* before_node, T*);
     void remove(T*);
     void append(InlineLinkedList<T>&);
 
@@ -199,6 +200,22 @@ inline void InlineLinkedList<T>::append(T* node)
     m_tail = node;
 }
 
+template<typename T>
+inline void InlineLinkedList<T>::insert_before(T* before_node, T* node)
+{
+    ASSERT(before_node);
+    ASSERT(node != before_node);
+    if (before_node == m_head) {
+        prepend(node);
+        return;
+    }
+
+    before_node->prev()->set_next(node);
+    node->set_prev(before_node->prev());
+    node->set_next(before_node);
+    before_node->set_prev(node);
+}
+
 template<typename T>
 inline void InlineLinkedList<T>::remove(T* node)
 {
@@ -0,0 +1,420 @@
+/*
+ * Copyright (c) 2020, the SerenityOS developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <AK/Assertions.h>
+#include <AK/Noncopyable.h>
+#include <AK/StdLibExtras.h>
+#include <AK/Types.h>
+
+namespace AK {
+
+// An ordered map from K to V, kept balanced as a red-black tree so that
+// lookups, insertions and removals are all O(log n).
+template<typename K, typename V>
+class RedBlackTree {
+    AK_MAKE_NONCOPYABLE(RedBlackTree);
+
+    struct Node {
+        Node(const K& key, V&& value)
+            : key(key)
+            , value(move(value))
+        {
+        }
+
+        K key;
+        V value;
+        Node* parent { nullptr };
+        Node* left { nullptr };
+        Node* right { nullptr };
+        bool is_red { true };
+    };
+
+public:
+    RedBlackTree() { }
+    ~RedBlackTree() { clear(); }
+
+    RedBlackTree(RedBlackTree&& other)
+        : m_root(exchange(other.m_root, nullptr))
+        , m_size(exchange(other.m_size, 0))
+    {
+    }
+
+    RedBlackTree& operator=(RedBlackTree&& other)
+    {
+        if (this != &other) {
+            clear();
+            m_root = exchange(other.m_root, nullptr);
+            m_size = exchange(other.m_size, 0);
+        }
+        return *this;
+    }
+
+    size_t size() const { return m_size; }
+    bool is_empty() const { return !m_root; }
+
+    // Adds key, or replaces its value if it's already there.
+    void insert(const K& key, V value)
+    {
+        Node* parent = nullptr;
+        Node** link = &m_root;
+        while (*link) {
+            parent = *link;
+            if (key < parent->key) {
+                link = &parent->left;
+            } else if (parent->key < key) {
+                link = &parent->right;
+            } else {
+                parent->value = move(value);
+                return;
+            }
+        }
+        auto* node = new Node(key, move(value));
+        node->parent = parent;
+        *link = node;
+        ++m_size;
+        insert_fixup(node);
+    }
+
+    bool remove(const K& key)
+    {
+        auto* node = find_node(key);
+        if (!node)
+            return false;
+        remove_node(node);
+        return true;
+    }
+
+    void clear()
+    {
+        destroy_subtree(m_root);
+        m_root = nullptr;
+        m_size = 0;
+    }
+
+    V* find(const K& key)
+    {
+        auto* node = find_node(key);
+        return node ? &node->value : nullptr;
+    }
+
+    const V* find(const K& key) const { return const_cast<RedBlackTree*>(this)->find(key); }
+
+    // The value of the biggest key that is <= key.
+    V* find_largest_not_above(const K& key)
+    {
+        Node* candidate = nullptr;
+        for (auto* node = m_root; node;) {
+            if (key < node->key) {
+                node = node->left;
+            } else {
+                candidate = node;
+                if (!(node->key < key))
+                    break;
+                node = node->right;
+            }
+        }
+        return candidate ? &candidate->value : nullptr;
+    }
+
+    const V* find_largest_not_above(const K& key) const { return const_cast<RedBlackTree*>(this)->find_largest_not_above(key); }
+
+    // The value of the smallest key that is >= key.
+    V* find_smallest_not_below(const K& key)
+    {
+        Node* candidate = nullptr;
+        for (auto* node = m_root; node;) {
+            if (node->key < key) {
+                node = node->right;
+            } else {
+                candidate = node;
+                if (!(key < node->key))
+                    break;
+                node = node->left;
+            }
+        }
+        return candidate ? &candidate->value : nullptr;
+    }
+
+    const V* find_smallest_not_below(const K& key) const { return const_cast<RedBlackTree*>(this)->find_smallest_not_below(key); }
+
+    template<typename NodeType, typename ValueType>
+    class IteratorBase {
+    public:
+        bool operator!=(const IteratorBase& other) const { return m_node != other.m_node; }
+        bool operator==(const IteratorBase& other) const { return m_node == other.m_node; }
+        IteratorBase& operator++()
+        {
+            m_node = successor(m_node);
+            return *this;
+        }
+        ValueType& operator*() { return m_node->value; }
+        ValueType* operator->() { return &m_node->value; }
+        const K& key() const { return m_node->key; }
+        bool is_end() const { return !m_node; }
+
+    private:
+        friend class RedBlackTree;
+        explicit IteratorBase(NodeType* node)
+            : m_node(node)
+        {
+        }
+        NodeType* m_node { nullptr };
+    };
+
+    using Iterator = IteratorBase<Node, V>;
+    using ConstIterator = IteratorBase<const Node, const V>;
+
+    Iterator begin() { return Iterator(leftmost(m_root)); }
+    Iterator end() { return Iterator(nullptr); }
+    ConstIterator begin() const { return ConstIterator(leftmost(m_root)); }
+    ConstIterator end() const { return ConstIterator(nullptr); }
+
+private:
+    static bool is_red(const Node* node) { return node && node->is_red; }
+
+    template<typename NodeType>
+    static NodeType* leftmost(NodeType* node)
+    {
+        if (!node)
+            return nullptr;
+        while (node->left)
+            node = node->left;
+        return node;
+    }
+
+    template<typename NodeType>
+    static NodeType* successor(NodeType* node)
+    {
+        if (node->right)
+            return leftmost(node->right);
+        while (node->parent && node == node->parent->right)
+            node = node->parent;
+        return node->parent;
+    }
+
+    static void destroy_subtree(Node* node)
+    {
+        while (node) {
+            destroy_subtree(node->right);
+            auto* left = node->left;
+            delete node;
+            node = left;
+        }
+    }
+
+    Node* find_node(const K& key)
+    {
+        for (auto* node = m_root; node;) {
+            if (key < node->key)
+                node = node->left;
+            else if (node->key < key)
+                node = node->right;
+            else
+                return node;
+        }
+        return nullptr;
+    }
+
+    void replace_child(Node* old_child, Node* new_child)
+    {
+        auto* parent = old_child->parent;
+        if (!parent)
+            m_root = new_child;
+        else if (old_child == parent->left)
+            parent->left = new_child;
+        else
+            parent->right = new_child;
+        if (new_child)
+            new_child->parent = parent;
+    }
+
+    void rotate_left(Node* node)
+    {
+        auto* pivot = node->right;
+        node->right = pivot->left;
+        if (pivot->left)
+            pivot->left->parent = node;
+        replace_child(node, pivot);
+        pivot->left = node;
+        node->parent = pivot;
+    }
+
+    void rotate_right(Node* node)
+    {
+        auto* pivot = node->left;
+        node->left = pivot->right;
+        if (pivot->right)
+            pivot->right->parent = node;
+        replace_child(node, pivot);
+        pivot->right = node;
+        node->parent = pivot;
+    }
+
+    void insert_fixup(Node* node)
+    {
+        while (is_red(node->parent)) {
+            auto* parent = node->parent;
+            auto* grandparent = parent->parent;
+            if (parent == grandparent->left) {
+                auto* uncle = grandparent->right;
+                if (is_red(uncle)) {
+                    parent->is_red = false;
+                    uncle->is_red = false;
+                    grandparent->is_red = true;
+                    node = grandparent;
+                    continue;
+                }
+                if (node == parent->right) {
+                    rotate_left(parent);
+                    node = parent;
+                    parent = node->parent;
+                }
+                parent->is_red = false;
+                grandparent->is_red = true;
+                rotate_right(grandparent);
+            } else {
+                auto* uncle = grandparent->left;
+                if (is_red(uncle)) {
+                    parent->is_red = false;
+                    uncle->is_red = false;
+                    grandparent->is_red = true;
+                    node = grandparent;
+                    continue;
+                }
+                if (node == parent->left) {
+                    rotate_right(parent);
+                    node = parent;
+                    parent = node->parent;
+                }
+                parent->is_red = false;
+                grandparent->is_red = true;
+                rotate_left(grandparent);
+            }
+        }
+        m_root->is_red = false;
+    }
+
+    void remove_node(Node* node)
+    {
+        Node* child;
+        Node* child_parent;
+        bool removed_black;
+        if (!node->left || !node->right) {
+            child = node->left ? node->left : node->right;
+            child_parent = node->parent;
+            removed_black = !node->is_red;
+            replace_child(node, child);
+        } else {
+            // Put the in-order successor where node was.
+            auto* next = leftmost(node->right);
+            removed_black = !next->is_red;
+            child = next->right;
+            if (next->parent == node) {
+                child_parent = next;
+            } else {
+                child_parent = next->parent;
+                replace_child(next, child);
+                next->right = node->right;
+                next->right->parent = next;
+            }
+            replace_child(node, next);
+            next->left = node->left;
+            next->left->parent = next;
+            next->is_red = node->is_red;
+        }
+        delete node;
+        --m_size;
+        if (removed_black)
+            remove_fixup(child, child_parent);
+    }
+
+    void remove_fixup(Node* node, Node* parent)
+    {
+        while (node != m_root && !is_red(node)) {
+            if (node == parent->left) {
+                auto* sibling = parent->right;
+                if (sibling->is_red) {
+                    sibling->is_red = false;
+                    parent->is_red = true;
+                    rotate_left(parent);
+                    sibling = parent->right;
+                }
+                if (!is_red(sibling->left) && !is_red(sibling->right)) {
+                    sibling->is_red = true;
+                    node = parent;
+                    parent = node->parent;
+                    continue;
+                }
+                if (!is_red(sibling->right)) {
+                    sibling->left->is_red = false;
+                    sibling->is_red = true;
+                    rotate_right(sibling);
+                    sibling = parent->right;
+                }
+                sibling->is_red = parent->is_red;
+                parent->is_red = false;
+                sibling->right->is_red = false;
+                rotate_left(parent);
+            } else {
+                auto* sibling = parent->left;
+                if (sibling->is_red) {
+                    sibling->is_red = false;
+                    parent->is_red = true;
+                    rotate_right(parent);
+                    sibling = parent->left;
+                }
+                if (!is_red(sibling->left) && !is_red(sibling->right)) {
+                    sibling->is_red = true;
+                    node = parent;
+                    parent = node->parent;
+                    continue;
+                }
+                if (!is_red(sibling->left)) {
+                    sibling->right->is_red = false;
+                    sibling->is_red = true;
+                    rotate_left(sibling);
+                    sibling = parent->left;
+                }
+                sibling->is_red = parent->is_red;
+                parent->is_red = false;
+                sibling->left->is_red = false;
+                rotate_right(parent);
+            }
+            node = m_root;
+        }
+        if (node)
+            node->is_red = false;
+    }
+
+    Node* m_root { nullptr };
+    size_t m_size { 0 };
+};
+
+}
+
+using AK::RedBlackTree;
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2020, the SerenityOS developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <AK/TestSuite.h>
+
+#include <AK/RedBlackTree.h>
+
+TEST_CASE(construct)
+{
+    RedBlackTree<int, int> tree;
+    EXPECT(tree.is_empty());
+    EXPECT_EQ(tree.size(), 0u);
+    EXPECT_EQ(tree.find(1), nullptr);
+}
+
+TEST_CASE(insert_and_find)
+{
+    RedBlackTree<int, String> tree;
+    tree.insert(2, "two");
+    tree.insert(1, "one");
+    tree.insert(3, "three");
+    EXPECT_EQ(tree.size(), 3u);
+    EXPECT_EQ(*tree.find(1), "one");
+    EXPECT_EQ(*tree.find(2), "two");
+    EXPECT_EQ(*tree.find(3), "three");
+    EXPECT_EQ(tree.find(4), nullptr);
+
+    tree.insert(2, "deux");
+    EXPECT_EQ(tree.size(), 3u);
+    EXPECT_EQ(*tree.find(2), "deux");
+}
+
+TEST_CASE(neighbor_lookups)
+{
+    RedBlackTree<int, int> tree;
+    for (int i = 10; i <= 100; i += 10)
+        tree.insert(i, i);
+
+    EXPECT_EQ(*tree.find_largest_not_above(10), 10);
+    EXPECT_EQ(*tree.find_largest_not_above(15), 10);
+    EXPECT_EQ(*tree.find_largest_not_above(1000), 100);
+    EXPECT_EQ(tree.find_largest_not_above(9), nullptr);
+
+    EXPECT_EQ(*tree.find_smallest_not_below(10), 10);
+    EXPECT_EQ(*tree.find_smallest_not_below(15), 20);
+    EXPECT_EQ(*tree.find_smallest_not_below(0), 10);
+    EXPECT_EQ(tree.find_smallest_not_below(101), nullptr);
+}
+
+TEST_CASE(iterates_in_order)
+{
+    RedBlackTree<int, int> tree;
+    for (int i = 0; i < 1000; ++i)
+        tree.insert((i * 7919) % 1000, i);
+
+    int expected_key = 0;
+    for (auto it = tree.begin(); it != tree.end(); ++it) {
+        EXPECT_EQ(it.key(), expected_key);
+        ++expected_key;
+    }
+    EXPECT_EQ(expected_key, 1000);
+}
+
+TEST_CASE(remove_keys)
+{
+    RedBlackTree<int, int> tree;
+    for (int i = 0; i < 1000; ++i)
+        tree.insert(i, i);
+
+    for (int i = 0; i < 1000; i += 2)
+        EXPECT(tree.remove(i));
+    EXPECT(!tree.remove(0));
+    EXPECT_EQ(tree.size(), 500u);
+
+    for (int i = 0; i < 1000; ++i) {
+        if (i % 2)
+            EXPECT_EQ(*tree.find(i), i);
+        else
+            EXPECT_EQ(tree.find(i), nullptr);
+    }
+
+    int previous_key = -1;
+    size_t count = 0;
+    for (auto it = tree.begin(); it != tree.end(); ++it) {
+        EXPECT(it.key() > previous_key);
+        previous_key = it.key();
+        ++count;
+    }
+    EXPECT_EQ(count, 500u);
+
+    for (int i = 999; i >= 0; --i)
+        tree.remove(i);
+    EXPECT(tree.is_empty());
+    EXPECT(tree.begin() == tree.end());
+}
+
+TEST_CASE(move_tree)
+{
+    RedBlackTree<int, int> tree;
+    tree.insert(1, 1);
+    tree.insert(2, 2);
+
+    auto other = move(tree);
+    EXPECT(tree.is_empty());
+    EXPECT_EQ(other.size(), 2u);
+    EXPECT_EQ(*other.find(2), 2);
+}
+
+TEST_MAIN(RedBlackTree)
@@ -39,6 +39,7 @@
 #include <Kernel/KSyms.h>
 #include <Kernel/Process.h>
 #include <Kernel/VM/MemoryManager.h>
+#include <Kernel/VM/PageDirectory.h>
 #include <Kernel/IO.h>
 #include <LibC/mallocdefs.h>
 
@@ -47,26 +48,29 @@
 namespace Kernel {
 
 static DescriptorTablePointer s_idtr;
-static DescriptorTablePointer s_gdtr;
 static Descriptor s_idt[256];
-static Descriptor s_gdt[256];
 
 static GenericInterruptHandler* s_interrupt_handler[GENERIC_INTERRUPT_HANDLERS_COUNT];
 
-static Vector<u16>* s_gdt_freelist;
+Processor g_processors[MAX_PROCESSORS];
+static u32 s_processor_count;
 
-static u16 s_gdt_length;
+// GDT selectors are handed out for all processors at once, so a selector
+// means the same thing everywhere, even if the descriptors behind it differ.
+// This is set up before the heap exists, hence the fixed array.
+static u16 s_gdt_freelist[256];
+static size_t s_gdt_freelist_size;
 
 u16 gdt_alloc_entry()
 {
-    ASSERT(s_gdt_freelist);
-    ASSERT(!s_gdt_freelist->is_empty());
-    return s_gdt_freelist->take_last();
+    ASSERT(s_gdt_freelist_size);
+    return s_gdt_freelist[--s_gdt_freelist_size];
 }
 
 void gdt_free_entry(u16 entry)
 {
-    s_gdt_freelist->append(entry);
+    ASSERT(s_gdt_freelist_size < 256);
+    s_gdt_freelist[s_gdt_freelist_size++] = entry;
 }
 
 extern "C" void handle_interrupt(RegisterState);
@@ -86,6 +90,8 @@ extern "C" void handle_interrupt(RegisterState);
         "    mov $0x10, %ax\n"                      \
         "    mov %ax, %ds\n"                        \
         "    mov %ax, %es\n"                        \
+        "    mov $0x28, %ax\n"                      \
+        "    mov %ax, %fs\n"                        \
         "    cld\n"                                 \
         "    call " #title "_handler\n"             \
         "    add $0x4, %esp \n"                     \
@@ -113,6 +119,8 @@ extern "C" void handle_interrupt(RegisterState);
         "    mov $0x10, %ax\n"                      \
         "    mov %ax, %ds\n"                        \
         "    mov %ax, %es\n"                        \
+        "    mov $0x28, %ax\n"                      \
+        "    mov %ax, %fs\n"                        \
         "    cld\n"                                 \
         "    call " #title "_handler\n"             \
         "    add $0x4, %esp\n"                      \
@@ -128,7 +136,7 @@ static void dump(const RegisterState& regs)
 {
     u16 ss;
     u32 esp;
-    if (!Process::current || Process::current->is_ring0()) {
+    if (!Process::current() || Process::current()->is_ring0()) {
         ss = regs.ss;
         esp = regs.esp;
     } else {
@@ -154,7 +162,7 @@ static void dump(const RegisterState& regs)
         : "=a"(cr4));
     klog() << "cr0=" << String::format("%08x", cr0) << " cr2=" << String::format("%08x", cr2) << " cr3=" << String::format("%08x", cr3) << " cr4=" << String::format("%08x", cr4);
 
-    if (Process::current && Process::current->validate_read((void*)regs.eip, 8)) {
+    if (Process::current() && Process::current()->validate_read((void*)regs.eip, 8)) {
         SmapDisabler disabler;
         u8* codeptr = (u8*)regs.eip;
         klog() << "code: " << String::format("%02x", codeptr[0]) << " " << String::format("%02x", codeptr[1]) << " " << String::format("%02x", codeptr[2]) << " " << String::format("%02x", codeptr[3]) << " " << String::format("%02x", codeptr[4]) << " " << String::format("%02x", codeptr[5]) << " " << String::format("%02x", codeptr[6]) << " " << String::format("%02x", codeptr[7]);
@@ -163,32 +171,33 @@ static void dump(const RegisterState& regs)
 
 void handle_crash(RegisterState& regs, const char* description, int signal, bool out_of_memory)
 {
-    if (!Process::current) {
+    if (!Process::current()) {
         klog() << description << " with !current";
         hang();
     }
 
     // If a process crashed while inspecting another process,
     // make sure we switch back to the right page tables.
-    MM.enter_process_paging_scope(*Process::current);
+    MM.enter_process_paging_scope(*Process::current());
 
-    klog() << "CRASH: " << description << ". Ring " << (Process::current->is_ring0() ? 0 : 3) << ".";
+    klog() << "CRASH: " << description << ". Ring " << (Process::current()->is_ring0() ? 0 : 3) << ".";
     dump(regs);
 
-    if (Process::current->is_ring0()) {
+    if (Process::current()->is_ring0()) {
         klog() << "Crash in ring 0 :(";
         dump_backtrace();
         hang();
     }
 
     cli();
-    Process::current->crash(signal, regs.eip, out_of_memory);
+    Process::current()->crash(signal, regs.eip, out_of_memory);
 }
 
 EH_ENTRY_NO_CODE(6, illegal_instruction);
 void illegal_instruction_handler(RegisterState regs)
 {
     clac();
+    SchedulerLockGuard lock_guard;
     handle_crash(regs, "Illegal instruction", SIGILL);
 }
 
@@ -196,6 +205,7 @@ EH_ENTRY_NO_CODE(0, divide_error);
 void divide_error_handler(RegisterState regs)
 {
     clac();
+    SchedulerLockGuard lock_guard;
     handle_crash(regs, "Divide error", SIGFPE);
 }
 
@@ -203,6 +213,7 @@ EH_ENTRY(13, general_protection_fault);
 void general_protection_fault_handler(RegisterState regs)
 {
     clac();
+    SchedulerLockGuard lock_guard;
     handle_crash(regs, "General protection fault", SIGSEGV);
 }
 
@@ -220,6 +231,7 @@ EH_ENTRY(14, page_fault);
 void page_fault_handler(RegisterState regs)
 {
     clac();
+    SchedulerLockGuard lock_guard;
 
     u32 fault_address;
     asm("movl %%cr2, %%eax"
@@ -240,7 +252,7 @@ void page_fault_handler(RegisterState regs)
 #endif
 
     bool faulted_in_userspace = (regs.cs & 3) == 3;
-    if (faulted_in_userspace && !MM.validate_user_stack(*Process::current, VirtualAddress(regs.userspace_esp))) {
+    if (faulted_in_userspace && !MM.validate_user_stack(*Process::current(), VirtualAddress(regs.userspace_esp))) {
         dbg() << "Invalid stack pointer: " << VirtualAddress(regs.userspace_esp);
         handle_crash(regs, "Bad stack on page fault", SIGSTKFLT);
         ASSERT_NOT_REACHED();
@@ -250,8 +262,8 @@ void page_fault_handler(RegisterState regs)
 
     if (response == PageFaultResponse::ShouldCrash || response == PageFaultResponse::OutOfMemory) {
         if (response != PageFaultResponse::OutOfMemory) {
-            if (Thread::current->has_signal_handler(SIGSEGV)) {
-                Thread::current->send_urgent_signal_to_self(SIGSEGV);
+            if (Thread::current()->has_signal_handler(SIGSEGV)) {
+                Thread::current()->send_urgent_signal_to_self(SIGSEGV);
                 return;
             }
         }
@@ -297,7 +309,8 @@ EH_ENTRY_NO_CODE(1, debug);
 void debug_handler(RegisterState regs)
 {
     clac();
-    if (!Process::current || (regs.cs & 3) == 0) {
+    SchedulerLockGuard lock_guard;
+    if (!Process::current() || (regs.cs & 3) == 0) {
         klog() << "Debug Exception in Ring0";
         hang();
         return;
@@ -307,25 +320,26 @@ void debug_handler(RegisterState regs)
     if (!is_reason_singlestep)
         return;
 
-    if (Thread::current->tracer()) {
-        Thread::current->tracer()->set_regs(regs);
+    if (Thread::current()->tracer()) {
+        Thread::current()->tracer()->set_regs(regs);
     }
-    Thread::current->send_urgent_signal_to_self(SIGTRAP);
+    Thread::current()->send_urgent_signal_to_self(SIGTRAP);
 }
 
 EH_ENTRY_NO_CODE(3, breakpoint);
 void breakpoint_handler(RegisterState regs)
 {
     clac();
-    if (!Process::current || (regs.cs & 3) == 0) {
+    SchedulerLockGuard lock_guard;
+    if (!Process::current() || (regs.cs & 3) == 0) {
         klog() << "Breakpoint Trap in Ring0";
         hang();
         return;
     }
-    if (Thread::current->tracer()) {
-        Thread::current->tracer()->set_regs(regs);
+    if (Thread::current()->tracer()) {
+        Thread::current()->tracer()->set_regs(regs);
     }
-    Thread::current->send_urgent_signal_to_self(SIGTRAP);
+    Thread::current()->send_urgent_signal_to_self(SIGTRAP);
 }
 
 #define EH(i, msg)                                                                                                                                                             \
@@ -356,38 +370,26 @@ EH(12, "Stack exception")
 EH(15, "Unknown error")
 EH(16, "Coprocessor error")
 
-static void write_raw_gdt_entry(u16 selector, u32 low, u32 high)
-{
-    u16 i = (selector & 0xfffc) >> 3;
-    s_gdt[i].low = low;
-    s_gdt[i].high = high;
-
-    if (i > s_gdt_length)
-        s_gdtr.limit = (s_gdt_length + 1) * 8 - 1;
-}
-
 void write_gdt_entry(u16 selector, Descriptor& descriptor)
 {
-    write_raw_gdt_entry(selector, descriptor.low, descriptor.high);
+    auto& entry = Processor::current().gdt_entry(selector);
+    entry.low = descriptor.low;
+    entry.high = descriptor.high;
 }
 
 Descriptor& get_gdt_entry(u16 selector)
 {
-    u16 i = (selector & 0xfffc) >> 3;
-    return *(Descriptor*)(&s_gdt[i]);
+    return Processor::current().gdt_entry(selector);
 }
 
 void flush_gdt()
 {
-    s_gdtr.address = s_gdt;
-    s_gdtr.limit = (s_gdt_length * 8) - 1;
-    asm("lgdt %0" ::"m"(s_gdtr)
-        : "memory");
+    Processor::current().flush_gdt();
 }
 
 const DescriptorTablePointer& get_gdtr()
 {
-    return s_gdtr;
+    return Processor::current().gdtr();
 }
 
 const DescriptorTablePointer& get_idtr()
@@ -395,39 +397,149 @@ const DescriptorTablePointer& get_idtr()
     return s_idtr;
 }
 
-void gdt_init()
+void Processor::flush_gdt()
 {
-    s_gdt_length = 5;
+    m_gdtr.address = m_gdt;
+    m_gdtr.limit = sizeof(m_gdt) - 1;
+    asm("lgdt %0" ::"m"(m_gdtr)
+        : "memory");
+}
 
-    s_gdt_freelist = new Vector<u16>();
-    s_gdt_freelist->ensure_capacity(256);
-    for (size_t i = s_gdt_length; i < 256; ++i)
-        s_gdt_freelist->append(i * 8);
+void Processor::gdt_init()
+{
+    if (is_bootstrap_processor()) {
+        for (size_t i = 0; i < 256; ++i)
+            m_gdt[i].low = m_gdt[i].high = 0;
+        gdt_entry(0x0008).low = 0x0000ffff;
+        gdt_entry(0x0008).high = 0x00cf9a00;
+        gdt_entry(0x0010).low = 0x0000ffff;
+        gdt_entry(0x0010).high = 0x00cf9200;
+        gdt_entry(0x0018).low = 0x0000ffff;
+        gdt_entry(0x0018).high = 0x00cffa00;
+        gdt_entry(0x0020).low = 0x0000ffff;
+        gdt_entry(0x0020).high = 0x00cff200;
 
-    s_gdt_length = 256;
-    s_gdtr.address = s_gdt;
-    s_gdtr.limit = (s_gdt_length * 8) - 1;
+        s_gdt_freelist_size = 0;
+        for (u16 i = 255; i > (GDT_SELECTOR_PROCESSOR >> 3); --i)
+            s_gdt_freelist[s_gdt_freelist_size++] = i * 8;
+    } else {
+        // Start out with everything the BSP has. Any TSS descriptors in there
+        // get rewritten before this processor switches to them anyway.
+        auto& bsp = by_id(0);
+        for (size_t i = 0; i < 256; ++i)
+            m_gdt[i] = bsp.m_gdt[i];
+    }
 
-    write_raw_gdt_entry(0x0000, 0x00000000, 0x00000000);
-    write_raw_gdt_entry(0x0008, 0x0000ffff, 0x00cf9a00);
-    write_raw_gdt_entry(0x0010, 0x0000ffff, 0x00cf9200);
-    write_raw_gdt_entry(0x0018, 0x0000ffff, 0x00cffa00);
-    write_raw_gdt_entry(0x0020, 0x0000ffff, 0x00cff200);
+    auto& descriptor = gdt_entry(GDT_SELECTOR_PROCESSOR);
+    descriptor.low = descriptor.high = 0;
+    descriptor.set_base(this);
+    descriptor.set_limit(sizeof(Processor) - 1);
+    descriptor.dpl = 0;
+    descriptor.segment_present = 1;
+    descriptor.granularity = 0;
+    descriptor.zero = 0;
+    descriptor.operation_size = 1;
+    descriptor.descriptor_type = 1;
+    descriptor.type = 2;
 
     flush_gdt();
 
     asm volatile(
         "mov %%ax, %%ds\n"
         "mov %%ax, %%es\n"
-        "mov %%ax, %%fs\n"
         "mov %%ax, %%gs\n"
         "mov %%ax, %%ss\n" ::"a"(0x10)
         : "memory");
+    asm volatile(
+        "mov %%ax, %%fs\n" ::"a"(GDT_SELECTOR_PROCESSOR)
+        : "memory");
 
     // Make sure CS points to the kernel code descriptor.
     asm volatile(
-        "ljmpl $0x8, $sanity\n"
-        "sanity:\n");
+        "ljmpl $0x8, $sanity%=\n"
+        "sanity%=:\n" ::
+            : "memory");
+}
+
+void Processor::initialize(u32 cpu)
+{
+    ASSERT(cpu < MAX_PROCESSORS);
+    auto& processor = g_processors[cpu];
+    processor.m_self = &processor;
+    processor.m_cpu = cpu;
+    processor.m_current_thread = nullptr;
+    processor.m_idle_thread = nullptr;
+    processor.m_in_irq = 0;
+    processor.gdt_init();
+    AK::atomic_fetch_add(&s_processor_count, 1u);
+}
+
+Processor& Processor::by_id(u32 cpu)
+{
+    ASSERT(cpu < MAX_PROCESSORS);
+    return g_processors[cpu];
+}
+
+u32 Processor::count()
+{
+    return AK::atomic_load(&s_processor_count);
+}
+
+void Processor::set_online()
+{
+    // Whatever this processor cached before it joined the TLB shootdowns is suspect.
+    write_cr3(read_cr3());
+    AK::atomic_store(&m_online, true);
+}
+
+void Processor::flush_tlb_on_other_processors(const PageDirectory* page_directory, VirtualAddress vaddr, size_t page_count)
+{
+    if (!APIC::initialized())
+        return;
+    InterruptDisabler disabler;
+    auto& current = Processor::current();
+    bool is_user_address = vaddr.get() < 0xc0000000;
+    u32 recipient_count = 0;
+    Processor* recipients[MAX_PROCESSORS];
+
+    for_each([&](Processor& processor) {
+        if (&processor == &current || !processor.is_online())
+            return;
+        // User mappings only live in TLBs of processors that are running on
+        // this page directory right now; switching CR3 throws out the rest.
+        if (is_user_address && page_directory) {
+            auto* thread = processor.running_thread();
+            if (!thread || thread->tss().cr3 != page_directory->cr3())
+                return;
+        }
+        processor.m_tlb_flush_vaddr = vaddr.get();
+        processor.m_tlb_flush_page_count = page_count;
+        AK::atomic_store(&processor.m_tlb_flush_pending, true);
+        APIC::the().send_ipi(processor.apic_id(), APIC::tlb_flush_ipi_vector());
+        recipients[recipient_count++] = &processor;
+    });
+
+    for (u32 i = 0; i < recipient_count; ++i) {
+        while (AK::atomic_load(&recipients[i]->m_tlb_flush_pending))
+            asm volatile("pause");
+    }
+}
+
+void Processor::handle_tlb_flush_request()
+{
+    if (!AK::atomic_load(&m_tlb_flush_pending))
+        return;
+    if (!m_tlb_flush_page_count) {
+        write_cr3(read_cr3());
+    } else {
+        for (size_t i = 0; i < m_tlb_flush_page_count; ++i) {
+            asm volatile("invlpg %0"
+                         :
+                         : "m"(*(char*)(m_tlb_flush_vaddr + i * PAGE_SIZE))
+                         : "memory");
+        }
+    }
+    AK::atomic_store(&m_tlb_flush_pending, false);
 }
 
 static void unimp_trap()
@@ -683,18 +795,17 @@ void load_task_register(u16 selector)
     asm("ltr %0" ::"r"(selector));
 }
 
-u32 g_in_irq;
-
 void handle_interrupt(RegisterState regs)
 {
     clac();
-    ++g_in_irq;
+    SchedulerLockGuard lock_guard;
+    Processor::current().enter_irq();
     ASSERT(regs.isr_number >= IRQ_VECTOR_BASE && regs.isr_number <= (IRQ_VECTOR_BASE + GENERIC_INTERRUPT_HANDLERS_COUNT));
     u8 irq = (u8)(regs.isr_number - 0x50);
     ASSERT(s_interrupt_handler[irq]);
     s_interrupt_handler[irq]->handle_interrupt(regs);
     s_interrupt_handler[irq]->increment_invoking_counter();
-    --g_in_irq;
+    Processor::current().leave_irq();
     s_interrupt_handler[irq]->eoi();
 }
 
@@ -872,8 +983,8 @@ void __assertion_failed(const char* msg, const char* file, unsigned line, const
 
     // Switch back to the current process's page tables if there are any.
     // Otherwise stack walking will be a disaster.
-    if (Process::current)
-        MM.enter_process_paging_scope(*Process::current);
+    if (Process::current())
+        MM.enter_process_paging_scope(*Process::current());
 
     Kernel::dump_backtrace();
     asm volatile("hlt");
@@ -34,12 +34,19 @@
 #define PAGE_SIZE 4096
 #define GENERIC_INTERRUPT_HANDLERS_COUNT 128
 #define PAGE_MASK ((FlatPtr)0xfffff000u)
+// With PAE, a page directory entry can map 2 MiB directly instead of pointing to a page table.
+#define LARGE_PAGE_SIZE 0x200000
+#define LARGE_PAGE_MASK ((FlatPtr)0xffe00000u)
+
+#define MAX_PROCESSORS 8
+#define GDT_SELECTOR_PROCESSOR 0x28
 
 namespace Kernel {
 
 class MemoryManager;
 class PageDirectory;
 class PageTableEntry;
+class Thread;
 
 struct [[gnu::packed]] DescriptorTablePointer
 {
@@ -130,6 +137,14 @@ public:
         m_raw |= value & 0xfffff000;
     }
 
+    // Only meaningful when is_huge() is set.
+    u32 large_page_base() const { return m_raw & 0xffe00000u; }
+    void set_large_page_base(u32 value)
+    {
+        m_raw &= 0x8000000000000fffULL;
+        m_raw |= value & 0xffe00000;
+    }
+
     void clear() { m_raw = 0; }
 
     u64 raw() const { return m_raw; }
@@ -184,7 +199,7 @@ private:
 
 class PageTableEntry {
 public:
-    void* physical_page_base() { return reinterpret_cast<void*>(m_raw & 0xfffff000u); }
+    void* physical_page_base() const { return reinterpret_cast<void*>(m_raw & 0xfffff000u); }
     void set_physical_page_base(u32 value)
     {
         m_raw &= 0x8000000000000fffULL;
@@ -256,7 +271,6 @@ struct RegisterState;
 
 const DescriptorTablePointer& get_gdtr();
 const DescriptorTablePointer& get_idtr();
-void gdt_init();
 void idt_init();
 void sse_init();
 void register_interrupt_handler(u8 number, void (*f)());
@@ -628,6 +642,98 @@ private:
     u32 m_flags;
 };
 
-extern u32 g_in_irq;
+// Everything that belongs to one processor. Each processor reaches its own
+// Processor through the FS segment, which the kernel entry points load with
+// GDT_SELECTOR_PROCESSOR. Every processor has its own GDT, so that selector
+// (and any TSS descriptors) can mean something different on each of them.
+class Processor {
+    AK_MAKE_NONCOPYABLE(Processor);
+
+public:
+    Processor() = default;
+
+    // Sets up the GDT and per-processor data of the processor we're running on.
+    // This has to happen before anything looks at the current thread.
+    static void initialize(u32 cpu);
+
+    ALWAYS_INLINE static Processor& current()
+    {
+        return *reinterpret_cast<Processor*>(read_fs_u32(__builtin_offsetof(Processor, m_self)));
+    }
+
+    ALWAYS_INLINE static Thread* current_thread()
+    {
+        return reinterpret_cast<Thread*>(read_fs_u32(__builtin_offsetof(Processor, m_current_thread)));
+    }
+
+    static Processor& by_id(u32 cpu);
+    static u32 count();
+
+    template<typename Callback>
+    static void for_each(Callback callback);
+
+    u32 id() const { return m_cpu; }
+    bool is_bootstrap_processor() const { return m_cpu == 0; }
+
+    u32 apic_id() const { return m_apic_id; }
+    void set_apic_id(u32 apic_id) { m_apic_id = apic_id; }
+
+    // The thread this processor is running, as opposed to current_thread()
+    // which is always about the processor asking.
+    Thread* running_thread() const { return m_current_thread; }
+    void set_current_thread(Thread& thread) { m_current_thread = &thread; }
+
+    Thread* idle_thread() const { return m_idle_thread; }
+    void set_idle_thread(Thread& thread) { m_idle_thread = &thread; }
+
+    bool in_irq() const { return m_in_irq; }
+    void enter_irq() { ++m_in_irq; }
+    void leave_irq() { --m_in_irq; }
+
+    // Online processors take part in scheduling and TLB shootdowns.
+    bool is_online() const { return m_online; }
+    void set_online();
+
+    Descriptor& gdt_entry(u16 selector) { return m_gdt[(selector & 0xfffc) >> 3]; }
+    const DescriptorTablePointer& gdtr() const { return m_gdtr; }
+    void flush_gdt();
+
+    // Invalidates the given pages on every other online processor that may
+    // have them cached, and waits until they have done so. page_directory
+    // may be null for kernel addresses; a page_count of 0 means the whole TLB.
+    static void flush_tlb_on_other_processors(const PageDirectory*, VirtualAddress, size_t page_count);
+    void handle_tlb_flush_request();
+
+private:
+    void gdt_init();
+
+    // Must be the first member, see current().
+    Processor* m_self;
+    u32 m_cpu;
+    u32 m_apic_id;
+    u32 m_in_irq;
+    Thread* m_current_thread;
+    Thread* m_idle_thread;
+    volatile bool m_online;
+
+    // TLB shootdown mailbox, filled in by whoever asks for a flush.
+    volatile bool m_tlb_flush_pending;
+    FlatPtr m_tlb_flush_vaddr;
+    size_t m_tlb_flush_page_count;
+
+    DescriptorTablePointer m_gdtr;
+    Descriptor m_gdt[256];
+};
+
+extern Processor g_processors[MAX_PROCESSORS];
+
+template<typename Callback>
+inline void Processor::for_each(Callback callback)
+{
+    for (auto& processor : g_processors) {
+        if (processor.m_self)
+            callback(processor);
+    }
+}
 
 }
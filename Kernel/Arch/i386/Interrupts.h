@@ -50,6 +50,8 @@ asm(
     "    mov $0x10, %ax\n"
     "    mov %ax, %ds\n"
     "    mov %ax, %es\n"
+    "    mov $0x28, %ax\n"
+    "    mov %ax, %fs\n"
     "    cld\n"
     "    call handle_interrupt\n"
     "    add $0x4, %esp\n" // "popl %ss"
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2020, Andreas Kling <kling@serenityos.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <Kernel/BlockCondition.h>
+#include <Kernel/Scheduler.h>
+#include <Kernel/Thread.h>
+
+namespace Kernel {
+
+BlockCondition::BlockCondition()
+{
+}
+
+BlockCondition::~BlockCondition()
+{
+    ASSERT(m_threads.is_empty());
+}
+
+void BlockCondition::add(Thread& thread)
+{
+    InterruptDisabler disabler;
+    ASSERT(!m_threads.contains_slow(&thread));
+    m_threads.append(&thread);
+}
+
+void BlockCondition::remove(Thread& thread)
+{
+    InterruptDisabler disabler;
+    m_threads.remove_first_matching([&](auto* entry) { return entry == &thread; });
+}
+
+void BlockCondition::notify()
+{
+    InterruptDisabler disabler;
+    for (auto* thread : m_threads)
+        Scheduler::reconsider_blocked_thread(*thread);
+}
+
+}
@@ -186,7 +186,8 @@ KResultOr<Region*> BXVGADevice::mmap(Process& process, FileDescription&, Virtual
         vmobject.release_nonnull(),
         0,
         "BXVGA Framebuffer",
-        prot);
+        prot,
+        true);
     dbg() << "BXVGADevice: mmap with size " << region->size() << " at " << region->vaddr();
     ASSERT(region);
     return region;
@@ -198,14 +199,14 @@ int BXVGADevice::ioctl(FileDescription&, unsigned request, FlatPtr arg)
     switch (request) {
     case FB_IOCTL_GET_SIZE_IN_BYTES: {
         auto* out = (size_t*)arg;
-        if (!Process::current->validate_write_typed(out))
+        if (!Process::current()->validate_write_typed(out))
             return -EFAULT;
         *out = framebuffer_size_in_bytes();
         return 0;
     }
     case FB_IOCTL_GET_BUFFER: {
         auto* index = (int*)arg;
-        if (!Process::current->validate_write_typed(index))
+        if (!Process::current()->validate_write_typed(index))
             return -EFAULT;
         *index = m_y_offset == 0 ? 0 : 1;
         return 0;
@@ -218,7 +219,7 @@ int BXVGADevice::ioctl(FileDescription&, unsigned request, FlatPtr arg)
     }
     case FB_IOCTL_GET_RESOLUTION: {
         auto* resolution = (FBResolution*)arg;
-        if (!Process::current->validate_write_typed(resolution))
+        if (!Process::current()->validate_write_typed(resolution))
             return -EFAULT;
         resolution->pitch = m_framebuffer_pitch;
         resolution->width = m_framebuffer_width;
@@ -227,7 +228,7 @@ int BXVGADevice::ioctl(FileDescription&, unsigned request, FlatPtr arg)
     }
     case FB_IOCTL_SET_RESOLUTION: {
         auto* resolution = (FBResolution*)arg;
-        if (!Process::current->validate_read_typed(resolution) || !Process::current->validate_write_typed(resolution))
+        if (!Process::current()->validate_read_typed(resolution) || !Process::current()->validate_write_typed(resolution))
             return -EFAULT;
         if (resolution->width > MAX_RESOLUTION_WIDTH || resolution->height > MAX_RESOLUTION_HEIGHT)
             return -EINVAL;
@@ -25,9 +25,33 @@
  */
 
 #include <Kernel/Devices/BlockDevice.h>
+#include <Kernel/Thread.h>
 
 namespace Kernel {
 
+bool AsyncBlockDeviceRequest::wait()
+{
+    InterruptDisabler disabler;
+    while (!m_complete)
+        Thread::current()->wait_on(m_completion_queue);
+    return m_success;
+}
+
+void AsyncBlockDeviceRequest::complete(bool success)
+{
+    InterruptDisabler disabler;
+    ASSERT(!m_complete);
+    ASSERT(m_pending_transfer_count);
+    if (!success)
+        m_success = false;
+    if (--m_pending_transfer_count)
+        return;
+    m_complete = true;
+    m_completion_queue.wake_all();
+    if (m_completion_callback)
+        m_completion_callback(*this);
+}
+
 BlockDevice::~BlockDevice()
 {
 }
@@ -42,6 +66,24 @@ bool BlockDevice::write_block(unsigned index, const u8* data)
     return write_blocks(index, 1, data);
 }
 
+void BlockDevice::start_request(AsyncBlockDeviceRequest& request)
+{
+    bool success = true;
+    unsigned index = request.block_index();
+    for (auto& buffer : request.buffers()) {
+        ASSERT(!(buffer.size % block_size()));
+        u16 count = buffer.size / block_size();
+        if (request.is_write())
+            success = write_blocks(index, count, buffer.data);
+        else
+            success = read_blocks(index, count, buffer.data);
+        if (!success)
+            break;
+        index += count;
+    }
+    request.complete(success);
+}
+
 bool BlockDevice::read_raw(u32 offset, unsigned length, u8* out) const
 {
     ASSERT((offset % block_size()) == 0);
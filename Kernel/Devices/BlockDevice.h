@@ -26,10 +26,80 @@
 
 #pragma once
 
+#include <AK/Function.h>
+#include <AK/RefCounted.h>
+#include <AK/Vector.h>
 #include <Kernel/Devices/Device.h>
+#include <Kernel/WaitQueue.h>
 
 namespace Kernel {
 
+// A read or write of a range of blocks, into or out of one or more kernel buffers.
+// Whoever starts a request keeps it alive until it completes. Drivers may complete
+// it from an IRQ handler, so the completion callback must not block.
+class AsyncBlockDeviceRequest : public RefCounted<AsyncBlockDeviceRequest> {
+public:
+    enum class Type {
+        Read,
+        Write,
+    };
+
+    struct Buffer {
+        u8* data { nullptr };
+        size_t size { 0 };
+    };
+
+    static NonnullRefPtr<AsyncBlockDeviceRequest> create(Type type, unsigned block_index, u16 block_count, u8* buffer, size_t size)
+    {
+        Vector<Buffer, 1> buffers;
+        buffers.append({ buffer, size });
+        return create(type, block_index, block_count, move(buffers));
+    }
+
+    static NonnullRefPtr<AsyncBlockDeviceRequest> create(Type type, unsigned block_index, u16 block_count, Vector<Buffer, 1>&& buffers)
+    {
+        return adopt(*new AsyncBlockDeviceRequest(type, block_index, block_count, move(buffers)));
+    }
+
+    Type type() const { return m_type; }
+    bool is_write() const { return m_type == Type::Write; }
+    unsigned block_index() const { return m_block_index; }
+    u16 block_count() const { return m_block_count; }
+    const Vector<Buffer, 1>& buffers() const { return m_buffers; }
+
+    void set_completion_callback(Function<void(AsyncBlockDeviceRequest&)> callback) { m_completion_callback = move(callback); }
+
+    bool is_complete() const { return m_complete; }
+    bool succeeded() const { return m_success; }
+
+    // Blocks until the request is complete, and returns whether it succeeded.
+    bool wait();
+
+    // For drivers: a request that is carried out in several transfers
+    // only completes once complete() was called for each of them.
+    void set_transfer_count(size_t count) { m_pending_transfer_count = count; }
+    void complete(bool success);
+
+private:
+    AsyncBlockDeviceRequest(Type type, unsigned block_index, u16 block_count, Vector<Buffer, 1>&& buffers)
+        : m_type(type)
+        , m_block_index(block_index)
+        , m_block_count(block_count)
+        , m_buffers(move(buffers))
+    {
+    }
+
+    Type m_type { Type::Read };
+    unsigned m_block_index { 0 };
+    u16 m_block_count { 0 };
+    Vector<Buffer, 1> m_buffers;
+    Function<void(AsyncBlockDeviceRequest&)> m_completion_callback;
+    WaitQueue m_completion_queue;
+    size_t m_pending_transfer_count { 1 };
+    bool m_complete { false };
+    bool m_success { true };
+};
+
 class BlockDevice : public Device {
 public:
     virtual ~BlockDevice() override;
@@ -45,6 +115,10 @@ public:
     virtual bool read_blocks(unsigned index, u16 count, u8*) = 0;
     virtual bool write_blocks(unsigned index, u16 count, const u8*) = 0;
 
+    // Starts the request and returns without waiting for it. Devices that can't do
+    // asynchronous I/O carry it out with read_blocks()/write_blocks() before returning.
+    virtual void start_request(AsyncBlockDeviceRequest&);
+
 protected:
     BlockDevice(unsigned major, unsigned minor, size_t block_size = PAGE_SIZE)
         : Device(major, minor)
@@ -110,6 +110,19 @@ bool DiskPartition::write_blocks(unsigned index, u16 count, const u8* data)
     return m_device->write_blocks(m_block_offset + index, count, data);
 }
 
+void DiskPartition::start_request(AsyncBlockDeviceRequest& request)
+{
+#ifdef OFFD_DEBUG
+    klog() << "DiskPartition::start_request " << request.block_index() << " (really: " << (m_block_offset + request.block_index()) << ") count=" << request.block_count();
+#endif
+    auto buffers = request.buffers();
+    auto device_request = AsyncBlockDeviceRequest::create(request.type(), m_block_offset + request.block_index(), request.block_count(), move(buffers));
+    device_request->set_completion_callback([&request](auto& device_request) {
+        request.complete(device_request.succeeded());
+    });
+    m_device->start_request(device_request);
+}
+
 const char* DiskPartition::class_name() const
 {
     return "DiskPartition";
@@ -273,6 +273,7 @@ void KeyboardDevice::key_state_changed(u8 scan_code, bool pressed)
         m_client->on_key_pressed(event);
 
     m_queue.enqueue(event);
+    evaluate_block_conditions();
 
     m_has_e0_prefix = false;
 }
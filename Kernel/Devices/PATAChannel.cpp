@@ -29,9 +29,10 @@
 #include <Kernel/Devices/PATAChannel.h>
 #include <Kernel/Devices/PATADiskDevice.h>
 #include <Kernel/FileSystem/ProcFS.h>
+#include <Kernel/IO.h>
+#include <Kernel/KBuffer.h>
 #include <Kernel/Process.h>
 #include <Kernel/VM/MemoryManager.h>
-#include <Kernel/IO.h>
 
 namespace Kernel {
 
@@ -104,6 +105,8 @@ namespace Kernel {
 #define ATA_CTL_ALTSTATUS 0x00
 #define ATA_CTL_DEVADDRESS 0x01
 
+#define PRDT_ENTRY_COUNT (PAGE_SIZE / sizeof(PhysicalRegionDescriptor))
+
 #define PCI_Mass_Storage_Class 0x1
 #define PCI_IDE_Controller_Subclass 0x1
 static Lock& s_lock()
@@ -165,8 +168,6 @@ void PATAChannel::initialize(bool force_pio)
     // Let's try to set up DMA transfers.
     PCI::enable_bus_mastering(pci_address());
     m_prdt_page = MM.allocate_supervisor_physical_page();
-    prdt().end_of_table = 0x8000;
-    m_dma_buffer_page = MM.allocate_supervisor_physical_page();
     klog() << "PATAChannel: Bus master IDE: " << m_bus_master_base;
 }
 
@@ -177,7 +178,7 @@ static void print_ide_status(u8 status)
 
 void PATAChannel::wait_for_irq()
 {
-    Thread::current->wait_on(m_irq_queue);
+    Thread::current()->wait_on(m_irq_queue);
     disable_irq();
 }
 
@@ -196,6 +197,20 @@ void PATAChannel::handle_irq(const RegisterState&)
 #ifdef PATA_DEBUG
     klog() << "PATAChannel: interrupt: DRQ=" << ((status & ATA_SR_DRQ) != 0) << " BSY=" << ((status & ATA_SR_BSY) != 0) << " DRDY=" << ((status & ATA_SR_DRDY) != 0);
 #endif
+
+    if (!m_running_batch.is_empty()) {
+        u8 bus_master_status = m_bus_master_base.offset(2).in<u8>();
+        // Not the bus master interrupt, the transfer is still going.
+        if (!(bus_master_status & 0x4))
+            return;
+        // Stop bus master, and acknowledge the "Interrupt" and "Error" flags.
+        m_bus_master_base.out<u8>(0);
+        m_bus_master_base.offset(2).out<u8>(bus_master_status | 0x6);
+        complete_dma_batch(!m_device_error && !(bus_master_status & 0x2));
+        start_next_dma_batch();
+        return;
+    }
+
     m_irq_queue.wake_all();
 }
 
@@ -266,90 +281,227 @@ void PATAChannel::detect_disks()
 
 bool PATAChannel::ata_read_sectors_with_dma(u32 lba, u16 count, u8* outbuf, bool slave_request)
 {
-    LOCKER(s_lock());
 #ifdef PATA_DEBUG
     dbg() << "PATAChannel::ata_read_sectors_with_dma (" << lba << " x" << count << ") -> " << outbuf;
 #endif
+    return ata_transfer_sectors_with_dma(false, lba, count, outbuf, slave_request);
+}
 
-    prdt().offset = m_dma_buffer_page->paddr();
-    prdt().size = 512 * count;
-
-    ASSERT(prdt().size <= PAGE_SIZE);
-
-    // Stop bus master
-    m_bus_master_base.out<u8>(0);
+bool PATAChannel::ata_write_sectors_with_dma(u32 lba, u16 count, const u8* inbuf, bool slave_request)
+{
+#ifdef PATA_DEBUG
+    dbg() << "PATAChannel::ata_write_sectors_with_dma (" << lba << " x" << count << ") <- " << inbuf;
+#endif
+    return ata_transfer_sectors_with_dma(true, lba, count, const_cast<u8*>(inbuf), slave_request);
+}
 
-    // Write the PRDT location
-    m_bus_master_base.offset(4).out(m_prdt_page->paddr().get());
+static bool append_dma_segments(Vector<PhysicalRegionDescriptor, 4>& segments, u8* buffer, size_t size, bool is_write)
+{
+    // The controller wants word aligned buffers, and a descriptor may not cross a 64 KiB boundary.
+    if ((FlatPtr)buffer & 1 || is_user_address(VirtualAddress(buffer)))
+        return false;
+    for (size_t offset = 0; offset < size;) {
+        auto* ptr = buffer + offset;
+        size_t chunk_size = min(size - offset, PAGE_SIZE - offset_in_page(ptr));
+        // Kernel buffers are often committed lazily, so fault the page in first.
+        // When the disk is going to write into it, it has to be a private, writable page.
+        if (is_write)
+            (void)*(volatile u8*)ptr;
+        else
+            *(volatile u8*)ptr = *(volatile u8*)ptr;
+        auto paddr = MM.physical_address_of_kernel_vaddr(VirtualAddress(ptr));
+        if (paddr.is_null())
+            return false;
+        if (!segments.is_empty()) {
+            auto& last = segments.last();
+            auto last_end = last.offset.offset(last.size);
+            bool same_64k_window = (last.offset.get() & ~0xffff) == ((paddr.get() + chunk_size - 1) & ~0xffff);
+            if (last_end == paddr && same_64k_window && last.size + chunk_size < 0x10000) {
+                last.size += chunk_size;
+                offset += chunk_size;
+                continue;
+            }
+        }
+        segments.append({ paddr, (u16)chunk_size, 0 });
+        offset += chunk_size;
+    }
+    return true;
+}
 
-    // Turn on "Interrupt" and "Error" flag. The error flag should be cleared by hardware.
-    m_bus_master_base.offset(2).out<u8>(m_bus_master_base.offset(2).in<u8>() | 0x6);
+static bool can_dma_directly(const u8* buffer)
+{
+    // We DMA straight into the caller's pages when we can. User memory (which could
+    // go away under us) and odd addresses go through a bounce buffer instead.
+    return !((FlatPtr)buffer & 1) && !is_user_address(VirtualAddress(buffer));
+}
 
-    // Set transfer direction
-    m_bus_master_base.out<u8>(0x8);
+bool PATAChannel::ata_transfer_sectors_with_dma(bool is_write, u32 lba, u16 count, u8* buffer, bool slave_request)
+{
+    size_t size = count * 512;
+
+    u8* dma_buffer = buffer;
+    Optional<KBuffer> bounce_buffer;
+    if (!can_dma_directly(buffer)) {
+        bounce_buffer = KBuffer::create_with_size(size);
+        dma_buffer = bounce_buffer.value().data();
+        if (is_write)
+            memcpy(dma_buffer, buffer, size);
+    }
 
-    while (m_io_base.offset(ATA_REG_STATUS).in<u8>() & ATA_SR_BSY)
-        ;
+    auto request = AsyncBlockDeviceRequest::create(is_write ? AsyncBlockDeviceRequest::Type::Write : AsyncBlockDeviceRequest::Type::Read, lba, count, dma_buffer, size);
+    if (!start_request(request, slave_request))
+        ASSERT_NOT_REACHED();
+    if (!request->wait())
+        return false;
 
-    u8 devsel = 0xe0;
-    if (slave_request)
-        devsel |= 0x10;
+    if (bounce_buffer.has_value() && !is_write)
+        memcpy(buffer, dma_buffer, size);
+    return true;
+}
 
-    m_control_base.offset(ATA_CTL_CONTROL).out<u8>(0);
-    m_io_base.offset(ATA_REG_HDDEVSEL).out<u8>(devsel | (static_cast<u8>(slave_request) << 4));
-    io_delay();
+bool PATAChannel::start_request(AsyncBlockDeviceRequest& request, bool slave_request)
+{
+    for (auto& buffer : request.buffers()) {
+        if (!can_dma_directly(buffer.data))
+            return false;
+    }
 
-    m_io_base.offset(ATA_REG_FEATURES).out<u8>(0);
+    // Split the request into transfers a single command can carry. Building the
+    // segment lists may fault pages in, so do it before disabling interrupts.
+    Vector<Request*, 16> transfers;
+    u32 lba = request.block_index();
+    for (auto& buffer : request.buffers()) {
+        ASSERT(!(buffer.size % 512));
+        for (size_t offset = 0; offset < buffer.size;) {
+            auto* transfer = new Request;
+            transfer->owner = &request;
+            transfer->is_write = request.is_write();
+            transfer->slave = slave_request;
+            transfer->lba = lba;
+            transfer->sector_count = min((buffer.size - offset) / 512, (size_t)max_sectors_per_command);
+            if (!append_dma_segments(transfer->segments, buffer.data + offset, transfer->sector_count * 512, transfer->is_write)) {
+                delete transfer;
+                for (auto* transfer : transfers)
+                    delete transfer;
+                return false;
+            }
+            transfers.append(transfer);
+            lba += transfer->sector_count;
+            offset += transfer->sector_count * 512;
+        }
+    }
 
-    m_io_base.offset(ATA_REG_SECCOUNT0).out<u8>(0);
-    m_io_base.offset(ATA_REG_LBA0).out<u8>(0);
-    m_io_base.offset(ATA_REG_LBA1).out<u8>(0);
-    m_io_base.offset(ATA_REG_LBA2).out<u8>(0);
+    if (transfers.is_empty()) {
+        request.complete(true);
+        return true;
+    }
+    request.set_transfer_count(transfers.size());
 
-    m_io_base.offset(ATA_REG_SECCOUNT0).out<u8>(count);
-    m_io_base.offset(ATA_REG_LBA0).out<u8>((lba & 0x000000ff) >> 0);
-    m_io_base.offset(ATA_REG_LBA1).out<u8>((lba & 0x0000ff00) >> 8);
-    m_io_base.offset(ATA_REG_LBA2).out<u8>((lba & 0x00ff0000) >> 16);
+#ifdef PATA_DEBUG
+    dbg() << "PATAChannel::start_request " << (request.is_write() ? "write" : "read") << " @ LBA " << request.block_index() << " x" << request.block_count() << " in " << transfers.size() << " transfer(s)";
+#endif
 
-    for (;;) {
-        auto status = m_io_base.offset(ATA_REG_STATUS).in<u8>();
-        if (!(status & ATA_SR_BSY) && (status & ATA_SR_DRDY))
-            break;
+    InterruptDisabler disabler;
+    for (auto* transfer : transfers) {
+        auto* next = m_pending_requests.head();
+        while (next && (next->slave != transfer->slave ? !next->slave : next->lba < transfer->lba))
+            next = next->next();
+        if (next)
+            m_pending_requests.insert_before(next, transfer);
+        else
+            m_pending_requests.append(transfer);
     }
+    if (m_running_batch.is_empty())
+        start_next_dma_batch();
+    return true;
+}
 
-    m_io_base.offset(ATA_REG_COMMAND).out<u8>(ATA_CMD_READ_DMA_EXT);
-    io_delay();
-
-    prepare_for_irq();
-    // Start bus master
-    m_bus_master_base.out<u8>(0x9);
+void PATAChannel::start_next_dma_batch()
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    ASSERT(m_running_batch.is_empty());
+    m_running_batch = take_next_dma_batch();
+    if (m_running_batch.is_empty()) {
+        disable_irq();
+        return;
+    }
+    enable_irq();
+    execute_dma_batch();
+}
 
-    wait_for_irq();
+void PATAChannel::complete_dma_batch(bool success)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    auto batch = move(m_running_batch);
+    m_running_batch.clear();
+    for (auto* transfer : batch) {
+        transfer->owner->complete(success);
+        delete transfer;
+    }
+}
 
-    if (m_device_error)
-        return false;
+Vector<PATAChannel::Request*, 16> PATAChannel::take_next_dma_batch()
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    Vector<Request*, 16> batch;
+    if (m_pending_requests.is_empty())
+        return batch;
+
+    // Keep sweeping upwards from where the last command ended, then start over from the lowest LBA.
+    auto* first = m_pending_requests.head();
+    for (auto* request = first; request; request = request->next()) {
+        if (request->slave == m_last_request_slave ? request->lba >= m_last_request_end_lba : request->slave) {
+            first = request;
+            break;
+        }
+    }
 
-    memcpy(outbuf, m_dma_buffer_page->paddr().offset(0xc0000000).as_ptr(), 512 * count);
+    size_t sector_count = first->sector_count;
+    size_t segment_count = first->segments.size();
+    batch.append(first);
+    for (auto* request = first->next(); request; request = request->next()) {
+        if (request->slave != first->slave || request->is_write != first->is_write)
+            break;
+        if (request->lba != first->lba + sector_count)
+            break;
+        if (sector_count + request->sector_count > max_sectors_per_command || segment_count + request->segments.size() > PRDT_ENTRY_COUNT)
+            break;
+        sector_count += request->sector_count;
+        segment_count += request->segments.size();
+        batch.append(request);
+    }
+    for (auto* request : batch)
+        m_pending_requests.remove(request);
 
-    // I read somewhere that this may trigger a cache flush so let's do it.
-    m_bus_master_base.offset(2).out<u8>(m_bus_master_base.offset(2).in<u8>() | 0x6);
-    return true;
+    m_last_request_slave = first->slave;
+    m_last_request_end_lba = first->lba + sector_count;
+    return batch;
 }
 
-bool PATAChannel::ata_write_sectors_with_dma(u32 lba, u16 count, const u8* inbuf, bool slave_request)
+void PATAChannel::execute_dma_batch()
 {
-    LOCKER(s_lock());
+    auto& batch = m_running_batch;
+    auto& first = *batch.first();
+    bool is_write = first.is_write;
+    bool slave_request = first.slave;
+    u32 lba = first.lba;
+    u16 count = 0;
+
+    size_t prdt_index = 0;
+    for (auto* request : batch) {
+        count += request->sector_count;
+        for (auto& segment : request->segments) {
+            prdt()[prdt_index] = segment;
+            prdt()[prdt_index].end_of_table = 0;
+            ++prdt_index;
+        }
+    }
+    prdt()[prdt_index - 1].end_of_table = 0x8000;
+
 #ifdef PATA_DEBUG
-    dbg() << "PATAChannel::ata_write_sectors_with_dma (" << lba << " x" << count << ") <- " << inbuf;
+    dbg() << "PATAChannel: DMA " << (is_write ? "write" : "read") << " of " << count << " sector(s) @ LBA " << lba << " for " << batch.size() << " request(s), " << prdt_index << " PRD(s)";
 #endif
 
-    prdt().offset = m_dma_buffer_page->paddr();
-    prdt().size = 512 * count;
-
-    memcpy(m_dma_buffer_page->paddr().offset(0xc0000000).as_ptr(), inbuf, 512 * count);
-
-    ASSERT(prdt().size <= PAGE_SIZE);
-
     // Stop bus master
     m_bus_master_base.out<u8>(0);
 
@@ -359,6 +511,10 @@ bool PATAChannel::ata_write_sectors_with_dma(u32 lba, u16 count, const u8* inbuf
     // Turn on "Interrupt" and "Error" flag. The error flag should be cleared by hardware.
     m_bus_master_base.offset(2).out<u8>(m_bus_master_base.offset(2).in<u8>() | 0x6);
 
+    // Set transfer direction (the bus master writes to memory when we read from the disk)
+    if (!is_write)
+        m_bus_master_base.out<u8>(0x8);
+
     while (m_io_base.offset(ATA_REG_STATUS).in<u8>() & ATA_SR_BSY)
         ;
 
@@ -372,12 +528,13 @@ bool PATAChannel::ata_write_sectors_with_dma(u32 lba, u16 count, const u8* inbuf
 
     m_io_base.offset(ATA_REG_FEATURES).out<u8>(0);
 
-    m_io_base.offset(ATA_REG_SECCOUNT0).out<u8>(0);
-    m_io_base.offset(ATA_REG_LBA0).out<u8>(0);
+    // 48-bit LBA: the high order bytes go first, then the low order bytes.
+    m_io_base.offset(ATA_REG_SECCOUNT0).out<u8>((count >> 8) & 0xff);
+    m_io_base.offset(ATA_REG_LBA0).out<u8>((lba >> 24) & 0xff);
     m_io_base.offset(ATA_REG_LBA1).out<u8>(0);
     m_io_base.offset(ATA_REG_LBA2).out<u8>(0);
 
-    m_io_base.offset(ATA_REG_SECCOUNT0).out<u8>(count);
+    m_io_base.offset(ATA_REG_SECCOUNT0).out<u8>(count & 0xff);
     m_io_base.offset(ATA_REG_LBA0).out<u8>((lba & 0x000000ff) >> 0);
     m_io_base.offset(ATA_REG_LBA1).out<u8>((lba & 0x0000ff00) >> 8);
     m_io_base.offset(ATA_REG_LBA2).out<u8>((lba & 0x00ff0000) >> 16);
@@ -388,20 +545,11 @@ bool PATAChannel::ata_write_sectors_with_dma(u32 lba, u16 count, const u8* inbuf
             break;
     }
 
-    m_io_base.offset(ATA_REG_COMMAND).out<u8>(ATA_CMD_WRITE_DMA_EXT);
+    m_io_base.offset(ATA_REG_COMMAND).out<u8>(is_write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT);
     io_delay();
 
-    prepare_for_irq();
-    // Start bus master
-    m_bus_master_base.out<u8>(0x1);
-    wait_for_irq();
-
-    if (m_device_error)
-        return false;
-
-    // I read somewhere that this may trigger a cache flush so let's do it.
-    m_bus_master_base.offset(2).out<u8>(m_bus_master_base.offset(2).in<u8>() | 0x6);
-    return true;
+    // Start bus master, the IRQ handler takes it from here.
+    m_bus_master_base.out<u8>(is_write ? 0x1 : 0x9);
 }
 
 bool PATAChannel::ata_read_sectors(u32 lba, u16 count, u8* outbuf, bool slave_request)
@@ -37,8 +37,11 @@
 
 #pragma once
 
+#include <AK/InlineLinkedList.h>
 #include <AK/OwnPtr.h>
 #include <AK/RefPtr.h>
+#include <AK/Vector.h>
+#include <Kernel/Devices/BlockDevice.h>
 #include <Kernel/IO.h>
 #include <Kernel/Lock.h>
 #include <Kernel/PCI/Access.h>
@@ -55,6 +58,8 @@ struct PhysicalRegionDescriptor {
     u16 end_of_table { 0 };
 };
 
+static_assert(sizeof(PhysicalRegionDescriptor) == 8);
+
 class PATADiskDevice;
 class PATAChannel final : public PCI::Device {
     friend class PATADiskDevice;
@@ -75,7 +80,31 @@ public:
 
     virtual const char* purpose() const override { return "PATA Channel"; }
 
+    // The most a single DMA command transfers (128 KiB, using 48-bit LBA commands).
+    static constexpr u16 max_sectors_per_command = 256;
+
+    bool is_dma_enabled() { return !m_bus_master_base.is_null() && m_dma_enabled.resource(); }
+
+    // Queues the request for DMA and returns right away, the request is completed from the IRQ handler.
+    // Returns false (without touching the request) if its buffers can't be used for DMA directly.
+    bool start_request(AsyncBlockDeviceRequest&, bool slave_request);
+
 private:
+    // One DMA transfer of (a part of) an AsyncBlockDeviceRequest.
+    // Adjacent transfers in the queue are merged into one command.
+    struct Request : public InlineLinkedListNode<Request> {
+        RefPtr<AsyncBlockDeviceRequest> owner;
+        bool is_write { false };
+        bool slave { false };
+        u32 lba { 0 };
+        u16 sector_count { 0 };
+        Vector<PhysicalRegionDescriptor, 4> segments;
+
+        // For InlineLinkedListNode
+        Request* m_next { nullptr };
+        Request* m_prev { nullptr };
+    };
+
     //^ IRQHandler
     virtual void handle_irq(const RegisterState&) override;
 
@@ -85,6 +114,11 @@ private:
     void wait_for_irq();
     bool ata_read_sectors_with_dma(u32, u16, u8*, bool);
     bool ata_write_sectors_with_dma(u32, u16, const u8*, bool);
+    bool ata_transfer_sectors_with_dma(bool is_write, u32, u16, u8*, bool);
+    void start_next_dma_batch();
+    void complete_dma_batch(bool success);
+    Vector<Request*, 16> take_next_dma_batch();
+    void execute_dma_batch();
     bool ata_read_sectors(u32, u16, u8*, bool);
     bool ata_write_sectors(u32, u16, const u8*, bool);
 
@@ -98,12 +132,18 @@ private:
 
     WaitQueue m_irq_queue;
 
-    PhysicalRegionDescriptor& prdt() { return *reinterpret_cast<PhysicalRegionDescriptor*>(m_prdt_page->paddr().offset(0xc0000000).as_ptr()); }
+    PhysicalRegionDescriptor* prdt() { return reinterpret_cast<PhysicalRegionDescriptor*>(m_prdt_page->paddr().offset(0xc0000000).as_ptr()); }
     RefPtr<PhysicalPage> m_prdt_page;
-    RefPtr<PhysicalPage> m_dma_buffer_page;
     IOAddress m_bus_master_base;
     Lockable<bool> m_dma_enabled;
 
+    // Pending transfers, sorted by drive and LBA. Submitting a transfer to an idle channel
+    // starts it, after that the IRQ handler starts the next batch whenever one finishes.
+    InlineLinkedList<Request> m_pending_requests;
+    Vector<Request*, 16> m_running_batch;
+    bool m_last_request_slave { false };
+    u32 m_last_request_end_lba { 0 };
+
     RefPtr<PATADiskDevice> m_master;
     RefPtr<PATADiskDevice> m_slave;
 };
@@ -57,14 +57,14 @@ const char* PATADiskDevice::class_name() const
 
 bool PATADiskDevice::read_blocks(unsigned index, u16 count, u8* out)
 {
-    if (!m_channel.m_bus_master_base.is_null() && m_channel.m_dma_enabled.resource())
+    if (m_channel.is_dma_enabled())
         return read_sectors_with_dma(index, count, out);
     return read_sectors(index, count, out);
 }
 
 bool PATADiskDevice::write_blocks(unsigned index, u16 count, const u8* data)
 {
-    if (!m_channel.m_bus_master_base.is_null() && m_channel.m_dma_enabled.resource())
+    if (m_channel.is_dma_enabled())
         return write_sectors_with_dma(index, count, data);
     for (unsigned i = 0; i < count; ++i) {
         if (!write_sectors(index + i, 1, data + i * 512))
@@ -73,6 +73,13 @@ bool PATADiskDevice::write_blocks(unsigned index, u16 count, const u8* data)
     return true;
 }
 
+void PATADiskDevice::start_request(AsyncBlockDeviceRequest& request)
+{
+    if (m_channel.is_dma_enabled() && m_channel.start_request(request, is_slave()))
+        return;
+    BlockDevice::start_request(request);
+}
+
 void PATADiskDevice::set_drive_geometry(u16 cyls, u16 heads, u16 spt)
 {
     m_cylinders = cyls;
@@ -83,15 +90,14 @@ void PATADiskDevice::set_drive_geometry(u16 cyls, u16 heads, u16 spt)
 ssize_t PATADiskDevice::read(FileDescription&, size_t offset, u8* outbuf, ssize_t len)
 {
     unsigned index = offset / block_size();
-    u16 whole_blocks = len / block_size();
+    unsigned whole_blocks = len / block_size();
     ssize_t remaining = len % block_size();
 
-    unsigned blocks_per_page = PAGE_SIZE / block_size();
+    unsigned blocks_per_command = PATAChannel::max_sectors_per_command * 512 / block_size();
 
-    // PATAChannel will chuck a wobbly if we try to read more than PAGE_SIZE
-    // at a time, because it uses a single page for its DMA buffer.
-    if (whole_blocks >= blocks_per_page) {
-        whole_blocks = blocks_per_page;
+    // Don't read more than a single command can transfer, the caller will come back for the rest.
+    if (whole_blocks >= blocks_per_command) {
+        whole_blocks = blocks_per_command;
         remaining = 0;
     }
 
@@ -124,15 +130,14 @@ bool PATADiskDevice::can_read(const FileDescription&, size_t offset) const
 ssize_t PATADiskDevice::write(FileDescription&, size_t offset, const u8* inbuf, ssize_t len)
 {
     unsigned index = offset / block_size();
-    u16 whole_blocks = len / block_size();
+    unsigned whole_blocks = len / block_size();
     ssize_t remaining = len % block_size();
 
-    unsigned blocks_per_page = PAGE_SIZE / block_size();
+    unsigned blocks_per_command = PATAChannel::max_sectors_per_command * 512 / block_size();
 
-    // PATAChannel will chuck a wobbly if we try to write more than PAGE_SIZE
-    // at a time, because it uses a single page for its DMA buffer.
-    if (whole_blocks >= blocks_per_page) {
-        whole_blocks = blocks_per_page;
+    // Don't write more than a single command can transfer, the caller will come back for the rest.
+    if (whole_blocks >= blocks_per_command) {
+        whole_blocks = blocks_per_command;
         remaining = 0;
     }
 
@@ -57,6 +57,7 @@ public:
     // ^DiskDevice
     virtual bool read_blocks(unsigned index, u16 count, u8*) override;
     virtual bool write_blocks(unsigned index, u16 count, const u8*) override;
+    virtual void start_request(AsyncBlockDeviceRequest&) override;
 
     void set_drive_geometry(u16, u16, u16);
 
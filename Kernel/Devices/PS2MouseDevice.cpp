@@ -81,8 +81,10 @@ void PS2MouseDevice::handle_irq(const RegisterState&)
         if (backdoor->vmmouse_is_absolute()) {
             IO::in8(I8042_BUFFER);
             auto packet = backdoor->receive_mouse_packet();
-            if (packet.has_value())
+            if (packet.has_value()) {
                 m_queue.enqueue(packet.value());
+                evaluate_block_conditions();
+            }
             return;
         }
     }
@@ -166,6 +168,7 @@ void PS2MouseDevice::parse_data_packet()
     dbg() << "Mouse: X " << packet.x << ", Y " << packet.y << ", Z " << packet.z;
 #endif
     m_queue.enqueue(packet);
+    evaluate_block_conditions();
 }
 
 void PS2MouseDevice::wait_then_write(u8 port, u8 data)
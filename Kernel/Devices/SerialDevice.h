@@ -47,6 +47,9 @@ public:
     virtual bool can_write(const FileDescription&, size_t) const override;
     virtual ssize_t write(FileDescription&, size_t, const u8*, ssize_t) override;
 
+    // We don't take interrupts, so the line status has to be polled.
+    virtual bool is_readiness_polled() const override { return true; }
+
     enum InterruptEnable {
         LowPowerMode = 0x01 << 5,
         SleepMode = 0x01 << 4,
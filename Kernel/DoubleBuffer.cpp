@@ -34,6 +34,7 @@ inline void DoubleBuffer::compute_lockfree_metadata()
     InterruptDisabler disabler;
     m_empty = m_read_buffer_index >= m_read_buffer->size && m_write_buffer->size == 0;
     m_space_for_writing = m_capacity - m_write_buffer->size;
+    m_used_bytes = (m_read_buffer->size - m_read_buffer_index) + m_write_buffer->size;
 }
 
 DoubleBuffer::DoubleBuffer(size_t capacity)
@@ -0,0 +1,255 @@
+/*
+ * Copyright (c) 2020, the SerenityOS developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <Kernel/Arch/i386/CPU.h>
+#include <Kernel/FileSystem/EventPoll.h>
+#include <Kernel/FileSystem/FileDescription.h>
+
+//#define EVENTPOLL_DEBUG
+
+namespace Kernel {
+
+NonnullRefPtr<EventPoll> EventPoll::create()
+{
+    return adopt(*new EventPoll);
+}
+
+EventPoll::EventPoll()
+{
+}
+
+EventPoll::~EventPoll()
+{
+    ASSERT(m_interests.is_empty());
+}
+
+void EventPoll::remove_all_interests(Badge<FileDescription>)
+{
+    LOCKER(m_lock);
+    while (!m_interests.is_empty())
+        destroy_interest(*m_interests.begin()->value);
+}
+
+u32 EventPoll::ready_events(const EventPollInterest& interest)
+{
+    if (interest.is_disabled)
+        return 0;
+    u32 events = 0;
+    if ((interest.events & EPOLLIN) && interest.description.can_read())
+        events |= EPOLLIN;
+    if ((interest.events & EPOLLOUT) && interest.description.can_write())
+        events |= EPOLLOUT;
+    // Hang-ups and errors are always reported, whether they were asked for or not.
+    auto& file = interest.description.file();
+    if (file.has_hung_up(interest.description))
+        events |= EPOLLHUP;
+    if (file.has_pending_error(interest.description))
+        events |= EPOLLERR;
+    return events;
+}
+
+void EventPoll::enqueue(EventPollInterest& interest)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    if (interest.is_queued)
+        return;
+    interest.is_queued = true;
+    m_ready.append(&interest);
+    ++m_ready_count;
+}
+
+void EventPoll::dequeue(EventPollInterest& interest)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    if (!interest.is_queued)
+        return;
+    interest.is_queued = false;
+    m_ready.remove(&interest);
+    --m_ready_count;
+}
+
+KResult EventPoll::add_interest(int fd, FileDescription& description, const epoll_event& event)
+{
+    auto& file = description.file();
+    // Regular files are always ready, so there's nothing to wait for.
+    if (file.is_inode())
+        return KResult(-EPERM);
+    // Watching another EventPoll could set up notification cycles.
+    if (file.is_event_poll())
+        return KResult(-EINVAL);
+
+    LOCKER(m_lock);
+    auto it = m_interests.find(fd);
+    if (it != m_interests.end()) {
+        if (&it->value->description == &description)
+            return KResult(-EEXIST);
+        // The fd was closed and reused while the old description lived on through a dup().
+        destroy_interest(*it->value);
+    }
+
+    auto interest = make<EventPollInterest>(*this, fd, description, event);
+    file.register_event_poll_interest({}, *interest);
+    if (file.is_readiness_polled())
+        ++m_polled_interest_count;
+
+    {
+        // Report the current state on the next wait.
+        InterruptDisabler disabler;
+        enqueue(*interest);
+    }
+
+#ifdef EVENTPOLL_DEBUG
+    dbg() << "EventPoll{" << this << "}: Added interest in fd " << fd << " (" << file.class_name() << "), events=" << String::format("%x", event.events);
+#endif
+    m_interests.set(fd, move(interest));
+    evaluate_block_conditions();
+    return KSuccess;
+}
+
+KResult EventPoll::modify_interest(int fd, FileDescription& description, const epoll_event& event)
+{
+    LOCKER(m_lock);
+    auto it = m_interests.find(fd);
+    if (it == m_interests.end() || &it->value->description != &description)
+        return KResult(-ENOENT);
+
+    auto& interest = *it->value;
+    {
+        InterruptDisabler disabler;
+        interest.events = event.events;
+        interest.data = event.data;
+        interest.is_disabled = false;
+        enqueue(interest);
+    }
+    evaluate_block_conditions();
+    return KSuccess;
+}
+
+KResult EventPoll::remove_interest(int fd, FileDescription& description)
+{
+    LOCKER(m_lock);
+    auto it = m_interests.find(fd);
+    if (it == m_interests.end() || &it->value->description != &description)
+        return KResult(-ENOENT);
+
+    destroy_interest(*it->value);
+    return KSuccess;
+}
+
+void EventPoll::destroy_interest(EventPollInterest& interest)
+{
+    ASSERT(m_lock.is_locked());
+    auto& file = interest.description.file();
+    file.unregister_event_poll_interest({}, interest);
+    if (file.is_readiness_polled())
+        --m_polled_interest_count;
+    {
+        InterruptDisabler disabler;
+        dequeue(interest);
+    }
+    m_interests.remove(interest.fd);
+}
+
+void EventPoll::description_will_close(Badge<File>, FileDescription& description)
+{
+    LOCKER(m_lock);
+    Vector<EventPollInterest*, 4> doomed;
+    for (auto& it : m_interests) {
+        if (&it.value->description == &description)
+            doomed.append(it.value.ptr());
+    }
+    for (auto* interest : doomed)
+        destroy_interest(*interest);
+}
+
+void EventPoll::interest_did_change(Badge<File>, EventPollInterest& interest)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    enqueue(interest);
+    // Wake waiters even if it was already queued; they may have found it not ready a moment ago.
+    evaluate_block_conditions();
+}
+
+void EventPoll::collect_events(Vector<epoll_event, 32>& events, size_t max_events)
+{
+    LOCKER(m_lock);
+
+    // Only look at what was queued when we started; anything the Files push while we
+    // check readiness lands behind it and is picked up by the next call.
+    size_t pending;
+    {
+        InterruptDisabler disabler;
+        pending = m_ready_count;
+    }
+
+    Vector<EventPollInterest*, 32> requeue;
+    while (pending-- && events.size() < max_events) {
+        EventPollInterest* interest;
+        {
+            InterruptDisabler disabler;
+            interest = m_ready.head();
+            ASSERT(interest);
+            dequeue(*interest);
+        }
+
+        // A polled File never tells us when it changes, so it has to stay queued.
+        bool is_polled = interest->description.file().is_readiness_polled();
+        u32 ready = ready_events(*interest);
+        if (!ready) {
+            if (is_polled)
+                requeue.append(interest);
+            continue;
+        }
+
+        events.append({ ready, interest->data });
+
+        if (interest->events & EPOLLONESHOT) {
+            // Disabled until the next EPOLL_CTL_MOD.
+            interest->is_disabled = true;
+        } else if (!(interest->events & EPOLLET) || is_polled) {
+            // Level-triggered: it stays ready until a wait finds it isn't.
+            requeue.append(interest);
+        }
+    }
+
+    if (requeue.is_empty())
+        return;
+    InterruptDisabler disabler;
+    for (auto* interest : requeue)
+        enqueue(*interest);
+}
+
+bool EventPoll::can_read(const FileDescription&, size_t) const
+{
+    InterruptDisabler disabler;
+    for (auto* interest = m_ready.head(); interest; interest = interest->next()) {
+        if (ready_events(*interest))
+            return true;
+    }
+    return false;
+}
+
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2020, the SerenityOS developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <AK/Badge.h>
+#include <AK/HashMap.h>
+#include <AK/InlineLinkedList.h>
+#include <AK/NonnullOwnPtr.h>
+#include <Kernel/FileSystem/File.h>
+#include <Kernel/Lock.h>
+
+namespace Kernel {
+
+// One file descriptor an EventPoll is interested in.
+// Interests sit on their File's interest list for as long as they exist, and on the
+// EventPoll's ready list from the moment the File reports a change until epoll_wait()
+// has looked at them.
+struct EventPollInterest : public InlineLinkedListNode<EventPollInterest> {
+    EventPollInterest(EventPoll& event_poll, int fd, FileDescription& description, const epoll_event& event)
+        : event_poll(event_poll)
+        , description(description)
+        , fd(fd)
+        , events(event.events)
+        , data(event.data)
+    {
+    }
+
+    EventPoll& event_poll;
+    FileDescription& description;
+    int fd { -1 };
+    u32 events { 0 };
+    epoll_data_t data;
+    bool is_queued { false };
+    // A one-shot interest that has fired, it reports nothing until it's modified.
+    bool is_disabled { false };
+
+    // For InlineLinkedListNode
+    EventPollInterest* m_next { nullptr };
+    EventPollInterest* m_prev { nullptr };
+};
+
+class EventPoll final : public File {
+public:
+    static NonnullRefPtr<EventPoll> create();
+    virtual ~EventPoll() override;
+
+    KResult add_interest(int fd, FileDescription&, const epoll_event&);
+    KResult modify_interest(int fd, FileDescription&, const epoll_event&);
+    KResult remove_interest(int fd, FileDescription&);
+
+    // Moves up to max_events ready events into the buffer, without blocking.
+    void collect_events(Vector<epoll_event, 32>&, size_t max_events);
+
+    void interest_did_change(Badge<File>, EventPollInterest&);
+    void description_will_close(Badge<File>, FileDescription&);
+
+    // Only called once the one description for this EventPoll goes away. close() on it just means
+    // one fd is gone, while dups and fork()ed copies may still be sharing the set.
+    void remove_all_interests(Badge<FileDescription>);
+
+    virtual bool can_read(const FileDescription&, size_t) const override;
+    virtual bool can_write(const FileDescription&, size_t) const override { return false; }
+    virtual ssize_t read(FileDescription&, size_t, u8*, ssize_t) override { return -EINVAL; }
+    virtual ssize_t write(FileDescription&, size_t, const u8*, ssize_t) override { return -EINVAL; }
+    virtual String absolute_path(const FileDescription&) const override { return "epoll"; }
+    virtual const char* class_name() const override { return "EventPoll"; }
+
+    virtual bool is_event_poll() const override { return true; }
+    virtual bool is_readiness_polled() const override { return m_polled_interest_count; }
+
+private:
+    EventPoll();
+
+    static u32 ready_events(const EventPollInterest&);
+
+    // These must be called with interrupts disabled.
+    void enqueue(EventPollInterest&);
+    void dequeue(EventPollInterest&);
+
+    void destroy_interest(EventPollInterest&);
+
+    Lock m_lock { "EventPoll" };
+    HashMap<int, NonnullOwnPtr<EventPollInterest>> m_interests;
+    InlineLinkedList<EventPollInterest> m_ready;
+    size_t m_ready_count { 0 };
+    size_t m_polled_interest_count { 0 };
+};
+
+}
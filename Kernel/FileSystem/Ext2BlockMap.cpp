@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2020, the SerenityOS developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <Kernel/FileSystem/Ext2BlockMap.h>
+
+namespace Kernel {
+
+static bool is_continued_by(const Ext2BlockMap::Extent& extent, u32 logical_index, u32 physical_index)
+{
+    if (extent.logical_end() != logical_index)
+        return false;
+    if (!extent.physical_index)
+        return !physical_index;
+    return physical_index && extent.physical_index + extent.length == physical_index;
+}
+
+size_t Ext2BlockMap::lower_bound(u32 logical_index) const
+{
+    size_t low = 0;
+    size_t high = m_extents.size();
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (m_extents[middle].logical_end() <= logical_index)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+void Ext2BlockMap::add(u32 logical_index, u32 physical_index)
+{
+    size_t index = lower_bound(logical_index);
+    ASSERT(index == m_extents.size() || m_extents[index].logical_index > logical_index);
+
+    if (index > 0 && is_continued_by(m_extents[index - 1], logical_index, physical_index)) {
+        auto& previous = m_extents[index - 1];
+        ++previous.length;
+        // This may have closed the gap to the next extent.
+        if (index < m_extents.size() && is_continued_by(previous, m_extents[index].logical_index, m_extents[index].physical_index)) {
+            previous.length += m_extents[index].length;
+            m_extents.remove(index);
+        }
+        return;
+    }
+
+    if (index < m_extents.size()) {
+        auto& next = m_extents[index];
+        Extent extent { logical_index, physical_index, 1 };
+        if (is_continued_by(extent, next.logical_index, next.physical_index)) {
+            next.logical_index = logical_index;
+            next.physical_index = physical_index;
+            ++next.length;
+            return;
+        }
+    }
+
+    m_extents.insert(index, { logical_index, physical_index, 1 });
+}
+
+void Ext2BlockMap::truncate(u32 block_count)
+{
+    size_t index = lower_bound(block_count);
+    if (index < m_extents.size() && m_extents[index].logical_index < block_count) {
+        m_extents[index].length = block_count - m_extents[index].logical_index;
+        ++index;
+    }
+    m_extents.shrink(index);
+}
+
+Vector<Ext2BlockMap::Range, 4> Ext2BlockMap::unmapped_ranges(u32 first, u32 count) const
+{
+    Vector<Range, 4> ranges;
+    u32 end = first + count;
+    u32 cursor = first;
+    for (size_t i = lower_bound(first); i < m_extents.size() && m_extents[i].logical_index < end; ++i) {
+        auto& extent = m_extents[i];
+        if (extent.logical_index > cursor)
+            ranges.append({ cursor, extent.logical_index - cursor });
+        cursor = max(cursor, extent.logical_end());
+    }
+    if (cursor < end)
+        ranges.append({ cursor, end - cursor });
+    return ranges;
+}
+
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2020, the SerenityOS developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <AK/Types.h>
+#include <AK/Vector.h>
+
+namespace Kernel {
+
+// The logical-to-physical block map of an Ext2 inode, stored as runs of consecutive
+// blocks instead of one entry per block. It's filled in lazily, one range at a time,
+// so parts of it may not be known yet.
+class Ext2BlockMap {
+public:
+    // Logical blocks [logical_index, logical_index + length) live in the physical blocks
+    // starting at physical_index. A physical_index of 0 is a hole, which reads as zeroes.
+    struct Extent {
+        u32 logical_index { 0 };
+        u32 physical_index { 0 };
+        u32 length { 0 };
+
+        u32 logical_end() const { return logical_index + length; }
+    };
+
+    struct Range {
+        u32 first { 0 };
+        u32 count { 0 };
+    };
+
+    bool is_empty() const { return m_extents.is_empty(); }
+    size_t extent_count() const { return m_extents.size(); }
+    void clear() { m_extents.clear(); }
+
+    // Records where a logical block that isn't mapped yet lives.
+    void add(u32 logical_index, u32 physical_index);
+
+    // Forgets about everything at and past the given logical block.
+    void truncate(u32 block_count);
+
+    // The parts of the given range that aren't mapped yet.
+    Vector<Range, 4> unmapped_ranges(u32 first, u32 count) const;
+
+    // Calls callback(logical_index, physical_index, count) for each run in the given range,
+    // in order. The whole range has to be mapped.
+    template<typename Callback>
+    void for_each_run_in_range(u32 first, u32 count, Callback callback) const
+    {
+        u32 end = first + count;
+        u32 cursor = first;
+        for (size_t i = lower_bound(first); i < m_extents.size() && m_extents[i].logical_index < end; ++i) {
+            auto& extent = m_extents[i];
+            u32 run_start = max(first, extent.logical_index);
+            u32 run_end = min(end, extent.logical_end());
+            ASSERT(run_start == cursor);
+            callback(run_start, extent.physical_index ? extent.physical_index + (run_start - extent.logical_index) : 0, run_end - run_start);
+            cursor = run_end;
+        }
+        ASSERT(cursor == end);
+    }
+
+private:
+    // The index of the first extent that ends past the given logical block.
+    size_t lower_bound(u32 logical_index) const;
+
+    Vector<Extent> m_extents;
+};
+
+}
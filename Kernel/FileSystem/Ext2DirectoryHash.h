@@ -1,5 +1,5 @@
 /*
- * Copyright (c) 2020, Andreas Kling <kling@serenityos.org>
+ * Copyright (c) 2020, the SerenityOS developers.
  * All rights reserved.
  *
  * Redistribution and use in source and binary forms, with or without
@@ -24,22 +24,17 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include <Kernel/FileSystem/VirtualFileSystem.h>
-#include <Kernel/Process.h>
-#include <Kernel/Tasks/SyncTask.h>
-#include <Kernel/Time/TimeManagement.h>
+#pragma once
+
+#include <AK/StringView.h>
+#include <AK/Types.h>
 
 namespace Kernel {
 
-void SyncTask::spawn()
-{
-    Thread* syncd_thread = nullptr;
-    Process::create_kernel_process(syncd_thread, "SyncTask", [] {
-        for (;;) {
-            VFS::the().sync();
-            Thread::current->sleep(1 * TimeManagement::the().ticks_per_second());
-        }
-    });
-}
+// Computes the hash used to place a name in an Ext2 hashed directory index (htree).
+// The hash version is one of the EXT2_HASH_* values, including the unsigned variants.
+// The low bit of the result is always clear, it's used as a continuation marker in
+// the index. Returns 0 for unknown hash versions.
+u32 ext2_directory_hash(const StringView& name, u8 hash_version, const u32 seed[4]);
 
 }
@@ -27,18 +27,25 @@
 #include <AK/Bitmap.h>
 #include <AK/BufferStream.h>
 #include <AK/HashMap.h>
+#include <AK/QuickSort.h>
 #include <AK/StdLibExtras.h>
 #include <AK/StringView.h>
 #include <Kernel/Devices/BlockDevice.h>
+#include <Kernel/FileSystem/Ext2DirectoryHash.h>
 #include <Kernel/FileSystem/Ext2FileSystem.h>
 #include <Kernel/FileSystem/FileDescription.h>
 #include <Kernel/FileSystem/ext2_fs.h>
 #include <Kernel/Process.h>
+#include <Kernel/Tasks/WritebackTask.h>
 #include <Kernel/UnixTypes.h>
+#include <Kernel/VM/PageCache.h>
 #include <LibC/errno_numbers.h>
 
 //#define EXT2_DEBUG
 
+// Regular files that grow get this many blocks reserved after their last one.
+#define EXT2_PREALLOCATION_BLOCK_COUNT 16
+
 namespace Kernel {
 
 static const size_t max_link_count = 65535;
@@ -226,7 +233,10 @@ bool Ext2FS::write_block_list_for_inode(InodeIndex inode_index, ext2_inode& e2in
 
     Vector<BlockIndex> new_meta_blocks;
     if (new_shape.meta_blocks > old_shape.meta_blocks) {
-        new_meta_blocks = allocate_blocks(group_index_from_inode(inode_index), new_shape.meta_blocks - old_shape.meta_blocks);
+        auto blocks_or_error = allocate_blocks(group_index_from_inode(inode_index), new_shape.meta_blocks - old_shape.meta_blocks);
+        if (blocks_or_error.is_error())
+            return false;
+        new_meta_blocks = blocks_or_error.release_value();
     }
 
     e2inode.i_blocks = (blocks.size() + new_shape.meta_blocks) * (block_size() / 512);
@@ -488,6 +498,151 @@ Vector<Ext2FS::BlockIndex> Ext2FS::block_list_for_inode_impl(const ext2_inode& e
     return list;
 }
 
+void Ext2FS::read_block_pointers(const ext2_inode& e2inode, unsigned first_block, unsigned count, Vector<BlockIndex>& out) const
+{
+    LOCKER(m_lock);
+    const unsigned entries_per_block = EXT2_ADDR_PER_BLOCK(&super_block());
+    unsigned end = first_block + count;
+    out.ensure_capacity(out.size() + count);
+
+    for (; first_block < end && first_block < EXT2_NDIR_BLOCKS; ++first_block)
+        out.unchecked_append(e2inode.i_block[first_block]);
+
+    // Then the singly, doubly and triply indirect blocks, each covering entries_per_block times as many blocks as the one before.
+    unsigned level_start = EXT2_NDIR_BLOCKS;
+    unsigned level_size = entries_per_block;
+    for (unsigned depth = 1; depth <= 3 && first_block < end; ++depth) {
+        unsigned level_end = level_start + level_size;
+        if (first_block < level_end) {
+            unsigned count_in_level = min(end, level_end) - first_block;
+            read_block_pointers_below(e2inode.i_block[EXT2_IND_BLOCK + depth - 1], depth, first_block - level_start, count_in_level, out);
+            first_block += count_in_level;
+        }
+        level_start = level_end;
+        level_size *= entries_per_block;
+    }
+    ASSERT(first_block == end);
+}
+
+void Ext2FS::read_block_pointers_below(BlockIndex array_block, unsigned depth, unsigned first_block, unsigned count, Vector<BlockIndex>& out) const
+{
+    if (!array_block) {
+        // Nothing was ever allocated below here.
+        for (unsigned i = 0; i < count; ++i)
+            out.append(0);
+        return;
+    }
+
+    const unsigned entries_per_block = EXT2_ADDR_PER_BLOCK(&super_block());
+    unsigned blocks_per_entry = 1;
+    for (unsigned i = 1; i < depth; ++i)
+        blocks_per_entry *= entries_per_block;
+
+    unsigned first_entry = first_block / blocks_per_entry;
+    unsigned last_entry = (first_block + count - 1) / blocks_per_entry;
+    unsigned entry_count = last_entry - first_entry + 1;
+    auto entries = ByteBuffer::create_uninitialized(entry_count * sizeof(u32));
+    read_block(array_block, entries.data(), entries.size(), first_entry * sizeof(u32));
+    auto* pointers = reinterpret_cast<const u32*>(entries.data());
+
+    for (unsigned i = 0; i < entry_count; ++i) {
+        if (depth == 1) {
+            out.append(pointers[i]);
+            continue;
+        }
+        unsigned entry_first = i == 0 ? first_block % blocks_per_entry : 0;
+        unsigned entry_end = i == entry_count - 1 ? (first_block + count - 1) % blocks_per_entry + 1 : blocks_per_entry;
+        read_block_pointers_below(pointers[i], depth - 1, entry_first, entry_end - entry_first, out);
+    }
+}
+
+bool Ext2FS::append_blocks_to_inode(InodeIndex inode_index, ext2_inode& e2inode, unsigned old_block_count, const Vector<BlockIndex>& blocks)
+{
+    LOCKER(m_lock);
+
+    auto old_shape = compute_block_list_shape(old_block_count);
+    auto new_shape = compute_block_list_shape(old_block_count + blocks.size());
+
+    Vector<BlockIndex> new_meta_blocks;
+    if (new_shape.meta_blocks > old_shape.meta_blocks) {
+        auto blocks_or_error = allocate_blocks(group_index_from_inode(inode_index), new_shape.meta_blocks - old_shape.meta_blocks);
+        if (blocks_or_error.is_error())
+            return false;
+        new_meta_blocks = blocks_or_error.release_value();
+    }
+
+    auto zeroed_block = ByteBuffer::create_zeroed(block_size());
+    Function<BlockIndex()> take_new_array_block = [&]() -> BlockIndex {
+        if (new_meta_blocks.is_empty()) {
+            auto blocks_or_error = allocate_blocks(group_index_from_inode(inode_index), 1);
+            if (blocks_or_error.is_error())
+                return 0;
+            new_meta_blocks = blocks_or_error.release_value();
+        }
+        auto block_index = new_meta_blocks.take_last();
+        write_block(block_index, zeroed_block.data(), block_size());
+        return block_index;
+    };
+
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        if (!set_block_pointer(e2inode, old_block_count + i, blocks[i], take_new_array_block))
+            return false;
+    }
+
+    // Arrays left over from an earlier shrink were reused, so we may not have needed all of the new ones.
+    for (auto block_index : new_meta_blocks)
+        set_block_allocation_state(block_index, false);
+
+    e2inode.i_blocks = (old_block_count + blocks.size() + new_shape.meta_blocks) * (block_size() / 512);
+    return write_ext2_inode(inode_index, e2inode);
+}
+
+bool Ext2FS::set_block_pointer(ext2_inode& e2inode, unsigned logical_index, BlockIndex block_index, Function<BlockIndex()>& take_new_array_block)
+{
+    ASSERT(m_lock.is_locked());
+    if (logical_index < EXT2_NDIR_BLOCKS) {
+        e2inode.i_block[logical_index] = block_index;
+        return true;
+    }
+
+    // Find out which tree the block is in, and where in that tree.
+    const unsigned entries_per_block = EXT2_ADDR_PER_BLOCK(&super_block());
+    logical_index -= EXT2_NDIR_BLOCKS;
+    unsigned depth = 1;
+    unsigned blocks_in_tree = entries_per_block;
+    while (logical_index >= blocks_in_tree) {
+        logical_index -= blocks_in_tree;
+        blocks_in_tree *= entries_per_block;
+        ++depth;
+        ASSERT(depth <= 3);
+    }
+
+    // Walk down to the array that holds the pointer, filling in missing arrays on the way.
+    auto& root = e2inode.i_block[EXT2_IND_BLOCK + depth - 1];
+    if (!root)
+        root = take_new_array_block();
+    BlockIndex array_block = root;
+    unsigned blocks_per_entry = blocks_in_tree;
+    for (unsigned level = depth; level > 1; --level) {
+        if (!array_block)
+            return false;
+        blocks_per_entry /= entries_per_block;
+        unsigned entry = logical_index / blocks_per_entry;
+        logical_index %= blocks_per_entry;
+        u32 child = 0;
+        read_block(array_block, reinterpret_cast<u8*>(&child), sizeof(child), entry * sizeof(u32));
+        if (!child) {
+            child = take_new_array_block();
+            write_block(array_block, reinterpret_cast<const u8*>(&child), sizeof(child), entry * sizeof(u32));
+        }
+        array_block = child;
+    }
+    if (!array_block)
+        return false;
+    u32 pointer = block_index;
+    return write_block(array_block, reinterpret_cast<const u8*>(&pointer), sizeof(pointer), logical_index * sizeof(u32));
+}
+
 void Ext2FS::free_inode(Ext2FSInode& inode)
 {
     LOCKER(m_lock);
@@ -527,7 +682,39 @@ void Ext2FS::flush_block_group_descriptor_table()
     write_blocks(first_block_of_bgdt, blocks_to_write, (const u8*)block_group_descriptors());
 }
 
-void Ext2FS::flush_writes()
+void Ext2FS::flush_page_caches(bool only_expired)
+{
+    struct DirtyInode {
+        RefPtr<Ext2FSInode> inode;
+        u64 dirty_since { 0 };
+    };
+    Vector<DirtyInode> dirty_inodes;
+    {
+        LOCKER(m_lock);
+        for (auto& it : m_inode_cache) {
+            if (!it.value)
+                continue;
+            auto* page_cache = it.value->existing_page_cache();
+            if (!page_cache || !page_cache->dirty_page_count())
+                continue;
+            dirty_inodes.append({ it.value, page_cache->dirty_since() });
+        }
+    }
+    // Oldest first, that's what goes when we're only writing back until we're under the background ratio.
+    quick_sort(dirty_inodes, [](auto& a, auto& b) { return a.dirty_since < b.dirty_since; });
+    for (auto& dirty_inode : dirty_inodes) {
+        if (only_expired && !WritebackTask::is_expired(dirty_inode.dirty_since)) {
+            // Everything after this is newer still, so only keep going while there's too much dirty data.
+            if (!PageCache::dirty_pages_exceed(WritebackTask::dirty_background_percent))
+                break;
+        }
+        auto result = dirty_inode.inode->page_cache().flush();
+        if (result.is_error())
+            dbg() << "Ext2FS: Failed to flush page cache of inode " << dirty_inode.inode->identifier() << ": " << result.error();
+    }
+}
+
+void Ext2FS::flush_metadata_to_cache()
 {
     LOCKER(m_lock);
     if (m_super_block_dirty) {
@@ -538,7 +725,8 @@ void Ext2FS::flush_writes()
         flush_block_group_descriptor_table();
         m_block_group_descriptors_dirty = false;
     }
-    for (auto& cached_bitmap : m_cached_bitmaps) {
+    for (auto& it : m_cached_bitmaps) {
+        auto& cached_bitmap = it.value;
         if (cached_bitmap->dirty) {
             write_block(cached_bitmap->bitmap_block_index, cached_bitmap->buffer.data(), block_size());
             cached_bitmap->dirty = false;
@@ -547,9 +735,11 @@ void Ext2FS::flush_writes()
 #endif
         }
     }
+}
 
-    FileBackedFS::flush_writes();
-
+void Ext2FS::uncache_unused_inodes()
+{
+    LOCKER(m_lock);
     // Uncache Inodes that are only kept alive by the index-to-inode lookup cache.
     // We don't uncache Inodes that are being watched by at least one InodeWatcher.
 
@@ -568,6 +758,27 @@ void Ext2FS::flush_writes()
         uncache_inode(index);
 }
 
+void Ext2FS::flush_writes()
+{
+    // Writing back file data takes the inode lock before ours, so do it before locking.
+    flush_page_caches();
+
+    LOCKER(m_lock);
+    flush_metadata_to_cache();
+    FileBackedFS::flush_writes();
+    uncache_unused_inodes();
+}
+
+void Ext2FS::write_back()
+{
+    flush_page_caches(true);
+
+    LOCKER(m_lock);
+    flush_metadata_to_cache();
+    FileBackedFS::write_back();
+    uncache_unused_inodes();
+}
+
 Ext2FSInode::Ext2FSInode(Ext2FS& fs, unsigned index)
     : Inode(fs, index)
 {
@@ -575,8 +786,164 @@ Ext2FSInode::Ext2FSInode(Ext2FS& fs, unsigned index)
 
 Ext2FSInode::~Ext2FSInode()
 {
-    if (m_raw_inode.i_links_count == 0)
+    fs().discard_preallocation(*this);
+    if (m_raw_inode.i_links_count == 0) {
         fs().free_inode(*this);
+        return;
+    }
+    if (auto* page_cache = existing_page_cache()) {
+        auto result = page_cache->flush();
+        if (result.is_error())
+            dbg() << "Ext2FS: Failed to flush page cache of inode " << identifier() << ": " << result.error();
+    }
+}
+
+bool Ext2FSInode::uses_page_cache() const
+{
+    return Kernel::is_regular_file(m_raw_inode.i_mode) || is_directory();
+}
+
+unsigned Ext2FSInode::block_count() const
+{
+    // Short symbolic links live in the i_block array, and have no blocks at all.
+    if (is_symlink() && m_raw_inode.i_blocks == 0)
+        return 0;
+    return ceil_div(static_cast<size_t>(m_raw_inode.i_size), fs().block_size());
+}
+
+void Ext2FSInode::map_blocks(unsigned first_block, unsigned count) const
+{
+    LOCKER(m_lock);
+    for (auto& range : m_block_map.unmapped_ranges(first_block, count)) {
+        Vector<Ext2FS::BlockIndex> pointers;
+        fs().read_block_pointers(m_raw_inode, range.first, range.count, pointers);
+        for (unsigned i = 0; i < range.count; ++i)
+            m_block_map.add(range.first + i, pointers[i]);
+    }
+}
+
+KResult Ext2FSInode::allocate_blocks_for_holes(unsigned first_block, unsigned count)
+{
+    ASSERT(m_lock.is_locked());
+    ASSERT(fs().m_lock.is_locked());
+    map_blocks(first_block, count);
+    Vector<unsigned> holes;
+    m_block_map.for_each_run_in_range(first_block, count, [&](u32 logical_index, u32 physical_index, u32 run_length) {
+        if (physical_index)
+            return;
+        for (u32 i = 0; i < run_length; ++i)
+            holes.append(logical_index + i);
+    });
+    if (holes.is_empty())
+        return KSuccess;
+
+    auto blocks_or_error = fs().allocate_blocks(fs().group_index_from_inode(index()), holes.size());
+    if (blocks_or_error.is_error())
+        return blocks_or_error.error();
+    auto& blocks = blocks_or_error.value();
+
+    const size_t block_size = fs().block_size();
+    auto zeroed_block = ByteBuffer::create_zeroed(block_size);
+    size_t array_block_count = 0;
+    Function<Ext2FS::BlockIndex()> take_new_array_block = [&]() -> Ext2FS::BlockIndex {
+        auto array_block_or_error = fs().allocate_blocks(fs().group_index_from_inode(index()), 1);
+        if (array_block_or_error.is_error())
+            return 0;
+        auto block_index = array_block_or_error.value().first();
+        fs().write_block(block_index, zeroed_block.data(), block_size);
+        ++array_block_count;
+        return block_index;
+    };
+
+    size_t filled_count = 0;
+    for (; filled_count < holes.size(); ++filled_count) {
+        // Whatever part of the block isn't written has to keep reading as zeroes.
+        fs().write_block(blocks[filled_count], zeroed_block.data(), block_size);
+        if (!fs().set_block_pointer(m_raw_inode, holes[filled_count], blocks[filled_count], take_new_array_block))
+            break;
+    }
+    for (size_t i = filled_count; i < holes.size(); ++i)
+        fs().set_block_allocation_state(blocks[i], false);
+
+    m_raw_inode.i_blocks += (filled_count + array_block_count) * (block_size / 512);
+    fs().write_ext2_inode(index(), m_raw_inode);
+
+    // The block map still has them down as holes, read the new pointers back in.
+    m_block_map.truncate(holes.first());
+    map_blocks(first_block, count);
+
+    if (filled_count < holes.size())
+        return KResult(-ENOSPC);
+    return KSuccess;
+}
+
+KResult Ext2FSInode::read_pages_from_disk(size_t first_page_index, size_t page_count, u8* buffer) const
+{
+    Locker inode_locker(m_lock);
+    Locker fs_locker(fs().m_lock);
+
+    const size_t block_size = fs().block_size();
+    ASSERT(PAGE_SIZE % block_size == 0);
+    size_t blocks_per_page = PAGE_SIZE / block_size;
+    size_t first_block_logical_index = first_page_index * blocks_per_page;
+    size_t end_block_logical_index = min(first_block_logical_index + page_count * blocks_per_page, (size_t)block_count());
+    if (first_block_logical_index >= end_block_logical_index) {
+        memset(buffer, 0, page_count * PAGE_SIZE);
+        return KSuccess;
+    }
+
+    // Submit all the blocks at once, physically contiguous ones end up in the same request.
+    size_t block_count_to_read = end_block_logical_index - first_block_logical_index;
+    map_blocks(first_block_logical_index, block_count_to_read);
+    Vector<Ext2FS::BlockTransfer, 16> transfers;
+    m_block_map.for_each_run_in_range(first_block_logical_index, block_count_to_read, [&](u32 logical_index, u32 physical_index, u32 count) {
+        u8* out = buffer + (logical_index - first_block_logical_index) * block_size;
+        if (!physical_index) {
+            memset(out, 0, count * block_size);
+            return;
+        }
+        for (u32 i = 0; i < count; ++i)
+            transfers.append({ physical_index + i, out + i * block_size });
+    });
+    if (!fs().read_blocks_directly(transfers)) {
+        klog() << "ext2fs: read_pages_from_disk: reading " << transfers.size() << " blocks failed (first lbi: " << first_block_logical_index << ")";
+        return KResult(-EIO);
+    }
+
+    size_t nread = block_count_to_read * block_size;
+    memset(buffer + nread, 0, page_count * PAGE_SIZE - nread);
+    return KSuccess;
+}
+
+KResult Ext2FSInode::write_pages_to_disk(size_t first_page_index, size_t page_count, const u8* data)
+{
+    Locker inode_locker(m_lock);
+    Locker fs_locker(fs().m_lock);
+
+    const size_t block_size = fs().block_size();
+    ASSERT(PAGE_SIZE % block_size == 0);
+    size_t blocks_per_page = PAGE_SIZE / block_size;
+    size_t first_block_logical_index = first_page_index * blocks_per_page;
+    size_t end_block_logical_index = min(first_block_logical_index + page_count * blocks_per_page, (size_t)block_count());
+    if (first_block_logical_index >= end_block_logical_index)
+        return KSuccess;
+
+    size_t block_count_to_write = end_block_logical_index - first_block_logical_index;
+    auto result = allocate_blocks_for_holes(first_block_logical_index, block_count_to_write);
+    if (result.is_error())
+        return result;
+    Vector<Ext2FS::BlockTransfer, 16> transfers;
+    m_block_map.for_each_run_in_range(first_block_logical_index, block_count_to_write, [&](u32 logical_index, u32 physical_index, u32 count) {
+        ASSERT(physical_index);
+        u8* in = const_cast<u8*>(data) + (logical_index - first_block_logical_index) * block_size;
+        for (u32 i = 0; i < count; ++i)
+            transfers.append({ physical_index + i, in + i * block_size });
+    });
+    if (!fs().write_blocks_directly(transfers)) {
+        dbg() << "Ext2FS: write_pages_to_disk: writing " << transfers.size() << " blocks failed (first lbi: " << first_block_logical_index << ")";
+        return KResult(-EIO);
+    }
+    return KSuccess;
 }
 
 InodeMetadata Ext2FSInode::metadata() const
@@ -613,13 +980,6 @@ void Ext2FSInode::flush_metadata()
     dbg() << "Ext2FS: flush_metadata for inode " << identifier();
 #endif
     fs().write_ext2_inode(index(), m_raw_inode);
-    if (is_directory()) {
-        // Unless we're about to go away permanently, invalidate the lookup cache.
-        if (m_raw_inode.i_links_count != 0) {
-            // FIXME: This invalidation is way too hardcore. It's sad to throw away the whole cache.
-            m_lookup_cache.clear();
-        }
-    }
     set_metadata_dirty(false);
 }
 
@@ -666,49 +1026,74 @@ ssize_t Ext2FSInode::read_bytes(off_t offset, ssize_t count, u8* buffer, FileDes
         return nread;
     }
 
-    Locker fs_locker(fs().m_lock);
+    bool allow_cache = !description || !description->is_direct();
+
+    if (uses_page_cache()) {
+        if (allow_cache) {
+            if (static_cast<size_t>(offset) >= size())
+                return 0;
+            return page_cache().read(offset, min((off_t)count, (off_t)size() - offset), buffer);
+        }
+        // O_DIRECT reads go straight to the disk, so it has to have our latest writes.
+        if (auto* page_cache = existing_page_cache()) {
+            auto result = page_cache->flush();
+            if (result.is_error())
+                return result;
+        }
+    }
 
-    if (m_block_list.is_empty())
-        m_block_list = fs().block_list_for_inode(m_raw_inode);
+    Locker fs_locker(fs().m_lock);
 
-    if (m_block_list.is_empty()) {
+    if (!block_count()) {
         klog() << "ext2fs: read_bytes: empty block list for inode " << index();
         return -EIO;
     }
+    if (static_cast<size_t>(offset) >= size())
+        return 0;
 
-    bool allow_cache = !description || !description->is_direct();
-
-    const int block_size = fs().block_size();
+    const size_t block_size = fs().block_size();
 
+    size_t remaining_count = min((off_t)count, (off_t)size() - offset);
     size_t first_block_logical_index = offset / block_size;
-    size_t last_block_logical_index = (offset + count) / block_size;
-    if (last_block_logical_index >= m_block_list.size())
-        last_block_logical_index = m_block_list.size() - 1;
-
-    int offset_into_first_block = offset % block_size;
+    size_t end_block_logical_index = ceil_div(offset + remaining_count, block_size);
+    size_t offset_into_first_block = offset % block_size;
 
     ssize_t nread = 0;
-    size_t remaining_count = min((off_t)count, (off_t)size() - offset);
     u8* out = buffer;
 
 #ifdef EXT2_DEBUG
     dbg() << "Ext2FS: Reading up to " << count << " bytes " << offset << " bytes into inode " << identifier() << " to " << (const void*)buffer;
 #endif
 
-    for (size_t bi = first_block_logical_index; remaining_count && bi <= last_block_logical_index; ++bi) {
-        auto block_index = m_block_list[bi];
-        ASSERT(block_index);
-        size_t offset_into_block = (bi == first_block_logical_index) ? offset_into_first_block : 0;
-        size_t num_bytes_to_copy = min(block_size - offset_into_block, remaining_count);
-        bool success = fs().read_block(block_index, out, num_bytes_to_copy, offset_into_block, allow_cache);
-        if (!success) {
-            klog() << "ext2fs: read_bytes: read_block(" << block_index << ") failed (lbi: " << bi << ")";
-            return -EIO;
+    map_blocks(first_block_logical_index, end_block_logical_index - first_block_logical_index);
+
+    // Whole blocks that are contiguous on disk are read with a single request.
+    bool success = true;
+    m_block_map.for_each_run_in_range(first_block_logical_index, end_block_logical_index - first_block_logical_index, [&](u32 logical_index, u32 physical_index, u32 run_length) {
+        for (u32 i = 0; success && i < run_length;) {
+            size_t bi = logical_index + i;
+            size_t offset_into_block = (bi == first_block_logical_index) ? offset_into_first_block : 0;
+            size_t whole_blocks = offset_into_block ? 0 : min((size_t)(run_length - i), remaining_count / block_size);
+            size_t num_bytes_to_copy = whole_blocks ? whole_blocks * block_size : min(block_size - offset_into_block, remaining_count);
+            if (!physical_index) {
+                memset(out, 0, num_bytes_to_copy);
+            } else if (whole_blocks) {
+                success = fs().read_blocks(physical_index + i, whole_blocks, out, allow_cache);
+            } else {
+                success = fs().read_block(physical_index + i, out, num_bytes_to_copy, offset_into_block, allow_cache);
+            }
+            if (!success) {
+                klog() << "ext2fs: read_bytes: reading block " << (physical_index + i) << " failed (lbi: " << bi << ")";
+                break;
+            }
+            i += whole_blocks ? whole_blocks : 1;
+            remaining_count -= num_bytes_to_copy;
+            nread += num_bytes_to_copy;
+            out += num_bytes_to_copy;
         }
-        remaining_count -= num_bytes_to_copy;
-        nread += num_bytes_to_copy;
-        out += num_bytes_to_copy;
-    }
+    });
+    if (!success)
+        return -EIO;
 
     return nread;
 }
@@ -730,36 +1115,47 @@ KResult Ext2FSInode::resize(u64 new_size)
 
     if (blocks_needed_after > blocks_needed_before) {
         u32 additional_blocks_needed = blocks_needed_after - blocks_needed_before;
-        if (additional_blocks_needed > fs().super_block().s_free_blocks_count)
+        if (additional_blocks_needed > fs().super_block().s_free_blocks_count + m_preallocated_count)
             return KResult(-ENOSPC);
     }
 
-    auto block_list = fs().block_list_for_inode(m_raw_inode);
+    // Drop the cached pages past the new end first, so they can't be written back into freed blocks.
+    if (uses_page_cache())
+        page_cache().resize(new_size);
+
     if (blocks_needed_after > blocks_needed_before) {
-        auto new_blocks = fs().allocate_blocks(fs().group_index_from_inode(index()), blocks_needed_after - blocks_needed_before);
-        block_list.append(move(new_blocks));
+        // Growing only has to fill in the new pointers, we don't need the whole block list for that.
+        auto blocks_or_error = fs().allocate_blocks_for_inode(*this, blocks_needed_after - blocks_needed_before);
+        if (blocks_or_error.is_error())
+            return blocks_or_error.error();
+        auto new_blocks = blocks_or_error.release_value();
+        if (!fs().append_blocks_to_inode(index(), m_raw_inode, blocks_needed_before, new_blocks))
+            return KResult(-EIO);
+        for (size_t i = 0; i < new_blocks.size(); ++i)
+            m_block_map.add(blocks_needed_before + i, new_blocks[i]);
     } else if (blocks_needed_after < blocks_needed_before) {
+        fs().discard_preallocation(*this);
+        auto block_list = fs().block_list_for_inode(m_raw_inode);
 #ifdef EXT2_DEBUG
         dbg() << "Ext2FS: Shrinking inode " << identifier() << ". Old block list is " << block_list.size() << " entries:";
         for (auto block_index : block_list) {
             dbg() << "    # " << block_index;
         }
 #endif
-        while (block_list.size() != blocks_needed_after) {
+        while (block_list.size() > blocks_needed_after) {
             auto block_index = block_list.take_last();
             if (block_index)
                 fs().set_block_allocation_state(block_index, false);
         }
-    }
 
-    bool success = fs().write_block_list_for_inode(index(), m_raw_inode, block_list);
-    if (!success)
-        return KResult(-EIO);
+        bool success = fs().write_block_list_for_inode(index(), m_raw_inode, block_list);
+        if (!success)
+            return KResult(-EIO);
+        m_block_map.truncate(blocks_needed_after);
+    }
 
     m_raw_inode.i_size = new_size;
     set_metadata_dirty(true);
-
-    m_block_list = move(block_list);
     return KSuccess;
 }
 
@@ -799,48 +1195,70 @@ ssize_t Ext2FSInode::write_bytes(off_t offset, ssize_t count, const u8* data, Fi
     if (resize_result.is_error())
         return resize_result;
 
-    if (m_block_list.is_empty())
-        m_block_list = fs().block_list_for_inode(m_raw_inode);
+    if (uses_page_cache()) {
+        // O_DIRECT writes go through the page cache too, so mappings of the file see them,
+        // but are written back before we return.
+        ssize_t nwritten = page_cache().write(offset, count, data);
+        if (nwritten > 0 && !allow_cache) {
+            auto result = page_cache().flush();
+            if (result.is_error())
+                return result;
+        }
+        if (old_size != new_size)
+            inode_size_changed(old_size, new_size);
+        return nwritten;
+    }
 
-    if (m_block_list.is_empty()) {
+    if (!block_count()) {
         dbg() << "Ext2FSInode::write_bytes(): empty block list for inode " << index();
         return -EIO;
     }
 
+    size_t remaining_count = min((off_t)count, (off_t)new_size - offset);
     size_t first_block_logical_index = offset / block_size;
-    size_t last_block_logical_index = (offset + count) / block_size;
-    if (last_block_logical_index >= m_block_list.size())
-        last_block_logical_index = m_block_list.size() - 1;
-
+    size_t end_block_logical_index = ceil_div(offset + remaining_count, block_size);
     size_t offset_into_first_block = offset % block_size;
 
     ssize_t nwritten = 0;
-    size_t remaining_count = min((off_t)count, (off_t)new_size - offset);
     const u8* in = data;
 
 #ifdef EXT2_DEBUG
     dbg() << "Ext2FS: Writing " << count << " bytes " << offset << " bytes into inode " << identifier() << " from " << (const void*)data;
 #endif
 
-    for (size_t bi = first_block_logical_index; remaining_count && bi <= last_block_logical_index; ++bi) {
-        size_t offset_into_block = (bi == first_block_logical_index) ? offset_into_first_block : 0;
-        size_t num_bytes_to_copy = min(block_size - offset_into_block, remaining_count);
+    result = allocate_blocks_for_holes(first_block_logical_index, end_block_logical_index - first_block_logical_index);
+    if (result.is_error())
+        return result;
+
+    // Whole blocks that are contiguous on disk are written with a single request.
+    m_block_map.for_each_run_in_range(first_block_logical_index, end_block_logical_index - first_block_logical_index, [&](u32 logical_index, u32 physical_index, u32 run_length) {
+        ASSERT(physical_index);
+        for (u32 i = 0; i < run_length;) {
+            size_t bi = logical_index + i;
+            size_t offset_into_block = (bi == first_block_logical_index) ? offset_into_first_block : 0;
+            size_t whole_blocks = offset_into_block ? 0 : min((size_t)(run_length - i), remaining_count / block_size);
+            size_t num_bytes_to_copy = whole_blocks ? whole_blocks * block_size : min(block_size - offset_into_block, remaining_count);
 #ifdef EXT2_DEBUG
-        dbg() << "Ext2FS: Writing block " << m_block_list[bi] << " (offset_into_block: " << offset_into_block << ")";
+            dbg() << "Ext2FS: Writing block " << (physical_index + i) << " (offset_into_block: " << offset_into_block << ", bytes: " << num_bytes_to_copy << ")";
 #endif
-        bool success = fs().write_block(m_block_list[bi], in, num_bytes_to_copy, offset_into_block, allow_cache);
-        if (!success) {
-            dbg() << "Ext2FS: write_block(" << m_block_list[bi] << ") failed (bi: " << bi << ")";
-            ASSERT_NOT_REACHED();
-            return -EIO;
+            bool success;
+            if (whole_blocks)
+                success = fs().write_blocks(physical_index + i, whole_blocks, in, allow_cache);
+            else
+                success = fs().write_block(physical_index + i, in, num_bytes_to_copy, offset_into_block, allow_cache);
+            if (!success) {
+                dbg() << "Ext2FS: writing block " << (physical_index + i) << " failed (bi: " << bi << ")";
+                ASSERT_NOT_REACHED();
+            }
+            i += whole_blocks ? whole_blocks : 1;
+            remaining_count -= num_bytes_to_copy;
+            nwritten += num_bytes_to_copy;
+            in += num_bytes_to_copy;
         }
-        remaining_count -= num_bytes_to_copy;
-        nwritten += num_bytes_to_copy;
-        in += num_bytes_to_copy;
-    }
+    });
 
 #ifdef EXT2_DEBUG
-    dbg() << "Ext2FS: After write, i_size=" << m_raw_inode.i_size << ", i_blocks=" << m_raw_inode.i_blocks << " (" << m_block_list.size() << " blocks in list)";
+    dbg() << "Ext2FS: After write, i_size=" << m_raw_inode.i_size << ", i_blocks=" << m_raw_inode.i_blocks << " (" << m_block_map.extent_count() << " extents in block map)";
 #endif
 
     if (old_size != new_size)
@@ -849,6 +1267,572 @@ ssize_t Ext2FSInode::write_bytes(off_t offset, ssize_t count, const u8* data, Fi
     return nwritten;
 }
 
+// The first two entries in the root block of an indexed directory are "." and "..",
+// with ".." spanning the rest of the block. The index itself lives behind them.
+static constexpr size_t dx_root_info_offset = 24;
+// Other index blocks start with an empty entry that spans the whole block.
+static constexpr size_t dx_node_entries_offset = 8;
+
+struct Ext2FSInode::DirectoryIndexFrame {
+    unsigned block_index { 0 };
+    ByteBuffer block;
+    size_t entries_offset { 0 };
+    size_t position { 0 };
+
+    ext2_dx_countlimit& countlimit() { return *reinterpret_cast<ext2_dx_countlimit*>(block.data() + entries_offset); }
+    ext2_dx_entry* entries() { return reinterpret_cast<ext2_dx_entry*>(block.data() + entries_offset); }
+    ext2_dx_entry& current_entry() { return entries()[position]; }
+
+    void insert_entry(size_t index, u32 hash, u32 block)
+    {
+        auto& count = countlimit().count;
+        ASSERT(count < countlimit().limit);
+        auto* entries = this->entries();
+        memmove(&entries[index + 1], &entries[index], (count - index) * sizeof(ext2_dx_entry));
+        entries[index].block = block;
+        entries[index].hash = hash;
+        ++count;
+    }
+};
+
+struct DirectoryEntryRecord {
+    String name;
+    unsigned inode { 0 };
+    u8 file_type { 0 };
+    u32 hash { 0 };
+};
+
+static ext2_dir_entry_2& directory_entry_at(ByteBuffer& block, size_t offset)
+{
+    return *reinterpret_cast<ext2_dir_entry_2*>(block.data() + offset);
+}
+
+static void write_directory_entry(ByteBuffer& block, size_t offset, const StringView& name, unsigned inode, u8 file_type, u16 record_length)
+{
+    auto& entry = directory_entry_at(block, offset);
+    entry.inode = inode;
+    entry.rec_len = record_length;
+    entry.name_len = name.length();
+    entry.file_type = file_type;
+    if (!name.is_empty())
+        memcpy(entry.name, name.characters_without_null_termination(), name.length());
+}
+
+template<typename Callback>
+static void for_each_directory_entry_in_block(const ByteBuffer& block, Callback callback)
+{
+    size_t offset = 0;
+    while (offset + 8 <= block.size()) {
+        auto& entry = *reinterpret_cast<const ext2_dir_entry_2*>(block.data() + offset);
+        // Don't loop forever on a corrupted block.
+        if (entry.rec_len < 8 || offset + entry.rec_len > block.size())
+            return;
+        if (callback(offset, entry) == IterationDecision::Break)
+            return;
+        offset += entry.rec_len;
+    }
+}
+
+static Optional<size_t> find_directory_entry_in_block(const ByteBuffer& block, const StringView& name)
+{
+    Optional<size_t> found_offset;
+    for_each_directory_entry_in_block(block, [&](size_t offset, auto& entry) {
+        if (entry.inode && StringView(entry.name, entry.name_len) == name) {
+            found_offset = offset;
+            return IterationDecision::Break;
+        }
+        return IterationDecision::Continue;
+    });
+    return found_offset;
+}
+
+// Puts a new entry in the first gap that's big enough for it, splitting the entry that owns the gap.
+static bool insert_directory_entry_into_block(ByteBuffer& block, const StringView& name, unsigned inode, u8 file_type)
+{
+    size_t needed_length = EXT2_DIR_REC_LEN(name.length());
+    bool inserted = false;
+    for_each_directory_entry_in_block(block, [&](size_t offset, auto& entry) {
+        size_t used_length = entry.inode ? EXT2_DIR_REC_LEN(entry.name_len) : 0;
+        if (entry.rec_len - used_length < needed_length)
+            return IterationDecision::Continue;
+        if (!used_length) {
+            write_directory_entry(block, offset, name, inode, file_type, entry.rec_len);
+        } else {
+            u16 remaining_length = entry.rec_len - used_length;
+            directory_entry_at(block, offset).rec_len = used_length;
+            write_directory_entry(block, offset + used_length, name, inode, file_type, remaining_length);
+        }
+        inserted = true;
+        return IterationDecision::Break;
+    });
+    return inserted;
+}
+
+static void pack_directory_entries_into_block(ByteBuffer& block, const DirectoryEntryRecord* records, size_t count)
+{
+    memset(block.data(), 0, block.size());
+    if (!count) {
+        write_directory_entry(block, 0, {}, 0, 0, block.size());
+        return;
+    }
+    size_t offset = 0;
+    for (size_t i = 0; i < count; ++i) {
+        auto& record = records[i];
+        size_t record_length = i == count - 1 ? block.size() - offset : EXT2_DIR_REC_LEN(record.name.length());
+        write_directory_entry(block, offset, record.name, record.inode, record.file_type, record_length);
+        offset += record_length;
+    }
+}
+
+bool Ext2FSInode::is_indexed_directory() const
+{
+    if (!(m_raw_inode.i_flags & EXT2_INDEX_FL))
+        return false;
+    return fs().super_block().s_feature_compat & EXT2_FEATURE_COMPAT_DIR_INDEX;
+}
+
+u8 Ext2FSInode::directory_hash_version(u8 root_hash_version) const
+{
+    if (root_hash_version <= EXT2_HASH_TEA && (fs().super_block().s_flags & EXT2_FLAGS_UNSIGNED_HASH))
+        return root_hash_version + EXT2_HASH_LEGACY_UNSIGNED;
+    return root_hash_version;
+}
+
+KResult Ext2FSInode::read_directory_block(unsigned block_index, ByteBuffer& buffer) const
+{
+    auto block_size = fs().block_size();
+    buffer = ByteBuffer::create_uninitialized(block_size);
+    ssize_t nread = read_bytes(block_index * block_size, block_size, buffer.data(), nullptr);
+    if (nread < 0)
+        return KResult(nread);
+    if (static_cast<size_t>(nread) != block_size)
+        return KResult(-EIO);
+    return KSuccess;
+}
+
+KResult Ext2FSInode::write_directory_block(unsigned block_index, const ByteBuffer& buffer)
+{
+    auto block_size = fs().block_size();
+    ASSERT(buffer.size() == block_size);
+    ssize_t nwritten = write_bytes(block_index * block_size, block_size, buffer.data(), nullptr);
+    if (nwritten < 0)
+        return KResult(nwritten);
+    if (static_cast<size_t>(nwritten) != block_size)
+        return KResult(-EIO);
+    return KSuccess;
+}
+
+KResultOr<unsigned> Ext2FSInode::append_directory_block(const ByteBuffer& buffer)
+{
+    unsigned block_index = block_count();
+    auto result = write_directory_block(block_index, buffer);
+    if (result.is_error())
+        return result;
+    set_metadata_dirty(true);
+    return block_index;
+}
+
+KResultOr<u32> Ext2FSInode::find_directory_index_path(const StringView& name, Vector<DirectoryIndexFrame, 2>& frames) const
+{
+    frames.clear();
+
+    ByteBuffer root;
+    auto result = read_directory_block(0, root);
+    if (result.is_error())
+        return result;
+
+    auto& info = *reinterpret_cast<const ext2_dx_root_info*>(root.data() + dx_root_info_offset);
+    u8 hash_version = directory_hash_version(info.hash_version);
+    // We only know indexes with one level of index blocks below the root, like ext3.
+    if (info.reserved_zero || info.info_length != 8 || info.indirect_levels > 1 || hash_version > EXT2_HASH_TEA_UNSIGNED) {
+        dbg() << "Ext2FS: Bad directory index root in inode " << identifier();
+        return KResult(-EIO);
+    }
+    u32 hash = ext2_directory_hash(name, hash_version, fs().super_block().s_hash_seed);
+
+    auto block_size = fs().block_size();
+    DirectoryIndexFrame frame { 0, move(root), dx_root_info_offset + info.info_length, 0 };
+    for (unsigned level = 0; level <= info.indirect_levels; ++level) {
+        size_t expected_limit = (block_size - frame.entries_offset) / sizeof(ext2_dx_entry);
+        auto count = frame.countlimit().count;
+        if (!count || count > frame.countlimit().limit || frame.countlimit().limit != expected_limit) {
+            dbg() << "Ext2FS: Bad directory index block " << frame.block_index << " in inode " << identifier();
+            return KResult(-EIO);
+        }
+
+        // The first entry has no hash, it covers everything below the second one.
+        auto* entries = frame.entries();
+        size_t low = 1;
+        size_t high = count;
+        while (low < high) {
+            size_t middle = low + (high - low) / 2;
+            if (entries[middle].hash > hash)
+                high = middle;
+            else
+                low = middle + 1;
+        }
+        frame.position = low - 1;
+
+        unsigned child_block_index = frame.current_entry().block;
+        frames.append(move(frame));
+        if (level == info.indirect_levels)
+            break;
+
+        frame = { child_block_index, {}, dx_node_entries_offset, 0 };
+        result = read_directory_block(child_block_index, frame.block);
+        if (result.is_error())
+            return result;
+    }
+    return hash;
+}
+
+// Moves on to the next leaf block if the entries with the given hash continue there.
+bool Ext2FSInode::advance_directory_index_path(u32 hash, Vector<DirectoryIndexFrame, 2>& frames) const
+{
+    size_t level = frames.size() - 1;
+    for (;;) {
+        auto& frame = frames[level];
+        if (++frame.position < frame.countlimit().count)
+            break;
+        if (level == 0)
+            return false;
+        --level;
+    }
+
+    // The low bit of an index hash says that the block continues the previous one.
+    u32 next_hash = frames[level].current_entry().hash;
+    if ((next_hash & ~1u) != hash)
+        return false;
+
+    for (++level; level < frames.size(); ++level) {
+        auto& frame = frames[level];
+        frame.block_index = frames[level - 1].current_entry().block;
+        frame.position = 0;
+        if (read_directory_block(frame.block_index, frame.block).is_error())
+            return false;
+    }
+    return true;
+}
+
+KResultOr<Ext2FSInode::DirectoryEntryLocation> Ext2FSInode::find_directory_entry(const StringView& name) const
+{
+    auto find_in_block = [&](unsigned block_index) -> KResultOr<Optional<DirectoryEntryLocation>> {
+        ByteBuffer block;
+        auto result = read_directory_block(block_index, block);
+        if (result.is_error())
+            return result;
+        auto offset = find_directory_entry_in_block(block, name);
+        if (!offset.has_value())
+            return Optional<DirectoryEntryLocation> {};
+        return Optional<DirectoryEntryLocation>(DirectoryEntryLocation { block_index, offset.value(), directory_entry_at(block, offset.value()).inode });
+    };
+
+    // "." and ".." are always in the first block, even when it's an index root.
+    bool is_dot_or_dot_dot = name == "." || name == "..";
+    if (is_indexed_directory() && !is_dot_or_dot_dot) {
+        Vector<DirectoryIndexFrame, 2> frames;
+        auto hash_or_error = find_directory_index_path(name, frames);
+        if (hash_or_error.is_error())
+            return hash_or_error.error();
+        do {
+            auto location_or_error = find_in_block(frames.last().current_entry().block);
+            if (location_or_error.is_error())
+                return location_or_error.error();
+            if (location_or_error.value().has_value())
+                return location_or_error.value().value();
+        } while (advance_directory_index_path(hash_or_error.value(), frames));
+        return KResult(-ENOENT);
+    }
+
+    unsigned block_count = is_dot_or_dot_dot ? min(1u, this->block_count()) : this->block_count();
+    for (unsigned block_index = 0; block_index < block_count; ++block_index) {
+        auto location_or_error = find_in_block(block_index);
+        if (location_or_error.is_error())
+            return location_or_error.error();
+        if (location_or_error.value().has_value())
+            return location_or_error.value().value();
+    }
+    return KResult(-ENOENT);
+}
+
+KResult Ext2FSInode::add_directory_entry(const StringView& name, unsigned inode, u8 file_type)
+{
+    if (is_indexed_directory())
+        return add_directory_entry_to_index(name, inode, file_type);
+
+    // Without index support, the index blocks would look like empty space. Drop the index.
+    if (m_raw_inode.i_flags & EXT2_INDEX_FL) {
+        m_raw_inode.i_flags &= ~EXT2_INDEX_FL;
+        set_metadata_dirty(true);
+    }
+
+    unsigned block_count = this->block_count();
+    ByteBuffer block;
+    for (unsigned block_index = 0; block_index < block_count; ++block_index) {
+        auto result = read_directory_block(block_index, block);
+        if (result.is_error())
+            return result;
+        if (insert_directory_entry_into_block(block, name, inode, file_type))
+            return write_directory_block(block_index, block);
+    }
+
+    if (block_count == 1 && (fs().super_block().s_feature_compat & EXT2_FEATURE_COMPAT_DIR_INDEX)) {
+        auto result = make_indexed_directory();
+        if (result.is_error())
+            return result;
+        if (is_indexed_directory())
+            return add_directory_entry_to_index(name, inode, file_type);
+    }
+
+    block = ByteBuffer::create_zeroed(fs().block_size());
+    write_directory_entry(block, 0, name, inode, file_type, block.size());
+    auto block_index_or_error = append_directory_block(block);
+    if (block_index_or_error.is_error())
+        return block_index_or_error.error();
+    return KSuccess;
+}
+
+// Turns a full single block directory into an index root with one leaf block behind it.
+KResult Ext2FSInode::make_indexed_directory()
+{
+    ByteBuffer root;
+    auto result = read_directory_block(0, root);
+    if (result.is_error())
+        return result;
+
+    Vector<DirectoryEntryRecord> records;
+    unsigned dot_dot_inode = 0;
+    size_t entry_index = 0;
+    for_each_directory_entry_in_block(root, [&](size_t, auto& entry) {
+        StringView name(entry.name, entry.name_len);
+        if (entry_index == 1 && name == "..")
+            dot_dot_inode = entry.inode;
+        else if (entry_index > 1 && entry.inode)
+            records.append({ name, entry.inode, entry.file_type, 0 });
+        ++entry_index;
+        return IterationDecision::Continue;
+    });
+    if (!dot_dot_inode || directory_entry_at(root, 0).name_len != 1 || directory_entry_at(root, 0).name[0] != '.')
+        return KSuccess;
+
+    u8 hash_version = fs().super_block().s_def_hash_version;
+    if (hash_version > EXT2_HASH_TEA)
+        hash_version = EXT2_HASH_HALF_MD4;
+    for (auto& record : records)
+        record.hash = ext2_directory_hash(record.name, directory_hash_version(hash_version), fs().super_block().s_hash_seed);
+    quick_sort(records, [](auto& a, auto& b) { return a.hash < b.hash; });
+
+    auto block_size = fs().block_size();
+    auto leaf = ByteBuffer::create_zeroed(block_size);
+    pack_directory_entries_into_block(leaf, records.data(), records.size());
+    auto leaf_block_index_or_error = append_directory_block(leaf);
+    if (leaf_block_index_or_error.is_error())
+        return leaf_block_index_or_error.error();
+
+    memset(root.data(), 0, block_size);
+    write_directory_entry(root, 0, ".", index(), EXT2_FT_DIR, 12);
+    write_directory_entry(root, 12, "..", dot_dot_inode, EXT2_FT_DIR, block_size - 12);
+    auto& info = *reinterpret_cast<ext2_dx_root_info*>(root.data() + dx_root_info_offset);
+    info.hash_version = hash_version;
+    info.info_length = 8;
+    DirectoryIndexFrame frame { 0, move(root), dx_root_info_offset + 8, 0 };
+    frame.countlimit().limit = (block_size - frame.entries_offset) / sizeof(ext2_dx_entry);
+    frame.countlimit().count = 1;
+    frame.entries()[0].block = leaf_block_index_or_error.value();
+    result = write_directory_block(0, frame.block);
+    if (result.is_error())
+        return result;
+
+#ifdef EXT2_DEBUG
+    dbg() << "Ext2FS: Indexed directory " << identifier() << " with " << records.size() << " entries";
+#endif
+    m_raw_inode.i_flags |= EXT2_INDEX_FL;
+    set_metadata_dirty(true);
+    m_lookup_cache.clear();
+    return KSuccess;
+}
+
+// Makes sure the index block at the end of the path can take one more entry.
+KResult Ext2FSInode::make_room_in_directory_index(Vector<DirectoryIndexFrame, 2>& frames)
+{
+    auto block_size = fs().block_size();
+    auto& frame = frames.last();
+    if (frame.countlimit().count < frame.countlimit().limit)
+        return KSuccess;
+
+    if (frames.size() == 1) {
+        // The root is full, move its entries down into a new index block.
+        auto node = ByteBuffer::create_zeroed(block_size);
+        write_directory_entry(node, 0, {}, 0, 0, block_size);
+        DirectoryIndexFrame node_frame { 0, move(node), dx_node_entries_offset, frame.position };
+        u16 count = frame.countlimit().count;
+        memcpy(node_frame.entries(), frame.entries(), count * sizeof(ext2_dx_entry));
+        node_frame.countlimit().limit = (block_size - dx_node_entries_offset) / sizeof(ext2_dx_entry);
+        node_frame.countlimit().count = count;
+
+        auto node_block_index_or_error = append_directory_block(node_frame.block);
+        if (node_block_index_or_error.is_error())
+            return node_block_index_or_error.error();
+        node_frame.block_index = node_block_index_or_error.value();
+
+        frame.countlimit().count = 1;
+        frame.entries()[0].block = node_frame.block_index;
+        frame.position = 0;
+        reinterpret_cast<ext2_dx_root_info*>(frame.block.data() + dx_root_info_offset)->indirect_levels = 1;
+        auto result = write_directory_block(0, frame.block);
+        if (result.is_error())
+            return result;
+        frames.append(move(node_frame));
+        return KSuccess;
+    }
+
+    auto& root = frames[0];
+    if (root.countlimit().count >= root.countlimit().limit) {
+        klog() << "Ext2FS: Directory index of inode " << identifier() << " is full";
+        return KResult(-ENOSPC);
+    }
+
+    // Split the index block in half and point the root at the new half.
+    u16 count = frame.countlimit().count;
+    u16 kept_count = count / 2;
+    u32 split_hash = frame.entries()[kept_count].hash;
+    auto new_node = ByteBuffer::create_zeroed(block_size);
+    write_directory_entry(new_node, 0, {}, 0, 0, block_size);
+    DirectoryIndexFrame new_frame { 0, move(new_node), dx_node_entries_offset, 0 };
+    memcpy(new_frame.entries(), &frame.entries()[kept_count], (count - kept_count) * sizeof(ext2_dx_entry));
+    new_frame.countlimit().limit = frame.countlimit().limit;
+    new_frame.countlimit().count = count - kept_count;
+    frame.countlimit().count = kept_count;
+
+    auto new_block_index_or_error = append_directory_block(new_frame.block);
+    if (new_block_index_or_error.is_error())
+        return new_block_index_or_error.error();
+    new_frame.block_index = new_block_index_or_error.value();
+    auto result = write_directory_block(frame.block_index, frame.block);
+    if (result.is_error())
+        return result;
+
+    root.insert_entry(root.position + 1, split_hash, new_frame.block_index);
+    result = write_directory_block(0, root.block);
+    if (result.is_error())
+        return result;
+
+    if (frame.position >= kept_count) {
+        new_frame.position = frame.position - kept_count;
+        frame = move(new_frame);
+        ++root.position;
+    }
+    return KSuccess;
+}
+
+KResult Ext2FSInode::add_directory_entry_to_index(const StringView& name, unsigned inode, u8 file_type)
+{
+    Vector<DirectoryIndexFrame, 2> frames;
+    auto hash_or_error = find_directory_index_path(name, frames);
+    if (hash_or_error.is_error())
+        return hash_or_error.error();
+    u32 hash = hash_or_error.value();
+
+    unsigned leaf_block_index = frames.last().current_entry().block;
+    ByteBuffer leaf;
+    auto result = read_directory_block(leaf_block_index, leaf);
+    if (result.is_error())
+        return result;
+    if (insert_directory_entry_into_block(leaf, name, inode, file_type))
+        return write_directory_block(leaf_block_index, leaf);
+
+    // The leaf is full. Split it in two by hash, the upper half goes into a new block.
+    // The new entry is sorted in with the others, so whichever half it lands in has room for it.
+    u8 hash_version = directory_hash_version(reinterpret_cast<const ext2_dx_root_info*>(frames[0].block.data() + dx_root_info_offset)->hash_version);
+    Vector<DirectoryEntryRecord> records;
+    size_t total_length = EXT2_DIR_REC_LEN(name.length());
+    for_each_directory_entry_in_block(leaf, [&](size_t, auto& entry) {
+        if (entry.inode) {
+            StringView entry_name(entry.name, entry.name_len);
+            records.append({ entry_name, entry.inode, entry.file_type, ext2_directory_hash(entry_name, hash_version, fs().super_block().s_hash_seed) });
+            total_length += EXT2_DIR_REC_LEN(entry.name_len);
+        }
+        return IterationDecision::Continue;
+    });
+    records.append({ name, inode, file_type, hash });
+    ASSERT(records.size() >= 2);
+    quick_sort(records, [](auto& a, auto& b) { return a.hash < b.hash; });
+
+    // Take the most even split that leaves both halves fitting in a block.
+    Optional<size_t> split;
+    size_t best_imbalance = 0;
+    size_t length = 0;
+    for (size_t i = 1; i < records.size(); ++i) {
+        length += EXT2_DIR_REC_LEN(records[i - 1].name.length());
+        if (length > leaf.size())
+            break;
+        if (total_length - length > leaf.size())
+            continue;
+        size_t imbalance = length * 2 > total_length ? length * 2 - total_length : total_length - length * 2;
+        if (!split.has_value() || imbalance < best_imbalance) {
+            split = i;
+            best_imbalance = imbalance;
+        }
+    }
+    if (!split.has_value()) {
+        dbg() << "Ext2FS: Can't split directory block " << leaf_block_index << " of inode " << identifier();
+        return KResult(-ENOSPC);
+    }
+
+    result = make_room_in_directory_index(frames);
+    if (result.is_error())
+        return result;
+
+    // Names with the same hash may end up on both sides, mark the new block as a continuation.
+    u32 split_hash = records[split.value()].hash;
+    if (records[split.value() - 1].hash == split_hash)
+        split_hash |= 1;
+
+    auto new_leaf = ByteBuffer::create_zeroed(leaf.size());
+    pack_directory_entries_into_block(new_leaf, records.data() + split.value(), records.size() - split.value());
+    pack_directory_entries_into_block(leaf, records.data(), split.value());
+
+    auto new_leaf_block_index_or_error = append_directory_block(new_leaf);
+    if (new_leaf_block_index_or_error.is_error())
+        return new_leaf_block_index_or_error.error();
+    result = write_directory_block(leaf_block_index, leaf);
+    if (result.is_error())
+        return result;
+
+    auto& frame = frames.last();
+    frame.insert_entry(frame.position + 1, split_hash, new_leaf_block_index_or_error.value());
+    return write_directory_block(frame.block_index, frame.block);
+}
+
+KResult Ext2FSInode::remove_directory_entry(const DirectoryEntryLocation& location)
+{
+    ByteBuffer block;
+    auto result = read_directory_block(location.block_index, block);
+    if (result.is_error())
+        return result;
+
+    // Give the space to the entry before it, or mark it unused if it's the first in the block.
+    Optional<size_t> previous_offset;
+    bool found = false;
+    for_each_directory_entry_in_block(block, [&](size_t offset, auto&) {
+        if (offset == location.offset) {
+            found = true;
+            return IterationDecision::Break;
+        }
+        previous_offset = offset;
+        return IterationDecision::Continue;
+    });
+    if (!found)
+        return KResult(-EIO);
+
+    auto& entry = directory_entry_at(block, location.offset);
+    if (previous_offset.has_value())
+        directory_entry_at(block, previous_offset.value()).rec_len += entry.rec_len;
+    else
+        entry.inode = 0;
+    return write_directory_block(location.block_index, block);
+}
+
 KResult Ext2FSInode::traverse_as_directory(Function<bool(const FS::DirectoryEntry&)> callback) const
 {
     LOCKER(m_lock);
@@ -858,23 +1842,25 @@ KResult Ext2FSInode::traverse_as_directory(Function<bool(const FS::DirectoryEntr
     dbg() << "Ext2FS: Traversing as directory: " << identifier();
 #endif
 
-    auto buffer_or = read_entire();
-    ASSERT(!buffer_or.is_error());
-    if (buffer_or.is_error())
-        return buffer_or.error();
-
-    auto buffer = buffer_or.value();
-    auto* entry = reinterpret_cast<ext2_dir_entry_2*>(buffer.data());
-
-    while (entry < buffer.end_pointer()) {
-        if (entry->inode != 0) {
+    // Index blocks look like unused space to this, so indexed directories need no special care.
+    ByteBuffer block;
+    unsigned block_count = this->block_count();
+    for (unsigned block_index = 0; block_index < block_count; ++block_index) {
+        auto result = read_directory_block(block_index, block);
+        if (result.is_error())
+            return result;
+        bool should_continue = true;
+        for_each_directory_entry_in_block(block, [&](size_t, auto& entry) {
+            if (!entry.inode)
+                return IterationDecision::Continue;
 #ifdef EXT2_DEBUG
-            dbg() << "Ext2Inode::traverse_as_directory: " << entry->inode << ", name_len: " << entry->name_len << ", rec_len: " << entry->rec_len << ", file_type: " << entry->file_type << ", name: " << String(entry->name, entry->name_len);
+            dbg() << "Ext2Inode::traverse_as_directory: " << entry.inode << ", name_len: " << entry.name_len << ", rec_len: " << entry.rec_len << ", file_type: " << entry.file_type << ", name: " << String(entry.name, entry.name_len);
 #endif
-            if (!callback({ entry->name, entry->name_len, { fsid(), entry->inode }, entry->file_type }))
-                break;
-        }
-        entry = (ext2_dir_entry_2*)((char*)entry + entry->rec_len);
+            should_continue = callback({ entry.name, entry.name_len, { fsid(), entry.inode }, entry.file_type });
+            return should_continue ? IterationDecision::Continue : IterationDecision::Break;
+        });
+        if (!should_continue)
+            break;
     }
 
     return KSuccess;
@@ -947,35 +1933,25 @@ KResult Ext2FSInode::add_child(InodeIdentifier child_id, const StringView& name,
     dbg() << "Ext2FSInode::add_child(): Adding inode " << child_id.index() << " with name '" << name << "' and mode " << mode << " to directory " << index();
 #endif
 
-    Vector<FS::DirectoryEntry> entries;
-    bool name_already_exists = false;
-    KResult result = traverse_as_directory([&](auto& entry) {
-        if (name == entry.name) {
-            name_already_exists = true;
-            return false;
-        }
-        entries.append(entry);
-        return true;
-    });
-
-    if (result.is_error())
-        return result;
-
-    if (name_already_exists) {
+    if (find_child_index(name).has_value()) {
         dbg() << "Ext2FSInode::add_child(): Name '" << name << "' already exists in inode " << index();
         return KResult(-EEXIST);
     }
 
     auto child_inode = fs().get_inode(child_id);
     if (child_inode) {
-        result = child_inode->increment_link_count();
+        auto result = child_inode->increment_link_count();
         if (result.is_error())
             return result;
     }
 
-    entries.empend(name.characters_without_null_termination(), name.length(), child_id, to_ext2_file_type(mode));
-    bool success = write_directory(entries);
-    if (success)
+    auto result = add_directory_entry(name, child_id.index(), to_ext2_file_type(mode));
+    if (result.is_error()) {
+        if (child_inode)
+            child_inode->decrement_link_count();
+        return result;
+    }
+    if (!m_lookup_cache.is_empty())
         m_lookup_cache.set(name, child_id.index());
     return KSuccess;
 }
@@ -988,32 +1964,21 @@ KResult Ext2FSInode::remove_child(const StringView& name)
 #endif
     ASSERT(is_directory());
 
-    auto it = m_lookup_cache.find(name);
-    if (it == m_lookup_cache.end())
-        return KResult(-ENOENT);
-    auto child_inode_index = (*it).value;
+    auto location_or_error = find_directory_entry(name);
+    if (location_or_error.is_error())
+        return location_or_error.error();
+    auto& location = location_or_error.value();
 
-    InodeIdentifier child_id { fsid(), child_inode_index };
+    InodeIdentifier child_id { fsid(), location.inode };
 
 #ifdef EXT2_DEBUG
     dbg() << "Ext2FSInode::remove_child(): Removing '" << name << "' in directory " << index();
 #endif
 
-    Vector<FS::DirectoryEntry> entries;
-    KResult result = traverse_as_directory([&](auto& entry) {
-        if (name != entry.name)
-            entries.append(entry);
-        return true;
-    });
+    auto result = remove_directory_entry(location);
     if (result.is_error())
         return result;
 
-    bool success = write_directory(entries);
-    if (!success) {
-        // FIXME: Plumb error from write_directory().
-        return KResult(-EIO);
-    }
-
     m_lookup_cache.remove(name);
 
     auto child_inode = fs().get_inode(child_id);
@@ -1050,44 +2015,38 @@ bool Ext2FS::write_ext2_inode(unsigned inode, const ext2_inode& e2inode)
     return write_block(block_index, reinterpret_cast<const u8*>(&e2inode), inode_size(), offset);
 }
 
-Vector<Ext2FS::BlockIndex> Ext2FS::allocate_blocks(GroupIndex preferred_group_index, size_t count)
+KResultOr<Vector<Ext2FS::BlockIndex>> Ext2FS::allocate_blocks(GroupIndex preferred_group_index, size_t count, BlockIndex goal)
 {
     LOCKER(m_lock);
 #ifdef EXT2_DEBUG
-    dbg() << "Ext2FS: allocate_blocks(preferred group: " << preferred_group_index << ", count: " << count << ")";
+    dbg() << "Ext2FS: allocate_blocks(preferred group: " << preferred_group_index << ", count: " << count << ", goal: " << goal << ")";
 #endif
     if (count == 0)
-        return {};
+        return Vector<BlockIndex>();
 
     Vector<BlockIndex> blocks;
-#ifdef EXT2_DEBUG
-    dbg() << "Ext2FS: allocate_blocks:";
-#endif
     blocks.ensure_capacity(count);
 
-    GroupIndex group_index = preferred_group_index;
-
-    if (!group_descriptor(preferred_group_index).bg_free_blocks_count) {
+    GroupIndex group_index = goal ? group_index_from_block_index(goal) : preferred_group_index;
+    if (!group_index || group_index > m_block_group_count)
         group_index = 1;
-    }
 
+    unsigned groups_visited = 0;
     while (blocks.size() < count) {
-
-        bool found_a_group = false;
-        if (group_descriptor(group_index).bg_free_blocks_count) {
-            found_a_group = true;
-        } else {
-            if (group_index == preferred_group_index)
-                group_index = 1;
-            for (; group_index < m_block_group_count; ++group_index) {
-                if (group_descriptor(group_index).bg_free_blocks_count) {
-                    found_a_group = true;
-                    break;
-                }
+        if (!group_descriptor(group_index).bg_free_blocks_count) {
+            // Try the following groups, wrapping around at the end.
+            ++groups_visited;
+            if (groups_visited >= m_block_group_count) {
+                // Every group is full, give back what we've taken so far.
+                for (auto block_index : blocks)
+                    set_block_allocation_state(block_index, false);
+                return KResult(-ENOSPC);
             }
+            group_index = group_index % m_block_group_count + 1;
+            goal = 0;
+            continue;
         }
 
-        ASSERT(found_a_group);
         auto& bgd = group_descriptor(group_index);
         auto& cached_bitmap = get_bitmap_block(bgd.bg_block_bitmap);
 
@@ -1095,26 +2054,134 @@ Vector<Ext2FS::BlockIndex> Ext2FS::allocate_blocks(GroupIndex preferred_group_in
         auto block_bitmap = Bitmap::wrap(cached_bitmap.buffer.data(), blocks_in_group);
 
         BlockIndex first_block_in_group = (group_index - 1) * blocks_per_group() + first_block_index();
-        size_t free_region_size = 0;
-        auto first_unset_bit_index = block_bitmap.find_longest_range_of_unset_bits(count - blocks.size(), free_region_size);
-        ASSERT(first_unset_bit_index.has_value());
+        size_t remaining = count - blocks.size();
+
+        // Take the first free run that fits everything, starting at the goal. Failing that,
+        // take the longest free run in the group and look for the rest right behind it.
+        size_t start = goal && group_index_from_block_index(goal) == group_index ? goal - first_block_in_group : 0;
+        auto run_length = block_bitmap.find_next_range_of_unset_bits(start, remaining, remaining);
+        if (!run_length.has_value() && start) {
+            start = 0;
+            run_length = block_bitmap.find_next_range_of_unset_bits(start, remaining, remaining);
+        }
+        if (!run_length.has_value()) {
+            size_t longest_run_length = 0;
+            auto longest_run_start = block_bitmap.find_longest_range_of_unset_bits(remaining, longest_run_length);
+            ASSERT(longest_run_start.has_value());
+            start = longest_run_start.value();
+            run_length = longest_run_length;
+        }
+
 #ifdef EXT2_DEBUG
-        dbg() << "Ext2FS: allocating free region of size: " << free_region_size << "[" << group_index << "]";
+        dbg() << "Ext2FS: allocating free region of size: " << run_length.value() << "[" << group_index << "]";
 #endif
-        for (size_t i = 0; i < free_region_size; ++i) {
-            BlockIndex block_index = (first_unset_bit_index.value() + i) + first_block_in_group;
+        for (size_t i = 0; i < run_length.value(); ++i) {
+            BlockIndex block_index = first_block_in_group + start + i;
             set_block_allocation_state(block_index, true);
             blocks.unchecked_append(block_index);
-#ifdef EXT2_DEBUG
-            dbg() << "  allocated > " << block_index;
-#endif
         }
+        goal = first_block_in_group + start + run_length.value();
     }
 
     ASSERT(blocks.size() == count);
     return blocks;
 }
 
+KResultOr<Vector<Ext2FS::BlockIndex>> Ext2FS::allocate_blocks_for_inode(Ext2FSInode& inode, size_t count)
+{
+    LOCKER(m_lock);
+    Vector<BlockIndex> blocks;
+    blocks.ensure_capacity(count);
+
+    // New blocks should go right after the last block of the file.
+    BlockIndex goal = 0;
+    if (unsigned block_count = inode.block_count()) {
+        inode.map_blocks(block_count - 1, 1);
+        inode.m_block_map.for_each_run_in_range(block_count - 1, 1, [&](u32, u32 physical_index, u32) {
+            if (physical_index)
+                goal = physical_index + 1;
+        });
+    }
+
+    if (inode.m_preallocated_count && inode.m_preallocated_block == goal) {
+        size_t taken = min(count, (size_t)inode.m_preallocated_count);
+        for (size_t i = 0; i < taken; ++i)
+            blocks.unchecked_append(inode.m_preallocated_block + i);
+        inode.m_preallocated_block += taken;
+        inode.m_preallocated_count -= taken;
+    } else {
+        discard_preallocation(inode);
+    }
+    if (blocks.size() == count)
+        return blocks;
+
+    size_t needed = count - blocks.size();
+    if (!blocks.is_empty())
+        goal = blocks.last() + 1;
+
+    // Only regular files get a preallocation window, other inodes rarely grow.
+    size_t extra = 0;
+    if (Kernel::is_regular_file(inode.m_raw_inode.i_mode) && super_block().s_free_blocks_count > needed)
+        extra = min((size_t)EXT2_PREALLOCATION_BLOCK_COUNT, super_block().s_free_blocks_count - needed);
+
+    auto blocks_or_error = allocate_blocks(group_index_from_inode(inode.index()), needed + extra, goal);
+    if (blocks_or_error.is_error()) {
+        for (auto block_index : blocks)
+            set_block_allocation_state(block_index, false);
+        return blocks_or_error.error();
+    }
+    auto new_blocks = blocks_or_error.release_value();
+    for (size_t i = 0; i < needed; ++i)
+        blocks.unchecked_append(new_blocks[i]);
+
+    // Keep the extra blocks if they're a contiguous run right after the ones we're using.
+    bool extra_is_contiguous = true;
+    for (size_t i = needed; i < new_blocks.size(); ++i) {
+        if (new_blocks[i] != new_blocks[i - 1] + 1)
+            extra_is_contiguous = false;
+    }
+    if (extra && extra_is_contiguous) {
+        inode.m_preallocated_block = new_blocks[needed];
+        inode.m_preallocated_count = extra;
+    } else {
+        for (size_t i = needed; i < new_blocks.size(); ++i)
+            set_block_allocation_state(new_blocks[i], false);
+    }
+    return blocks;
+}
+
+void Ext2FS::discard_preallocation(Ext2FSInode& inode)
+{
+    LOCKER(m_lock);
+    for (unsigned i = 0; i < inode.m_preallocated_count; ++i)
+        set_block_allocation_state(inode.m_preallocated_block + i, false);
+    inode.m_preallocated_block = 0;
+    inode.m_preallocated_count = 0;
+}
+
+FS::FreeSpaceInfo Ext2FS::free_space_info() const
+{
+    LOCKER(m_lock);
+    FreeSpaceInfo info;
+    for (GroupIndex group_index = 1; group_index <= m_block_group_count; ++group_index) {
+        auto& bgd = group_descriptor(group_index);
+        if (!bgd.bg_free_blocks_count)
+            continue;
+        auto& cached_bitmap = const_cast<Ext2FS&>(*this).get_bitmap_block(bgd.bg_block_bitmap);
+        int blocks_in_group = min(blocks_per_group(), super_block().s_blocks_count);
+        auto block_bitmap = Bitmap::wrap(cached_bitmap.buffer.data(), blocks_in_group);
+        for (size_t start = 0;;) {
+            auto run_length = block_bitmap.find_next_range_of_unset_bits(start);
+            if (!run_length.has_value())
+                break;
+            ++info.free_extent_count;
+            info.largest_free_extent = max(info.largest_free_extent, (unsigned)run_length.value());
+            start += run_length.value();
+        }
+    }
+    return info;
+}
+
 unsigned Ext2FS::find_a_free_inode(GroupIndex preferred_group, off_t expected_size)
 {
     ASSERT(expected_size >= 0);
@@ -1268,16 +2335,17 @@ Ext2FS::BlockIndex Ext2FS::first_block_index() const
 
 Ext2FS::CachedBitmap& Ext2FS::get_bitmap_block(BlockIndex bitmap_block_index)
 {
-    for (auto& cached_bitmap : m_cached_bitmaps) {
-        if (cached_bitmap->bitmap_block_index == bitmap_block_index)
-            return *cached_bitmap;
-    }
+    auto it = m_cached_bitmaps.find(bitmap_block_index);
+    if (it != m_cached_bitmaps.end())
+        return *it->value;
 
     auto block = KBuffer::create_with_size(block_size(), Region::Access::Read | Region::Access::Write, "Ext2FS: Cached bitmap block");
     bool success = read_block(bitmap_block_index, block.data(), block_size());
     ASSERT(success);
-    m_cached_bitmaps.append(make<CachedBitmap>(bitmap_block_index, move(block)));
-    return *m_cached_bitmaps.last();
+    auto cached_bitmap = make<CachedBitmap>(bitmap_block_index, move(block));
+    auto& cached_bitmap_ref = *cached_bitmap;
+    m_cached_bitmaps.set(bitmap_block_index, move(cached_bitmap));
+    return cached_bitmap_ref;
 }
 
 bool Ext2FS::set_block_allocation_state(BlockIndex block_index, bool new_state)
@@ -1410,8 +2478,12 @@ KResultOr<NonnullRefPtr<Inode>> Ext2FS::create_inode(InodeIdentifier parent_id,
     if (result.is_error())
         return result;
 
-    auto blocks = allocate_blocks(group_index_from_inode(inode_id), needed_blocks);
-    ASSERT(blocks.size() == needed_blocks);
+    auto blocks_or_error = allocate_blocks(group_index_from_inode(inode_id), needed_blocks);
+    if (blocks_or_error.is_error()) {
+        parent_inode->remove_child(name);
+        return blocks_or_error.error();
+    }
+    auto blocks = blocks_or_error.release_value();
 
     // Looks like we're good, time to update the inode bitmap and group+global inode counters.
     bool success = set_inode_allocation_state(inode_id, true);
@@ -1457,7 +2529,9 @@ KResultOr<NonnullRefPtr<Inode>> Ext2FS::create_inode(InodeIdentifier parent_id,
 
     auto inode = get_inode({ fsid(), inode_id });
     // If we've already computed a block list, no sense in throwing it away.
-    static_cast<Ext2FSInode&>(*inode).m_block_list = move(blocks);
+    auto& block_map = static_cast<Ext2FSInode&>(*inode).m_block_map;
+    for (size_t i = 0; i < blocks.size(); ++i)
+        block_map.add(i, blocks[i]);
     return inode.release_nonnull();
 }
 
@@ -1478,17 +2552,32 @@ void Ext2FSInode::populate_lookup_cache() const
     m_lookup_cache = move(children);
 }
 
-RefPtr<Inode> Ext2FSInode::lookup(StringView name)
+Optional<unsigned> Ext2FSInode::find_child_index(const StringView& name) const
 {
-    ASSERT(is_directory());
-    populate_lookup_cache();
     LOCKER(m_lock);
+    // Indexed directories can be huge, look names up through the index instead of caching all of them.
+    if (is_indexed_directory()) {
+        auto location_or_error = find_directory_entry(name);
+        if (location_or_error.is_error())
+            return {};
+        return location_or_error.value().inode;
+    }
+    populate_lookup_cache();
     auto it = m_lookup_cache.find(name.hash(), [&](auto& entry) { return entry.key == name; });
     if (it != m_lookup_cache.end())
-        return fs().get_inode({ fsid(), (*it).value });
+        return (*it).value;
     return {};
 }
 
+RefPtr<Inode> Ext2FSInode::lookup(StringView name)
+{
+    ASSERT(is_directory());
+    auto child_index = find_child_index(name);
+    if (!child_index.has_value())
+        return {};
+    return fs().get_inode({ fsid(), child_index.value() });
+}
+
 void Ext2FSInode::one_ref_left()
 {
     // FIXME: I would like to not live forever, but uncached Ext2FS is fucking painful right now.
@@ -1559,6 +2648,14 @@ size_t Ext2FSInode::directory_entry_count() const
 {
     ASSERT(is_directory());
     LOCKER(m_lock);
+    if (is_indexed_directory()) {
+        size_t count = 0;
+        traverse_as_directory([&](auto&) {
+            ++count;
+            return true;
+        });
+        return count;
+    }
     populate_lookup_cache();
     return m_lookup_cache.size();
 }
@@ -1587,12 +2684,14 @@ KResult Ext2FSInode::chown(uid_t uid, gid_t gid)
 KResult Ext2FSInode::truncate(u64 size)
 {
     LOCKER(m_lock);
-    if (static_cast<u64>(m_raw_inode.i_size) == size)
+    u64 old_size = m_raw_inode.i_size;
+    if (old_size == size)
         return KSuccess;
     auto result = resize(size);
     if (result.is_error())
         return result;
     set_metadata_dirty(true);
+    inode_size_changed(old_size, size);
     return KSuccess;
 }
 
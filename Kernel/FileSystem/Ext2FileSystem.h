@@ -28,6 +28,7 @@
 
 #include <AK/Bitmap.h>
 #include <AK/HashMap.h>
+#include <Kernel/FileSystem/Ext2BlockMap.h>
 #include <Kernel/FileSystem/FileBackedFileSystem.h>
 #include <Kernel/FileSystem/Inode.h>
 #include <Kernel/FileSystem/ext2_fs.h>
@@ -74,16 +75,55 @@ private:
     virtual KResult chmod(mode_t) override;
     virtual KResult chown(uid_t, gid_t) override;
     virtual KResult truncate(u64) override;
+    virtual bool uses_page_cache() const override;
+    virtual KResult read_pages_from_disk(size_t first_page_index, size_t page_count, u8* buffer) const override;
+    virtual KResult write_pages_to_disk(size_t first_page_index, size_t page_count, const u8* data) override;
 
     bool write_directory(const Vector<FS::DirectoryEntry>&);
     void populate_lookup_cache() const;
+    Optional<unsigned> find_child_index(const StringView& name) const;
+
+    // Entries are added and removed in place, only the blocks that change are written.
+    // Directories that outgrow their first block get a hashed index (htree) in it.
+    struct DirectoryIndexFrame;
+    struct DirectoryEntryLocation {
+        unsigned block_index { 0 };
+        size_t offset { 0 };
+        unsigned inode { 0 };
+    };
+    bool is_indexed_directory() const;
+    u8 directory_hash_version(u8 root_hash_version) const;
+    KResult read_directory_block(unsigned block_index, ByteBuffer&) const;
+    KResult write_directory_block(unsigned block_index, const ByteBuffer&);
+    KResultOr<unsigned> append_directory_block(const ByteBuffer&);
+    KResultOr<u32> find_directory_index_path(const StringView& name, Vector<DirectoryIndexFrame, 2>&) const;
+    bool advance_directory_index_path(u32 hash, Vector<DirectoryIndexFrame, 2>&) const;
+    KResult make_room_in_directory_index(Vector<DirectoryIndexFrame, 2>&);
+    KResultOr<DirectoryEntryLocation> find_directory_entry(const StringView& name) const;
+    KResult add_directory_entry(const StringView& name, unsigned inode, u8 file_type);
+    KResult add_directory_entry_to_index(const StringView& name, unsigned inode, u8 file_type);
+    KResult make_indexed_directory();
+    KResult remove_directory_entry(const DirectoryEntryLocation&);
     KResult resize(u64);
 
+    // The number of data blocks the inode has, going by its size.
+    unsigned block_count() const;
+    // Makes sure the given range of the block map is known, reading in the parts that aren't.
+    void map_blocks(unsigned first_block, unsigned count) const;
+    // Gives the holes (of a sparse file) in the given range blocks of their own, so they can be written to.
+    KResult allocate_blocks_for_holes(unsigned first_block, unsigned count);
+
     Ext2FS& fs();
     const Ext2FS& fs() const;
     Ext2FSInode(Ext2FS&, unsigned index);
 
-    mutable Vector<unsigned> m_block_list;
+    mutable Ext2BlockMap m_block_map;
+
+    // Free blocks reserved right after the end of the file, so that it stays
+    // contiguous while it grows in small steps. They're given back once the
+    // inode is dropped from the cache, or when the file shrinks.
+    unsigned m_preallocated_block { 0 };
+    unsigned m_preallocated_count { 0 };
     mutable HashMap<String, unsigned> m_lookup_cache;
     ext2_inode m_raw_inode;
 };
@@ -103,6 +143,7 @@ public:
     virtual unsigned free_inode_count() const override;
 
     virtual KResult prepare_to_unmount() const override;
+    virtual FreeSpaceInfo free_space_info() const override;
 
     virtual bool supports_watchers() const override { return true; }
 
@@ -133,16 +174,29 @@ private:
     virtual KResult create_directory(InodeIdentifier parent_inode, const String& name, mode_t, uid_t, gid_t) override;
     virtual RefPtr<Inode> get_inode(InodeIdentifier) const override;
     virtual void flush_writes() override;
+    virtual void write_back() override;
+    void flush_page_caches(bool only_expired = false);
+    void flush_metadata_to_cache();
+    void uncache_unused_inodes();
 
     BlockIndex first_block_index() const;
     InodeIndex find_a_free_inode(GroupIndex preferred_group, off_t expected_size);
-    Vector<BlockIndex> allocate_blocks(GroupIndex preferred_group_index, size_t count);
+    KResultOr<Vector<BlockIndex>> allocate_blocks(GroupIndex preferred_group_index, size_t count, BlockIndex goal = 0);
+    KResultOr<Vector<BlockIndex>> allocate_blocks_for_inode(Ext2FSInode&, size_t count);
+    void discard_preallocation(Ext2FSInode&);
     GroupIndex group_index_from_inode(InodeIndex) const;
     GroupIndex group_index_from_block_index(BlockIndex) const;
 
     Vector<BlockIndex> block_list_for_inode_impl(const ext2_inode&, bool include_block_list_blocks = false) const;
     Vector<BlockIndex> block_list_for_inode(const ext2_inode&, bool include_block_list_blocks = false) const;
     bool write_block_list_for_inode(InodeIndex, ext2_inode&, const Vector<BlockIndex>&);
+    // Only reads the parts of the (indirect) block arrays that cover the given blocks.
+    void read_block_pointers(const ext2_inode&, unsigned first_block, unsigned count, Vector<BlockIndex>&) const;
+    void read_block_pointers_below(BlockIndex array_block, unsigned depth, unsigned first_block, unsigned count, Vector<BlockIndex>&) const;
+    // Adds blocks to the end of the inode, only touching the block arrays that change.
+    bool append_blocks_to_inode(InodeIndex, ext2_inode&, unsigned old_block_count, const Vector<BlockIndex>&);
+    // Points one logical block of the inode at the given block, getting any missing arrays on the way from the callback.
+    bool set_block_pointer(ext2_inode&, unsigned logical_index, BlockIndex, Function<BlockIndex()>& take_new_array_block);
 
     bool get_inode_allocation_state(InodeIndex) const;
     bool set_inode_allocation_state(InodeIndex, bool);
@@ -185,7 +239,7 @@ private:
 
     CachedBitmap& get_bitmap_block(BlockIndex);
 
-    Vector<OwnPtr<CachedBitmap>> m_cached_bitmaps;
+    HashMap<BlockIndex, OwnPtr<CachedBitmap>> m_cached_bitmaps;
 };
 
 inline Ext2FS& Ext2FSInode::fs()
@@ -87,6 +87,7 @@ void FIFO::attach(Direction direction)
         klog() << "open writer (" << m_writers << ")";
 #endif
     }
+    evaluate_block_conditions();
 }
 
 void FIFO::detach(Direction direction)
@@ -104,6 +105,7 @@ void FIFO::detach(Direction direction)
         ASSERT(m_writers);
         --m_writers;
     }
+    evaluate_block_conditions();
 }
 
 bool FIFO::can_read(const FileDescription&, size_t) const
@@ -116,6 +118,17 @@ bool FIFO::can_write(const FileDescription&, size_t) const
     return m_buffer.space_for_writing() || !m_readers;
 }
 
+bool FIFO::has_hung_up(const FileDescription& description) const
+{
+    return description.fifo_direction() == Direction::Reader && !m_writers;
+}
+
+bool FIFO::has_pending_error(const FileDescription& description) const
+{
+    // Writing would fail with EPIPE.
+    return description.fifo_direction() == Direction::Writer && !m_readers;
+}
+
 ssize_t FIFO::read(FileDescription&, size_t, u8* buffer, ssize_t size)
 {
     if (!m_writers && m_buffer.is_empty())
@@ -127,19 +140,24 @@ ssize_t FIFO::read(FileDescription&, size_t, u8* buffer, ssize_t size)
 #ifdef FIFO_DEBUG
     dbg() << "   -> read (" << String::format("%c", buffer[0]) << ") " << nread;
 #endif
+    if (nread > 0)
+        evaluate_block_conditions();
     return nread;
 }
 
 ssize_t FIFO::write(FileDescription&, size_t, const u8* buffer, ssize_t size)
 {
     if (!m_readers) {
-        Thread::current->send_signal(SIGPIPE, Process::current);
+        Thread::current()->send_signal(SIGPIPE, Process::current());
         return -EPIPE;
     }
 #ifdef FIFO_DEBUG
     dbg() << "fifo: write(" << (const void*)buffer << ", " << size << ")";
 #endif
-    return m_buffer.write(buffer, size);
+    ssize_t nwritten = m_buffer.write(buffer, size);
+    if (nwritten > 0)
+        evaluate_block_conditions();
+    return nwritten;
 }
 
 String FIFO::absolute_path(const FileDescription&) const
@@ -25,6 +25,8 @@
  */
 
 #include <AK/StringView.h>
+#include <Kernel/Arch/i386/CPU.h>
+#include <Kernel/FileSystem/EventPoll.h>
 #include <Kernel/FileSystem/File.h>
 #include <Kernel/FileSystem/FileDescription.h>
 
@@ -56,6 +58,43 @@ int File::ioctl(FileDescription&, unsigned, FlatPtr)
     return -ENOTTY;
 }
 
+void File::evaluate_block_conditions()
+{
+    m_block_condition.notify();
+
+    // This may run in IRQ context, so the EventPoll side only links the interest onto its ready list.
+    InterruptDisabler disabler;
+    for (auto* interest : m_event_poll_interests)
+        interest->event_poll.interest_did_change({}, *interest);
+}
+
+void File::register_event_poll_interest(Badge<EventPoll>, EventPollInterest& interest)
+{
+    InterruptDisabler disabler;
+    m_event_poll_interests.append(&interest);
+}
+
+void File::unregister_event_poll_interest(Badge<EventPoll>, EventPollInterest& interest)
+{
+    InterruptDisabler disabler;
+    m_event_poll_interests.remove_first_matching([&](auto* entry) { return entry == &interest; });
+}
+
+void File::detach_event_poll_interests(Badge<FileDescription>, FileDescription& description)
+{
+    Vector<NonnullRefPtr<EventPoll>, 4> event_polls;
+    {
+        InterruptDisabler disabler;
+        for (auto* interest : m_event_poll_interests) {
+            if (&interest->description == &description)
+                event_polls.append(interest->event_poll);
+        }
+    }
+    // An EventPoll may show up more than once here; the repeated calls find nothing left to drop.
+    for (auto& event_poll : event_polls)
+        event_poll->description_will_close({}, description);
+}
+
 KResultOr<Region*> File::mmap(Process&, FileDescription&, VirtualAddress, size_t, size_t, int, bool)
 {
     return KResult(-ENODEV);
@@ -26,10 +26,13 @@
 
 #pragma once
 
+#include <AK/Badge.h>
 #include <AK/NonnullRefPtr.h>
 #include <AK/RefCounted.h>
 #include <AK/String.h>
 #include <AK/Types.h>
+#include <AK/Vector.h>
+#include <Kernel/BlockCondition.h>
 #include <Kernel/Forward.h>
 #include <Kernel/KResult.h>
 #include <Kernel/UnixTypes.h>
@@ -52,6 +55,14 @@ namespace Kernel {
 //   - Note that can_read() should return true in EOF conditions,
 //     and a subsequent call to read() should return 0.
 //
+// evaluate_block_conditions()
+//
+//   - Must be called whenever the answer from can_read() or can_write() may have changed,
+//     so threads blocked on this File get woken up to take another look.
+//   - Also pushes the change into every EventPoll (epoll) watching this File.
+//   - Files that can't tell when that happens should return true from is_readiness_polled()
+//     instead, and their waiters will be checked on every scheduler pass.
+//
 // ioctl()
 //
 //   - Optional. If unimplemented, ioctl() on this File will fail with -ENOTTY.
@@ -73,6 +84,9 @@ public:
 
     virtual bool can_read(const FileDescription&, size_t) const = 0;
     virtual bool can_write(const FileDescription&, size_t) const = 0;
+    // The other end has gone away, or something went wrong that the next read or write will report.
+    virtual bool has_hung_up(const FileDescription&) const { return false; }
+    virtual bool has_pending_error(const FileDescription&) const { return false; }
 
     virtual ssize_t read(FileDescription&, size_t, u8*, ssize_t) = 0;
     virtual ssize_t write(FileDescription&, size_t, const u8*, ssize_t) = 0;
@@ -97,9 +111,23 @@ public:
     virtual bool is_block_device() const { return false; }
     virtual bool is_character_device() const { return false; }
     virtual bool is_socket() const { return false; }
+    virtual bool is_event_poll() const { return false; }
+
+    virtual bool is_readiness_polled() const { return false; }
+
+    BlockCondition& block_condition() { return m_block_condition; }
+    void evaluate_block_conditions();
+
+    void register_event_poll_interest(Badge<EventPoll>, EventPollInterest&);
+    void unregister_event_poll_interest(Badge<EventPoll>, EventPollInterest&);
+    void detach_event_poll_interests(Badge<FileDescription>, FileDescription&);
 
 protected:
     File();
+
+private:
+    BlockCondition m_block_condition;
+    Vector<EventPollInterest*> m_event_poll_interests;
 };
 
 }
@@ -24,6 +24,10 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <AK/HashMap.h>
+#include <AK/InlineLinkedList.h>
+#include <AK/NonnullRefPtrVector.h>
+#include <AK/QuickSort.h>
 #include <AK/StringView.h>
 #include <Kernel/Arch/i386/CPU.h>
 #include <Kernel/Devices/BlockDevice.h>
@@ -31,28 +35,52 @@
 #include <Kernel/FileSystem/FileDescription.h>
 #include <Kernel/KBuffer.h>
 #include <Kernel/Process.h>
+#include <Kernel/Scheduler.h>
+#include <Kernel/Tasks/WritebackTask.h>
 
 //#define FBFS_DEBUG
 
 namespace Kernel {
 
-struct CacheEntry {
-    time_t timestamp { 0 };
+// The cache uses at most this fraction of physical memory (it's only committed as it fills up).
+#define DISK_CACHE_MEMORY_FRACTION 16
+#define DISK_CACHE_MIN_ENTRY_COUNT 1024
+#define DISK_CACHE_MAX_ENTRY_COUNT 65536
+
+// Blocks are written back in sorted batches of at most this many. Throttled writers
+// write back the smaller batch, so they can carry on soon.
+#define WRITEBACK_BATCH_SIZE 256
+#define WRITEBACK_THROTTLE_BATCH_SIZE 32
+
+static size_t s_dirty_block_count;
+static size_t s_writeback_block_count;
+static size_t s_throttled_write_count;
+
+struct CacheEntry : public InlineLinkedListNode<CacheEntry> {
     u32 block_index { 0 };
     u8* data { nullptr };
     bool has_data { false };
     bool is_dirty { false };
+    u64 dirty_since { 0 };
+
+    // For InlineLinkedListNode
+    CacheEntry* m_next { nullptr };
+    CacheEntry* m_prev { nullptr };
 };
 
 class DiskCache {
 public:
     explicit DiskCache(FileBackedFS& fs)
         : m_fs(fs)
+        , m_entry_count(entry_count_for_block_size(fs.block_size()))
         , m_cached_block_data(KBuffer::create_with_size(m_entry_count * m_fs.block_size()))
         , m_entries(KBuffer::create_with_size(m_entry_count * sizeof(CacheEntry)))
     {
+        m_entries_by_block.ensure_capacity(m_entry_count);
         for (size_t i = 0; i < m_entry_count; ++i) {
-            entries()[i].data = m_cached_block_data.data() + i * m_fs.block_size();
+            auto* entry = new (&entries()[i]) CacheEntry;
+            entry->data = m_cached_block_data.data() + i * m_fs.block_size();
+            m_clean_entries.append(entry);
         }
     }
 
@@ -61,59 +89,121 @@ public:
     bool is_dirty() const { return m_dirty; }
     void set_dirty(bool b) { m_dirty = b; }
 
-    CacheEntry& get(u32 block_index) const
+    CacheEntry* find(u32 block_index)
     {
-        auto now = kgettimeofday().tv_sec;
+        auto it = m_entries_by_block.find(block_index);
+        if (it == m_entries_by_block.end())
+            return nullptr;
+        return it->value;
+    }
 
-        CacheEntry* oldest_clean_entry = nullptr;
-        for (size_t i = 0; i < m_entry_count; ++i) {
-            auto& entry = const_cast<CacheEntry&>(entries()[i]);
-            if (entry.block_index == block_index) {
-                entry.timestamp = now;
-                return entry;
-            }
-            if (!entry.is_dirty) {
-                if (!oldest_clean_entry)
-                    oldest_clean_entry = &entry;
-                else if (entry.timestamp < oldest_clean_entry->timestamp)
-                    oldest_clean_entry = &entry;
+    CacheEntry& get(u32 block_index)
+    {
+        if (auto* entry = find(block_index)) {
+            // Dirty entries stay in the order they were dirtied in, so they're written back oldest first.
+            if (!entry->is_dirty) {
+                m_clean_entries.remove(entry);
+                m_clean_entries.prepend(entry);
             }
+            return *entry;
         }
-        if (!oldest_clean_entry) {
-            // Not a single clean entry! Flush writes and try again.
-            // NOTE: We want to make sure we only call FileBackedFS flush here,
-            //       not some FileBackedFS subclass flush!
-            m_fs.flush_writes_impl();
+
+        // Both lists are kept in most-recently-used order, so the victim is the last clean entry.
+        auto* victim = m_clean_entries.tail();
+        if (!victim) {
+            // Not a single clean entry! Write back the oldest blocks and try again.
+            m_fs.write_back_oldest_blocks(WRITEBACK_THROTTLE_BATCH_SIZE);
             return get(block_index);
         }
 
-        // Replace the oldest clean entry.
-        auto& new_entry = *oldest_clean_entry;
-        new_entry.timestamp = now;
-        new_entry.block_index = block_index;
-        new_entry.has_data = false;
-        new_entry.is_dirty = false;
-        return new_entry;
+        if (find(victim->block_index) == victim)
+            m_entries_by_block.remove(victim->block_index);
+        victim->block_index = block_index;
+        victim->has_data = false;
+        m_entries_by_block.set(block_index, victim);
+        m_clean_entries.remove(victim);
+        m_clean_entries.prepend(victim);
+        return *victim;
     }
 
+    void mark_dirty(CacheEntry& entry)
+    {
+        if (entry.is_dirty)
+            return;
+        entry.is_dirty = true;
+        entry.dirty_since = g_uptime;
+        m_clean_entries.remove(&entry);
+        m_dirty_entries.prepend(&entry);
+        ++m_dirty_count;
+        ++s_dirty_block_count;
+        m_dirty = true;
+    }
+
+    void mark_clean(CacheEntry& entry)
+    {
+        if (!entry.is_dirty)
+            return;
+        entry.is_dirty = false;
+        m_dirty_entries.remove(&entry);
+        m_clean_entries.prepend(&entry);
+        --m_dirty_count;
+        --s_dirty_block_count;
+        if (!m_dirty_count)
+            m_dirty = false;
+    }
+
+    size_t entry_count() const { return m_entry_count; }
+    size_t dirty_count() const { return m_dirty_count; }
+    const CacheEntry* oldest_dirty_entry() const { return m_dirty_entries.tail(); }
+
     const CacheEntry* entries() const { return (const CacheEntry*)m_entries.data(); }
     CacheEntry* entries() { return (CacheEntry*)m_entries.data(); }
 
+    // Oldest first. The callback may mark the entry clean, and returns IterationDecision.
     template<typename Callback>
-    void for_each_entry(Callback callback)
+    void for_each_dirty_entry(Callback callback)
     {
-        for (size_t i = 0; i < m_entry_count; ++i)
-            callback(entries()[i]);
+        for (auto* entry = m_dirty_entries.tail(); entry;) {
+            auto* prev = entry->prev();
+            if (callback(*entry) == IterationDecision::Break)
+                break;
+            entry = prev;
+        }
     }
 
 private:
+    static size_t entry_count_for_block_size(size_t block_size)
+    {
+        size_t bytes = (size_t)MM.user_physical_pages() * PAGE_SIZE / DISK_CACHE_MEMORY_FRACTION;
+        return min(max(bytes / block_size, (size_t)DISK_CACHE_MIN_ENTRY_COUNT), (size_t)DISK_CACHE_MAX_ENTRY_COUNT);
+    }
+
     FileBackedFS& m_fs;
-    size_t m_entry_count { 10000 };
+    size_t m_entry_count { 0 };
     KBuffer m_cached_block_data;
     KBuffer m_entries;
+    HashMap<u32, CacheEntry*> m_entries_by_block;
+    InlineLinkedList<CacheEntry> m_clean_entries;
+    InlineLinkedList<CacheEntry> m_dirty_entries;
+    size_t m_dirty_count { 0 };
     bool m_dirty { false };
 };
 
+size_t FileBackedFS::dirty_block_count()
+{
+    return s_dirty_block_count;
+}
+
+size_t FileBackedFS::writeback_block_count()
+{
+    return s_writeback_block_count;
+}
+
+size_t FileBackedFS::throttled_write_count()
+{
+    return s_throttled_write_count;
+}
+
 FileBackedFS::FileBackedFS(FileDescription& file_description)
     : m_file_description(file_description)
 {
@@ -122,6 +212,8 @@ FileBackedFS::FileBackedFS(FileDescription& file_description)
 
 FileBackedFS::~FileBackedFS()
 {
+    if (m_cache)
+        s_dirty_block_count -= m_cache->dirty_count();
 }
 
 bool FileBackedFS::write_block(unsigned index, const u8* data, size_t count, size_t offset, bool allow_cache)
@@ -140,6 +232,7 @@ bool FileBackedFS::write_block(unsigned index, const u8* data, size_t count, siz
         if (nwritten < 0)
             return false;
         ASSERT(static_cast<size_t>(nwritten) == count);
+        update_cached_block_if_needed(index, data, count, offset);
         return true;
     }
 
@@ -149,10 +242,10 @@ bool FileBackedFS::write_block(unsigned index, const u8* data, size_t count, siz
         read_block(index, nullptr, block_size());
     }
     memcpy(entry.data + offset, data, count);
-    entry.is_dirty = true;
     entry.has_data = true;
 
-    cache().set_dirty(true);
+    cache().mark_dirty(entry);
+    balance_dirty_blocks();
     return true;
 }
 
@@ -198,6 +291,22 @@ bool FileBackedFS::write_blocks(unsigned index, unsigned count, const u8* data,
 #ifdef FBFS_DEBUG
     klog() << "FileBackedFileSystem::write_blocks " << index << " x" << count;
 #endif
+    if (!allow_cache && count > 1) {
+        // Bypass the cache with as few requests as the device allows.
+        for (unsigned i = 0; i < count; ++i)
+            flush_specific_block_if_needed(index + i);
+        m_file_description->seek(static_cast<u32>(index) * static_cast<u32>(block_size()), SEEK_SET);
+        size_t size = count * block_size();
+        for (size_t nwritten = 0; nwritten < size;) {
+            auto result = m_file_description->write(data + nwritten, size - nwritten);
+            if (result <= 0)
+                return false;
+            nwritten += result;
+        }
+        for (unsigned i = 0; i < count; ++i)
+            update_cached_block_if_needed(index + i, data + i * block_size(), block_size(), 0);
+        return true;
+    }
     for (unsigned i = 0; i < count; ++i)
         write_block(index + i, data + i * block_size(), block_size(), 0, allow_cache);
     return true;
@@ -244,6 +353,20 @@ bool FileBackedFS::read_blocks(unsigned index, unsigned count, u8* buffer, bool
         return false;
     if (count == 1)
         return read_block(index, buffer, block_size(), 0, allow_cache);
+    if (!allow_cache) {
+        // Bypass the cache with as few requests as the device allows.
+        for (unsigned i = 0; i < count; ++i)
+            const_cast<FileBackedFS*>(this)->flush_specific_block_if_needed(index + i);
+        m_file_description->seek(static_cast<u32>(index) * static_cast<u32>(block_size()), SEEK_SET);
+        size_t size = count * block_size();
+        for (size_t nread = 0; nread < size;) {
+            auto result = m_file_description->read(buffer + nread, size - nread);
+            if (result <= 0)
+                return false;
+            nread += result;
+        }
+        return true;
+    }
     u8* out = buffer;
 
     for (unsigned i = 0; i < count; ++i) {
@@ -260,14 +383,152 @@ void FileBackedFS::flush_specific_block_if_needed(unsigned index)
     LOCKER(m_lock);
     if (!cache().is_dirty())
         return;
-    cache().for_each_entry([&](CacheEntry& entry) {
-        if (entry.is_dirty && entry.block_index == index) {
-            u32 base_offset = static_cast<u32>(entry.block_index) * static_cast<u32>(block_size());
-            m_file_description->seek(base_offset, SEEK_SET);
-            m_file_description->write(entry.data, block_size());
-            entry.is_dirty = false;
+    auto* entry = cache().find(index);
+    if (!entry || !entry->is_dirty)
+        return;
+    u32 base_offset = static_cast<u32>(entry->block_index) * static_cast<u32>(block_size());
+    m_file_description->seek(base_offset, SEEK_SET);
+    m_file_description->write(entry->data, block_size());
+    cache().mark_clean(*entry);
+}
+
+void FileBackedFS::update_cached_block_if_needed(unsigned index, const u8* data, size_t count, size_t offset)
+{
+    // Keep a cached copy of a block that was written around the cache in sync with the disk.
+    auto* entry = cache().find(index);
+    if (entry && entry->has_data)
+        memcpy(entry->data + offset, data, count);
+}
+
+bool FileBackedFS::read_blocks_directly(const Vector<BlockTransfer, 16>& transfers) const
+{
+    auto& fs = const_cast<FileBackedFS&>(*this);
+    for (auto& transfer : transfers)
+        fs.flush_specific_block_if_needed(transfer.index);
+    return fs.transfer_blocks(AsyncBlockDeviceRequest::Type::Read, transfers);
+}
+
+bool FileBackedFS::write_blocks_directly(const Vector<BlockTransfer, 16>& transfers)
+{
+    for (auto& transfer : transfers)
+        flush_specific_block_if_needed(transfer.index);
+    if (!transfer_blocks(AsyncBlockDeviceRequest::Type::Write, transfers))
+        return false;
+    for (auto& transfer : transfers)
+        update_cached_block_if_needed(transfer.index, transfer.data, block_size(), 0);
+    return true;
+}
+
+bool FileBackedFS::transfer_blocks(AsyncBlockDeviceRequest::Type type, const Vector<BlockTransfer, 16>& transfers)
+{
+    bool is_write = type == AsyncBlockDeviceRequest::Type::Write;
+    if (!file().is_block_device() || block_size() % static_cast<BlockDevice&>(file()).block_size()) {
+        for (auto& transfer : transfers) {
+            m_file_description->seek(static_cast<u32>(transfer.index) * static_cast<u32>(block_size()), SEEK_SET);
+            auto result = is_write ? m_file_description->write(transfer.data, block_size()) : m_file_description->read(transfer.data, block_size());
+            if (result != static_cast<ssize_t>(block_size()))
+                return false;
         }
+        return true;
+    }
+
+    auto& device = static_cast<BlockDevice&>(file());
+    size_t device_blocks_per_block = block_size() / device.block_size();
+    size_t max_blocks_per_request = 0xffff / device_blocks_per_block;
+
+    // One request per run of consecutive blocks, with as few buffers as their memory layout allows.
+    NonnullRefPtrVector<AsyncBlockDeviceRequest> requests;
+    for (size_t i = 0; i < transfers.size();) {
+        unsigned first_index = transfers[i].index;
+        size_t count = 0;
+        Vector<AsyncBlockDeviceRequest::Buffer, 1> buffers;
+        for (; i < transfers.size() && transfers[i].index == first_index + count && count < max_blocks_per_request; ++i, ++count) {
+            auto* data = transfers[i].data;
+            if (!buffers.is_empty() && buffers.last().data + buffers.last().size == data)
+                buffers.last().size += block_size();
+            else
+                buffers.append({ data, block_size() });
+        }
+        auto request = AsyncBlockDeviceRequest::create(type, first_index * device_blocks_per_block, count * device_blocks_per_block, move(buffers));
+        device.start_request(request);
+        requests.append(move(request));
+    }
+
+#ifdef FBFS_DEBUG
+    klog() << "FileBackedFileSystem::transfer_blocks " << (is_write ? "wrote " : "read ") << transfers.size() << " blocks with " << requests.size() << " requests";
+#endif
+
+    bool success = true;
+    for (auto& request : requests) {
+        if (!request.wait())
+            success = false;
+    }
+    return success;
+}
+
+size_t FileBackedFS::write_back_oldest_blocks(size_t max_count, bool only_expired)
+{
+    LOCKER(m_lock);
+    if (!cache().is_dirty())
+        return 0;
+
+    Vector<CacheEntry*, 16> entries;
+    cache().for_each_dirty_entry([&](CacheEntry& entry) {
+        if (entries.size() == max_count || (only_expired && !WritebackTask::is_expired(entry.dirty_since)))
+            return IterationDecision::Break;
+        entries.append(&entry);
+        return IterationDecision::Continue;
     });
+    if (entries.is_empty())
+        return 0;
+    quick_sort(entries, [](auto* a, auto* b) { return a->block_index < b->block_index; });
+
+    Vector<BlockTransfer, 16> transfers;
+    transfers.ensure_capacity(entries.size());
+    for (auto* entry : entries)
+        transfers.unchecked_append({ entry->block_index, entry->data });
+
+    s_writeback_block_count += entries.size();
+    if (!transfer_blocks(AsyncBlockDeviceRequest::Type::Write, transfers))
+        dbg() << class_name() << ": Failed to write back some blocks";
+    s_writeback_block_count -= entries.size();
+
+    for (auto* entry : entries)
+        cache().mark_clean(*entry);
+#ifdef FBFS_DEBUG
+    dbg() << class_name() << ": Wrote back " << entries.size() << " blocks, " << cache().dirty_count() << " still dirty";
+#endif
+    return entries.size();
+}
+
+void FileBackedFS::balance_dirty_blocks()
+{
+    size_t dirty_count = cache().dirty_count();
+    if (dirty_count * 100 > cache().entry_count() * WritebackTask::dirty_throttle_percent) {
+        // This writer is dirtying blocks faster than they're written back, make it help out.
+        ++s_throttled_write_count;
+        write_back_oldest_blocks(WRITEBACK_THROTTLE_BATCH_SIZE);
+    } else if (dirty_count * 100 > cache().entry_count() * WritebackTask::dirty_background_percent) {
+        WritebackTask::wake();
+    }
+}
+
+void FileBackedFS::write_back_impl()
+{
+    LOCKER(m_lock);
+    // Write back everything that has been dirty for too long, then keep going
+    // while there's more dirty data than we want to keep around.
+    while (write_back_oldest_blocks(WRITEBACK_BATCH_SIZE, true))
+        ;
+    while (cache().dirty_count() * 100 > cache().entry_count() * WritebackTask::dirty_background_percent) {
+        if (!write_back_oldest_blocks(WRITEBACK_BATCH_SIZE))
+            break;
+    }
+}
+
+void FileBackedFS::write_back()
+{
+    write_back_impl();
 }
 
 void FileBackedFS::flush_writes_impl()
@@ -275,16 +536,7 @@ void FileBackedFS::flush_writes_impl()
     LOCKER(m_lock);
     if (!cache().is_dirty())
         return;
-    u32 count = 0;
-    cache().for_each_entry([&](CacheEntry& entry) {
-        if (!entry.is_dirty)
-            return;
-        u32 base_offset = static_cast<u32>(entry.block_index) * static_cast<u32>(block_size());
-        m_file_description->seek(base_offset, SEEK_SET);
-        m_file_description->write(entry.data, block_size());
-        ++count;
-        entry.is_dirty = false;
-    });
+    size_t count = write_back_oldest_blocks(cache().dirty_count());
     cache().set_dirty(false);
     dbg() << class_name() << ": Flushed " << count << " blocks to disk";
 }
@@ -26,6 +26,8 @@
 
 #pragma once
 
+#include <AK/Vector.h>
+#include <Kernel/Devices/BlockDevice.h>
 #include <Kernel/FileSystem/FileDescription.h>
 #include <Kernel/FileSystem/FileSystem.h>
 #include <Kernel/Forward.h>
@@ -42,8 +44,17 @@ public:
     const FileDescription& file_description() const { return *m_file_description; }
 
     virtual void flush_writes() override;
+    virtual void write_back() override;
 
     void flush_writes_impl();
+    void write_back_impl();
+
+    // Writes back up to max_count of the longest dirty blocks. Returns how many were written.
+    size_t write_back_oldest_blocks(size_t max_count, bool only_expired = false);
+
+    static size_t dirty_block_count();
+    static size_t writeback_block_count();
+    static size_t throttled_write_count();
 
     size_t logical_block_size() const { return m_logical_block_size; };
 
@@ -62,6 +73,16 @@ protected:
     bool write_block(unsigned index, const u8* buffer, size_t count, size_t offset = 0, bool allow_cache = true);
     bool write_blocks(unsigned index, unsigned count, const u8*, bool allow_cache = true);
 
+    struct BlockTransfer {
+        unsigned index { 0 };
+        u8* data { nullptr };
+    };
+
+    // Read or write whole blocks around the cache. When the file system lives on a block device,
+    // all of the transfers are submitted to it at once, and then waited for together.
+    bool read_blocks_directly(const Vector<BlockTransfer, 16>&) const;
+    bool write_blocks_directly(const Vector<BlockTransfer, 16>&);
+
     size_t m_logical_block_size { 512 };
 
 private:
@@ -69,6 +90,9 @@ private:
 
     DiskCache& cache() const;
     void flush_specific_block_if_needed(unsigned index);
+    void balance_dirty_blocks();
+    void update_cached_block_if_needed(unsigned index, const u8* data, size_t count, size_t offset);
+    bool transfer_blocks(AsyncBlockDeviceRequest::Type, const Vector<BlockTransfer, 16>&);
 
     mutable NonnullRefPtr<FileDescription> m_file_description;
     mutable OwnPtr<DiskCache> m_cache;
@@ -28,6 +28,7 @@
 #include <Kernel/Devices/BlockDevice.h>
 #include <Kernel/Devices/CharacterDevice.h>
 #include <Kernel/FileSystem/Custody.h>
+#include <Kernel/FileSystem/EventPoll.h>
 #include <Kernel/FileSystem/FIFO.h>
 #include <Kernel/FileSystem/FileDescription.h>
 #include <Kernel/FileSystem/FileSystem.h>
@@ -70,6 +71,9 @@ FileDescription::~FileDescription()
         socket()->detach(*this);
     if (is_fifo())
         static_cast<FIFO*>(m_file.ptr())->detach(m_fifo_direction);
+    m_file->detach_event_poll_interests({}, *this);
+    if (m_file->is_event_poll())
+        static_cast<EventPoll&>(*m_file).remove_all_interests({});
     m_file->close();
     m_inode = nullptr;
 }
@@ -148,6 +152,24 @@ ssize_t FileDescription::write(const u8* data, ssize_t size)
     return nwritten;
 }
 
+ssize_t FileDescription::read_at(off_t offset, u8* buffer, ssize_t count)
+{
+    // We don't touch m_current_offset, so there's no need to take m_lock and make
+    // threads reading different parts of the file take turns.
+    if ((offset + count) < 0)
+        return -EOVERFLOW;
+    SmapDisabler disabler;
+    return m_file->read(*this, offset, buffer, count);
+}
+
+ssize_t FileDescription::write_at(off_t offset, const u8* data, ssize_t size)
+{
+    if ((offset + size) < 0)
+        return -EOVERFLOW;
+    SmapDisabler disabler;
+    return m_file->write(*this, offset, data, size);
+}
+
 bool FileDescription::can_write() const
 {
     return m_file->can_write(*this, offset());
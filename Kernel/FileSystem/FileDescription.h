@@ -70,6 +70,10 @@ public:
     off_t seek(off_t, int whence);
     ssize_t read(u8*, ssize_t);
     ssize_t write(const u8* data, ssize_t);
+
+    // Read or write at the given offset, leaving the current offset alone.
+    ssize_t read_at(off_t, u8*, ssize_t);
+    ssize_t write_at(off_t, const u8* data, ssize_t);
     KResult fstat(stat&);
 
     KResult chmod(mode_t);
@@ -125,7 +129,7 @@ public:
 
     bool is_fifo() const;
     FIFO* fifo();
-    FIFO::Direction fifo_direction() { return m_fifo_direction; }
+    FIFO::Direction fifo_direction() const { return m_fifo_direction; }
     void set_fifo_direction(Badge<FIFO>, FIFO::Direction direction) { m_fifo_direction = direction; }
 
     Optional<KBuffer>& generator_cache() { return m_generator_cache; }
@@ -52,6 +52,7 @@ public:
     unsigned fsid() const { return m_fsid; }
     static FS* from_fsid(u32);
     static void sync();
+    static void write_back_all();
     static void lock_all();
 
     virtual bool initialize() = 0;
@@ -68,6 +69,13 @@ public:
 
     virtual KResult prepare_to_unmount() const { return KSuccess; }
 
+    // How fragmented the free space is, for file systems that keep track of blocks.
+    struct FreeSpaceInfo {
+        unsigned free_extent_count { 0 };
+        unsigned largest_free_extent { 0 };
+    };
+    virtual FreeSpaceInfo free_space_info() const { return {}; }
+
     // FIXME: This data structure is very clunky and unpleasant. Replace it with something nicer.
     struct DirectoryEntry {
         DirectoryEntry(const char* name, InodeIdentifier, u8 file_type);
@@ -85,6 +93,9 @@ public:
 
     virtual void flush_writes() { }
 
+    // Writes back the data that has been dirty for a while, or that there's too much of.
+    virtual void write_back() { flush_writes(); }
+
     size_t block_size() const { return m_block_size; }
 
     virtual bool is_file_backed() const { return false; }
@@ -32,6 +32,7 @@
 #include <Kernel/FileSystem/InodeWatcher.h>
 #include <Kernel/FileSystem/VirtualFileSystem.h>
 #include <Kernel/Net/LocalSocket.h>
+#include <Kernel/VM/PageCache.h>
 #include <Kernel/VM/SharedInodeVMObject.h>
 
 namespace Kernel {
@@ -61,6 +62,40 @@ void Inode::sync()
     }
 }
 
+size_t Inode::release_clean_cached_pages()
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    size_t count = 0;
+    for (auto& inode : all_inodes()) {
+        // Skip caches that are in use, we might be allocating a page for one of them right now.
+        if (!inode.m_page_cache || inode.m_lock.is_locked())
+            continue;
+        count += inode.m_page_cache->release_clean_pages();
+    }
+    return count;
+}
+
+PageCache& Inode::page_cache() const
+{
+    ASSERT(uses_page_cache());
+    LOCKER(m_lock);
+    if (!m_page_cache)
+        m_page_cache = make<PageCache>(const_cast<Inode&>(*this));
+    return *m_page_cache;
+}
+
+KResult Inode::read_pages_from_disk(size_t, size_t, u8*) const
+{
+    ASSERT_NOT_REACHED();
+    return KResult(-EINVAL);
+}
+
+KResult Inode::write_pages_to_disk(size_t, size_t, const u8*)
+{
+    ASSERT_NOT_REACHED();
+    return KResult(-EINVAL);
+}
+
 KResultOr<ByteBuffer> Inode::read_entire(FileDescription* descriptor) const
 {
     size_t initial_size = metadata().size ? metadata().size : 4096;
@@ -117,6 +152,9 @@ Inode::Inode(FS& fs, unsigned index)
 Inode::~Inode()
 {
     all_inodes().remove(this);
+    // Watchers report EOF once we're gone, so wake up anyone reading from them.
+    for (auto& watcher : m_watchers)
+        watcher->evaluate_block_conditions();
 }
 
 void Inode::will_be_destroyed()
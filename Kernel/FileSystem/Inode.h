@@ -29,6 +29,7 @@
 #include <AK/Function.h>
 #include <AK/HashTable.h>
 #include <AK/InlineLinkedList.h>
+#include <AK/OwnPtr.h>
 #include <AK/RefCounted.h>
 #include <AK/String.h>
 #include <AK/WeakPtr.h>
@@ -46,6 +47,7 @@ class Inode : public RefCounted<Inode>
     , public InlineLinkedListNode<Inode> {
     friend class VFS;
     friend class FS;
+    friend class PageCache;
 
 public:
     virtual ~Inode();
@@ -103,7 +105,14 @@ public:
     SharedInodeVMObject* shared_vmobject() { return m_shared_vmobject.ptr(); }
     const SharedInodeVMObject* shared_vmobject() const { return m_shared_vmobject.ptr(); }
 
+    // Inodes that return true here keep their data in a PageCache, and move it to and
+    // from the disk in whole pages with read_pages_from_disk() and write_pages_to_disk().
+    virtual bool uses_page_cache() const { return false; }
+    PageCache& page_cache() const;
+    PageCache* existing_page_cache() const { return m_page_cache.ptr(); }
+
     static void sync();
+    static size_t release_clean_cached_pages();
 
     bool has_watchers() const { return !m_watchers.is_empty(); }
 
@@ -121,12 +130,16 @@ protected:
     void inode_size_changed(size_t old_size, size_t new_size);
     KResult prepare_to_write_data();
 
+    virtual KResult read_pages_from_disk(size_t first_page_index, size_t page_count, u8* buffer) const;
+    virtual KResult write_pages_to_disk(size_t first_page_index, size_t page_count, const u8* data);
+
     mutable Lock m_lock { "Inode" };
 
 private:
     FS& m_fs;
     unsigned m_index { 0 };
     WeakPtr<SharedInodeVMObject> m_shared_vmobject;
+    mutable OwnPtr<PageCache> m_page_cache;
     RefPtr<LocalSocket> m_socket;
     HashTable<InodeWatcher*> m_watchers;
     bool m_metadata_dirty { false };
@@ -55,6 +55,7 @@
 #include <Kernel/StdLib.h>
 #include <Kernel/TTY/TTY.h>
 #include <Kernel/VM/MemoryManager.h>
+#include <Kernel/VM/PageCache.h>
 #include <Kernel/VM/PurgeableVMObject.h>
 #include <LibC/errno_numbers.h>
 
@@ -295,7 +296,7 @@ Optional<KBuffer> procfs$pid_vm(InodeIdentifier identifier)
     KBufferBuilder builder;
     JsonArraySerializer array { builder };
     for (auto& region : process.regions()) {
-        if (!region.is_user_accessible() && !Process::current->is_superuser())
+        if (!region.is_user_accessible() && !Process::current()->is_superuser())
             continue;
         auto region_object = array.add_object();
         region_object.add("readable", region.is_readable());
@@ -314,6 +315,7 @@ Optional<KBuffer> procfs$pid_vm(InodeIdentifier identifier)
         region_object.add("amount_resident", region.amount_resident());
         region_object.add("amount_dirty", region.amount_dirty());
         region_object.add("cow_pages", region.cow_pages());
+        region_object.add("large_pages", region.large_page_count());
         region_object.add("name", region.name());
         region_object.add("vmobject", region.vmobject().class_name());
 
@@ -438,7 +440,7 @@ Optional<KBuffer> procfs$profile(InodeIdentifier)
     object.add("executable", Profiling::executable_path());
 
     auto array = object.add_array("events");
-    bool mask_kernel_addresses = !Process::current->is_superuser();
+    bool mask_kernel_addresses = !Process::current()->is_superuser();
     Profiling::for_each_sample([&](auto& sample) {
         auto object = array.add_object();
         object.add("type", "sample");
@@ -481,6 +483,19 @@ Optional<KBuffer> procfs$net_adapters(InodeIdentifier)
         obj.add("bytes_out", adapter.bytes_out());
         obj.add("link_up", adapter.link_up());
         obj.add("mtu", adapter.mtu());
+        auto ring_statistics = adapter.ring_statistics();
+        if (ring_statistics.tx_ring_size) {
+            obj.add("tx_ring_size", ring_statistics.tx_ring_size);
+            obj.add("tx_in_flight", ring_statistics.tx_in_flight);
+            obj.add("tx_completed", ring_statistics.tx_completed);
+            obj.add("tx_errors", ring_statistics.tx_errors);
+            obj.add("tx_ring_full_waits", ring_statistics.tx_ring_full_waits);
+        }
+        if (ring_statistics.rx_ring_size) {
+            obj.add("rx_ring_size", ring_statistics.rx_ring_size);
+            obj.add("rx_received", ring_statistics.rx_received);
+            obj.add("rx_overruns", ring_statistics.rx_overruns);
+        }
     });
     array.finish();
     return builder.build();
@@ -517,6 +532,12 @@ Optional<KBuffer> procfs$net_tcp(InodeIdentifier)
         obj.add("bytes_in", socket.bytes_in());
         obj.add("packets_out", socket.packets_out());
         obj.add("bytes_out", socket.bytes_out());
+        obj.add("send_mss", socket.send_mss());
+        obj.add("congestion_window", socket.congestion_window());
+        obj.add("slow_start_threshold", socket.slow_start_threshold());
+        obj.add("smoothed_rtt_usec", socket.smoothed_rtt());
+        obj.add("retransmit_timeout_ms", socket.retransmit_timeout());
+        obj.add("retransmissions", socket.retransmissions());
     });
     array.finish();
     return builder.build();
@@ -676,7 +697,7 @@ Optional<KBuffer> procfs$pid_root(InodeIdentifier identifier)
 Optional<KBuffer> procfs$self(InodeIdentifier)
 {
     char buffer[16];
-    sprintf(buffer, "%u", Process::current->pid());
+    sprintf(buffer, "%u", Process::current()->pid());
     return KBuffer::copy((const u8*)buffer, strlen(buffer));
 }
 
@@ -741,6 +762,9 @@ Optional<KBuffer> procfs$df(InodeIdentifier)
         fs_object.add("free_block_count", fs.free_block_count());
         fs_object.add("total_inode_count", fs.total_inode_count());
         fs_object.add("free_inode_count", fs.free_inode_count());
+        auto free_space_info = fs.free_space_info();
+        fs_object.add("free_extent_count", free_space_info.free_extent_count);
+        fs_object.add("largest_free_extent", free_space_info.largest_free_extent);
         fs_object.add("mount_point", mount.absolute_path());
         fs_object.add("block_size", static_cast<u64>(fs.block_size()));
         fs_object.add("readonly", fs.is_readonly());
@@ -828,14 +852,30 @@ Optional<KBuffer> procfs$memstat(InodeIdentifier)
     json.add("kmalloc_eternal_allocated", g_kmalloc_bytes_eternal);
     json.add("user_physical_allocated", MM.user_physical_pages_used());
     json.add("user_physical_available", MM.user_physical_pages() - MM.user_physical_pages_used());
+    json.add("user_physical_zeroed", MM.zeroed_user_physical_pages());
     json.add("super_physical_allocated", MM.super_physical_pages_used());
     json.add("super_physical_available", MM.super_physical_pages() - MM.super_physical_pages_used());
+    json.add("page_cache_pages", PageCache::total_page_count());
+    json.add("page_cache_dirty_pages", PageCache::total_dirty_page_count());
+    json.add("page_cache_writeback_pages", PageCache::total_writeback_page_count());
+    json.add("page_cache_throttled_writes", PageCache::throttled_write_count());
+    json.add("disk_cache_dirty_blocks", FileBackedFS::dirty_block_count());
+    json.add("disk_cache_writeback_blocks", FileBackedFS::writeback_block_count());
+    json.add("disk_cache_throttled_writes", FileBackedFS::throttled_write_count());
     json.add("kmalloc_call_count", g_kmalloc_call_count);
     json.add("kfree_call_count", g_kfree_call_count);
-    slab_alloc_stats([&json](size_t slab_size, size_t num_allocated, size_t num_free) {
+    kmalloc_size_class_stats([&json](size_t size, size_t slab_count, size_t allocated, size_t free) {
+        auto prefix = String::format("kmalloc_%zu", size);
+        json.add(String::format("%s_num_slabs", prefix.characters()), slab_count);
+        json.add(String::format("%s_num_allocated", prefix.characters()), allocated);
+        json.add(String::format("%s_num_free", prefix.characters()), free);
+    });
+    slab_alloc_stats([&json](size_t slab_size, size_t num_allocated, size_t num_free, size_t num_hits, size_t num_misses) {
         auto prefix = String::format("slab_%zu", slab_size);
         json.add(String::format("%s_num_allocated", prefix.characters()), num_allocated);
         json.add(String::format("%s_num_free", prefix.characters()), num_free);
+        json.add(String::format("%s_cache_hits", prefix.characters()), num_hits);
+        json.add(String::format("%s_cache_misses", prefix.characters()), num_misses);
     });
     json.finish();
     return builder.build();
@@ -902,6 +942,9 @@ Optional<KBuffer> procfs$all(InodeIdentifier)
             thread_object.add("state", thread.state_string());
             thread_object.add("priority", thread.priority());
             thread_object.add("effective_priority", thread.effective_priority());
+            thread_object.add("cpu", thread.cpu());
+            thread_object.add("affinity_mask", thread.affinity_mask());
+            thread_object.add("migrations", thread.migration_count());
             thread_object.add("syscall_count", thread.syscall_count());
             thread_object.add("inode_faults", thread.inode_faults());
             thread_object.add("zero_faults", thread.zero_faults());
@@ -28,12 +28,15 @@
 
 namespace Kernel {
 
+class BlockCondition;
 class BlockDevice;
 class CharacterDevice;
 class Custody;
 class Device;
 class DiskCache;
 class DoubleBuffer;
+class EventPoll;
+struct EventPollInterest;
 class File;
 class FileDescription;
 class IPv4Socket;
@@ -45,6 +48,7 @@ class KBuffer;
 class KResult;
 class LocalSocket;
 class MappedROM;
+class PageCache;
 class PageDirectory;
 class PerformanceEventBuffer;
 class PhysicalPage;
@@ -26,12 +26,24 @@
 
 #include <AK/Assertions.h>
 #include <AK/Memory.h>
+#include <Kernel/Arch/i386/CPU.h>
 #include <Kernel/Heap/SlabAllocator.h>
 #include <Kernel/Heap/kmalloc.h>
+#include <Kernel/KBuffer.h>
+#include <Kernel/SpinLock.h>
+#include <Kernel/VM/PhysicalPage.h>
 #include <Kernel/VM/Region.h>
 
 #define SANITIZE_SLABS
 
+// Each processor keeps a few free slabs of every size to itself, so that
+// allocating and freeing usually doesn't touch the shared free list.
+#define SLAB_MAGAZINE_SIZE 16
+// How many slabs move between a magazine and the shared free list at once.
+#define SLAB_MAGAZINE_BATCH 8
+// How much the shared free list grows by when it runs dry.
+#define SLAB_GROWTH_PAGES 4
+
 namespace Kernel {
 
 template<size_t templated_slab_size>
@@ -41,17 +53,17 @@ public:
 
     void init(size_t size)
     {
-        m_base = kmalloc_eternal(size);
-        m_end = (u8*)m_base + size;
-        FreeSlab* slabs = (FreeSlab*)m_base;
-        size_t slab_count = size / templated_slab_size;
-        for (size_t i = 1; i < slab_count; ++i) {
-            slabs[i].next = &slabs[i - 1];
+        m_freelist = nullptr;
+        m_num_total = 0;
+        m_num_free = 0;
+        for (auto& magazine : m_magazines) {
+            magazine.count = 0;
+            magazine.hits = 0;
+            magazine.misses = 0;
         }
-        slabs[0].next = nullptr;
-        m_freelist = &slabs[slab_count - 1];
-        m_num_allocated = 0;
-        m_num_free = slab_count;
+        m_lock.unlock();
+        if (size)
+            grow(PAGE_ROUND_UP(size) / PAGE_SIZE);
     }
 
     constexpr size_t slab_size() const { return templated_slab_size; }
@@ -59,13 +71,14 @@ public:
     void* alloc()
     {
         InterruptDisabler disabler;
-        if (!m_freelist)
-            return kmalloc(slab_size());
-        ASSERT(m_freelist);
-        void* ptr = m_freelist;
-        m_freelist = m_freelist->next;
-        ++m_num_allocated;
-        --m_num_free;
+        auto& magazine = m_magazines[Processor::current().id()];
+        if (magazine.count) {
+            ++magazine.hits;
+        } else {
+            ++magazine.misses;
+            refill(magazine);
+        }
+        void* ptr = magazine.objects[--magazine.count];
 #ifdef SANITIZE_SLABS
         memset(ptr, SLAB_ALLOC_SCRUB_BYTE, slab_size());
 #endif
@@ -76,22 +89,44 @@ public:
     {
         InterruptDisabler disabler;
         ASSERT(ptr);
-        if (ptr < m_base || ptr >= m_end) {
-            kfree(ptr);
-            return;
-        }
-        ((FreeSlab*)ptr)->next = m_freelist;
 #ifdef SANITIZE_SLABS
         if (slab_size() > sizeof(FreeSlab*))
             memset(((FreeSlab*)ptr)->padding, SLAB_DEALLOC_SCRUB_BYTE, sizeof(FreeSlab::padding));
 #endif
-        m_freelist = (FreeSlab*)ptr;
-        ++m_num_allocated;
-        --m_num_free;
+        auto& magazine = m_magazines[Processor::current().id()];
+        if (magazine.count == SLAB_MAGAZINE_SIZE) {
+            ++magazine.misses;
+            flush(magazine);
+        } else {
+            ++magazine.hits;
+        }
+        magazine.objects[magazine.count++] = ptr;
     }
 
-    size_t num_allocated() const { return m_num_allocated; }
-    size_t num_free() const { return m_num_free; }
+    size_t num_allocated() const { return m_num_total - num_free(); }
+    size_t num_free() const
+    {
+        size_t count = m_num_free;
+        for (auto& magazine : m_magazines)
+            count += magazine.count;
+        return count;
+    }
+
+    size_t num_hits() const
+    {
+        size_t count = 0;
+        for (auto& magazine : m_magazines)
+            count += magazine.hits;
+        return count;
+    }
+
+    size_t num_misses() const
+    {
+        size_t count = 0;
+        for (auto& magazine : m_magazines)
+            count += magazine.misses;
+        return count;
+    }
 
 private:
     struct FreeSlab {
@@ -99,12 +134,62 @@ private:
         char padding[templated_slab_size - sizeof(FreeSlab*)];
     };
 
+    struct Magazine {
+        size_t count;
+        size_t hits;
+        size_t misses;
+        void* objects[SLAB_MAGAZINE_SIZE];
+    };
+
+    void grow(size_t page_count)
+    {
+        // NOTE: This may end up back in here for the same size (MemoryManager allocates
+        //       Regions while growing the heap), so the lock can't be held across it.
+        auto* slabs = (FreeSlab*)kmalloc_pages(page_count);
+        size_t slab_count = page_count * PAGE_SIZE / templated_slab_size;
+        for (size_t i = 1; i < slab_count; ++i)
+            slabs[i].next = &slabs[i - 1];
+        ScopedSpinLock lock(m_lock);
+        slabs[0].next = m_freelist;
+        m_freelist = &slabs[slab_count - 1];
+        m_num_total += slab_count;
+        m_num_free += slab_count;
+    }
+
+    void refill(Magazine& magazine)
+    {
+        for (;;) {
+            {
+                ScopedSpinLock lock(m_lock);
+                while (m_freelist && magazine.count < SLAB_MAGAZINE_BATCH) {
+                    magazine.objects[magazine.count++] = m_freelist;
+                    m_freelist = m_freelist->next;
+                    --m_num_free;
+                }
+            }
+            if (magazine.count)
+                return;
+            grow(SLAB_GROWTH_PAGES);
+        }
+    }
+
+    void flush(Magazine& magazine)
+    {
+        ScopedSpinLock lock(m_lock);
+        while (magazine.count > SLAB_MAGAZINE_SIZE - SLAB_MAGAZINE_BATCH) {
+            auto* slab = (FreeSlab*)magazine.objects[--magazine.count];
+            slab->next = m_freelist;
+            m_freelist = slab;
+            ++m_num_free;
+        }
+    }
+
     // NOTE: These are not default-initialized to prevent an init-time constructor from overwriting them
     FreeSlab* m_freelist;
-    size_t m_num_allocated;
+    size_t m_num_total;
     size_t m_num_free;
-    void* m_base;
-    void* m_end;
+    SpinLock m_lock;
+    Magazine m_magazines[MAX_PROCESSORS];
 
     static_assert(sizeof(FreeSlab) == templated_slab_size);
 };
@@ -112,8 +197,14 @@ private:
 static SlabAllocator<16> s_slab_allocator_16;
 static SlabAllocator<32> s_slab_allocator_32;
 static SlabAllocator<64> s_slab_allocator_64;
+static SlabAllocator<128> s_slab_allocator_128;
+static SlabAllocator<256> s_slab_allocator_256;
+static SlabAllocator<512> s_slab_allocator_512;
+static SlabAllocator<1024> s_slab_allocator_1024;
 
-static_assert(sizeof(Region) <= s_slab_allocator_64.slab_size());
+static_assert(sizeof(Region) <= s_slab_allocator_128.slab_size());
+static_assert(sizeof(PhysicalPage) <= s_slab_allocator_16.slab_size());
+static_assert(sizeof(KBufferImpl) <= s_slab_allocator_32.slab_size());
 
 template<typename Callback>
 void for_each_allocator(Callback callback)
@@ -121,13 +212,22 @@ void for_each_allocator(Callback callback)
     callback(s_slab_allocator_16);
     callback(s_slab_allocator_32);
     callback(s_slab_allocator_64);
+    callback(s_slab_allocator_128);
+    callback(s_slab_allocator_256);
+    callback(s_slab_allocator_512);
+    callback(s_slab_allocator_1024);
 }
 
 void slab_alloc_init()
 {
-    s_slab_allocator_16.init(128 * KB);
-    s_slab_allocator_32.init(128 * KB);
-    s_slab_allocator_64.init(512 * KB);
+    // Start out with enough for booting, everything else grows on demand.
+    s_slab_allocator_16.init(64 * KB);
+    s_slab_allocator_32.init(64 * KB);
+    s_slab_allocator_64.init(64 * KB);
+    s_slab_allocator_128.init(128 * KB);
+    s_slab_allocator_256.init(0);
+    s_slab_allocator_512.init(0);
+    s_slab_allocator_1024.init(0);
 }
 
 void* slab_alloc(size_t slab_size)
@@ -138,6 +238,14 @@ void* slab_alloc(size_t slab_size)
         return s_slab_allocator_32.alloc();
     if (slab_size <= 64)
         return s_slab_allocator_64.alloc();
+    if (slab_size <= 128)
+        return s_slab_allocator_128.alloc();
+    if (slab_size <= 256)
+        return s_slab_allocator_256.alloc();
+    if (slab_size <= 512)
+        return s_slab_allocator_512.alloc();
+    if (slab_size <= 1024)
+        return s_slab_allocator_1024.alloc();
     ASSERT_NOT_REACHED();
 }
 
@@ -149,13 +257,21 @@ void slab_dealloc(void* ptr, size_t slab_size)
         return s_slab_allocator_32.dealloc(ptr);
     if (slab_size <= 64)
         return s_slab_allocator_64.dealloc(ptr);
+    if (slab_size <= 128)
+        return s_slab_allocator_128.dealloc(ptr);
+    if (slab_size <= 256)
+        return s_slab_allocator_256.dealloc(ptr);
+    if (slab_size <= 512)
+        return s_slab_allocator_512.dealloc(ptr);
+    if (slab_size <= 1024)
+        return s_slab_allocator_1024.dealloc(ptr);
     ASSERT_NOT_REACHED();
 }
 
-void slab_alloc_stats(Function<void(size_t slab_size, size_t allocated, size_t free)> callback)
+void slab_alloc_stats(Function<void(size_t slab_size, size_t allocated, size_t free, size_t hits, size_t misses)> callback)
 {
     for_each_allocator([&](auto& allocator) {
-        callback(allocator.slab_size(), allocator.num_allocated(), allocator.num_free());
+        callback(allocator.slab_size(), allocator.num_allocated(), allocator.num_free(), allocator.num_hits(), allocator.num_misses());
     });
 }
 
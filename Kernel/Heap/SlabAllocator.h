@@ -37,7 +37,8 @@ namespace Kernel {
 void* slab_alloc(size_t slab_size);
 void slab_dealloc(void*, size_t slab_size);
 void slab_alloc_init();
-void slab_alloc_stats(Function<void(size_t slab_size, size_t allocated, size_t free)>);
+// hits and misses count how often the per-processor caches could serve a request on their own.
+void slab_alloc_stats(Function<void(size_t slab_size, size_t allocated, size_t free, size_t hits, size_t misses)>);
 
 #define MAKE_SLAB_ALLOCATED(type)                                        \
 public:                                                                  \
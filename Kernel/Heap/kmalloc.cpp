@@ -25,13 +25,24 @@
  */
 
 /*
- * Really really *really* Q&D malloc() and free() implementations
- * just to get going. Don't ever let anyone see this shit. :^)
+ * Segregated-fit kernel heap.
+ *
+ * Small allocations are rounded up to one of a handful of size classes. Every
+ * size class carves whole pages ("slabs") into equally sized objects and keeps
+ * a free list per slab, so allocating and freeing is a couple of pointer moves.
+ * Allocations too big for any size class get a run of whole pages.
+ *
+ * The pages come from arenas: the 3 MB pool set up at boot, plus whatever the
+ * heap grows into later by asking MemoryManager for more kernel memory.
+ * Really big allocations get a kernel region of their own.
  */
 
 #include <AK/Assertions.h>
 #include <AK/Bitmap.h>
+#include <AK/Function.h>
 #include <AK/Optional.h>
+#include <AK/StringView.h>
+#include <AK/TemporaryChange.h>
 #include <AK/Types.h>
 #include <Kernel/Arch/i386/CPU.h>
 #include <Kernel/Heap/kmalloc.h>
@@ -39,25 +50,101 @@
 #include <Kernel/Process.h>
 #include <Kernel/Scheduler.h>
 #include <Kernel/StdLib.h>
+#include <Kernel/VM/MemoryManager.h>
+#include <Kernel/VM/Region.h>
+#include <Kernel/WaitQueue.h>
 
-#define SANITIZE_KMALLOC
-
-struct AllocationHeader {
-    size_t allocation_size_in_chunks;
-    u8 data[0];
-};
+//#define SANITIZE_KMALLOC
 
 #define BASE_PHYSICAL (0xc0000000 + (4 * MB))
-#define CHUNK_SIZE 32
 #define POOL_SIZE (3 * MB)
 
 #define ETERNAL_BASE_PHYSICAL (0xc0000000 + (2 * MB))
 #define ETERNAL_RANGE_SIZE (2 * MB)
 
-static u8 alloc_map[POOL_SIZE / CHUNK_SIZE / 8];
+// Arenas added at runtime are this big, and there can only be so many of them.
+#define EXPANSION_SIZE (1 * MB)
+#define MAX_ARENAS 32
+#define MAX_ARENA_PAGES (POOL_SIZE / PAGE_SIZE)
+
+// Start growing the heap when it gets down to this many free pages. This is done
+// by the finalizer rather than from inside kmalloc(), since the allocation that
+// crosses the line may come from inside MemoryManager itself.
+#define EXPANSION_WATERMARK_PAGES 128
+
+// Allocations this many pages or bigger get a kernel region of their own.
+#define REGION_ALLOCATION_PAGES 64
+
+#define SLAB_MAGIC 0x51ab51ab
+#define LARGE_MAGIC 0xb19a110c
+
+struct Arena {
+    u8* base;
+    size_t page_count;
+    size_t free_page_count;
+    u8 page_map[MAX_ARENA_PAGES / 8];
+};
+
+struct FreeObject {
+    FreeObject* next;
+};
+
+// Sits at the start of every page that is carved up for a size class.
+struct SlabHeader {
+    u32 magic;
+    u16 size_class;
+    u16 free_count;
+    FreeObject* freelist;
+    SlabHeader* prev;
+    SlabHeader* next;
+    Arena* arena;
+    u8 padding[8];
+};
+
+static_assert(sizeof(SlabHeader) == 32);
+
+// Sits at the start of the pages backing an allocation that is too big for any size class.
+struct LargeHeader {
+    u32 magic;
+    u32 page_count;
+    Arena* arena;
+    Kernel::Region* region;
+};
+
+static_assert(sizeof(LargeHeader) == 16);
+
+struct SizeClass {
+    size_t size;
+    SlabHeader* partial_slabs { nullptr };
+    size_t slab_count { 0 };
+    size_t allocated { 0 };
+    size_t free { 0 };
+
+    size_t objects_per_slab() const { return (PAGE_SIZE - sizeof(SlabHeader)) / size; }
+};
+
+// The bigger classes are picked so that they fill a page with little left over.
+static SizeClass s_size_classes[] = {
+    { 16 }, { 32 }, { 48 }, { 64 }, { 80 }, { 96 }, { 112 }, { 128 }, { 160 }, { 192 }, { 224 }, { 256 },
+    { 336 }, { 400 }, { 496 }, { 672 }, { 1008 }, { 2032 }
+};
+
+static constexpr size_t size_class_count = sizeof(s_size_classes) / sizeof(s_size_classes[0]);
+static constexpr size_t size_class_granularity = 16;
+static constexpr size_t largest_size_class = 2032;
+
+// Which size class a given size (in units of size_class_granularity, rounded up) goes into.
+static u8 s_size_class_for[largest_size_class / size_class_granularity + 1];
+
+static Arena s_arenas[MAX_ARENAS];
+static size_t s_arena_count;
+static size_t s_free_page_count;
+static bool s_expansion_enabled;
+static bool s_expansion_requested;
+static bool s_expanding;
 
 size_t g_kmalloc_bytes_allocated = 0;
-size_t g_kmalloc_bytes_free = POOL_SIZE;
+size_t g_kmalloc_bytes_free = 0;
 size_t g_kmalloc_bytes_eternal = 0;
 size_t g_kmalloc_call_count;
 size_t g_kfree_call_count;
@@ -66,19 +153,306 @@ bool g_dump_kmalloc_stacks;
 static u8* s_next_eternal_ptr;
 static u8* s_end_of_eternal_range;
 
+static void add_arena(u8* base, size_t size)
+{
+    ASSERT(s_arena_count < MAX_ARENAS);
+    ASSERT(size <= POOL_SIZE);
+    auto& arena = s_arenas[s_arena_count++];
+    arena.base = base;
+    arena.page_count = size / PAGE_SIZE;
+    arena.free_page_count = arena.page_count;
+    memset(arena.page_map, 0, sizeof(arena.page_map));
+    s_free_page_count += arena.page_count;
+    g_kmalloc_bytes_free += size;
+}
+
 void kmalloc_init()
 {
-    memset(&alloc_map, 0, sizeof(alloc_map));
     memset((void*)BASE_PHYSICAL, 0, POOL_SIZE);
 
     g_kmalloc_bytes_eternal = 0;
     g_kmalloc_bytes_allocated = 0;
-    g_kmalloc_bytes_free = POOL_SIZE;
+    g_kmalloc_bytes_free = 0;
+
+    s_arena_count = 0;
+    s_free_page_count = 0;
+    s_expansion_enabled = false;
+    s_expansion_requested = false;
+    s_expanding = false;
+    add_arena((u8*)BASE_PHYSICAL, POOL_SIZE);
+
+    size_t size_class = 0;
+    for (size_t i = 0; i < sizeof(s_size_class_for); ++i) {
+        while (s_size_classes[size_class].size < i * size_class_granularity)
+            ++size_class;
+        s_size_class_for[i] = size_class;
+    }
+    for (auto& size_class : s_size_classes) {
+        size_class.partial_slabs = nullptr;
+        size_class.slab_count = 0;
+        size_class.allocated = 0;
+        size_class.free = 0;
+    }
 
     s_next_eternal_ptr = (u8*)ETERNAL_BASE_PHYSICAL;
     s_end_of_eternal_range = s_next_eternal_ptr + ETERNAL_RANGE_SIZE;
 }
 
+void kmalloc_enable_expansion()
+{
+    s_expansion_enabled = true;
+}
+
+static bool can_ask_memory_manager()
+{
+    return s_expansion_enabled && !s_expanding && !Kernel::Processor::current().in_irq();
+}
+
+static bool expand()
+{
+    if (!can_ask_memory_manager() || s_arena_count == MAX_ARENAS)
+        return false;
+    TemporaryChange<bool> change(s_expanding, true);
+    auto region = MM.allocate_kernel_region(EXPANSION_SIZE, "kmalloc", Kernel::Region::Access::Read | Kernel::Region::Access::Write, false, true);
+    if (!region)
+        return false;
+    add_arena(region->vaddr().as_ptr(), EXPANSION_SIZE);
+    // The heap never gives memory back, so the region stays around for good.
+    region.leak_ptr();
+    return true;
+}
+
+static void request_expansion()
+{
+    if (!s_expansion_enabled || s_expansion_requested || !Kernel::g_finalizer_wait_queue)
+        return;
+    s_expansion_requested = true;
+    Kernel::g_finalizer_has_work = true;
+    Kernel::g_finalizer_wait_queue->wake_all();
+}
+
+void kmalloc_expand_if_needed()
+{
+    Kernel::InterruptDisabler disabler;
+    s_expansion_requested = false;
+    while (s_free_page_count < EXPANSION_WATERMARK_PAGES) {
+        if (!expand())
+            break;
+    }
+}
+
+static u8* allocate_pages(size_t page_count, Arena*& arena_out)
+{
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        for (size_t i = 0; i < s_arena_count; ++i) {
+            auto& arena = s_arenas[i];
+            if (arena.free_page_count < page_count)
+                continue;
+            auto bitmap = Bitmap::wrap(arena.page_map, arena.page_count);
+            auto first_page = bitmap.find_first_fit(page_count);
+            if (!first_page.has_value())
+                continue;
+            bitmap.set_range(first_page.value(), page_count, true);
+            arena.free_page_count -= page_count;
+            s_free_page_count -= page_count;
+            g_kmalloc_bytes_free -= page_count * PAGE_SIZE;
+            arena_out = &arena;
+            if (s_free_page_count < EXPANSION_WATERMARK_PAGES)
+                request_expansion();
+            return arena.base + first_page.value() * PAGE_SIZE;
+        }
+        // We ran dry before the finalizer got around to growing the heap.
+        // Going into MemoryManager from here is a gamble, but it beats panicking.
+        if (attempt == 0 && !expand())
+            break;
+    }
+    return nullptr;
+}
+
+static void deallocate_pages(Arena& arena, u8* pages, size_t page_count)
+{
+    size_t first_page = (pages - arena.base) / PAGE_SIZE;
+    auto bitmap = Bitmap::wrap(arena.page_map, arena.page_count);
+    bitmap.set_range(first_page, page_count, false);
+    arena.free_page_count += page_count;
+    s_free_page_count += page_count;
+    g_kmalloc_bytes_free += page_count * PAGE_SIZE;
+}
+
+[[noreturn]] static void out_of_memory(size_t size)
+{
+    klog() << "kmalloc(): PANIC! Out of memory (no suitable block for size " << size << ")";
+    Kernel::dump_backtrace();
+    Kernel::hang();
+}
+
+static void link_slab(SizeClass& size_class, SlabHeader& slab)
+{
+    slab.prev = nullptr;
+    slab.next = size_class.partial_slabs;
+    if (slab.next)
+        slab.next->prev = &slab;
+    size_class.partial_slabs = &slab;
+}
+
+static void unlink_slab(SizeClass& size_class, SlabHeader& slab)
+{
+    if (slab.prev)
+        slab.prev->next = slab.next;
+    else
+        size_class.partial_slabs = slab.next;
+    if (slab.next)
+        slab.next->prev = slab.prev;
+    slab.prev = nullptr;
+    slab.next = nullptr;
+}
+
+static SlabHeader* allocate_slab(u8 size_class_index)
+{
+    auto& size_class = s_size_classes[size_class_index];
+    Arena* arena = nullptr;
+    auto* page = allocate_pages(1, arena);
+    if (!page)
+        return nullptr;
+
+    auto& slab = *(SlabHeader*)page;
+    slab.magic = SLAB_MAGIC;
+    slab.size_class = size_class_index;
+    slab.arena = arena;
+    slab.freelist = nullptr;
+
+    // Thread the free list front to back, so consecutive allocations are adjacent.
+    size_t object_count = size_class.objects_per_slab();
+    u8* first_object = page + sizeof(SlabHeader);
+    for (size_t i = object_count; i > 0; --i) {
+        auto* object = (FreeObject*)(first_object + (i - 1) * size_class.size);
+        object->next = slab.freelist;
+        slab.freelist = object;
+    }
+    slab.free_count = object_count;
+
+    ++size_class.slab_count;
+    size_class.free += object_count;
+    g_kmalloc_bytes_free += object_count * size_class.size;
+    link_slab(size_class, slab);
+    return &slab;
+}
+
+static void* allocate_from_size_class(size_t size)
+{
+    u8 size_class_index = s_size_class_for[(size + size_class_granularity - 1) / size_class_granularity];
+    auto& size_class = s_size_classes[size_class_index];
+
+    auto* slab = size_class.partial_slabs;
+    if (!slab)
+        slab = allocate_slab(size_class_index);
+    if (!slab)
+        out_of_memory(size);
+
+    auto* object = slab->freelist;
+    slab->freelist = object->next;
+    if (!--slab->free_count)
+        unlink_slab(size_class, *slab);
+
+    ++size_class.allocated;
+    --size_class.free;
+    g_kmalloc_bytes_allocated += size_class.size;
+    g_kmalloc_bytes_free -= size_class.size;
+#ifdef SANITIZE_KMALLOC
+    memset(object, KMALLOC_SCRUB_BYTE, size_class.size);
+#endif
+    return object;
+}
+
+static void deallocate_to_size_class(SlabHeader& slab, void* ptr)
+{
+    auto& size_class = s_size_classes[slab.size_class];
+    ASSERT(((u8*)ptr - ((u8*)&slab + sizeof(SlabHeader))) % size_class.size == 0);
+
+#ifdef SANITIZE_KMALLOC
+    memset(ptr, KFREE_SCRUB_BYTE, size_class.size);
+#endif
+    auto* object = (FreeObject*)ptr;
+    object->next = slab.freelist;
+    slab.freelist = object;
+    if (slab.free_count++ == 0)
+        link_slab(size_class, slab);
+
+    --size_class.allocated;
+    ++size_class.free;
+    g_kmalloc_bytes_allocated -= size_class.size;
+    g_kmalloc_bytes_free += size_class.size;
+
+    // Hand the page back once it's empty, unless it's all the size class has left to allocate from.
+    size_t object_count = size_class.objects_per_slab();
+    if (slab.free_count != object_count || size_class.free - object_count < object_count)
+        return;
+    unlink_slab(size_class, slab);
+    --size_class.slab_count;
+    size_class.free -= object_count;
+    g_kmalloc_bytes_free -= object_count * size_class.size;
+    slab.magic = 0;
+    deallocate_pages(*slab.arena, (u8*)&slab, 1);
+}
+
+static void* allocate_large(size_t size)
+{
+    size_t page_count = PAGE_ROUND_UP(size + sizeof(LargeHeader)) / PAGE_SIZE;
+    LargeHeader* header = nullptr;
+
+    if (page_count >= REGION_ALLOCATION_PAGES && can_ask_memory_manager()) {
+        TemporaryChange<bool> change(s_expanding, true);
+        auto region = MM.allocate_kernel_region(page_count * PAGE_SIZE, "kmalloc large", Kernel::Region::Access::Read | Kernel::Region::Access::Write, false, true);
+        if (region) {
+            header = (LargeHeader*)region->vaddr().as_ptr();
+            header->arena = nullptr;
+            header->region = region.leak_ptr();
+        }
+    }
+
+    if (!header) {
+        Arena* arena = nullptr;
+        auto* pages = allocate_pages(page_count, arena);
+        if (!pages)
+            out_of_memory(size);
+        header = (LargeHeader*)pages;
+        header->arena = arena;
+        header->region = nullptr;
+    }
+
+    header->magic = LARGE_MAGIC;
+    header->page_count = page_count;
+    g_kmalloc_bytes_allocated += page_count * PAGE_SIZE;
+#ifdef SANITIZE_KMALLOC
+    memset(header + 1, KMALLOC_SCRUB_BYTE, page_count * PAGE_SIZE - sizeof(LargeHeader));
+#endif
+    return header + 1;
+}
+
+static void deallocate_large(LargeHeader& header)
+{
+    g_kmalloc_bytes_allocated -= header.page_count * PAGE_SIZE;
+    header.magic = 0;
+    if (header.region) {
+        delete header.region;
+        return;
+    }
+#ifdef SANITIZE_KMALLOC
+    memset(&header + 1, KFREE_SCRUB_BYTE, header.page_count * PAGE_SIZE - sizeof(LargeHeader));
+#endif
+    deallocate_pages(*header.arena, (u8*)&header, header.page_count);
+}
+
+// How much can be stored at ptr, which came from kmalloc().
+static size_t allocation_size(void* ptr)
+{
+    auto* page = (u32*)((FlatPtr)ptr & PAGE_MASK);
+    if (*page == SLAB_MAGIC)
+        return s_size_classes[((SlabHeader*)page)->size_class].size;
+    ASSERT(*page == LARGE_MAGIC);
+    return ((LargeHeader*)page)->page_count * PAGE_SIZE - sizeof(LargeHeader);
+}
+
 void* kmalloc_eternal(size_t size)
 {
     void* ptr = s_next_eternal_ptr;
@@ -88,6 +462,17 @@ void* kmalloc_eternal(size_t size)
     return ptr;
 }
 
+void* kmalloc_pages(size_t page_count)
+{
+    Kernel::InterruptDisabler disabler;
+    Arena* arena = nullptr;
+    u8* pages = allocate_pages(page_count, arena);
+    if (!pages)
+        out_of_memory(page_count * PAGE_SIZE);
+    g_kmalloc_bytes_allocated += page_count * PAGE_SIZE;
+    return pages;
+}
+
 void* kmalloc_aligned(size_t size, size_t alignment)
 {
     void* ptr = kmalloc(size + alignment + sizeof(void*));
@@ -110,23 +495,6 @@ void* kmalloc_page_aligned(size_t size)
     return ptr;
 }
 
-inline void* kmalloc_allocate(size_t first_chunk, size_t chunks_needed)
-{
-    auto* a = (AllocationHeader*)(BASE_PHYSICAL + (first_chunk * CHUNK_SIZE));
-    u8* ptr = a->data;
-    a->allocation_size_in_chunks = chunks_needed;
-
-    Bitmap bitmap_wrapper = Bitmap::wrap(alloc_map, POOL_SIZE / CHUNK_SIZE);
-    bitmap_wrapper.set_range(first_chunk, chunks_needed, true);
-
-    g_kmalloc_bytes_allocated += a->allocation_size_in_chunks * CHUNK_SIZE;
-    g_kmalloc_bytes_free -= a->allocation_size_in_chunks * CHUNK_SIZE;
-#ifdef SANITIZE_KMALLOC
-    memset(ptr, KMALLOC_SCRUB_BYTE, (a->allocation_size_in_chunks * CHUNK_SIZE) - sizeof(AllocationHeader));
-#endif
-    return ptr;
-}
-
 void* kmalloc_impl(size_t size)
 {
     Kernel::InterruptDisabler disabler;
@@ -137,35 +505,9 @@ void* kmalloc_impl(size_t size)
         Kernel::dump_backtrace();
     }
 
-    // We need space for the AllocationHeader at the head of the block.
-    size_t real_size = size + sizeof(AllocationHeader);
-
-    if (g_kmalloc_bytes_free < real_size) {
-        Kernel::dump_backtrace();
-        klog() << "kmalloc(): PANIC! Out of memory\nsum_free=" << g_kmalloc_bytes_free << ", real_size=" << real_size;
-        Kernel::hang();
-    }
-
-    size_t chunks_needed = (real_size + CHUNK_SIZE - 1) / CHUNK_SIZE;
-
-    Bitmap bitmap_wrapper = Bitmap::wrap(alloc_map, POOL_SIZE / CHUNK_SIZE);
-    Optional<size_t> first_chunk;
-
-    // Choose the right politic for allocation.
-    constexpr u32 best_fit_threshold = 128;
-    if (chunks_needed < best_fit_threshold) {
-        first_chunk = bitmap_wrapper.find_first_fit(chunks_needed);
-    } else {
-        first_chunk = bitmap_wrapper.find_best_fit(chunks_needed);
-    }
-
-    if (!first_chunk.has_value()) {
-        klog() << "kmalloc(): PANIC! Out of memory (no suitable block for size " << size << ")";
-        Kernel::dump_backtrace();
-        Kernel::hang();
-    }
-
-    return kmalloc_allocate(first_chunk.value(), chunks_needed);
+    if (size <= largest_size_class)
+        return allocate_from_size_class(size ? size : 1);
+    return allocate_large(size);
 }
 
 void kfree(void* ptr)
@@ -176,18 +518,14 @@ void kfree(void* ptr)
     Kernel::InterruptDisabler disabler;
     ++g_kfree_call_count;
 
-    auto* a = (AllocationHeader*)((((u8*)ptr) - sizeof(AllocationHeader)));
-    FlatPtr start = ((FlatPtr)a - (FlatPtr)BASE_PHYSICAL) / CHUNK_SIZE;
-
-    Bitmap bitmap_wrapper = Bitmap::wrap(alloc_map, POOL_SIZE / CHUNK_SIZE);
-    bitmap_wrapper.set_range(start, a->allocation_size_in_chunks, false);
-
-    g_kmalloc_bytes_allocated -= a->allocation_size_in_chunks * CHUNK_SIZE;
-    g_kmalloc_bytes_free += a->allocation_size_in_chunks * CHUNK_SIZE;
-
-#ifdef SANITIZE_KMALLOC
-    memset(a, KFREE_SCRUB_BYTE, a->allocation_size_in_chunks * CHUNK_SIZE);
-#endif
+    auto* page = (u32*)((FlatPtr)ptr & PAGE_MASK);
+    if (*page == SLAB_MAGIC) {
+        deallocate_to_size_class(*(SlabHeader*)page, ptr);
+        return;
+    }
+    ASSERT(*page == LARGE_MAGIC);
+    ASSERT(ptr == (LargeHeader*)page + 1);
+    deallocate_large(*(LargeHeader*)page);
 }
 
 void* krealloc(void* ptr, size_t new_size)
@@ -197,10 +535,8 @@ void* krealloc(void* ptr, size_t new_size)
 
     Kernel::InterruptDisabler disabler;
 
-    auto* a = (AllocationHeader*)((((u8*)ptr) - sizeof(AllocationHeader)));
-    size_t old_size = a->allocation_size_in_chunks * CHUNK_SIZE;
-
-    if (old_size == new_size)
+    size_t old_size = allocation_size(ptr);
+    if (old_size >= new_size && (new_size > largest_size_class || old_size <= largest_size_class))
         return ptr;
 
     auto* new_ptr = kmalloc(new_size);
@@ -209,6 +545,12 @@ void* krealloc(void* ptr, size_t new_size)
     return new_ptr;
 }
 
+void kmalloc_size_class_stats(Function<void(size_t size, size_t slab_count, size_t allocated, size_t free)> callback)
+{
+    for (auto& size_class : s_size_classes)
+        callback(size_class.size, size_class.slab_count, size_class.allocated, size_class.free);
+}
+
 void* operator new(size_t size)
 {
     return kmalloc(size);
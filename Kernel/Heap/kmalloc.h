@@ -33,14 +33,24 @@
 #define KMALLOC_SCRUB_BYTE 0xbb
 #define KFREE_SCRUB_BYTE 0xaa
 
+namespace AK {
+template<typename>
+class Function;
+}
+
 void kmalloc_init();
+void kmalloc_enable_expansion();
+void kmalloc_expand_if_needed();
 [[gnu::malloc, gnu::returns_nonnull, gnu::alloc_size(1)]] void* kmalloc_impl(size_t);
 [[gnu::malloc, gnu::returns_nonnull, gnu::alloc_size(1)]] void* kmalloc_eternal(size_t);
 [[gnu::malloc, gnu::returns_nonnull, gnu::alloc_size(1)]] void* kmalloc_page_aligned(size_t);
 [[gnu::malloc, gnu::returns_nonnull, gnu::alloc_size(1)]] void* kmalloc_aligned(size_t, size_t alignment);
+// Page-aligned whole pages for allocators layered on top of kmalloc. They can't be kfree()'d.
+[[gnu::malloc, gnu::returns_nonnull]] void* kmalloc_pages(size_t page_count);
 void* krealloc(void*, size_t);
 void kfree(void*);
 void kfree_aligned(void*);
+void kmalloc_size_class_stats(AK::Function<void(size_t size, size_t slab_count, size_t allocated, size_t free)>);
 
 extern size_t g_kmalloc_bytes_allocated;
 extern size_t g_kmalloc_bytes_free;
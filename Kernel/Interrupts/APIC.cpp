@@ -32,16 +32,22 @@
 #include <Kernel/Arch/i386/CPU.h>
 #include <Kernel/IO.h>
 #include <Kernel/Interrupts/APIC.h>
+#include <Kernel/Interrupts/GenericInterruptHandler.h>
 #include <Kernel/Interrupts/SpuriousInterruptHandler.h>
+#include <Kernel/Scheduler.h>
 #include <Kernel/Thread.h>
 #include <Kernel/VM/MemoryManager.h>
 #include <Kernel/VM/PageDirectory.h>
 #include <Kernel/VM/TypedMapping.h>
 
+#define IRQ_APIC_TIMER 0x7c
+#define IRQ_APIC_TLB_FLUSH 0x7d
+#define IRQ_APIC_RESCHEDULE 0x7e
 #define IRQ_APIC_SPURIOUS 0x7f
 
 #define APIC_BASE_MSR 0x1b
 
+#define APIC_REG_ID 0x20
 #define APIC_REG_EOI 0xb0
 #define APIC_REG_LD 0xd0
 #define APIC_REG_DF 0xe0
@@ -55,11 +61,83 @@
 #define APIC_REG_LVT_LINT0 0x350
 #define APIC_REG_LVT_LINT1 0x360
 #define APIC_REG_LVT_ERR 0x370
+#define APIC_REG_TIMER_INITIAL_COUNT 0x380
+#define APIC_REG_TIMER_CURRENT_COUNT 0x390
+#define APIC_REG_TIMER_CONFIGURATION 0x3e0
+
+#define APIC_ICR_DELIVERY_PENDING (1 << 12)
+#define APIC_TIMER_PERIODIC (1 << 17)
+#define APIC_TIMER_DIVIDE_BY_16 0x3
 
 namespace Kernel {
 
 static APIC *s_apic;
 
+// The local APIC timer drives the scheduler on the APs. The BSP keeps using the system timer.
+class APICTimerHandler final : public GenericInterruptHandler {
+public:
+    APICTimerHandler()
+        : GenericInterruptHandler(IRQ_APIC_TIMER)
+    {
+    }
+    virtual ~APICTimerHandler() { }
+
+    virtual void handle_interrupt(const RegisterState& regs) override { Scheduler::timer_tick(regs); }
+    virtual bool eoi() override
+    {
+        APIC::the().eoi();
+        return true;
+    }
+
+    virtual size_t sharing_devices_count() const override { return 0; }
+    virtual bool is_shared_handler() const override { return false; }
+    virtual bool is_sharing_with_others() const override { return false; }
+
+    virtual HandlerType type() const override { return HandlerType::IRQHandler; }
+    virtual const char* purpose() const override { return "Local APIC Timer"; }
+    virtual const char* controller() const override { return "Local APIC"; }
+};
+
+// The IPI handlers don't go through handle_interrupt(), since they must not wait for the scheduler lock:
+// the processor that sent a TLB flush request holds it while waiting for us to acknowledge.
+#define APIC_IPI_ENTRY(title)                 \
+    extern "C" void title##_asm_entry();     \
+    extern "C" void title##_handler();       \
+    asm(                                     \
+        ".globl " #title "_asm_entry\n"      \
+        "" #title "_asm_entry: \n"           \
+        "    pusha\n"                        \
+        "    pushl %ds\n"                    \
+        "    pushl %es\n"                    \
+        "    pushl %fs\n"                    \
+        "    mov $0x10, %ax\n"               \
+        "    mov %ax, %ds\n"                 \
+        "    mov %ax, %es\n"                 \
+        "    mov $0x28, %ax\n"               \
+        "    mov %ax, %fs\n"                 \
+        "    cld\n"                          \
+        "    call " #title "_handler\n"      \
+        "    popl %fs\n"                     \
+        "    popl %es\n"                     \
+        "    popl %ds\n"                     \
+        "    popa\n"                         \
+        "    iret\n");
+
+APIC_IPI_ENTRY(apic_tlb_flush_ipi)
+APIC_IPI_ENTRY(apic_reschedule_ipi)
+
+void apic_tlb_flush_ipi_handler()
+{
+    Processor::current().handle_tlb_flush_request();
+    APIC::the().eoi();
+}
+
+void apic_reschedule_ipi_handler()
+{
+    // Nothing to do here, the interrupt itself is what gets the processor out of hlt.
+    APIC::the().eoi();
+}
+
 bool APIC::initialized()
 {
     return (s_apic != nullptr);
@@ -134,6 +212,65 @@ u8 APIC::spurious_interrupt_vector()
     return IRQ_APIC_SPURIOUS;
 }
 
+u8 APIC::timer_interrupt_vector()
+{
+    return IRQ_APIC_TIMER;
+}
+
+u8 APIC::tlb_flush_ipi_vector()
+{
+    return IRQ_APIC_TLB_FLUSH;
+}
+
+u8 APIC::reschedule_ipi_vector()
+{
+    return IRQ_APIC_RESCHEDULE;
+}
+
+void APIC::send_ipi(u32 apic_id, u8 interrupt_number)
+{
+    InterruptDisabler disabler;
+    while (read_register(APIC_REG_ICR_LOW) & APIC_ICR_DELIVERY_PENDING)
+        asm volatile("pause");
+    write_icr(ICRReg(interrupt_number + IRQ_VECTOR_BASE, ICRReg::Fixed, ICRReg::Physical, ICRReg::Assert, ICRReg::TriggerMode::Edge, ICRReg::NoShorthand, apic_id));
+}
+
+void APIC::calibrate_timer()
+{
+    ASSERT(Processor::current().is_bootstrap_processor());
+    ASSERT_INTERRUPTS_ENABLED();
+
+    auto uptime = [] { return *reinterpret_cast<volatile u64*>(&g_uptime); };
+    const u64 calibration_ticks = 10;
+
+    write_register(APIC_REG_TIMER_CONFIGURATION, APIC_TIMER_DIVIDE_BY_16);
+    write_register(APIC_REG_LVT_TIMER, APIC_LVT((IRQ_APIC_TIMER + IRQ_VECTOR_BASE), 0) | APIC_LVT_MASKED);
+
+    // Start counting down right at a tick boundary, and see how far we got after a few more.
+    auto start = uptime();
+    while (uptime() == start)
+        asm volatile("pause");
+    write_register(APIC_REG_TIMER_INITIAL_COUNT, 0xffffffff);
+    start = uptime();
+    while (uptime() < start + calibration_ticks)
+        asm volatile("pause");
+    u32 elapsed = 0xffffffff - read_register(APIC_REG_TIMER_CURRENT_COUNT);
+    write_register(APIC_REG_TIMER_INITIAL_COUNT, 0);
+
+    m_timer_initial_count = elapsed / calibration_ticks;
+    klog() << "APIC: Timer runs at " << m_timer_initial_count << " counts per tick";
+
+    new APICTimerHandler;
+}
+
+void APIC::enable_local_timer()
+{
+    ASSERT(m_timer_initial_count);
+    write_register(APIC_REG_TIMER_CONFIGURATION, APIC_TIMER_DIVIDE_BY_16);
+    write_register(APIC_REG_LVT_TIMER, APIC_LVT((IRQ_APIC_TIMER + IRQ_VECTOR_BASE), 0) | APIC_TIMER_PERIODIC);
+    write_register(APIC_REG_TIMER_INITIAL_COUNT, m_timer_initial_count);
+}
+
 #define APIC_INIT_VAR_PTR(tpe,vaddr,varname) \
     reinterpret_cast<volatile tpe*>(reinterpret_cast<ptrdiff_t>(vaddr) \
         + reinterpret_cast<ptrdiff_t>(&varname) \
@@ -273,29 +410,35 @@ void APIC::enable(u32 cpu)
     if (cpu == 0)// FIXME: once memory management can deal with it, re-enable for all
         klog() << "Enabling local APIC for cpu #" << cpu;
 
-    if (cpu == 0) {
-        // dummy read, apparently to avoid a bug in old CPUs.
-        read_register(APIC_REG_SIV);
-        // set spurious interrupt vector
-        write_register(APIC_REG_SIV, (IRQ_APIC_SPURIOUS + IRQ_VECTOR_BASE) | 0x100);
+    Processor::current().set_apic_id(read_register(APIC_REG_ID) >> 24);
 
-        // local destination mode (flat mode)
-        write_register(APIC_REG_DF, 0xf0000000);
+    // dummy read, apparently to avoid a bug in old CPUs.
+    read_register(APIC_REG_SIV);
+    // set spurious interrupt vector
+    write_register(APIC_REG_SIV, (IRQ_APIC_SPURIOUS + IRQ_VECTOR_BASE) | 0x100);
 
-        // set destination id (note that this limits it to 8 cpus)
-        write_register(APIC_REG_LD, 0);
+    // local destination mode (flat mode)
+    write_register(APIC_REG_DF, 0xf0000000);
 
+    // set destination id (note that this limits it to 8 cpus)
+    write_register(APIC_REG_LD, 0);
+
+    if (cpu == 0) {
         SpuriousInterruptHandler::initialize(IRQ_APIC_SPURIOUS);
+        register_interrupt_handler(IRQ_APIC_TLB_FLUSH + IRQ_VECTOR_BASE, apic_tlb_flush_ipi_asm_entry);
+        register_interrupt_handler(IRQ_APIC_RESCHEDULE + IRQ_VECTOR_BASE, apic_reschedule_ipi_asm_entry);
+    }
+
+    write_register(APIC_REG_LVT_TIMER, APIC_LVT(0, 0) | APIC_LVT_MASKED);
+    write_register(APIC_REG_LVT_THERMAL, APIC_LVT(0, 0) | APIC_LVT_MASKED);
+    write_register(APIC_REG_LVT_PERFORMANCE_COUNTER, APIC_LVT(0, 0) | APIC_LVT_MASKED);
+    write_register(APIC_REG_LVT_LINT0, APIC_LVT(0, 7) | APIC_LVT_MASKED);
+    write_register(APIC_REG_LVT_LINT1, APIC_LVT(0, 0) | APIC_LVT_TRIGGER_LEVEL);
+    write_register(APIC_REG_LVT_ERR, APIC_LVT(0, 0) | APIC_LVT_MASKED);
 
-        write_register(APIC_REG_LVT_TIMER, APIC_LVT(0, 0) | APIC_LVT_MASKED);
-        write_register(APIC_REG_LVT_THERMAL, APIC_LVT(0, 0) | APIC_LVT_MASKED);
-        write_register(APIC_REG_LVT_PERFORMANCE_COUNTER, APIC_LVT(0, 0) | APIC_LVT_MASKED);
-        write_register(APIC_REG_LVT_LINT0, APIC_LVT(0, 7) | APIC_LVT_MASKED);
-        write_register(APIC_REG_LVT_LINT1, APIC_LVT(0, 0) | APIC_LVT_TRIGGER_LEVEL);
-        write_register(APIC_REG_LVT_ERR, APIC_LVT(0, 0) | APIC_LVT_MASKED);
+    write_register(APIC_REG_TPR, 0);
 
-        write_register(APIC_REG_TPR, 0);
-    } else {
+    if (cpu != 0) {
         // Notify the BSP that we are done initializing. It will unmap the startup data at P8000
         m_apic_ap_count++;
     }
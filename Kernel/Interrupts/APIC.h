@@ -42,11 +42,18 @@ public:
     void enable_bsp();
     void eoi();
     void enable(u32 cpu);
+    void send_ipi(u32 apic_id, u8 interrupt_number);
+    void calibrate_timer();
+    void enable_local_timer();
     static u8 spurious_interrupt_vector();
+    static u8 timer_interrupt_vector();
+    static u8 tlb_flush_ipi_vector();
+    static u8 reschedule_ipi_vector();
 
 private:
     class ICRReg {
         u32 m_reg { 0 };
+        u32 m_destination { 0 };
     
     public:
         enum DeliveryMode {
@@ -76,18 +83,20 @@ private:
             AllExcludingSelf = 0x3,
         };
     
-        ICRReg(u8 vector, DeliveryMode delivery_mode, DestinationMode destination_mode, Level level, TriggerMode trigger_mode, DestinationShorthand destination)
+        ICRReg(u8 vector, DeliveryMode delivery_mode, DestinationMode destination_mode, Level level, TriggerMode trigger_mode, DestinationShorthand destination, u8 destination_apic_id = 0)
             : m_reg(vector | (delivery_mode << 8) | (destination_mode << 11) | (level << 14) | (static_cast<u32>(trigger_mode) << 15) | (destination << 18))
+            , m_destination(destination_apic_id)
         {
         }
     
         u32 low() const { return m_reg; }
-        u32 high() const { return 0; }
+        u32 high() const { return m_destination << 24; }
     };
 
     OwnPtr<Region> m_apic_base;
     NonnullOwnPtrVector<Region> m_apic_ap_stacks;
     AK::Atomic<u32> m_apic_ap_count{0};
+    u32 m_timer_initial_count { 0 };
     
     static PhysicalAddress get_base();
     static void set_base(const PhysicalAddress& base);
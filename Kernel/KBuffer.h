@@ -41,12 +41,14 @@
 #include <AK/LogStream.h>
 #include <AK/Memory.h>
 #include <AK/StringView.h>
+#include <Kernel/Heap/SlabAllocator.h>
 #include <Kernel/VM/MemoryManager.h>
 #include <Kernel/VM/Region.h>
 
 namespace Kernel {
 
 class KBufferImpl : public RefCounted<KBufferImpl> {
+    MAKE_SLAB_ALLOCATED(KBufferImpl)
 public:
     static NonnullRefPtr<KBufferImpl> create_with_size(size_t size, u8 access, const char* name)
     {
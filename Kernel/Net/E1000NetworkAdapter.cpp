@@ -24,6 +24,7 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <Kernel/CommandLine.h>
 #include <Kernel/Net/E1000NetworkAdapter.h>
 #include <Kernel/Thread.h>
 #include <Kernel/IO.h>
@@ -139,6 +140,11 @@ namespace Kernel {
 #define INTERRUPT_TXD_LOW (1 << 15)
 #define INTERRUPT_SRPD (1 << 16)
 
+#define RX_INTERRUPTS (INTERRUPT_RXT0 | INTERRUPT_RXO | INTERRUPT_RXDMT0)
+
+// The interrupt throttling register counts in units of 256 ns.
+#define DEFAULT_INTERRUPT_RATE 651 // About one interrupt every 1.5 ms
+
 void E1000NetworkAdapter::detect()
 {
     static const PCI::ID qemu_bochs_vbox_id = { 0x8086, 0x100e };
@@ -183,13 +189,16 @@ E1000NetworkAdapter::E1000NetworkAdapter(PCI::Address address, u8 irq)
     u32 flags = in32(REG_CTRL);
     out32(REG_CTRL, flags | ECTRL_SLU);
 
-    out16(REG_INTERRUPT_RATE, 6000); // Interrupt rate of 1.536 milliseconds
+    // Under load, received frames pile up between interrupts and are handled in batches.
+    // The rate can be tuned with e1000_interrupt_rate=<interrupts per second>, 0 turns throttling off.
+    auto interrupt_rate = kernel_command_line().lookup("e1000_interrupt_rate").value_or("").to_uint();
+    set_interrupt_rate(interrupt_rate.has_value() ? interrupt_rate.value() : DEFAULT_INTERRUPT_RATE);
 
     initialize_rx_descriptors();
     initialize_tx_descriptors();
 
     out32(REG_INTERRUPT_MASK_SET, 0x1f6dc);
-    out32(REG_INTERRUPT_MASK_SET, INTERRUPT_LSC | INTERRUPT_RXT0);
+    out32(REG_INTERRUPT_MASK_SET, INTERRUPT_LSC | INTERRUPT_TXDW | RX_INTERRUPTS);
     in32(REG_INTERRUPT_CAUSE_READ);
 
     enable_irq();
@@ -208,16 +217,20 @@ void E1000NetworkAdapter::handle_irq(const RegisterState&)
         u32 flags = in32(REG_CTRL);
         out32(REG_CTRL, flags | ECTRL_SLU);
     }
-    if (status & 0x80) {
-        receive();
-    }
-    if (status & 0x10) {
-        // Threshold OK?
+    if (status & INTERRUPT_RXO)
+        ++m_ring_statistics.rx_overruns;
+    if (status & RX_INTERRUPTS) {
+        // Leave the frames in the ring, the network task picks them up in poll_receive_ring().
+        m_rx_polling = true;
+        schedule_receive_poll();
     }
+    if (status & INTERRUPT_TXDW)
+        reclaim_tx_descriptors();
 
-    m_wait_queue.wake_all();
-
-    out32(REG_INTERRUPT_MASK_SET, INTERRUPT_LSC | INTERRUPT_RXT0 | INTERRUPT_RXO);
+    u32 interrupt_mask = INTERRUPT_LSC | INTERRUPT_TXDW;
+    if (!m_rx_polling)
+        interrupt_mask |= RX_INTERRUPTS;
+    out32(REG_INTERRUPT_MASK_SET, interrupt_mask);
 }
 
 void E1000NetworkAdapter::detect_eeprom()
@@ -276,13 +289,15 @@ bool E1000NetworkAdapter::link_up()
 
 void E1000NetworkAdapter::initialize_rx_descriptors()
 {
-    auto* rx_descriptors = (e1000_tx_desc*)m_rx_descriptors_region->vaddr().as_ptr();
+    auto* rx_descriptors = (e1000_rx_desc*)m_rx_descriptors_region->vaddr().as_ptr();
     for (size_t i = 0; i < number_of_rx_descriptors; ++i) {
+        if (i % rx_buffers_per_page == 0) {
+            auto region = MM.allocate_contiguous_kernel_region(PAGE_SIZE, "E1000 RX buffer", Region::Access::Read | Region::Access::Write);
+            ASSERT(region);
+            m_rx_buffers_regions.append(region.release_nonnull());
+        }
         auto& descriptor = rx_descriptors[i];
-        auto region = MM.allocate_contiguous_kernel_region(8192, "E1000 RX buffer", Region::Access::Read | Region::Access::Write);
-        ASSERT(region);
-        m_rx_buffers_regions.append(region.release_nonnull());
-        descriptor.addr = m_rx_buffers_regions[i].physical_page(0)->paddr().get();
+        descriptor.addr = m_rx_buffers_regions.last().physical_page(0)->paddr().offset((i % rx_buffers_per_page) * rx_buffer_size).get();
         descriptor.status = 0;
     }
 
@@ -292,20 +307,25 @@ void E1000NetworkAdapter::initialize_rx_descriptors()
     out32(REG_RXDESCHEAD, 0);
     out32(REG_RXDESCTAIL, number_of_rx_descriptors - 1);
 
-    out32(REG_RCTRL, RCTL_EN | RCTL_SBP | RCTL_UPE | RCTL_MPE | RCTL_LBM_NONE | RTCL_RDMTS_HALF | RCTL_BAM | RCTL_SECRC | RCTL_BSIZE_8192);
+    out32(REG_RCTRL, RCTL_EN | RCTL_SBP | RCTL_UPE | RCTL_MPE | RCTL_LBM_NONE | RTCL_RDMTS_HALF | RCTL_BAM | RCTL_SECRC | RCTL_BSIZE_2048);
 }
 
 void E1000NetworkAdapter::initialize_tx_descriptors()
 {
     auto* tx_descriptors = (e1000_tx_desc*)m_tx_descriptors_region->vaddr().as_ptr();
     for (size_t i = 0; i < number_of_tx_descriptors; ++i) {
+        if (i % tx_buffers_per_page == 0) {
+            auto region = MM.allocate_contiguous_kernel_region(PAGE_SIZE, "E1000 TX buffer", Region::Access::Read | Region::Access::Write);
+            ASSERT(region);
+            m_tx_buffers_regions.append(region.release_nonnull());
+        }
         auto& descriptor = tx_descriptors[i];
-        auto region = MM.allocate_contiguous_kernel_region(8192, "E1000 TX buffer", Region::Access::Read | Region::Access::Write);
-        ASSERT(region);
-        m_tx_buffers_regions.append(region.release_nonnull());
-        descriptor.addr = m_tx_buffers_regions[i].physical_page(0)->paddr().get();
+        descriptor.addr = m_tx_buffers_regions.last().physical_page(0)->paddr().offset((i % tx_buffers_per_page) * tx_buffer_size).get();
         descriptor.cmd = 0;
+        descriptor.status = 0;
     }
+    m_ring_statistics.tx_ring_size = number_of_tx_descriptors;
+    m_ring_statistics.rx_ring_size = number_of_rx_descriptors;
 
     out32(REG_TXDESCLO, m_tx_descriptors_region->physical_page(0)->paddr().get());
     out32(REG_TXDESCHI, 0);
@@ -388,59 +408,130 @@ u32 E1000NetworkAdapter::in32(u16 address)
 
 void E1000NetworkAdapter::send_raw(const u8* data, size_t length)
 {
-    disable_irq();
-    size_t tx_current = in32(REG_TXDESCTAIL) % number_of_tx_descriptors;
+    iovec vec { const_cast<u8*>(data), length };
+    send_raw_gather(&vec, 1);
+}
+
+void E1000NetworkAdapter::send_raw_gather(const iovec* vecs, size_t count)
+{
+    size_t length = 0;
+    for (size_t i = 0; i < count; ++i)
+        length += vecs[i].iov_len;
 #ifdef E1000_DEBUG
-    klog() << "E1000: Sending packet (" << length << " bytes)";
+    klog() << "E1000: Sending packet (" << length << " bytes in " << count << " pieces)";
 #endif
+    ASSERT(length <= tx_buffer_size);
+
+    InterruptDisabler disabler;
+    // One descriptor always stays unused, a full ring would look empty to the card.
+    while (m_tx_in_flight == number_of_tx_descriptors - 1) {
+        reclaim_tx_descriptors();
+        if (m_tx_in_flight < number_of_tx_descriptors - 1)
+            break;
+        ++m_ring_statistics.tx_ring_full_waits;
+        Thread::current()->wait_on(m_tx_wait_queue);
+    }
+
+    size_t tx_current = m_tx_next_free;
     auto* tx_descriptors = (e1000_tx_desc*)m_tx_descriptors_region->vaddr().as_ptr();
     auto& descriptor = tx_descriptors[tx_current];
-    ASSERT(length <= 8192);
-    auto* vptr = (void*)m_tx_buffers_regions[tx_current].vaddr().as_ptr();
-    memcpy(vptr, data, length);
+    auto* vptr = m_tx_buffers_regions[tx_current / tx_buffers_per_page].vaddr().offset((tx_current % tx_buffers_per_page) * tx_buffer_size).as_ptr();
+    for (size_t i = 0; i < count; ++i) {
+        memcpy(vptr, vecs[i].iov_base, vecs[i].iov_len);
+        vptr += vecs[i].iov_len;
+    }
     descriptor.length = length;
     descriptor.status = 0;
     descriptor.cmd = CMD_EOP | CMD_IFCS | CMD_RS;
 #ifdef E1000_DEBUG
     klog() << "E1000: Using tx descriptor " << tx_current << " (head is at " << in32(REG_TXDESCHEAD) << ")";
 #endif
-    tx_current = (tx_current + 1) % number_of_tx_descriptors;
-    cli();
-    enable_irq();
-    out32(REG_TXDESCTAIL, tx_current);
-    for (;;) {
-        if (descriptor.status) {
-            sti();
+    m_tx_next_free = (tx_current + 1) % number_of_tx_descriptors;
+    ++m_tx_in_flight;
+    out32(REG_TXDESCTAIL, m_tx_next_free);
+}
+
+void E1000NetworkAdapter::reclaim_tx_descriptors()
+{
+    auto* tx_descriptors = (e1000_tx_desc*)m_tx_descriptors_region->vaddr().as_ptr();
+    size_t reclaimed_count = 0;
+    while (m_tx_in_flight) {
+        auto& descriptor = tx_descriptors[m_tx_next_to_reclaim];
+        if (!(descriptor.status & TSTA_DD))
             break;
-        }
-        Thread::current->wait_on(m_wait_queue);
+        if (descriptor.status & (TSTA_EC | TSTA_LC))
+            ++m_ring_statistics.tx_errors;
+        else
+            ++m_ring_statistics.tx_completed;
+        descriptor.status = 0;
+        m_tx_next_to_reclaim = (m_tx_next_to_reclaim + 1) % number_of_tx_descriptors;
+        --m_tx_in_flight;
+        ++reclaimed_count;
     }
-#ifdef E1000_DEBUG
-    klog() << "E1000: Sent packet, status is now " << String::format("%b", descriptor.status) << "!";
-#endif
+    if (reclaimed_count)
+        m_tx_wait_queue.wake_all();
 }
 
-void E1000NetworkAdapter::receive()
+NetworkAdapter::RingStatistics E1000NetworkAdapter::ring_statistics() const
 {
-    auto* rx_descriptors = (e1000_tx_desc*)m_rx_descriptors_region->vaddr().as_ptr();
-    u32 rx_current;
-    for (;;) {
-        rx_current = in32(REG_RXDESCTAIL) % number_of_rx_descriptors;
-        if (rx_current == (in32(REG_RXDESCHEAD) % number_of_rx_descriptors))
-            return;
-        rx_current = (rx_current + 1) % number_of_rx_descriptors;
-        if (!(rx_descriptors[rx_current].status & 1))
+    InterruptDisabler disabler;
+    auto statistics = m_ring_statistics;
+    statistics.tx_in_flight = m_tx_in_flight;
+    return statistics;
+}
+
+size_t E1000NetworkAdapter::poll_receive_ring(size_t budget, const ReceiveCallback& callback)
+{
+    auto* rx_descriptors = (e1000_rx_desc*)m_rx_descriptors_region->vaddr().as_ptr();
+    size_t count = 0;
+    Optional<size_t> last_done;
+    while (count < budget) {
+        auto& descriptor = rx_descriptors[m_rx_next_to_check];
+        if (!(descriptor.status & 1))
             break;
-        auto* buffer = m_rx_buffers_regions[rx_current].vaddr().as_ptr();
-        u16 length = rx_descriptors[rx_current].length;
-        ASSERT(length <= 8192);
+        auto* buffer = m_rx_buffers_regions[m_rx_next_to_check / rx_buffers_per_page].vaddr().offset((m_rx_next_to_check % rx_buffers_per_page) * rx_buffer_size).as_ptr();
+        u16 length = descriptor.length;
+        ASSERT(length <= rx_buffer_size);
+        // Frames too big for one buffer are spread over several descriptors, we don't take those.
+        bool is_end_of_frame = descriptor.status & 2;
+        if (is_end_of_frame && !m_rx_dropping_frame) {
 #ifdef E1000_DEBUG
-        klog() << "E1000: Received 1 packet @ " << buffer << " (" << length << ") bytes!";
+            klog() << "E1000: Received 1 packet @ " << buffer << " (" << length << ") bytes!";
 #endif
-        did_receive(buffer, length);
-        rx_descriptors[rx_current].status = 0;
-        out32(REG_RXDESCTAIL, rx_current);
+            did_receive_in_place(length);
+            callback(buffer, length);
+            ++m_ring_statistics.rx_received;
+        } else if (is_end_of_frame) {
+            ++m_ring_statistics.rx_overruns;
+        }
+        m_rx_dropping_frame = !is_end_of_frame;
+        descriptor.status = 0;
+        last_done = m_rx_next_to_check;
+        m_rx_next_to_check = (m_rx_next_to_check + 1) % number_of_rx_descriptors;
+        ++count;
     }
+
+    // Give the whole batch back to the card at once.
+    if (last_done.has_value())
+        out32(REG_RXDESCTAIL, last_done.value());
+
+    InterruptDisabler disabler;
+    if (count == budget) {
+        schedule_receive_poll();
+    } else {
+        // The ring is empty. Anything that arrived since then is still flagged in the
+        // interrupt cause register, and raises an interrupt as soon as it's unmasked.
+        m_rx_polling = false;
+        out32(REG_INTERRUPT_MASK_SET, RX_INTERRUPTS);
+    }
+    return count;
+}
+
+void E1000NetworkAdapter::set_interrupt_rate(u32 interrupts_per_second)
+{
+    u32 interval = interrupts_per_second ? 1000000000 / (interrupts_per_second * 256) : 0;
+    out16(REG_INTERRUPT_RATE, min(interval, 0xffffu));
+    klog() << "E1000: Interrupt rate: " << (interrupts_per_second ? String::number(interrupts_per_second) : "unlimited") << " per second";
 }
 
 }
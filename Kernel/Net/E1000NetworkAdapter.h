@@ -45,7 +45,9 @@ public:
     virtual ~E1000NetworkAdapter() override;
 
     virtual void send_raw(const u8*, size_t) override;
+    virtual void send_raw_gather(const iovec*, size_t count) override;
     virtual bool link_up() override;
+    virtual RingStatistics ring_statistics() const override;
 
     virtual const char* purpose() const override { return class_name(); }
 
@@ -83,6 +85,7 @@ private:
 
     void initialize_rx_descriptors();
     void initialize_tx_descriptors();
+    void reclaim_tx_descriptors();
 
     void out8(u16 address, u8);
     void out16(u16 address, u16);
@@ -91,7 +94,8 @@ private:
     u16 in16(u16 address);
     u32 in32(u16 address);
 
-    void receive();
+    virtual size_t poll_receive_ring(size_t budget, const ReceiveCallback&) override;
+    void set_interrupt_rate(u32 interrupts_per_second);
 
     IOAddress m_io_base;
     VirtualAddress m_mmio_base;
@@ -104,9 +108,25 @@ private:
     bool m_has_eeprom { false };
     bool m_use_mmio { false };
 
-    static const size_t number_of_rx_descriptors = 32;
-    static const size_t number_of_tx_descriptors = 8;
-
-    WaitQueue m_wait_queue;
+    static const size_t number_of_rx_descriptors = 128;
+    static const size_t rx_buffer_size = 2048;
+    static const size_t rx_buffers_per_page = PAGE_SIZE / rx_buffer_size;
+    static const size_t number_of_tx_descriptors = 128;
+    static const size_t tx_buffer_size = 2048;
+    static const size_t tx_buffers_per_page = PAGE_SIZE / tx_buffer_size;
+
+    // Frames are queued at m_tx_next_free and handed back by the card from
+    // m_tx_next_to_reclaim on. Senders only wait when the ring is full.
+    size_t m_tx_next_free { 0 };
+    size_t m_tx_next_to_reclaim { 0 };
+    size_t m_tx_in_flight { 0 };
+    WaitQueue m_tx_wait_queue;
+
+    // While the network task is draining the receive ring, receive interrupts stay masked.
+    size_t m_rx_next_to_check { 0 };
+    bool m_rx_polling { false };
+    bool m_rx_dropping_frame { false };
+
+    RingStatistics m_ring_statistics;
 };
 }
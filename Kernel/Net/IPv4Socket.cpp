@@ -71,9 +71,6 @@ IPv4Socket::IPv4Socket(int type, int protocol)
     dbg() << "IPv4Socket{" << this << "} created with type=" << type << ", protocol=" << protocol;
 #endif
     m_buffer_mode = type == SOCK_STREAM ? BufferMode::Bytes : BufferMode::Packets;
-    if (m_buffer_mode == BufferMode::Bytes) {
-        m_scratch_buffer = KBuffer::create_with_size(65536);
-    }
     LOCKER(all_sockets().lock());
     all_sockets().resource().set(this);
 }
@@ -111,9 +108,9 @@ KResult IPv4Socket::bind(const sockaddr* user_address, socklen_t address_size)
         return KResult(-EINVAL);
 
     auto requested_local_port = ntohs(address.sin_port);
-    if (!Process::current->is_superuser()) {
+    if (!Process::current()->is_superuser()) {
         if (requested_local_port < 1024) {
-            dbg() << "UID " << Process::current->uid() << " attempted to bind " << class_name() << " to port " << requested_local_port;
+            dbg() << "UID " << Process::current()->uid() << " attempted to bind " << class_name() << " to port " << requested_local_port;
             return KResult(-EACCES);
         }
     }
@@ -193,7 +190,7 @@ int IPv4Socket::allocate_local_port_if_needed()
     return port;
 }
 
-ssize_t IPv4Socket::sendto(FileDescription&, const void* data, size_t data_length, int flags, const sockaddr* addr, socklen_t addr_length)
+ssize_t IPv4Socket::sendto(FileDescription& description, const void* data, size_t data_length, int flags, const sockaddr* addr, socklen_t addr_length)
 {
     (void)flags;
     if (addr && addr_length != sizeof(sockaddr_in))
@@ -231,8 +228,26 @@ ssize_t IPv4Socket::sendto(FileDescription&, const void* data, size_t data_lengt
     }
 
     int nsent = protocol_send(data, data_length);
+
+    // A stream protocol may only take part of the data when its send buffer fills up; keep feeding it as it drains.
+    while (type() == SOCK_STREAM && description.is_blocking() && (nsent == -EAGAIN || (nsent >= 0 && (size_t)nsent < data_length))) {
+        if (Thread::current()->block<Thread::WriteBlocker>(description) != Thread::BlockResult::WokeNormally) {
+            if (nsent <= 0)
+                return -EINTR;
+            break;
+        }
+        size_t nsent_so_far = nsent > 0 ? nsent : 0;
+        int rc = protocol_send((const u8*)data + nsent_so_far, data_length - nsent_so_far);
+        if (rc < 0 && rc != -EAGAIN) {
+            if (nsent_so_far == 0)
+                return rc;
+            break;
+        }
+        nsent = nsent_so_far + (rc > 0 ? rc : 0);
+    }
+
     if (nsent > 0)
-        Thread::current->did_ipv4_socket_write(nsent);
+        Thread::current()->did_ipv4_socket_write(nsent);
     return nsent;
 }
 
@@ -246,7 +261,7 @@ ssize_t IPv4Socket::receive_byte_buffered(FileDescription& description, void* bu
             return -EAGAIN;
 
         locker.unlock();
-        auto res = Thread::current->block<Thread::ReadBlocker>(description);
+        auto res = Thread::current()->block<Thread::ReadBlocker>(description);
         locker.lock();
 
         if (!m_can_read) {
@@ -261,9 +276,11 @@ ssize_t IPv4Socket::receive_byte_buffered(FileDescription& description, void* bu
     ASSERT(!m_receive_buffer.is_empty());
     int nreceived = m_receive_buffer.read((u8*)buffer, buffer_length);
     if (nreceived > 0)
-        Thread::current->did_ipv4_socket_read((size_t)nreceived);
+        Thread::current()->did_ipv4_socket_read((size_t)nreceived);
 
     m_can_read = !m_receive_buffer.is_empty();
+    if (nreceived > 0)
+        protocol_did_read();
     return nreceived;
 }
 
@@ -296,7 +313,7 @@ ssize_t IPv4Socket::receive_packet_buffered(FileDescription& description, void*
         }
 
         locker.unlock();
-        auto res = Thread::current->block<Thread::ReadBlocker>(description);
+        auto res = Thread::current()->block<Thread::ReadBlocker>(description);
         locker.lock();
 
         if (!m_can_read) {
@@ -354,45 +371,57 @@ ssize_t IPv4Socket::recvfrom(FileDescription& description, void* buffer, size_t
         nreceived = receive_packet_buffered(description, buffer, buffer_length, flags, addr, addr_length);
 
     if (nreceived > 0)
-        Thread::current->did_ipv4_socket_read(nreceived);
+        Thread::current()->did_ipv4_socket_read(nreceived);
     return nreceived;
 }
 
 bool IPv4Socket::did_receive(const IPv4Address& source_address, u16 source_port, KBuffer&& packet)
 {
     LOCKER(lock());
+    ASSERT(buffer_mode() == BufferMode::Packets);
 
     if (is_shut_down_for_reading())
         return false;
 
     auto packet_size = packet.size();
 
-    if (buffer_mode() == BufferMode::Bytes) {
-        size_t space_in_receive_buffer = m_receive_buffer.space_for_writing();
-        if (packet_size > space_in_receive_buffer) {
-            dbg() << "IPv4Socket(" << this << "): did_receive refusing packet since buffer is full.";
-            ASSERT(m_can_read);
-            return false;
-        }
-        int nreceived = protocol_receive(packet, m_scratch_buffer.value().data(), m_scratch_buffer.value().size(), 0);
-        m_receive_buffer.write(m_scratch_buffer.value().data(), nreceived);
-        m_can_read = !m_receive_buffer.is_empty();
-    } else {
-        // FIXME: Maybe track the number of packets so we don't have to walk the entire packet queue to count them..
-        if (m_receive_queue.size_slow() > 2000) {
-            dbg() << "IPv4Socket(" << this << "): did_receive refusing packet since queue is full.";
-            return false;
-        }
-        m_receive_queue.append({ source_address, source_port, move(packet) });
-        m_can_read = true;
+    // FIXME: Maybe track the number of packets so we don't have to walk the entire packet queue to count them..
+    if (m_receive_queue.size_slow() > 2000) {
+        dbg() << "IPv4Socket(" << this << "): did_receive refusing packet since queue is full.";
+        return false;
     }
+    m_receive_queue.append({ source_address, source_port, move(packet) });
+    m_can_read = true;
     m_bytes_received += packet_size;
 #ifdef IPV4_SOCKET_DEBUG
-    if (buffer_mode() == BufferMode::Bytes)
-        dbg() << "IPv4Socket(" << this << "): did_receive " << packet_size << " bytes, total_received=" << m_bytes_received;
-    else
-        dbg() << "IPv4Socket(" << this << "): did_receive " << packet_size << " bytes, total_received=" << m_bytes_received << ", packets in queue: " << m_receive_queue.size_slow();
+    dbg() << "IPv4Socket(" << this << "): did_receive " << packet_size << " bytes, total_received=" << m_bytes_received << ", packets in queue: " << m_receive_queue.size_slow();
+#endif
+    evaluate_block_conditions();
+    return true;
+}
+
+bool IPv4Socket::did_receive_stream_data(const u8* data, size_t size)
+{
+    LOCKER(lock());
+    ASSERT(buffer_mode() == BufferMode::Bytes);
+
+    if (is_shut_down_for_reading())
+        return false;
+
+    // Stream payloads are copied straight out of the received frame, which is the only copy
+    // they get before the one into userspace.
+    if (size > m_receive_buffer.space_for_writing()) {
+        dbg() << "IPv4Socket(" << this << "): did_receive_stream_data refusing data since buffer is full.";
+        ASSERT(m_can_read);
+        return false;
+    }
+    m_receive_buffer.write(data, size);
+    m_can_read = !m_receive_buffer.is_empty();
+    m_bytes_received += size;
+#ifdef IPV4_SOCKET_DEBUG
+    dbg() << "IPv4Socket(" << this << "): did_receive_stream_data " << size << " bytes, total_received=" << m_bytes_received;
 #endif
+    evaluate_block_conditions();
     return true;
 }
 
@@ -468,7 +497,7 @@ int IPv4Socket::ioctl(FileDescription&, unsigned request, FlatPtr arg)
 
     auto ioctl_route = [request, arg]() {
         auto* route = (rtentry*)arg;
-        if (!Process::current->validate_read_typed(route))
+        if (!Process::current()->validate_read_typed(route))
             return -EFAULT;
 
         char namebuf[IFNAMSIZ + 1];
@@ -481,7 +510,7 @@ int IPv4Socket::ioctl(FileDescription&, unsigned request, FlatPtr arg)
 
         switch (request) {
         case SIOCADDRT:
-            if (!Process::current->is_superuser())
+            if (!Process::current()->is_superuser())
                 return -EPERM;
             if (route->rt_gateway.sa_family != AF_INET)
                 return -EAFNOSUPPORT;
@@ -500,7 +529,7 @@ int IPv4Socket::ioctl(FileDescription&, unsigned request, FlatPtr arg)
 
     auto ioctl_interface = [request, arg]() {
         auto* ifr = (ifreq*)arg;
-        if (!Process::current->validate_read_typed(ifr))
+        if (!Process::current()->validate_read_typed(ifr))
             return -EFAULT;
 
         char namebuf[IFNAMSIZ + 1];
@@ -513,7 +542,7 @@ int IPv4Socket::ioctl(FileDescription&, unsigned request, FlatPtr arg)
 
         switch (request) {
         case SIOCSIFADDR:
-            if (!Process::current->is_superuser())
+            if (!Process::current()->is_superuser())
                 return -EPERM;
             if (ifr->ifr_addr.sa_family != AF_INET)
                 return -EAFNOSUPPORT;
@@ -521,7 +550,7 @@ int IPv4Socket::ioctl(FileDescription&, unsigned request, FlatPtr arg)
             return 0;
 
         case SIOCSIFNETMASK:
-            if (!Process::current->is_superuser())
+            if (!Process::current()->is_superuser())
                 return -EPERM;
             if (ifr->ifr_addr.sa_family != AF_INET)
                 return -EAFNOSUPPORT;
@@ -529,14 +558,14 @@ int IPv4Socket::ioctl(FileDescription&, unsigned request, FlatPtr arg)
             return 0;
 
         case SIOCGIFADDR:
-            if (!Process::current->validate_write_typed(ifr))
+            if (!Process::current()->validate_write_typed(ifr))
                 return -EFAULT;
             ifr->ifr_addr.sa_family = AF_INET;
             ((sockaddr_in&)ifr->ifr_addr).sin_addr.s_addr = adapter->ipv4_address().to_u32();
             return 0;
 
         case SIOCGIFHWADDR:
-            if (!Process::current->validate_write_typed(ifr))
+            if (!Process::current()->validate_write_typed(ifr))
                 return -EFAULT;
             ifr->ifr_hwaddr.sa_family = AF_INET;
             {
@@ -574,6 +603,7 @@ void IPv4Socket::shut_down_for_reading()
 {
     Socket::shut_down_for_reading();
     m_can_read = true;
+    evaluate_block_conditions();
 }
 
 }
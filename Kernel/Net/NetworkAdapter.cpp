@@ -102,15 +102,31 @@ void NetworkAdapter::send(const MACAddress& destination, const ARPPacket& packet
 
 void NetworkAdapter::send_ipv4(const MACAddress& destination_mac, const IPv4Address& destination_ipv4, IPv4Protocol protocol, const u8* payload, size_t payload_size, u8 ttl)
 {
+    iovec vec { const_cast<u8*>(payload), payload_size };
+    send_ipv4(destination_mac, destination_ipv4, protocol, &vec, 1, ttl);
+}
+
+void NetworkAdapter::send_ipv4(const MACAddress& destination_mac, const IPv4Address& destination_ipv4, IPv4Protocol protocol, const iovec* payload, size_t payload_count, u8 ttl)
+{
+    size_t payload_size = 0;
+    for (size_t i = 0; i < payload_count; ++i)
+        payload_size += payload[i].iov_len;
+
     size_t ipv4_packet_size = sizeof(IPv4Packet) + payload_size;
     if (ipv4_packet_size > mtu()) {
-        send_ipv4_fragmented(destination_mac, destination_ipv4, protocol, payload, payload_size, ttl);
+        auto buffer = ByteBuffer::create_uninitialized(payload_size);
+        size_t offset = 0;
+        for (size_t i = 0; i < payload_count; ++i) {
+            memcpy(buffer.data() + offset, payload[i].iov_base, payload[i].iov_len);
+            offset += payload[i].iov_len;
+        }
+        send_ipv4_fragmented(destination_mac, destination_ipv4, protocol, buffer.data(), payload_size, ttl);
         return;
     }
 
-    size_t ethernet_frame_size = sizeof(EthernetFrameHeader) + sizeof(IPv4Packet) + payload_size;
-    auto buffer = ByteBuffer::create_zeroed(ethernet_frame_size);
-    auto& eth = *(EthernetFrameHeader*)buffer.data();
+    // The headers are put together on the stack; the payload goes to the adapter where it already is.
+    u8 headers[sizeof(EthernetFrameHeader) + sizeof(IPv4Packet)] = {};
+    auto& eth = *(EthernetFrameHeader*)headers;
     eth.set_source(mac_address());
     eth.set_destination(destination_mac);
     eth.set_ether_type(EtherType::IPv4);
@@ -124,10 +140,37 @@ void NetworkAdapter::send_ipv4(const MACAddress& destination_mac, const IPv4Addr
     ipv4.set_ident(1);
     ipv4.set_ttl(ttl);
     ipv4.set_checksum(ipv4.compute_checksum());
+
+    size_t ethernet_frame_size = sizeof(headers) + payload_size;
     m_packets_out++;
     m_bytes_out += ethernet_frame_size;
-    memcpy(ipv4.payload(), payload, payload_size);
-    send_raw((const u8*)&eth, ethernet_frame_size);
+
+    Vector<iovec, 4> frame;
+    frame.append({ headers, sizeof(headers) });
+    for (size_t i = 0; i < payload_count; ++i) {
+        if (payload[i].iov_len)
+            frame.append(payload[i]);
+    }
+    send_raw_gather(frame.data(), frame.size());
+}
+
+void NetworkAdapter::send_raw_gather(const iovec* vecs, size_t count)
+{
+    if (count == 1) {
+        send_raw((const u8*)vecs[0].iov_base, vecs[0].iov_len);
+        return;
+    }
+
+    size_t frame_size = 0;
+    for (size_t i = 0; i < count; ++i)
+        frame_size += vecs[i].iov_len;
+    auto buffer = ByteBuffer::create_uninitialized(frame_size);
+    size_t offset = 0;
+    for (size_t i = 0; i < count; ++i) {
+        memcpy(buffer.data() + offset, vecs[i].iov_base, vecs[i].iov_len);
+        offset += vecs[i].iov_len;
+    }
+    send_raw(buffer.data(), frame_size);
 }
 
 void NetworkAdapter::send_ipv4_fragmented(const MACAddress& destination_mac, const IPv4Address& destination_ipv4, IPv4Protocol protocol, const u8* payload, size_t payload_size, u8 ttl)
@@ -181,7 +224,7 @@ void NetworkAdapter::did_receive(const u8* data, size_t length)
     } else {
         buffer = m_unused_packet_buffers.take_first();
         --m_unused_packet_buffers_count;
-        if (length <= buffer.value().size()) {
+        if (length <= buffer.value().capacity()) {
             memcpy(buffer.value().data(), data, length);
             buffer.value().set_size(length);
         } else {
@@ -189,26 +232,51 @@ void NetworkAdapter::did_receive(const u8* data, size_t length)
         }
     }
 
+    bool was_pending = has_pending_receive();
     m_packet_queue.append(buffer.value());
 
-    if (on_receive)
+    if (!was_pending && on_receive)
         on_receive();
 }
 
-size_t NetworkAdapter::dequeue_packet(u8* buffer, size_t buffer_size)
+void NetworkAdapter::schedule_receive_poll()
 {
     InterruptDisabler disabler;
-    if (m_packet_queue.is_empty())
-        return 0;
-    auto packet = m_packet_queue.take_first();
-    size_t packet_size = packet.size();
-    ASSERT(packet_size <= buffer_size);
-    memcpy(buffer, packet.data(), packet_size);
-    if (m_unused_packet_buffers_count < 100) {
-        m_unused_packet_buffers.append(packet);
-        ++m_unused_packet_buffers_count;
+    bool was_pending = has_pending_receive();
+    m_receive_poll_scheduled = true;
+    if (!was_pending && on_receive)
+        on_receive();
+}
+
+size_t NetworkAdapter::poll_received(size_t budget, const ReceiveCallback& callback)
+{
+    {
+        InterruptDisabler disabler;
+        m_receive_poll_scheduled = false;
     }
-    return packet_size;
+
+    size_t count = 0;
+    while (count < budget) {
+        Optional<KBuffer> packet;
+        {
+            InterruptDisabler disabler;
+            if (m_packet_queue.is_empty())
+                break;
+            packet = m_packet_queue.take_first();
+        }
+        callback(packet.value().data(), packet.value().size());
+        ++count;
+
+        InterruptDisabler disabler;
+        if (m_unused_packet_buffers_count < 100) {
+            m_unused_packet_buffers.append(packet.value());
+            ++m_unused_packet_buffers_count;
+        }
+    }
+
+    if (count < budget)
+        count += poll_receive_ring(budget - count, callback);
+    return count;
 }
 
 void NetworkAdapter::set_ipv4_address(const IPv4Address& address)
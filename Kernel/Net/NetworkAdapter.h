@@ -37,6 +37,7 @@
 #include <Kernel/Net/ARP.h>
 #include <Kernel/Net/ICMP.h>
 #include <Kernel/Net/IPv4.h>
+#include <Kernel/UnixTypes.h>
 
 namespace Kernel {
 
@@ -64,11 +65,15 @@ public:
 
     void send(const MACAddress&, const ARPPacket&);
     void send_ipv4(const MACAddress&, const IPv4Address&, IPv4Protocol, const u8* payload, size_t payload_size, u8 ttl);
+    void send_ipv4(const MACAddress&, const IPv4Address&, IPv4Protocol, const iovec* payload, size_t payload_count, u8 ttl);
     void send_ipv4_fragmented(const MACAddress&, const IPv4Address&, IPv4Protocol, const u8* payload, size_t payload_size, u8 ttl);
 
-    size_t dequeue_packet(u8* buffer, size_t buffer_size);
-
-    bool has_queued_packets() const { return !m_packet_queue.is_empty(); }
+    // Hands up to `budget` received frames to the callback, straight out of the buffer they
+    // were received into. If the whole budget is used up, the adapter stays pending and
+    // should be polled again.
+    using ReceiveCallback = Function<void(const u8*, size_t)>;
+    size_t poll_received(size_t budget, const ReceiveCallback&);
+    bool has_pending_receive() const { return m_receive_poll_scheduled || !m_packet_queue.is_empty(); }
 
     u32 mtu() const { return m_mtu; }
     void set_mtu(u32 mtu) { m_mtu = mtu; }
@@ -78,6 +83,19 @@ public:
     u32 packets_out() const { return m_packets_out; }
     u32 bytes_out() const { return m_bytes_out; }
 
+    // Counters for adapters that move frames through descriptor rings.
+    struct RingStatistics {
+        u32 tx_ring_size { 0 };
+        u32 tx_in_flight { 0 };
+        u32 tx_completed { 0 };
+        u32 tx_errors { 0 };
+        u32 tx_ring_full_waits { 0 };
+        u32 rx_ring_size { 0 };
+        u32 rx_received { 0 };
+        u32 rx_overruns { 0 };
+    };
+    virtual RingStatistics ring_statistics() const { return {}; }
+
     Function<void()> on_receive;
 
 protected:
@@ -85,8 +103,21 @@ protected:
     void set_interface_name(const StringView& basename);
     void set_mac_address(const MACAddress& mac_address) { m_mac_address = mac_address; }
     virtual void send_raw(const u8*, size_t) = 0;
+    // Sends one frame put together from several pieces. Adapters that copy frames into
+    // transmit buffers of their own should override this to copy the pieces directly.
+    virtual void send_raw_gather(const iovec*, size_t count);
     void did_receive(const u8*, size_t);
 
+    // Adapters that leave received frames in their own ring call schedule_receive_poll() from their
+    // interrupt handler (with the receive interrupt masked) and hand the frames up in poll_receive_ring().
+    void schedule_receive_poll();
+    virtual size_t poll_receive_ring(size_t, const ReceiveCallback&) { return 0; }
+    void did_receive_in_place(size_t length)
+    {
+        m_packets_in++;
+        m_bytes_in += length;
+    }
+
 private:
     MACAddress m_mac_address;
     IPv4Address m_ipv4_address;
@@ -95,6 +126,7 @@ private:
     SinglyLinkedList<KBuffer> m_packet_queue;
     SinglyLinkedList<KBuffer> m_unused_packet_buffers;
     size_t m_unused_packet_buffers_count { 0 };
+    bool m_receive_poll_scheduled { false };
     String m_name;
     u32 m_packets_in { 0 };
     u32 m_bytes_in { 0 };
@@ -51,12 +51,18 @@
 
 namespace Kernel {
 
+// How many frames to take from one adapter before moving on to the next.
+static const size_t receive_budget = 64;
+
+// How often we wake up without traffic to run the TCP retransmission timers.
+static const long tcp_timer_interval_usec = 100000;
+
+static void handle_frame(const u8*, size_t);
 static void handle_arp(const EthernetFrameHeader&, size_t frame_size);
 static void handle_ipv4(const EthernetFrameHeader&, size_t frame_size);
 static void handle_icmp(const EthernetFrameHeader&, const IPv4Packet&);
 static void handle_udp(const IPv4Packet&);
 static void handle_tcp(const IPv4Packet&);
-
 [[noreturn]] static void NetworkTask_main();
 
 void NetworkTask::spawn()
@@ -69,7 +75,6 @@ void NetworkTask_main()
 {
     WaitQueue packet_wait_queue;
     u8 octet = 15;
-    int pending_packets = 0;
     NetworkAdapter::for_each([&](auto& adapter) {
         if (String(adapter.class_name()) == "LoopbackAdapter") {
             adapter.set_ipv4_address({ 127, 0, 0, 1 });
@@ -83,82 +88,89 @@ void NetworkTask_main()
 
         klog() << "NetworkTask: " << adapter.class_name() << " network adapter found: hw=" << adapter.mac_address().to_string().characters() << " address=" << adapter.ipv4_address().to_string().characters() << " netmask=" << adapter.ipv4_netmask().to_string().characters() << " gateway=" << adapter.ipv4_gateway().to_string().characters();
 
+        // Only called when an adapter goes from idle to having frames for us.
         adapter.on_receive = [&]() {
-            pending_packets++;
             packet_wait_queue.wake_all();
         };
     });
 
-    auto dequeue_packet = [&pending_packets](u8* buffer, size_t buffer_size) -> size_t {
-        if (pending_packets == 0)
-            return 0;
-        size_t packet_size = 0;
+    NetworkAdapter::ReceiveCallback receive_callback = handle_frame;
+
+    klog() << "NetworkTask: Enter main loop.";
+    for (;;) {
+        Vector<RefPtr<NetworkAdapter>, 8> adapters;
         NetworkAdapter::for_each([&](auto& adapter) {
-            if (packet_size || !adapter.has_queued_packets())
-                return;
-            packet_size = adapter.dequeue_packet(buffer, buffer_size);
-            pending_packets--;
+            adapters.append(&adapter);
+        });
+
+        // Take a batch of frames from every adapter in turn, so that a busy one can't starve the others.
+        for (auto& adapter : adapters) {
+            if (!adapter->has_pending_receive())
+                continue;
+            size_t count = adapter->poll_received(receive_budget, receive_callback);
 #ifdef NETWORK_TASK_DEBUG
-            klog() << "NetworkTask: Dequeued packet from " << adapter.name().characters() << " (" << packet_size << " bytes)";
+            klog() << "NetworkTask: Handled " << count << " packet(s) from " << adapter->name().characters();
 #endif
-        });
-        return packet_size;
-    };
+            (void)count;
+        }
 
-    size_t buffer_size = 64 * KB;
-    auto buffer_region = MM.allocate_kernel_region(buffer_size, "Kernel Packet Buffer", Region::Access::Read | Region::Access::Write, false, true);
-    auto buffer = (u8*)buffer_region->vaddr().get();
+        TCPSocket::fire_retransmit_timers();
 
-    klog() << "NetworkTask: Enter main loop.";
-    for (;;) {
-        size_t packet_size = dequeue_packet(buffer, buffer_size);
-        if (!packet_size) {
-            Thread::current->wait_on(packet_wait_queue);
-            continue;
-        }
-        if (packet_size < sizeof(EthernetFrameHeader)) {
-            klog() << "NetworkTask: Packet is too small to be an Ethernet packet! (" << packet_size << ")";
-            continue;
+        InterruptDisabler disabler;
+        bool has_pending_receive = false;
+        for (auto& adapter : adapters)
+            has_pending_receive |= adapter->has_pending_receive();
+        if (!has_pending_receive) {
+            timeval timeout { 0, tcp_timer_interval_usec };
+            Thread::current()->wait_on(packet_wait_queue, &timeout);
         }
-        auto& eth = *(const EthernetFrameHeader*)buffer;
+    }
+}
+
+void handle_frame(const u8* buffer, size_t packet_size)
+{
+    if (packet_size < sizeof(EthernetFrameHeader)) {
+        klog() << "NetworkTask: Packet is too small to be an Ethernet packet! (" << packet_size << ")";
+        return;
+    }
+    auto& eth = *(const EthernetFrameHeader*)buffer;
 #ifdef ETHERNET_DEBUG
-        klog() << "NetworkTask: From " << eth.source().to_string().characters() << " to " << eth.destination().to_string().characters() << ", ether_type=" << String::format("%w", eth.ether_type()) << ", packet_length=" << packet_size;
+    klog() << "NetworkTask: From " << eth.source().to_string().characters() << " to " << eth.destination().to_string().characters() << ", ether_type=" << String::format("%w", eth.ether_type()) << ", packet_length=" << packet_size;
 #endif
 
 #ifdef ETHERNET_VERY_DEBUG
-        for (size_t i = 0; i < packet_size; i++) {
-            klog() << String::format("%b", buffer[i]);
-
-            switch (i % 16) {
-            case 7:
-                klog() << "  ";
-                break;
-            case 15:
-                klog() << "";
-                break;
-            default:
-                klog() << " ";
-                break;
-            }
-        }
-
-        klog() << "";
-#endif
+    for (size_t i = 0; i < packet_size; i++) {
+        klog() << String::format("%b", buffer[i]);
 
-        switch (eth.ether_type()) {
-        case EtherType::ARP:
-            handle_arp(eth, packet_size);
+        switch (i % 16) {
+        case 7:
+            klog() << "  ";
             break;
-        case EtherType::IPv4:
-            handle_ipv4(eth, packet_size);
-            break;
-        case EtherType::IPv6:
-            // ignore
+        case 15:
+            klog() << "";
             break;
         default:
-            klog() << "NetworkTask: Unknown ethernet type 0x" << String::format("%x", eth.ether_type());
+            klog() << " ";
+            break;
         }
     }
+
+    klog() << "";
+#endif
+
+    switch (eth.ether_type()) {
+    case EtherType::ARP:
+        handle_arp(eth, packet_size);
+        break;
+    case EtherType::IPv4:
+        handle_ipv4(eth, packet_size);
+        break;
+    case EtherType::IPv6:
+        // ignore
+        break;
+    default:
+        klog() << "NetworkTask: Unknown ethernet type 0x" << String::format("%x", eth.ether_type());
+    }
 }
 
 void handle_arp(const EthernetFrameHeader& eth, size_t frame_size)
@@ -395,6 +407,7 @@ void handle_tcp(const IPv4Packet& ipv4_packet)
                 klog() << "handle_tcp: couldn't create client socket";
                 return;
             }
+            client->receive_syn_options(tcp_packet);
 #ifdef TCP_DEBUG
             klog() << "handle_tcp: created new client socket with tuple " << client->tuple().to_string().characters();
 #endif
@@ -493,6 +506,9 @@ void handle_tcp(const IPv4Packet& ipv4_packet)
     case TCPSocket::State::LastAck:
         switch (tcp_packet.flags()) {
         case TCPFlags::ACK:
+            // Data we queued before our FIN may still be coming in for acknowledgement.
+            if (socket->has_unacknowledged_data())
+                return;
             socket->set_ack_number(tcp_packet.sequence_number() + payload_size);
             socket->set_state(TCPSocket::State::Closed);
             return;
@@ -505,6 +521,8 @@ void handle_tcp(const IPv4Packet& ipv4_packet)
     case TCPSocket::State::FinWait1:
         switch (tcp_packet.flags()) {
         case TCPFlags::ACK:
+            if (socket->has_unacknowledged_data())
+                return;
             socket->set_ack_number(tcp_packet.sequence_number() + payload_size);
             socket->set_state(TCPSocket::State::FinWait2);
             return;
@@ -546,9 +564,19 @@ void handle_tcp(const IPv4Packet& ipv4_packet)
             return;
         }
     case TCPSocket::State::Established:
+        if ((payload_size || tcp_packet.has_fin()) && tcp_packet.sequence_number() != socket->ack_number()) {
+            // We don't keep out-of-order segments around. Re-acknowledging what we have makes for the
+            // duplicate ACKs the peer needs to notice the hole and fast-retransmit into it.
+#ifdef TCP_DEBUG
+            klog() << "handle_tcp: dropping out-of-order segment seq_no=" << tcp_packet.sequence_number() << ", expected " << socket->ack_number();
+#endif
+            socket->send_tcp_packet(TCPFlags::ACK);
+            return;
+        }
+
         if (tcp_packet.has_fin()) {
             if (payload_size != 0)
-                socket->did_receive(ipv4_packet.source(), tcp_packet.source_port(), KBuffer::copy(&ipv4_packet, sizeof(IPv4Packet) + ipv4_packet.payload_size()));
+                socket->did_receive_stream_data((const u8*)tcp_packet.payload(), payload_size);
 
             socket->set_ack_number(tcp_packet.sequence_number() + payload_size + 1);
             socket->send_tcp_packet(TCPFlags::ACK);
@@ -557,15 +585,15 @@ void handle_tcp(const IPv4Packet& ipv4_packet)
             return;
         }
 
-        socket->set_ack_number(tcp_packet.sequence_number() + payload_size);
-
 #ifdef TCP_DEBUG
-        klog() << "Got packet with ack_no=" << tcp_packet.ack_number() << ", seq_no=" << tcp_packet.sequence_number() << ", payload_size=" << payload_size << ", acking it with new ack_no=" << socket->ack_number() << ", seq_no=" << socket->sequence_number();
+        klog() << "Got packet with ack_no=" << tcp_packet.ack_number() << ", seq_no=" << tcp_packet.sequence_number() << ", payload_size=" << payload_size << ", ack_no=" << socket->ack_number() << ", seq_no=" << socket->sequence_number();
 #endif
 
         if (payload_size) {
-            if (socket->did_receive(ipv4_packet.source(), tcp_packet.source_port(), KBuffer::copy(&ipv4_packet, sizeof(IPv4Packet) + ipv4_packet.payload_size())))
-                socket->send_tcp_packet(TCPFlags::ACK);
+            // Only acknowledge what actually made it into the receive buffer; the peer resends the rest.
+            if (socket->did_receive_stream_data((const u8*)tcp_packet.payload(), payload_size))
+                socket->set_ack_number(tcp_packet.sequence_number() + payload_size);
+            socket->send_tcp_packet(TCPFlags::ACK);
         }
     }
 }
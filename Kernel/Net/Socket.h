@@ -91,7 +91,11 @@ public:
     virtual Role role(const FileDescription&) const { return m_role; }
 
     bool is_connected() const { return m_connected; }
-    void set_connected(bool connected) { m_connected = connected; }
+    void set_connected(bool connected)
+    {
+        m_connected = connected;
+        evaluate_block_conditions();
+    }
 
     bool can_accept() const { return !m_pending.is_empty(); }
     RefPtr<Socket> accept();
@@ -110,6 +114,11 @@ public:
     virtual ssize_t sendto(FileDescription&, const void*, size_t, int flags, const sockaddr*, socklen_t) = 0;
     virtual ssize_t recvfrom(FileDescription&, void*, size_t, int flags, sockaddr*, socklen_t*) = 0;
 
+    // Brackets a series of writes that belong together, e.g. the pieces of a writev(). Stream
+    // sockets can then build full segments across them rather than sending each piece alone.
+    virtual void cork() {}
+    virtual void uncork() {}
+
     virtual KResult setsockopt(int level, int option, const void*, socklen_t);
     virtual KResult getsockopt(FileDescription&, int level, int option, void*, socklen_t*);
 
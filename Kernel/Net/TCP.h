@@ -26,6 +26,7 @@
 
 #pragma once
 
+#include <AK/Optional.h>
 #include <Kernel/Net/IPv4.h>
 
 namespace Kernel {
@@ -41,6 +42,14 @@ struct TCPFlags {
     };
 };
 
+struct TCPOptionKind {
+    enum : u8 {
+        End = 0,
+        NoOperation = 1,
+        MaximumSegmentSize = 2,
+    };
+};
+
 class [[gnu::packed]] TCPPacket
 {
 public:
@@ -81,6 +90,27 @@ public:
     u16 urgent() const { return m_urgent; }
     void set_urgent(u16 urgent) { m_urgent = urgent; }
 
+    Optional<u16> maximum_segment_size() const
+    {
+        auto* options = (const u8*)this + sizeof(TCPPacket);
+        size_t options_size = header_size() > sizeof(TCPPacket) ? header_size() - sizeof(TCPPacket) : 0;
+        for (size_t i = 0; i < options_size;) {
+            u8 kind = options[i];
+            if (kind == TCPOptionKind::End)
+                break;
+            if (kind == TCPOptionKind::NoOperation) {
+                ++i;
+                continue;
+            }
+            if (i + 1 >= options_size || options[i + 1] < 2 || i + options[i + 1] > options_size)
+                break;
+            if (kind == TCPOptionKind::MaximumSegmentSize && options[i + 1] == 4)
+                return (u16)((options[i + 2] << 8) | options[i + 3]);
+            i += options[i + 1];
+        }
+        return {};
+    }
+
     const void* payload() const { return ((const u8*)this) + header_size(); }
     void* payload() { return ((u8*)this) + header_size(); }
 
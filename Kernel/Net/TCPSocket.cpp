@@ -24,6 +24,7 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <AK/NumericLimits.h>
 #include <AK/Time.h>
 #include <Kernel/Devices/RandomDevice.h>
 #include <Kernel/FileSystem/FileDescription.h>
@@ -38,6 +39,39 @@
 
 namespace Kernel {
 
+// Segment size to assume when the peer doesn't tell us (RFC 1122, section 4.2.2.6).
+static const u16 default_mss = 536;
+static const u16 minimum_mss = 64;
+
+static const u32 minimum_retransmit_timeout_ms = 200;
+static const u32 maximum_retransmit_timeout_ms = 60000;
+
+static const u32 duplicate_ack_threshold = 3;
+static const u32 maximum_congestion_window = 1024 * 1024;
+
+// Sequence numbers wrap around, so they're ordered by the sign of their distance (RFC 793, section 3.3).
+static inline bool sequence_less_than(u32 a, u32 b)
+{
+    return (i32)(a - b) < 0;
+}
+
+static inline bool sequence_less_than_or_equal(u32 a, u32 b)
+{
+    return (i32)(a - b) <= 0;
+}
+
+// RFC 3390: up to four segments, but no more than about 4 KiB.
+static u32 initial_congestion_window(u16 mss)
+{
+    return min(4u * mss, max(2u * mss, 4380u));
+}
+
+static u64 now_in_microseconds()
+{
+    auto now = kgettimeofday();
+    return (u64)now.tv_sec * 1000000 + now.tv_usec;
+}
+
 void TCPSocket::for_each(Function<void(const TCPSocket&)> callback)
 {
     LOCKER(sockets_by_tuple().lock(), Lock::Mode::Shared);
@@ -57,9 +91,12 @@ void TCPSocket::set_state(State new_state)
         m_role = Role::Connected;
 
     if (new_state == State::Closed) {
+        m_retransmit_deadline = 0;
         LOCKER(closing_sockets().lock());
         closing_sockets().resource().remove(tuple());
     }
+
+    evaluate_block_conditions();
 }
 
 Lockable<HashMap<IPv4SocketTuple, RefPtr<TCPSocket>>>& TCPSocket::closing_sockets()
@@ -161,57 +198,157 @@ NonnullRefPtr<TCPSocket> TCPSocket::create(int protocol)
     return adopt(*new TCPSocket(protocol));
 }
 
-int TCPSocket::protocol_receive(const KBuffer& packet_buffer, void* buffer, size_t buffer_size, int flags)
+int TCPSocket::protocol_send(const void* data, size_t data_length)
 {
-    (void)flags;
-    auto& ipv4_packet = *(const IPv4Packet*)(packet_buffer.data());
-    auto& tcp_packet = *static_cast<const TCPPacket*>(ipv4_packet.payload());
-    size_t payload_size = packet_buffer.size() - sizeof(IPv4Packet) - tcp_packet.header_size();
-#ifdef TCP_SOCKET_DEBUG
-    klog() << "payload_size " << payload_size << ", will it fit in " << buffer_size << "?";
-#endif
-    ASSERT(buffer_size >= payload_size);
-    memcpy(buffer, tcp_packet.payload(), payload_size);
-    return payload_size;
+    if (m_state != State::Established && m_state != State::CloseWait)
+        return -ENOTCONN;
+
+    LOCKER(m_not_acked_lock);
+    if (m_fin_pending)
+        return -EPIPE;
+
+    // With nothing queued ahead of it, whatever the window allows is cut into segments straight
+    // from the caller's memory. Only the rest takes a detour through the send buffer.
+    auto* bytes = (const u8*)data;
+    size_t nsent = 0;
+    if (!m_send_buffer.used_bytes()) {
+        while (nsent < data_length) {
+            size_t segment_size = next_segment_size(data_length - nsent);
+            if (!segment_size)
+                break;
+            queue_segment(bytes + nsent, segment_size, nsent + segment_size == data_length);
+            nsent += segment_size;
+        }
+    }
+    if (nsent < data_length)
+        nsent += m_send_buffer.write(bytes + nsent, data_length - nsent);
+
+    if (!nsent && data_length)
+        return -EAGAIN;
+    send_outgoing_packets();
+    return nsent;
 }
 
-int TCPSocket::protocol_send(const void* data, size_t data_length)
+void TCPSocket::cork()
 {
-    send_tcp_packet(TCPFlags::PUSH | TCPFlags::ACK, data, data_length);
-    return data_length;
+    m_corked = true;
 }
 
-void TCPSocket::send_tcp_packet(u16 flags, const void* payload, size_t payload_size)
+void TCPSocket::uncork()
+{
+    m_corked = false;
+    if (m_state == State::Established || m_state == State::CloseWait)
+        send_outgoing_packets();
+}
+
+bool TCPSocket::can_write(const FileDescription& description, size_t size) const
+{
+    return IPv4Socket::can_write(description, size) && m_send_buffer.space_for_writing() > 0;
+}
+
+bool TCPSocket::has_hung_up(const FileDescription&) const
+{
+    // The peer has sent its FIN, or the connection is gone altogether.
+    switch (m_state) {
+    case State::Closed:
+    case State::CloseWait:
+    case State::LastAck:
+    case State::Closing:
+    case State::TimeWait:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool TCPSocket::has_unacknowledged_data() const
+{
+    return m_fin_pending || m_send_buffer.used_bytes() || m_send_unacknowledged != m_sequence_number;
+}
+
+u16 TCPSocket::local_mss() const
+{
+    auto routing_decision = route_to(peer_address(), local_address(), bound_interface());
+    if (routing_decision.is_zero())
+        return default_mss;
+    u32 mtu = min(routing_decision.adapter->mtu(), (u32)NumericLimits<u16>::max());
+    return mtu - sizeof(IPv4Packet) - sizeof(TCPPacket);
+}
+
+u16 TCPSocket::advertised_window_size() const
+{
+    // Without window scaling, the 16-bit header field is as much as we can offer.
+    size_t space = min(receive_buffer_space(), (size_t)NumericLimits<u16>::max());
+    // Don't offer slivers of window that would only invite tiny segments (RFC 1122, section 4.2.3.3).
+    if (space < min((size_t)m_send_mss, (size_t)NumericLimits<u16>::max() / 2))
+        return 0;
+    return space;
+}
+
+ByteBuffer TCPSocket::build_tcp_packet(u16 flags, const void* payload, size_t payload_size)
 {
-    auto buffer = ByteBuffer::create_zeroed(sizeof(TCPPacket) + payload_size);
+    // The only option we send is our MSS, and only on SYN.
+    size_t header_size = sizeof(TCPPacket) + ((flags & TCPFlags::SYN) ? 4 : 0);
+    auto buffer = ByteBuffer::create_uninitialized(header_size + payload_size);
+    memset(buffer.data(), 0, header_size);
     auto& tcp_packet = *(TCPPacket*)(buffer.data());
     ASSERT(local_port());
     tcp_packet.set_source_port(local_port());
     tcp_packet.set_destination_port(peer_port());
-    tcp_packet.set_window_size(1024);
     tcp_packet.set_sequence_number(m_sequence_number);
-    tcp_packet.set_data_offset(sizeof(TCPPacket) / sizeof(u32));
+    tcp_packet.set_data_offset(header_size / sizeof(u32));
     tcp_packet.set_flags(flags);
 
-    if (flags & TCPFlags::ACK)
-        tcp_packet.set_ack_number(m_ack_number);
-
     if (flags & TCPFlags::SYN) {
-        ++m_sequence_number;
-    } else {
-        m_sequence_number += payload_size;
+        u16 mss = local_mss();
+        auto* option = buffer.data() + sizeof(TCPPacket);
+        option[0] = TCPOptionKind::MaximumSegmentSize;
+        option[1] = 4;
+        option[2] = mss >> 8;
+        option[3] = mss & 0xff;
+
+        m_send_unacknowledged = m_sequence_number;
+        m_send_next = m_sequence_number;
+        m_recover = m_sequence_number;
+        m_congestion_window = initial_congestion_window(m_send_mss);
     }
 
-    memcpy(tcp_packet.payload(), payload, payload_size);
-    tcp_packet.set_checksum(compute_tcp_checksum(local_address(), peer_address(), tcp_packet, payload_size));
+    if (payload)
+        memcpy(tcp_packet.payload(), payload, payload_size);
 
-    if (tcp_packet.has_syn() || payload_size > 0) {
-        LOCKER(m_not_acked_lock);
+    // SYN and FIN each occupy a sequence number of their own.
+    if (flags & (TCPFlags::SYN | TCPFlags::FIN))
+        ++m_sequence_number;
+    m_sequence_number += payload_size;
+
+    return buffer;
+}
+
+void TCPSocket::send_tcp_packet(u16 flags, const void* payload, size_t payload_size)
+{
+    LOCKER(m_not_acked_lock);
+    auto buffer = build_tcp_packet(flags, payload, payload_size);
+
+    if ((flags & (TCPFlags::SYN | TCPFlags::FIN)) || payload_size > 0) {
         m_not_acked.append({ m_sequence_number, move(buffer) });
         send_outgoing_packets();
         return;
     }
 
+    transmit(buffer);
+}
+
+void TCPSocket::transmit(ByteBuffer& buffer)
+{
+    // The acknowledgement and window are filled in at the last moment, so retransmissions carry current ones.
+    auto& tcp_packet = *(TCPPacket*)(buffer.data());
+    if (tcp_packet.has_ack())
+        tcp_packet.set_ack_number(m_ack_number);
+    m_last_advertised_window = advertised_window_size();
+    tcp_packet.set_window_size(m_last_advertised_window);
+    tcp_packet.set_checksum(0);
+    tcp_packet.set_checksum(compute_tcp_checksum(local_address(), peer_address(), tcp_packet, buffer.size() - tcp_packet.header_size()));
+
     auto routing_decision = route_to(peer_address(), local_address(), bound_interface());
     ASSERT(!routing_decision.is_zero());
 
@@ -223,68 +360,317 @@ void TCPSocket::send_tcp_packet(u16 flags, const void* payload, size_t payload_s
     m_bytes_out += buffer.size();
 }
 
+void TCPSocket::transmit(OutgoingPacket& packet, u64 now)
+{
+    packet.tx_time = now;
+    packet.tx_counter++;
+
+#ifdef TCP_SOCKET_DEBUG
+    auto& tcp_packet = *(TCPPacket*)(packet.buffer.data());
+    klog() << "sending tcp packet from " << local_address().to_string().characters() << ":" << local_port() << " to " << peer_address().to_string().characters() << ":" << peer_port() << " with (" << (tcp_packet.has_syn() ? "SYN " : "") << (tcp_packet.has_ack() ? "ACK " : "") << (tcp_packet.has_fin() ? "FIN " : "") << (tcp_packet.has_rst() ? "RST " : "") << ") seq_no=" << tcp_packet.sequence_number() << ", ack_no=" << m_ack_number << ", tx_counter=" << packet.tx_counter;
+#endif
+
+    transmit(packet.buffer);
+}
+
+size_t TCPSocket::next_segment_size(size_t queued) const
+{
+    // New segments only go as far as both the peer's window and the congestion window reach.
+    u32 window = min(m_congestion_window, m_send_window);
+    u32 in_flight = m_sequence_number - m_send_unacknowledged;
+    size_t usable = window > in_flight ? window - in_flight : 0;
+    size_t wanted = min(queued, (size_t)m_send_mss);
+    size_t segment_size = min(wanted, usable);
+
+    // Sender-side silly window avoidance: while data is in flight, wait for room for a full segment.
+    if (segment_size < wanted && in_flight)
+        return 0;
+    if (m_corked && segment_size < m_send_mss)
+        return 0;
+    return segment_size;
+}
+
+void TCPSocket::queue_segment(const u8* data, size_t size, bool push)
+{
+    u16 flags = TCPFlags::ACK;
+    if (push)
+        flags |= TCPFlags::PUSH;
+
+    auto buffer = build_tcp_packet(flags, data, size);
+    if (!data) {
+        auto* payload = (u8*)((TCPPacket*)buffer.data())->payload();
+        for (size_t nread = 0; nread < size;) {
+            ssize_t rc = m_send_buffer.read(payload + nread, size - nread);
+            ASSERT(rc > 0);
+            nread += rc;
+        }
+    }
+
+    m_not_acked.append({ m_sequence_number, move(buffer) });
+}
+
 void TCPSocket::send_outgoing_packets()
 {
-    auto routing_decision = route_to(peer_address(), local_address(), bound_interface());
-    ASSERT(!routing_decision.is_zero());
+    LOCKER(m_not_acked_lock);
 
-    auto now = kgettimeofday();
+    switch (m_state) {
+    case State::Established:
+    case State::CloseWait:
+    case State::FinWait1:
+    case State::LastAck: {
+        bool did_take_data = false;
+        while (size_t queued = m_send_buffer.used_bytes()) {
+            size_t segment_size = next_segment_size(queued);
+            if (!segment_size)
+                break;
+            queue_segment(nullptr, segment_size, segment_size == queued);
+            did_take_data = true;
+        }
 
-    LOCKER(m_not_acked_lock, Lock::Mode::Shared);
+        if (m_fin_pending && !m_send_buffer.used_bytes()) {
+            m_fin_pending = false;
+            auto buffer = build_tcp_packet(TCPFlags::FIN | TCPFlags::ACK, nullptr, 0);
+            m_not_acked.append({ m_sequence_number, move(buffer) });
+        }
+
+        if (did_take_data)
+            evaluate_block_conditions();
+        break;
+    }
+    default:
+        break;
+    }
+
+    auto now = now_in_microseconds();
     for (auto& packet : m_not_acked) {
-        timeval diff;
-        timeval_sub(packet.tx_time, now, diff);
-        if (diff.tv_sec == 0 && diff.tv_usec <= 500000)
+        if (packet.tx_counter)
             continue;
-        packet.tx_time = now;
-        packet.tx_counter++;
+        transmit(packet, now);
+        m_send_next = packet.ack_number;
+    }
 
-#ifdef TCP_SOCKET_DEBUG
-        auto& tcp_packet = *(TCPPacket*)(packet.buffer.data());
-        klog() << "sending tcp packet from " << local_address().to_string().characters() << ":" << local_port() << " to " << peer_address().to_string().characters() << ":" << peer_port() << " with (" << (tcp_packet.has_syn() ? "SYN " : "") << (tcp_packet.has_ack() ? "ACK " : "") << (tcp_packet.has_fin() ? "FIN " : "") << (tcp_packet.has_rst() ? "RST " : "") << ") seq_no=" << tcp_packet.sequence_number() << ", ack_no=" << tcp_packet.ack_number() << ", tx_counter=" << packet.tx_counter;
-#endif
-        routing_decision.adapter->send_ipv4(
-            routing_decision.next_hop, peer_address(), IPv4Protocol::TCP,
-            packet.buffer.data(), packet.buffer.size(), ttl());
+    // Also keep the timer running while a closed window holds back queued data, so we get to probe it.
+    if (!m_retransmit_deadline && (bytes_in_flight() || m_send_buffer.used_bytes()))
+        arm_retransmit_timer(now);
+}
+
+void TCPSocket::retransmit_first_unacknowledged(u64 now)
+{
+    if (m_not_acked.is_empty() || !m_not_acked.first().tx_counter)
+        return;
+    ++m_retransmissions;
+    transmit(m_not_acked.first(), now);
+}
+
+void TCPSocket::arm_retransmit_timer(u64 now)
+{
+    m_retransmit_deadline = now + (u64)m_retransmit_timeout * 1000;
+}
 
-        m_packets_out++;
-        m_bytes_out += packet.buffer.size();
+void TCPSocket::update_rtt(u32 sample)
+{
+    sample = min(sample, maximum_retransmit_timeout_ms * 1000);
+    if (!m_has_rtt_sample) {
+        m_smoothed_rtt = sample;
+        m_rtt_variance = sample / 2;
+        m_has_rtt_sample = true;
+    } else {
+        u32 delta = m_smoothed_rtt > sample ? m_smoothed_rtt - sample : sample - m_smoothed_rtt;
+        m_rtt_variance = (3 * m_rtt_variance + delta) / 4;
+        m_smoothed_rtt = (7 * m_smoothed_rtt + sample) / 8;
     }
+
+    u32 timeout = (m_smoothed_rtt + 4 * m_rtt_variance) / 1000;
+    m_retransmit_timeout = max(minimum_retransmit_timeout_ms, min(timeout, maximum_retransmit_timeout_ms));
+}
+
+void TCPSocket::receive_syn_options(const TCPPacket& packet)
+{
+    LOCKER(m_not_acked_lock);
+    auto mss = packet.maximum_segment_size();
+    u16 peer_mss = mss.has_value() && mss.value() >= minimum_mss ? mss.value() : default_mss;
+    m_send_mss = min(peer_mss, local_mss());
+    m_send_window = packet.window_size();
+    m_congestion_window = initial_congestion_window(m_send_mss);
 }
 
 void TCPSocket::receive_tcp_packet(const TCPPacket& packet, u16 size)
 {
+    if (packet.has_syn() && m_state != State::Listen)
+        receive_syn_options(packet);
+
     if (packet.has_ack()) {
         u32 ack_number = packet.ack_number();
 
 #ifdef TCP_SOCKET_DEBUG
-        dbg() << "TCPSocket: receive_tcp_packet: " << ack_number;
+        dbg() << "TCPSocket: receive_tcp_packet: " << ack_number << ", unacknowledged=" << m_send_unacknowledged << ", next=" << m_send_next;
 #endif
 
-        int removed = 0;
         LOCKER(m_not_acked_lock);
-        while (!m_not_acked.is_empty()) {
-            auto& packet = m_not_acked.first();
+        auto now = now_in_microseconds();
+        if (sequence_less_than(m_send_next, ack_number)) {
+#ifdef TCP_SOCKET_DEBUG
+            dbg() << "TCPSocket: receive_tcp_packet ignoring ACK for data we haven't sent";
+#endif
+        } else if (sequence_less_than(m_send_unacknowledged, ack_number)) {
+            m_send_window = packet.window_size();
+            handle_new_ack(ack_number, now);
+        } else if (ack_number == m_send_unacknowledged) {
+            // Only a bare ACK that leaves the window alone hints at a lost segment (RFC 5681, section 2).
+            size_t payload_size = size - packet.header_size();
+            bool is_duplicate = !payload_size && !packet.has_syn() && !packet.has_fin() && packet.window_size() == m_send_window && bytes_in_flight();
+            m_send_window = packet.window_size();
+            if (is_duplicate)
+                handle_duplicate_ack(now);
+        }
+
+        send_outgoing_packets();
+    }
+
+    m_packets_in++;
+    m_bytes_in += packet.header_size() + size;
+}
+
+void TCPSocket::handle_new_ack(u32 ack_number, u64 now)
+{
+    u32 acked = ack_number - m_send_unacknowledged;
+    m_send_unacknowledged = ack_number;
+    m_duplicate_acks = 0;
+
+    int removed = 0;
+    bool did_retransmit = false;
+    u64 newest_tx_time = 0;
+    while (!m_not_acked.is_empty() && sequence_less_than_or_equal(m_not_acked.first().ack_number, ack_number)) {
+        auto packet = m_not_acked.take_first();
+        did_retransmit |= packet.tx_counter > 1;
+        newest_tx_time = packet.tx_time;
+        removed++;
+    }
 
 #ifdef TCP_SOCKET_DEBUG
-            dbg() << "TCPSocket: iterate: " << packet.ack_number;
+    dbg() << "TCPSocket: receive_tcp_packet acknowledged " << removed << " packets";
 #endif
 
-            if (packet.ack_number <= ack_number) {
-                m_not_acked.take_first();
-                removed++;
-            } else {
-                break;
-            }
+    // Karn's algorithm: the ACK of a retransmitted segment is ambiguous, so it can't be timed.
+    if (removed && !did_retransmit && now > newest_tx_time)
+        update_rtt(now - newest_tx_time);
+
+    switch (m_congestion_state) {
+    case CongestionState::FastRecovery:
+        if (sequence_less_than(ack_number, m_recover)) {
+            // Partial ACK: the segment after the one we resent was lost too (RFC 6582, section 3.2).
+            retransmit_first_unacknowledged(now);
+            m_congestion_window -= min(acked, m_congestion_window);
+            m_congestion_window += m_send_mss;
+        } else {
+            m_congestion_window = min(m_slow_start_threshold, bytes_in_flight() + m_send_mss);
+            m_congestion_state = CongestionState::Open;
         }
+        break;
+    case CongestionState::LossRecovery:
+        if (!sequence_less_than(ack_number, m_recover))
+            m_congestion_state = CongestionState::Open;
+        else if (m_not_acked.first().tx_counter == 1)
+            retransmit_first_unacknowledged(now);
+        [[fallthrough]];
+    case CongestionState::Open:
+        if (m_congestion_window < m_slow_start_threshold)
+            m_congestion_window += min(acked, (u32)m_send_mss);
+        else
+            m_congestion_window += max(1u, (u32)m_send_mss * m_send_mss / m_congestion_window);
+        m_congestion_window = min(m_congestion_window, maximum_congestion_window);
+        break;
+    }
+
+    // Restart the timer whenever new data is acknowledged (RFC 6298, section 5.3).
+    if (bytes_in_flight())
+        arm_retransmit_timer(now);
+    else
+        m_retransmit_deadline = 0;
+}
+
+void TCPSocket::handle_duplicate_ack(u64 now)
+{
+    ++m_duplicate_acks;
+
+    if (m_congestion_state == CongestionState::FastRecovery) {
+        // Each further duplicate means another segment has left the network.
+        m_congestion_window += m_send_mss;
+        return;
+    }
+
+    // Don't react twice to losses from a window we've already recovered (RFC 6582, section 3.2).
+    if (m_congestion_state != CongestionState::Open || m_duplicate_acks != duplicate_ack_threshold || sequence_less_than(m_send_unacknowledged, m_recover))
+        return;
+
+    m_slow_start_threshold = max(bytes_in_flight() / 2, 2u * m_send_mss);
+    m_recover = m_send_next;
+    retransmit_first_unacknowledged(now);
+    m_congestion_window = m_slow_start_threshold + duplicate_ack_threshold * m_send_mss;
+    m_congestion_state = CongestionState::FastRecovery;
+}
+
+void TCPSocket::handle_retransmit_timeout(u64 now)
+{
+    LOCKER(m_not_acked_lock);
+    if (!m_retransmit_deadline || now < m_retransmit_deadline)
+        return;
+    m_retransmit_deadline = 0;
+
+    // Back off exponentially until an unambiguous round trip gives us a new estimate (RFC 6298, section 5.5).
+    m_retransmit_timeout = min(m_retransmit_timeout * 2, maximum_retransmit_timeout_ms);
+
+    if (!bytes_in_flight()) {
+        // The peer's window is shut while we have data for it. Probe it with a single byte, so that
+        // a lost window update can't stall the connection forever (RFC 1122, section 4.2.2.17).
+        if (m_send_buffer.used_bytes() && !m_send_window)
+            queue_segment(nullptr, 1, false);
+        send_outgoing_packets();
+        return;
+    }
 
 #ifdef TCP_SOCKET_DEBUG
-        dbg() << "TCPSocket: receive_tcp_packet acknowledged " << removed << " packets";
+    dbg() << "TCPSocket: retransmission timeout, unacknowledged=" << m_send_unacknowledged << ", next timeout in " << m_retransmit_timeout << " ms";
 #endif
+
+    // Only the first timeout of a segment tells us something new about the path (RFC 5681, section 3.1).
+    if (m_not_acked.first().tx_counter == 1)
+        m_slow_start_threshold = max(bytes_in_flight() / 2, 2u * m_send_mss);
+    m_congestion_window = m_send_mss;
+    m_congestion_state = CongestionState::LossRecovery;
+    m_recover = m_send_next;
+    m_duplicate_acks = 0;
+
+    retransmit_first_unacknowledged(now);
+    arm_retransmit_timer(now);
+}
+
+void TCPSocket::fire_retransmit_timers()
+{
+    auto now = now_in_microseconds();
+
+    Vector<NonnullRefPtr<TCPSocket>> expired;
+    {
+        LOCKER(sockets_by_tuple().lock(), Lock::Mode::Shared);
+        for (auto& it : sockets_by_tuple().resource()) {
+            auto& socket = *it.value;
+            if (socket.m_retransmit_deadline && socket.m_retransmit_deadline <= now)
+                expired.append(socket);
+        }
     }
 
-    m_packets_in++;
-    m_bytes_in += packet.header_size() + size;
+    for (auto& socket : expired)
+        socket->handle_retransmit_timeout(now);
+}
+
+void TCPSocket::protocol_did_read()
+{
+    if (m_state != State::Established && m_state != State::FinWait1 && m_state != State::FinWait2)
+        return;
+
+    // Tell the peer once reading has opened up at least another segment's worth of window.
+    if (advertised_window_size() >= m_last_advertised_window + min((u32)m_send_mss, (u32)NumericLimits<u16>::max() / 2))
+        send_tcp_packet(TCPFlags::ACK);
 }
 
 NetworkOrdered<u16> TCPSocket::compute_tcp_checksum(const IPv4Address& source, const IPv4Address& destination, const TCPPacket& packet, u16 payload_size)
@@ -298,7 +684,7 @@ NetworkOrdered<u16> TCPSocket::compute_tcp_checksum(const IPv4Address& source, c
         NetworkOrdered<u16> payload_size;
     };
 
-    PseudoHeader pseudo_header { source, destination, 0, (u8)IPv4Protocol::TCP, sizeof(TCPPacket) + payload_size };
+    PseudoHeader pseudo_header { source, destination, 0, (u8)IPv4Protocol::TCP, (u16)(packet.header_size() + payload_size) };
 
     u32 checksum = 0;
     auto* w = (const NetworkOrdered<u16>*)&pseudo_header;
@@ -308,12 +694,11 @@ NetworkOrdered<u16> TCPSocket::compute_tcp_checksum(const IPv4Address& source, c
             checksum = (checksum >> 16) + (checksum & 0xffff);
     }
     w = (const NetworkOrdered<u16>*)&packet;
-    for (size_t i = 0; i < sizeof(packet) / sizeof(u16); ++i) {
+    for (size_t i = 0; i < packet.header_size() / sizeof(u16); ++i) {
         checksum += w[i];
         if (checksum > 0xffff)
             checksum = (checksum >> 16) + (checksum & 0xffff);
     }
-    ASSERT(packet.data_offset() * 4 == sizeof(TCPPacket));
     w = (const NetworkOrdered<u16>*)packet.payload();
     for (size_t i = 0; i < payload_size / sizeof(u16); ++i) {
         checksum += w[i];
@@ -372,7 +757,7 @@ KResult TCPSocket::protocol_connect(FileDescription& description, ShouldBlock sh
     m_direction = Direction::Outgoing;
 
     if (should_block == ShouldBlock::Yes) {
-        if (Thread::current->block<Thread::ConnectBlocker>(description) != Thread::BlockResult::WokeNormally)
+        if (Thread::current()->block<Thread::ConnectBlocker>(description) != Thread::BlockResult::WokeNormally)
             return KResult(-EINTR);
         ASSERT(setup_state() == SetupState::Completed);
         if (has_error()) {
@@ -433,8 +818,11 @@ void TCPSocket::shut_down_for_writing()
 #ifdef TCP_SOCKET_DEBUG
         dbg() << " Sending FIN/ACK from Established and moving into FinWait1";
 #endif
-        send_tcp_packet(TCPFlags::FIN | TCPFlags::ACK);
         set_state(State::FinWait1);
+        // The FIN goes out behind whatever is still queued for sending.
+        LOCKER(m_not_acked_lock);
+        m_fin_pending = true;
+        send_outgoing_packets();
     } else {
         dbg() << " Shutting down TCPSocket for writing but not moving to FinWait1 since state is " << to_string(state());
     }
@@ -447,8 +835,10 @@ KResult TCPSocket::close()
 #ifdef TCP_SOCKET_DEBUG
         dbg() << " Sending FIN from CloseWait and moving into LastAck";
 #endif
-        send_tcp_packet(TCPFlags::FIN | TCPFlags::ACK);
         set_state(State::LastAck);
+        LOCKER(m_not_acked_lock);
+        m_fin_pending = true;
+        send_outgoing_packets();
     }
 
     LOCKER(closing_sockets().lock());
@@ -149,9 +149,20 @@ public:
     u32 packets_out() const { return m_packets_out; }
     u32 bytes_out() const { return m_bytes_out; }
 
+    u16 send_mss() const { return m_send_mss; }
+    u32 congestion_window() const { return m_congestion_window; }
+    u32 slow_start_threshold() const { return m_slow_start_threshold; }
+    u32 smoothed_rtt() const { return m_smoothed_rtt; }
+    u32 retransmit_timeout() const { return m_retransmit_timeout; }
+    u32 retransmissions() const { return m_retransmissions; }
+
     void send_tcp_packet(u16 flags, const void* = nullptr, size_t = 0);
     void send_outgoing_packets();
     void receive_tcp_packet(const TCPPacket&, u16 size);
+    void receive_syn_options(const TCPPacket&);
+    bool has_unacknowledged_data() const;
+
+    static void fire_retransmit_timers();
 
     static Lockable<HashMap<IPv4SocketTuple, TCPSocket*>>& sockets_by_tuple();
     static RefPtr<TCPSocket> from_tuple(const IPv4SocketTuple& tuple);
@@ -177,14 +188,47 @@ private:
     static NetworkOrdered<u16> compute_tcp_checksum(const IPv4Address& source, const IPv4Address& destination, const TCPPacket&, u16 payload_size);
 
     virtual void shut_down_for_writing() override;
+    virtual bool can_write(const FileDescription&, size_t) const override;
+    virtual bool has_hung_up(const FileDescription&) const override;
+    virtual bool has_pending_error(const FileDescription&) const override { return has_error(); }
+    virtual void cork() override;
+    virtual void uncork() override;
 
-    virtual int protocol_receive(const KBuffer&, void* buffer, size_t buffer_size, int flags) override;
     virtual int protocol_send(const void*, size_t) override;
     virtual KResult protocol_connect(FileDescription&, ShouldBlock) override;
     virtual int protocol_allocate_local_port() override;
     virtual bool protocol_is_disconnected() const override;
     virtual KResult protocol_bind() override;
     virtual KResult protocol_listen() override;
+    virtual void protocol_did_read() override;
+
+    struct OutgoingPacket {
+        u32 ack_number { 0 };
+        ByteBuffer buffer;
+        int tx_counter { 0 };
+        u64 tx_time { 0 };
+    };
+
+    enum class CongestionState {
+        Open,
+        FastRecovery,
+        LossRecovery,
+    };
+
+    ByteBuffer build_tcp_packet(u16 flags, const void* payload, size_t payload_size);
+    void transmit(ByteBuffer&);
+    void transmit(OutgoingPacket&, u64 now);
+    size_t next_segment_size(size_t queued) const;
+    void queue_segment(const u8* data, size_t size, bool push);
+    void retransmit_first_unacknowledged(u64 now);
+    void handle_new_ack(u32 ack_number, u64 now);
+    void handle_duplicate_ack(u64 now);
+    void handle_retransmit_timeout(u64 now);
+    void update_rtt(u32 sample);
+    void arm_retransmit_timer(u64 now);
+    u16 local_mss() const;
+    u16 advertised_window_size() const;
+    u32 bytes_in_flight() const { return m_send_next - m_send_unacknowledged; }
 
     WeakPtr<TCPSocket> m_originator;
     HashMap<IPv4SocketTuple, NonnullRefPtr<TCPSocket>> m_pending_release_for_accept;
@@ -199,15 +243,33 @@ private:
     u32 m_packets_out { 0 };
     u32 m_bytes_out { 0 };
 
-    struct OutgoingPacket {
-        u32 ack_number { 0 };
-        ByteBuffer buffer;
-        int tx_counter { 0 };
-        timeval tx_time { 0, 0 };
-    };
-
     Lock m_not_acked_lock { "TCPSocket unacked packets" };
     SinglyLinkedList<OutgoingPacket> m_not_acked;
+
+    // Bytes written by the application that haven't been cut into segments yet.
+    DoubleBuffer m_send_buffer;
+    bool m_fin_pending { false };
+    bool m_corked { false };
+
+    u32 m_send_unacknowledged { 0 };
+    u32 m_send_next { 0 };
+    u32 m_send_window { 0 };
+    u16 m_send_mss { 536 };
+    u16 m_last_advertised_window { 0 };
+
+    CongestionState m_congestion_state { CongestionState::Open };
+    u32 m_congestion_window { 0 };
+    u32 m_slow_start_threshold { 0xffffffff };
+    u32 m_recover { 0 };
+    u32 m_duplicate_acks { 0 };
+
+    // Round-trip estimates in microseconds, retransmission timeout in milliseconds (RFC 6298).
+    bool m_has_rtt_sample { false };
+    u32 m_smoothed_rtt { 0 };
+    u32 m_rtt_variance { 0 };
+    u32 m_retransmit_timeout { 1000 };
+    u64 m_retransmit_deadline { 0 };
+    u32 m_retransmissions { 0 };
 };
 
 }
@@ -41,6 +41,7 @@
 #include <Kernel/Devices/RandomDevice.h>
 #include <Kernel/FileSystem/Custody.h>
 #include <Kernel/FileSystem/DevPtsFS.h>
+#include <Kernel/FileSystem/EventPoll.h>
 #include <Kernel/FileSystem/Ext2FileSystem.h>
 #include <Kernel/FileSystem/FIFO.h>
 #include <Kernel/FileSystem/FileDescription.h>
@@ -70,6 +71,7 @@
 #include <Kernel/Thread.h>
 #include <Kernel/ThreadTracer.h>
 #include <Kernel/Time/TimeManagement.h>
+#include <Kernel/VM/PageCache.h>
 #include <Kernel/VM/PageDirectory.h>
 #include <Kernel/VM/PrivateInodeVMObject.h>
 #include <Kernel/VM/ProcessPagingScope.h>
@@ -95,8 +97,6 @@ namespace Kernel {
 
 static void create_signal_trampolines();
 
-Process* Process::current;
-
 static pid_t next_pid;
 InlineLinkedList<Process>* g_processes;
 static String* s_hostname;
@@ -173,6 +173,7 @@ Region& Process::allocate_split_region(const Region& source_region, const Range&
     auto& region = add_region(Region::create_user_accessible(range, source_region.vmobject(), offset_in_vmobject, source_region.name(), source_region.access()));
     region.set_mmap(source_region.is_mmap());
     region.set_stack(source_region.is_stack());
+    region.set_large_pages(source_region.wants_large_pages());
     size_t page_offset_in_source_region = (offset_in_vmobject - source_region.offset_in_vmobject()) / PAGE_SIZE;
     for (size_t i = 0; i < region.page_count(); ++i) {
         if (source_region.should_cow(page_offset_in_source_region + i))
@@ -181,11 +182,16 @@ Region& Process::allocate_split_region(const Region& source_region, const Range&
     return region;
 }
 
-Region* Process::allocate_region(const Range& range, const String& name, int prot, bool should_commit)
+Region* Process::allocate_region(const Range& range, const String& name, int prot, bool should_commit, bool large_pages)
 {
     ASSERT(range.is_valid());
-    auto vmobject = AnonymousVMObject::create_with_size(range.size());
-    auto region = Region::create_user_accessible(range, vmobject, 0, name, prot_to_region_access_flags(prot));
+    RefPtr<AnonymousVMObject> vmobject;
+    if (large_pages && MM.large_pages_enabled() && !(range.base().get() & ~LARGE_PAGE_MASK))
+        vmobject = AnonymousVMObject::create_with_large_pages(range.size());
+    else
+        vmobject = AnonymousVMObject::create_with_size(range.size());
+    auto region = Region::create_user_accessible(range, vmobject.release_nonnull(), 0, name, prot_to_region_access_flags(prot));
+    region->set_large_pages(large_pages);
     region->map(page_directory());
     if (should_commit && !region->commit())
         return nullptr;
@@ -200,7 +206,7 @@ Region* Process::allocate_region(VirtualAddress vaddr, size_t size, const String
     return allocate_region(range, name, prot, should_commit);
 }
 
-Region* Process::allocate_region_with_vmobject(const Range& range, NonnullRefPtr<VMObject> vmobject, size_t offset_in_vmobject, const String& name, int prot)
+Region* Process::allocate_region_with_vmobject(const Range& range, NonnullRefPtr<VMObject> vmobject, size_t offset_in_vmobject, const String& name, int prot, bool large_pages)
 {
     ASSERT(range.is_valid());
     size_t end_in_vmobject = offset_in_vmobject + range.size();
@@ -218,16 +224,17 @@ Region* Process::allocate_region_with_vmobject(const Range& range, NonnullRefPtr
     }
     offset_in_vmobject &= PAGE_MASK;
     auto& region = add_region(Region::create_user_accessible(range, move(vmobject), offset_in_vmobject, name, prot_to_region_access_flags(prot)));
+    region.set_large_pages(large_pages);
     region.map(page_directory());
     return &region;
 }
 
-Region* Process::allocate_region_with_vmobject(VirtualAddress vaddr, size_t size, NonnullRefPtr<VMObject> vmobject, size_t offset_in_vmobject, const String& name, int prot)
+Region* Process::allocate_region_with_vmobject(VirtualAddress vaddr, size_t size, NonnullRefPtr<VMObject> vmobject, size_t offset_in_vmobject, const String& name, int prot, bool large_pages)
 {
-    auto range = allocate_range(vaddr, size);
+    auto range = allocate_range(vaddr, size, large_pages ? LARGE_PAGE_SIZE : PAGE_SIZE);
     if (!range.is_valid())
         return nullptr;
-    return allocate_region_with_vmobject(range, move(vmobject), offset_in_vmobject, name, prot);
+    return allocate_region_with_vmobject(range, move(vmobject), offset_in_vmobject, name, prot, large_pages);
 }
 
 bool Process::deallocate_region(Region& region)
@@ -235,6 +242,10 @@ bool Process::deallocate_region(Region& region)
     InterruptDisabler disabler;
     if (m_region_lookup_cache.region == &region)
         m_region_lookup_cache.region = nullptr;
+    // A region split off from this one may already have taken over its slot in the tree.
+    auto** indexed_region = m_region_tree.find(region.vaddr().get());
+    if (indexed_region && *indexed_region == &region)
+        m_region_tree.remove(region.vaddr().get());
     for (size_t i = 0; i < m_regions.size(); ++i) {
         if (&m_regions[i] == &region) {
             m_regions.unstable_remove(i);
@@ -249,24 +260,29 @@ Region* Process::region_from_range(const Range& range)
     if (m_region_lookup_cache.range == range && m_region_lookup_cache.region)
         return m_region_lookup_cache.region;
 
-    size_t size = PAGE_ROUND_UP(range.size());
-    for (auto& region : m_regions) {
-        if (region.vaddr() == range.base() && region.size() == size) {
-            m_region_lookup_cache.range = range;
-            m_region_lookup_cache.region = region.make_weak_ptr();
-            return &region;
-        }
-    }
-    return nullptr;
+    auto** region = m_region_tree.find(range.base().get());
+    if (!region || (*region)->size() != PAGE_ROUND_UP(range.size()))
+        return nullptr;
+    m_region_lookup_cache.range = range;
+    m_region_lookup_cache.region = (*region)->make_weak_ptr();
+    return *region;
 }
 
 Region* Process::region_containing(const Range& range)
 {
-    for (auto& region : m_regions) {
-        if (region.contains(range))
-            return &region;
-    }
-    return nullptr;
+    // Regions never overlap, so the only candidate is the last one starting at or below the range.
+    auto** region = m_region_tree.find_largest_not_above(range.base().get());
+    if (!region || !(*region)->contains(range))
+        return nullptr;
+    return *region;
+}
+
+Region* Process::region_containing(VirtualAddress vaddr)
+{
+    auto** region = m_region_tree.find_largest_not_above(vaddr.get());
+    if (!region || !(*region)->contains(vaddr))
+        return nullptr;
+    return *region;
 }
 
 int Process::sys$set_mmap_name(const Syscall::SC_set_mmap_name_params* user_params)
@@ -396,6 +412,7 @@ void* Process::sys$mmap(const Syscall::SC_mmap_params* user_params)
     bool map_private = flags & MAP_PRIVATE;
     bool map_stack = flags & MAP_STACK;
     bool map_fixed = flags & MAP_FIXED;
+    bool map_huge = flags & MAP_HUGE;
 
     if (map_shared && map_private)
         return (void*)-EINVAL;
@@ -409,6 +426,13 @@ void* Process::sys$mmap(const Syscall::SC_mmap_params* user_params)
     if (map_stack && (!map_private || !map_anonymous))
         return (void*)-EINVAL;
 
+    if (map_huge && (!map_anonymous || map_purgeable))
+        return (void*)-EINVAL;
+
+    // Large pages need the range lined up on a large page boundary.
+    if (map_huge && alignment < LARGE_PAGE_SIZE)
+        alignment = LARGE_PAGE_SIZE;
+
     Region* region = nullptr;
 
     auto range = allocate_range(VirtualAddress(addr), size, alignment);
@@ -421,9 +445,9 @@ void* Process::sys$mmap(const Syscall::SC_mmap_params* user_params)
         if (!region && (!map_fixed && addr != 0))
             region = allocate_region_with_vmobject({}, size, vmobject, 0, !name.is_null() ? name : "mmap (purgeable)", prot);
     } else if (map_anonymous) {
-        region = allocate_region(range, !name.is_null() ? name : "mmap", prot, false);
+        region = allocate_region(range, !name.is_null() ? name : "mmap", prot, false, map_huge);
         if (!region && (!map_fixed && addr != 0))
-            region = allocate_region(allocate_range({}, size), !name.is_null() ? name : "mmap", prot, false);
+            region = allocate_region(allocate_range({}, size, alignment), !name.is_null() ? name : "mmap", prot, false, map_huge);
     } else {
         if (offset < 0)
             return (void*)-EINVAL;
@@ -791,7 +815,7 @@ void Process::kill_threads_except_self()
         return;
 
     for_each_thread([&](Thread& thread) {
-        if (&thread == Thread::current
+        if (&thread == Thread::current()
             || thread.state() == Thread::State::Dead
             || thread.state() == Thread::State::Dying)
             return IterationDecision::Continue;
@@ -853,10 +877,11 @@ int Process::do_exec(NonnullRefPtr<FileDescription> main_program_description, Ve
 
     // Mark this thread as the current thread that does exec
     // No other thread from this process will be scheduled to run
-    m_exec_tid = Thread::current->tid();
+    m_exec_tid = Thread::current()->tid();
 
     auto old_page_directory = move(m_page_directory);
     auto old_regions = move(m_regions);
+    auto old_region_tree = move(m_region_tree);
     m_page_directory = PageDirectory::create_for_userspace(*this);
 #ifdef MM_DEBUG
     dbg() << "Process " << pid() << " exec: PD=" << m_page_directory.ptr() << " created";
@@ -893,9 +918,10 @@ int Process::do_exec(NonnullRefPtr<FileDescription> main_program_description, Ve
     RefPtr<ELF::Loader> loader;
     {
         ArmedScopeGuard rollback_regions_guard([&]() {
-            ASSERT(Process::current == this);
+            ASSERT(Process::current() == this);
             m_page_directory = move(old_page_directory);
             m_regions = move(old_regions);
+            m_region_tree = move(old_region_tree);
             MM.enter_process_paging_scope(*this);
         });
         loader = ELF::Loader::create(region->vaddr().as_ptr(), loader_metadata.size);
@@ -991,9 +1017,10 @@ int Process::do_exec(NonnullRefPtr<FileDescription> main_program_description, Ve
             m_egid = m_sgid = main_program_metadata.gid;
     }
 
-    Thread::current->set_default_signal_dispositions();
-    Thread::current->m_signal_mask = 0;
-    Thread::current->m_pending_signals = 0;
+    Thread::current()->set_default_signal_dispositions();
+    Thread::current()->m_signal_mask = 0;
+    Thread::current()->m_pending_signals = 0;
+    Thread::current()->did_change_pending_signals();
 
     m_futex_queues.clear();
 
@@ -1010,8 +1037,8 @@ int Process::do_exec(NonnullRefPtr<FileDescription> main_program_description, Ve
     }
 
     Thread* new_main_thread = nullptr;
-    if (Process::current == this) {
-        new_main_thread = Thread::current;
+    if (Process::current() == this) {
+        new_main_thread = Thread::current();
     } else {
         for_each_thread([&](auto& thread) {
             new_main_thread = &thread;
@@ -1027,7 +1054,7 @@ int Process::do_exec(NonnullRefPtr<FileDescription> main_program_description, Ve
     // We cli() manually here because we don't want to get interrupted between do_exec() and Schedule::yield().
     // The reason is that the task redirection we've set up above will be clobbered by the timer IRQ.
     // If we used an InterruptDisabler that sti()'d on exit, we might timer tick'd too soon in exec().
-    if (Process::current == this)
+    if (Process::current() == this)
         cli();
 
     // NOTE: Be careful to not trigger any page faults below!
@@ -1250,13 +1277,13 @@ int Process::exec(String path, Vector<String> arguments, Vector<String> environm
         return rc;
 
     if (m_wait_for_tracer_at_next_execve) {
-        ASSERT(Thread::current->state() == Thread::State::Skip1SchedulerPass);
+        ASSERT(Thread::current()->state() == Thread::State::Skip1SchedulerPass);
         // State::Skip1SchedulerPass is irrelevant since we block the thread
-        Thread::current->set_state(Thread::State::Running);
-        Thread::current->send_urgent_signal_to_self(SIGSTOP);
+        Thread::current()->set_state(Thread::State::Running);
+        Thread::current()->send_urgent_signal_to_self(SIGSTOP);
     }
 
-    if (Process::current == this) {
+    if (Process::current() == this) {
         Scheduler::yield();
         ASSERT_NOT_REACHED();
     }
@@ -1277,7 +1304,7 @@ int Process::sys$execve(const Syscall::SC_execve_params* user_params)
         return -E2BIG;
 
     if (m_wait_for_tracer_at_next_execve)
-        Thread::current->send_urgent_signal_to_self(SIGSTOP);
+        Thread::current()->send_urgent_signal_to_self(SIGSTOP);
 
     String path;
     {
@@ -1409,7 +1436,7 @@ Process::Process(Thread*& first_thread, const String& name, uid_t uid, gid_t gid
 
     if (fork_parent) {
         // NOTE: fork() doesn't clone all threads; the thread that called fork() becomes the only thread in the new process.
-        first_thread = Thread::current->clone(*this);
+        first_thread = Thread::current()->clone(*this);
     } else {
         // NOTE: This non-forked code path is only taken when the kernel creates a process "manually" (at boot.)
         first_thread = new Thread(*this);
@@ -1444,7 +1471,7 @@ void Process::sys$exit(int status)
     m_termination_status = status;
     m_termination_signal = 0;
     die();
-    Thread::current->die_if_needed();
+    Thread::current()->die_if_needed();
     ASSERT_NOT_REACHED();
 }
 
@@ -1508,7 +1535,7 @@ int Process::sys$sigreturn(RegisterState& registers)
     //pop the stored eax, ebp, return address, handler and signal code
     stack_ptr += 5;
 
-    Thread::current->m_signal_mask = *stack_ptr;
+    Thread::current()->m_signal_mask = *stack_ptr;
     stack_ptr++;
 
     //pop edi, esi, ebp, esp, ebx, edx, ecx and eax
@@ -1529,7 +1556,7 @@ void Process::crash(int signal, u32 eip, bool out_of_memory)
 {
     ASSERT_INTERRUPTS_DISABLED();
     ASSERT(!is_dead());
-    ASSERT(Process::current == this);
+    ASSERT(Process::current() == this);
 
     if (out_of_memory) {
         dbg() << "\033[31;1mOut of memory\033[m, killing: " << *this;
@@ -1550,7 +1577,7 @@ void Process::crash(int signal, u32 eip, bool out_of_memory)
     die();
     // We can not return from here, as there is nowhere
     // to unwind to, so die right away.
-    Thread::current->die_if_needed();
+    Thread::current()->die_if_needed();
     ASSERT_NOT_REACHED();
 }
 
@@ -1643,26 +1670,35 @@ int Process::sys$ptsname_r(int fd, char* buffer, ssize_t size)
     return 0;
 }
 
-ssize_t Process::sys$writev(int fd, const struct iovec* iov, int iov_count)
+KResultOr<size_t> Process::copy_iovecs_from_user(Vector<iovec, 32>& vecs, const iovec* user_iov, int iov_count, bool buffers_are_written)
 {
-    REQUIRE_PROMISE(stdio);
     if (iov_count < 0)
-        return -EINVAL;
+        return KResult(-EINVAL);
 
-    if (!validate_read_typed(iov, iov_count))
-        return -EFAULT;
+    if (!validate_read_typed(user_iov, iov_count))
+        return KResult(-EFAULT);
 
     u64 total_length = 0;
-    Vector<iovec, 32> vecs;
     vecs.resize(iov_count);
-    copy_from_user(vecs.data(), iov, iov_count * sizeof(iovec));
+    copy_from_user(vecs.data(), user_iov, iov_count * sizeof(iovec));
     for (auto& vec : vecs) {
-        if (!validate_read(vec.iov_base, vec.iov_len))
-            return -EFAULT;
+        bool valid = buffers_are_written ? validate_write(vec.iov_base, vec.iov_len) : validate_read(vec.iov_base, vec.iov_len);
+        if (!valid)
+            return KResult(-EFAULT);
         total_length += vec.iov_len;
         if (total_length > INT32_MAX)
-            return -EINVAL;
+            return KResult(-EINVAL);
     }
+    return (size_t)total_length;
+}
+
+ssize_t Process::sys$writev(int fd, const struct iovec* iov, int iov_count)
+{
+    REQUIRE_PROMISE(stdio);
+    Vector<iovec, 32> vecs;
+    auto total_length_or_error = copy_iovecs_from_user(vecs, iov, iov_count, false);
+    if (total_length_or_error.is_error())
+        return total_length_or_error.error();
 
     auto description = file_description(fd);
     if (!description)
@@ -1671,15 +1707,166 @@ ssize_t Process::sys$writev(int fd, const struct iovec* iov, int iov_count)
     if (!description->is_writable())
         return -EBADF;
 
+    auto* socket = description->is_socket() ? description->socket() : nullptr;
+    if (socket)
+        socket->cork();
+
     int nwritten = 0;
     for (auto& vec : vecs) {
         int rc = do_write(*description, (const u8*)vec.iov_base, vec.iov_len);
+        if (rc < 0) {
+            if (nwritten == 0)
+                nwritten = rc;
+            break;
+        }
+        nwritten += rc;
+    }
+
+    if (socket)
+        socket->uncork();
+    return nwritten;
+}
+
+ssize_t Process::sys$readv(int fd, const struct iovec* iov, int iov_count)
+{
+    REQUIRE_PROMISE(stdio);
+    Vector<iovec, 32> vecs;
+    auto total_length_or_error = copy_iovecs_from_user(vecs, iov, iov_count, true);
+    if (total_length_or_error.is_error())
+        return total_length_or_error.error();
+
+    auto description = file_description(fd);
+    if (!description)
+        return -EBADF;
+
+    if (!description->is_readable())
+        return -EBADF;
+
+    if (description->is_directory())
+        return -EISDIR;
+
+    if (description->is_blocking()) {
+        if (!description->can_read()) {
+            if (Thread::current()->block<Thread::ReadBlocker>(*description) != Thread::BlockResult::WokeNormally)
+                return -EINTR;
+            if (!description->can_read())
+                return -EAGAIN;
+        }
+    }
+
+    // Only the first piece may block; after that we take whatever is there and return.
+    int nread = 0;
+    for (auto& vec : vecs) {
+        if (!vec.iov_len)
+            continue;
+        if (nread && !description->can_read())
+            break;
+        int rc = description->read((u8*)vec.iov_base, vec.iov_len);
+        if (rc < 0) {
+            if (nread == 0)
+                return rc;
+            break;
+        }
+        nread += rc;
+        if ((size_t)rc < vec.iov_len)
+            break;
+    }
+
+    return nread;
+}
+
+ssize_t Process::sys$preadv(const Syscall::SC_preadv_params* user_params)
+{
+    REQUIRE_PROMISE(stdio);
+    Syscall::SC_preadv_params params;
+    if (!validate_read_and_copy_typed(&params, user_params))
+        return -EFAULT;
+
+    if (params.offset < 0)
+        return -EINVAL;
+
+    Vector<iovec, 32> vecs;
+    auto total_length_or_error = copy_iovecs_from_user(vecs, params.iov, params.iov_count, true);
+    if (total_length_or_error.is_error())
+        return total_length_or_error.error();
+
+    // We move through the file from the offset, so the end of the range has to fit in an off_t too.
+    if ((u64)params.offset + total_length_or_error.value() > INT32_MAX)
+        return -EINVAL;
+
+    auto description = file_description(params.fd);
+    if (!description)
+        return -EBADF;
+
+    if (!description->is_readable())
+        return -EBADF;
+
+    if (description->is_directory())
+        return -EISDIR;
+
+    if (!description->file().is_seekable())
+        return -ESPIPE;
+
+    int nread = 0;
+    for (auto& vec : vecs) {
+        if (!vec.iov_len)
+            continue;
+        int rc = description->read_at(params.offset + nread, (u8*)vec.iov_base, vec.iov_len);
+        if (rc < 0) {
+            if (nread == 0)
+                return rc;
+            break;
+        }
+        nread += rc;
+        if ((size_t)rc < vec.iov_len)
+            break;
+    }
+
+    return nread;
+}
+
+ssize_t Process::sys$pwritev(const Syscall::SC_pwritev_params* user_params)
+{
+    REQUIRE_PROMISE(stdio);
+    Syscall::SC_pwritev_params params;
+    if (!validate_read_and_copy_typed(&params, user_params))
+        return -EFAULT;
+
+    if (params.offset < 0)
+        return -EINVAL;
+
+    Vector<iovec, 32> vecs;
+    auto total_length_or_error = copy_iovecs_from_user(vecs, params.iov, params.iov_count, false);
+    if (total_length_or_error.is_error())
+        return total_length_or_error.error();
+
+    // We move through the file from the offset, so the end of the range has to fit in an off_t too.
+    if ((u64)params.offset + total_length_or_error.value() > INT32_MAX)
+        return -EINVAL;
+
+    auto description = file_description(params.fd);
+    if (!description)
+        return -EBADF;
+
+    if (!description->is_writable())
+        return -EBADF;
+
+    if (!description->file().is_seekable())
+        return -ESPIPE;
+
+    int nwritten = 0;
+    for (auto& vec : vecs) {
+        if (!vec.iov_len)
+            continue;
+        int rc = description->write_at(params.offset + nwritten, (const u8*)vec.iov_base, vec.iov_len);
         if (rc < 0) {
             if (nwritten == 0)
                 return rc;
-            return nwritten;
+            break;
         }
         nwritten += rc;
+        if ((size_t)rc < vec.iov_len)
+            break;
     }
 
     return nwritten;
@@ -1708,7 +1895,7 @@ ssize_t Process::do_write(FileDescription& description, const u8* data, int data
 #ifdef IO_DEBUG
             dbg() << "block write on " << description.absolute_path();
 #endif
-            if (Thread::current->block<Thread::WriteBlocker>(description) != Thread::BlockResult::WokeNormally) {
+            if (Thread::current()->block<Thread::WriteBlocker>(description) != Thread::BlockResult::WokeNormally) {
                 if (nwritten == 0)
                     return -EINTR;
             }
@@ -1750,6 +1937,118 @@ ssize_t Process::sys$write(int fd, const u8* data, ssize_t size)
     return do_write(*description, data, size);
 }
 
+ssize_t Process::sys$sendfile(const Syscall::SC_sendfile_params* user_params)
+{
+    REQUIRE_PROMISE(stdio);
+    Syscall::SC_sendfile_params params;
+    if (!validate_read_and_copy_typed(&params, user_params))
+        return -EFAULT;
+
+    auto out_description = file_description(params.out_fd);
+    if (!out_description)
+        return -EBADF;
+    if (!out_description->is_writable())
+        return -EBADF;
+    auto in_description = file_description(params.in_fd);
+    if (!in_description)
+        return -EBADF;
+    if (!in_description->is_readable())
+        return -EBADF;
+    if (in_description->is_directory())
+        return -EISDIR;
+
+    bool is_seekable = in_description->file().is_seekable();
+    off_t offset = in_description->offset();
+    if (params.offset) {
+        if (!is_seekable)
+            return -ESPIPE;
+        if (!validate_read_typed(params.offset) || !validate_write_typed(params.offset))
+            return -EFAULT;
+        copy_from_user(&offset, params.offset);
+        if (offset < 0)
+            return -EINVAL;
+    }
+
+    size_t count = min(params.count, (size_t)INT32_MAX);
+    if (!count)
+        return 0;
+
+    auto* socket = out_description->is_socket() ? out_description->socket() : nullptr;
+    if (socket)
+        socket->cork();
+
+    ssize_t nsent = 0;
+    auto* inode = in_description->inode();
+    if (in_description->file().is_inode() && inode->uses_page_cache()) {
+        // Write straight out of the page cache, the data never passes through a buffer of ours.
+        off_t size = inode->size();
+        if (offset < size) {
+            nsent = inode->page_cache().read_in_place(offset, min(count, (size_t)(size - offset)), [&](const u8* data, size_t size) {
+                return do_write(*out_description, data, size);
+            });
+        }
+    } else {
+        // Anything else (pipes, sockets, devices) goes through a kernel buffer, which still saves
+        // the trip through userspace.
+        auto buffer = KBuffer::create_with_size(min(count, (size_t)(64 * KB)), Region::Access::Read | Region::Access::Write, "sendfile");
+        while ((size_t)nsent < count) {
+            if (!out_description->is_blocking() && !out_description->can_write()) {
+                if (!nsent)
+                    nsent = -EAGAIN;
+                break;
+            }
+
+            size_t chunk_size = min(count - nsent, buffer.size());
+            ssize_t nread;
+            if (is_seekable) {
+                nread = in_description->read_at(offset + nsent, buffer.data(), chunk_size);
+            } else {
+                if (!in_description->can_read()) {
+                    // Only the first read may block; after that we move what's there and return.
+                    if (nsent)
+                        break;
+                    if (!in_description->is_blocking()) {
+                        nsent = -EAGAIN;
+                        break;
+                    }
+                    if (Thread::current()->block<Thread::ReadBlocker>(*in_description) != Thread::BlockResult::WokeNormally) {
+                        nsent = -EINTR;
+                        break;
+                    }
+                }
+                nread = in_description->read(buffer.data(), chunk_size);
+            }
+            if (nread <= 0) {
+                if (!nsent)
+                    nsent = nread;
+                break;
+            }
+
+            ssize_t nwritten = do_write(*out_description, buffer.data(), nread);
+            if (nwritten < 0) {
+                if (!nsent)
+                    nsent = nwritten;
+                break;
+            }
+            nsent += nwritten;
+            if (nwritten < nread)
+                break;
+        }
+    }
+
+    if (socket)
+        socket->uncork();
+
+    if (nsent > 0 && is_seekable) {
+        offset += nsent;
+        if (params.offset)
+            copy_to_user(params.offset, &offset);
+        else
+            in_description->seek(offset, SEEK_SET);
+    }
+    return nsent;
+}
+
 ssize_t Process::sys$read(int fd, u8* buffer, ssize_t size)
 {
     REQUIRE_PROMISE(stdio);
@@ -1771,7 +2070,7 @@ ssize_t Process::sys$read(int fd, u8* buffer, ssize_t size)
         return -EISDIR;
     if (description->is_blocking()) {
         if (!description->can_read()) {
-            if (Thread::current->block<Thread::ReadBlocker>(*description) != Thread::BlockResult::WokeNormally)
+            if (Thread::current()->block<Thread::ReadBlocker>(*description) != Thread::BlockResult::WokeNormally)
                 return -EINTR;
             if (!description->can_read())
                 return -EAGAIN;
@@ -2341,9 +2640,9 @@ KResult Process::do_killself(int signal)
     if (signal == 0)
         return KSuccess;
 
-    if (!Thread::current->should_ignore_signal(signal)) {
-        Thread::current->send_signal(signal, this);
-        (void)Thread::current->block<Thread::SemiPermanentBlocker>(Thread::SemiPermanentBlocker::Reason::Signal);
+    if (!Thread::current()->should_ignore_signal(signal)) {
+        Thread::current()->send_signal(signal, this);
+        (void)Thread::current()->block<Thread::SemiPermanentBlocker>(Thread::SemiPermanentBlocker::Reason::Signal);
     }
 
     return KSuccess;
@@ -2380,7 +2679,7 @@ int Process::sys$usleep(useconds_t usec)
     REQUIRE_PROMISE(stdio);
     if (!usec)
         return 0;
-    u64 wakeup_time = Thread::current->sleep(usec / 1000);
+    u64 wakeup_time = Thread::current()->sleep(usec / 1000);
     if (wakeup_time > g_uptime)
         return -EINTR;
     return 0;
@@ -2391,7 +2690,7 @@ int Process::sys$sleep(unsigned seconds)
     REQUIRE_PROMISE(stdio);
     if (!seconds)
         return 0;
-    u64 wakeup_time = Thread::current->sleep(seconds * TimeManagement::the().ticks_per_second());
+    u64 wakeup_time = Thread::current()->sleep(seconds * TimeManagement::the().ticks_per_second());
     if (wakeup_time > g_uptime) {
         u32 ticks_left_until_original_wakeup_time = wakeup_time - g_uptime;
         return ticks_left_until_original_wakeup_time / TimeManagement::the().ticks_per_second();
@@ -2530,6 +2829,7 @@ siginfo_t Process::reap(Process& process)
 #endif
         ASSERT(process.is_dead());
         g_processes->remove(&process);
+        process.notify_waiters();
     }
     delete &process;
     return siginfo;
@@ -2555,7 +2855,7 @@ KResultOr<siginfo_t> Process::do_waitid(idtype_t idtype, int id, int options)
         return KResult(-EINVAL);
     }
 
-    if (Thread::current->block<Thread::WaitBlocker>(options, waitee_pid) != Thread::BlockResult::WokeNormally)
+    if (Thread::current()->block<Thread::WaitBlocker>(options, waitee_pid) != Thread::BlockResult::WokeNormally)
         return KResult(-EINTR);
 
     InterruptDisabler disabler;
@@ -2788,7 +3088,7 @@ int Process::sys$sigprocmask(int how, const sigset_t* set, sigset_t* old_set)
     if (old_set) {
         if (!validate_write_typed(old_set))
             return -EFAULT;
-        copy_to_user(old_set, &Thread::current->m_signal_mask);
+        copy_to_user(old_set, &Thread::current()->m_signal_mask);
     }
     if (set) {
         if (!validate_read_typed(set))
@@ -2797,13 +3097,13 @@ int Process::sys$sigprocmask(int how, const sigset_t* set, sigset_t* old_set)
         copy_from_user(&set_value, set);
         switch (how) {
         case SIG_BLOCK:
-            Thread::current->m_signal_mask &= ~set_value;
+            Thread::current()->m_signal_mask &= ~set_value;
             break;
         case SIG_UNBLOCK:
-            Thread::current->m_signal_mask |= set_value;
+            Thread::current()->m_signal_mask |= set_value;
             break;
         case SIG_SETMASK:
-            Thread::current->m_signal_mask = set_value;
+            Thread::current()->m_signal_mask = set_value;
             break;
         default:
             return -EINVAL;
@@ -2817,7 +3117,7 @@ int Process::sys$sigpending(sigset_t* set)
     REQUIRE_PROMISE(stdio);
     if (!validate_write_typed(set))
         return -EFAULT;
-    copy_to_user(set, &Thread::current->m_pending_signals);
+    copy_to_user(set, &Thread::current()->m_pending_signals);
     return 0;
 }
 
@@ -2829,7 +3129,7 @@ int Process::sys$sigaction(int signum, const sigaction* act, sigaction* old_act)
     if (!validate_read_typed(act))
         return -EFAULT;
     InterruptDisabler disabler; // FIXME: This should use a narrower lock. Maybe a way to ignore signals temporarily?
-    auto& action = Thread::current->m_signal_action_data[signum];
+    auto& action = Thread::current()->m_signal_action_data[signum];
     if (old_act) {
         if (!validate_write_typed(old_act))
             return -EFAULT;
@@ -3009,7 +3309,7 @@ int Process::sys$select(const Syscall::SC_select_params* params)
 #endif
 
     if (!timeout || select_has_timeout) {
-        if (Thread::current->block<Thread::SelectBlocker>(computed_timeout, select_has_timeout, rfds, wfds, efds) != Thread::BlockResult::WokeNormally)
+        if (Thread::current()->block<Thread::SelectBlocker>(computed_timeout, select_has_timeout, rfds, wfds, efds) != Thread::BlockResult::WokeNormally)
             return -EINTR;
         // While we blocked, the process lock was dropped. This gave other threads
         // the opportunity to mess with the memory. For example, it could free the
@@ -3081,7 +3381,7 @@ int Process::sys$poll(pollfd* fds, int nfds, int timeout)
 #endif
 
     if (has_timeout || timeout < 0) {
-        if (Thread::current->block<Thread::SelectBlocker>(actual_timeout, has_timeout, rfds, wfds, Thread::SelectBlocker::FDVector()) != Thread::BlockResult::WokeNormally)
+        if (Thread::current()->block<Thread::SelectBlocker>(actual_timeout, has_timeout, rfds, wfds, Thread::SelectBlocker::FDVector()) != Thread::BlockResult::WokeNormally)
             return -EINTR;
     }
 
@@ -3106,6 +3406,106 @@ int Process::sys$poll(pollfd* fds, int nfds, int timeout)
     return fds_with_revents;
 }
 
+int Process::sys$epoll_create(int flags)
+{
+    REQUIRE_PROMISE(stdio);
+    if ((flags & EPOLL_CLOEXEC) != flags)
+        return -EINVAL;
+
+    int fd = alloc_fd();
+    if (fd < 0)
+        return fd;
+
+    m_fds[fd].set(FileDescription::create(*EventPoll::create()), (flags & EPOLL_CLOEXEC) ? FD_CLOEXEC : 0);
+    m_fds[fd].description->set_readable(true);
+    return fd;
+}
+
+int Process::sys$epoll_ctl(const Syscall::SC_epoll_ctl_params* user_params)
+{
+    REQUIRE_PROMISE(stdio);
+    Syscall::SC_epoll_ctl_params params;
+    if (!validate_read_and_copy_typed(&params, user_params))
+        return -EFAULT;
+
+    auto epoll_description = file_description(params.epfd);
+    if (!epoll_description)
+        return -EBADF;
+    auto description = file_description(params.fd);
+    if (!description)
+        return -EBADF;
+    if (!epoll_description->file().is_event_poll() || epoll_description == description)
+        return -EINVAL;
+    auto& event_poll = static_cast<EventPoll&>(epoll_description->file());
+
+    epoll_event event {};
+    if (params.op != EPOLL_CTL_DEL) {
+        if (!validate_read_typed(params.event))
+            return -EFAULT;
+        copy_from_user(&event, params.event);
+    }
+
+    switch (params.op) {
+    case EPOLL_CTL_ADD:
+        return event_poll.add_interest(params.fd, *description, event);
+    case EPOLL_CTL_MOD:
+        return event_poll.modify_interest(params.fd, *description, event);
+    case EPOLL_CTL_DEL:
+        return event_poll.remove_interest(params.fd, *description);
+    default:
+        return -EINVAL;
+    }
+}
+
+int Process::sys$epoll_wait(const Syscall::SC_epoll_wait_params* user_params)
+{
+    REQUIRE_PROMISE(stdio);
+    Syscall::SC_epoll_wait_params params;
+    if (!validate_read_and_copy_typed(&params, user_params))
+        return -EFAULT;
+
+    if (params.max_events <= 0)
+        return -EINVAL;
+    if (!validate_write_typed(params.events, params.max_events))
+        return -EFAULT;
+
+    auto description = file_description(params.epfd);
+    if (!description)
+        return -EBADF;
+    if (!description->file().is_event_poll())
+        return -EINVAL;
+    auto& event_poll = static_cast<EventPoll&>(description->file());
+
+    timeval deadline;
+    if (params.timeout > 0) {
+        timeval relative_timeout { params.timeout / 1000, (params.timeout % 1000) * 1000 };
+        timeval_add(Scheduler::time_since_boot(), relative_timeout, deadline);
+    }
+
+    Vector<epoll_event, 32> events;
+    for (;;) {
+        event_poll.collect_events(events, params.max_events);
+        if (!events.is_empty() || params.timeout == 0)
+            break;
+
+        Thread::BlockResult result;
+        if (params.timeout < 0) {
+            result = Thread::current()->block<Thread::ReadBlocker>(*description);
+        } else {
+            timeval remaining;
+            timeval_sub(deadline, Scheduler::time_since_boot(), remaining);
+            if (remaining.tv_sec < 0 || (remaining.tv_sec == 0 && remaining.tv_usec == 0))
+                break;
+            result = Thread::current()->block<Thread::ReadBlocker>(*description, remaining);
+        }
+        if (result != Thread::BlockResult::WokeNormally)
+            return -EINTR;
+    }
+
+    copy_to_user(params.events, events.data(), events.size() * sizeof(epoll_event));
+    return events.size();
+}
+
 Custody& Process::current_directory()
 {
     if (!m_cwd)
@@ -3218,7 +3618,7 @@ int Process::sys$chown(const Syscall::SC_chown_params* user_params)
 
 void Process::finalize()
 {
-    ASSERT(Thread::current == g_finalizer);
+    ASSERT(Thread::current() == g_finalizer);
 #ifdef PROCESS_DEBUG
     dbg() << "Finalizing process " << *this;
 #endif
@@ -3252,9 +3652,11 @@ void Process::finalize()
         }
     }
 
+    m_region_tree.clear();
     m_regions.clear();
 
     m_dead = true;
+    notify_waiters();
 }
 
 void Process::die()
@@ -3433,7 +3835,7 @@ int Process::sys$accept(int accepting_socket_fd, sockaddr* user_address, socklen
 
     if (!socket.can_accept()) {
         if (accepting_socket_description->is_blocking()) {
-            if (Thread::current->block<Thread::AcceptBlocker>(*accepting_socket_description) != Thread::BlockResult::WokeNormally)
+            if (Thread::current()->block<Thread::AcceptBlocker>(*accepting_socket_description) != Thread::BlockResult::WokeNormally)
                 return -EINTR;
         } else {
             return -EAGAIN;
@@ -3636,7 +4038,7 @@ int Process::sys$sched_setparam(int tid, const struct sched_param* param)
     copy_from_user(&desired_priority, &param->sched_priority);
 
     InterruptDisabler disabler;
-    auto* peer = Thread::current;
+    auto* peer = Thread::current();
     if (tid != 0)
         peer = Thread::from_tid(tid);
 
@@ -3660,7 +4062,7 @@ int Process::sys$sched_getparam(pid_t pid, struct sched_param* param)
         return -EFAULT;
 
     InterruptDisabler disabler;
-    auto* peer = Thread::current;
+    auto* peer = Thread::current();
     if (pid != 0)
         peer = Thread::from_tid(pid);
 
@@ -3675,6 +4077,67 @@ int Process::sys$sched_getparam(pid_t pid, struct sched_param* param)
     return 0;
 }
 
+int Process::sys$sched_setaffinity(pid_t tid, size_t cpu_set_size, const cpu_set_t* user_cpu_set)
+{
+    REQUIRE_PROMISE(proc);
+    if (cpu_set_size < sizeof(cpu_set_t))
+        return -EINVAL;
+    if (!validate_read_typed(user_cpu_set))
+        return -EFAULT;
+
+    cpu_set_t cpu_set;
+    copy_from_user(&cpu_set, user_cpu_set);
+
+    InterruptDisabler disabler;
+    auto* peer = Thread::current();
+    if (tid != 0)
+        peer = Thread::from_tid(tid);
+
+    if (!peer)
+        return -ESRCH;
+
+    if (!is_superuser() && m_euid != peer->process().m_uid && m_uid != peer->process().m_uid)
+        return -EPERM;
+
+    // The mask has to leave the thread somewhere to run.
+    u32 online_mask = 0;
+    Processor::for_each([&](Processor& processor) {
+        if (processor.is_online())
+            online_mask |= 1u << processor.id();
+    });
+    if (!(cpu_set.bits & online_mask))
+        return -EINVAL;
+
+    Scheduler::set_affinity(*peer, cpu_set.bits);
+    if (peer == Thread::current() && !peer->may_run_on(Processor::current().id()))
+        Scheduler::yield();
+    return 0;
+}
+
+int Process::sys$sched_getaffinity(pid_t tid, size_t cpu_set_size, cpu_set_t* user_cpu_set)
+{
+    REQUIRE_PROMISE(proc);
+    if (cpu_set_size < sizeof(cpu_set_t))
+        return -EINVAL;
+    if (!validate_write_typed(user_cpu_set))
+        return -EFAULT;
+
+    InterruptDisabler disabler;
+    auto* peer = Thread::current();
+    if (tid != 0)
+        peer = Thread::from_tid(tid);
+
+    if (!peer)
+        return -ESRCH;
+
+    if (!is_superuser() && m_euid != peer->process().m_uid && m_uid != peer->process().m_uid)
+        return -EPERM;
+
+    cpu_set_t cpu_set { peer->affinity_mask() };
+    copy_to_user(user_cpu_set, &cpu_set);
+    return 0;
+}
+
 int Process::sys$getsockopt(const Syscall::SC_getsockopt_params* params)
 {
     if (!validate_read_typed(params))
@@ -3937,6 +4400,7 @@ int Process::sys$create_thread(void* (*entry)(void*), const Syscall::SC_create_t
     // FIXME: Do something with guard pages?
 
     auto* thread = new Thread(*this);
+    Scheduler::set_affinity(*thread, Thread::current()->affinity_mask());
 
     // We know this thread is not the main_thread,
     // So give it a unique name until the user calls $set_thread_name on it
@@ -3964,10 +4428,10 @@ void Process::sys$exit_thread(void* exit_value)
 {
     REQUIRE_PROMISE(thread);
     cli();
-    Thread::current->m_exit_value = exit_value;
-    Thread::current->set_should_die();
+    Thread::current()->m_exit_value = exit_value;
+    Thread::current()->set_should_die();
     big_lock().force_unlock_if_locked();
-    Thread::current->die_if_needed();
+    Thread::current()->die_if_needed();
     ASSERT_NOT_REACHED();
 }
 
@@ -3997,13 +4461,13 @@ int Process::sys$join_thread(int tid, void** exit_value)
     if (!thread || thread->pid() != pid())
         return -ESRCH;
 
-    if (thread == Thread::current)
+    if (thread == Thread::current())
         return -EDEADLK;
 
-    if (thread->m_joinee == Thread::current)
+    if (thread->m_joinee == Thread::current())
         return -EDEADLK;
 
-    ASSERT(thread->m_joiner != Thread::current);
+    ASSERT(thread->m_joiner != Thread::current());
     if (thread->m_joiner)
         return -EINVAL;
 
@@ -4014,15 +4478,15 @@ int Process::sys$join_thread(int tid, void** exit_value)
 
     // NOTE: pthread_join() cannot be interrupted by signals. Only by death.
     for (;;) {
-        auto result = Thread::current->block<Thread::JoinBlocker>(*thread, joinee_exit_value);
+        auto result = Thread::current()->block<Thread::JoinBlocker>(*thread, joinee_exit_value);
         if (result == Thread::BlockResult::InterruptedByDeath) {
             // NOTE: This cleans things up so that Thread::finalize() won't
             //       get confused about a missing joiner when finalizing the joinee.
             InterruptDisabler disabler_t;
 
-            if (Thread::current->m_joinee) {
-                Thread::current->m_joinee->m_joiner = nullptr;
-                Thread::current->m_joinee = nullptr;
+            if (Thread::current()->m_joinee) {
+                Thread::current()->m_joinee->m_joiner = nullptr;
+                Thread::current()->m_joinee = nullptr;
             }
 
             break;
@@ -4080,7 +4544,7 @@ int Process::sys$get_thread_name(int tid, char* buffer, size_t buffer_size)
 int Process::sys$gettid()
 {
     REQUIRE_PROMISE(stdio);
-    return Thread::current->tid();
+    return Thread::current()->tid();
 }
 
 int Process::sys$donate(int tid)
@@ -4501,12 +4965,12 @@ int Process::sys$clock_nanosleep(const Syscall::SC_clock_nanosleep_params* user_
         u64 wakeup_time;
         if (is_absolute) {
             u64 time_to_wake = (requested_sleep.tv_sec * 1000 + requested_sleep.tv_nsec / 1000000);
-            wakeup_time = Thread::current->sleep_until(time_to_wake);
+            wakeup_time = Thread::current()->sleep_until(time_to_wake);
         } else {
             u32 ticks_to_sleep = (requested_sleep.tv_sec * 1000 + requested_sleep.tv_nsec / 1000000);
             if (!ticks_to_sleep)
                 return 0;
-            wakeup_time = Thread::current->sleep(ticks_to_sleep);
+            wakeup_time = Thread::current()->sleep(ticks_to_sleep);
         }
         if (wakeup_time > g_uptime) {
             u32 ticks_left = wakeup_time - g_uptime;
@@ -4544,14 +5008,14 @@ int Process::sys$sync()
 int Process::sys$yield()
 {
     REQUIRE_PROMISE(stdio);
-    Thread::current->yield_without_holding_big_lock();
+    Thread::current()->yield_without_holding_big_lock();
     return 0;
 }
 
 int Process::sys$beep()
 {
     PCSpeaker::tone_on(440);
-    u64 wakeup_time = Thread::current->sleep(100);
+    u64 wakeup_time = Thread::current()->sleep(100);
     PCSpeaker::tone_off();
     if (wakeup_time > g_uptime)
         return -EINTR;
@@ -4784,7 +5248,7 @@ int Process::sys$futex(const Syscall::SC_futex_params* user_params)
         }
 
         // FIXME: This is supposed to be interruptible by a signal, but right now WaitQueue cannot be interrupted.
-        Thread::BlockResult result = Thread::current->wait_on(wait_queue, optional_timeout);
+        Thread::BlockResult result = Thread::current()->wait_on(wait_queue, optional_timeout);
         if (result == Thread::BlockResult::InterruptedByTimeout) {
             return -ETIMEDOUT;
         }
@@ -4949,6 +5413,7 @@ int Process::sys$pledge(const Syscall::SC_pledge_params* user_params)
 Region& Process::add_region(NonnullOwnPtr<Region> region)
 {
     auto* ptr = region.ptr();
+    m_region_tree.insert(ptr->vaddr().get(), ptr);
     m_regions.append(move(region));
     return *ptr;
 }
@@ -5064,7 +5529,7 @@ int Process::sys$get_stack_bounds(FlatPtr* user_stack_base, size_t* user_stack_s
     if (!validate_write_typed(user_stack_size))
         return -EFAULT;
 
-    FlatPtr stack_pointer = Thread::current->get_register_dump_from_stack().userspace_esp;
+    FlatPtr stack_pointer = Thread::current()->get_register_dump_from_stack().userspace_esp;
     auto* stack_region = MM.region_from_vaddr(*this, VirtualAddress(stack_pointer));
     if (!stack_region) {
         ASSERT_NOT_REACHED();
@@ -5088,6 +5553,20 @@ int Process::sys$ptrace(const Syscall::SC_ptrace_params* user_params)
     return result.is_error() ? result.error() : result.value();
 }
 
+void Process::notify_waiters()
+{
+    InterruptDisabler disabler;
+    if (auto* parent = Process::from_pid(m_ppid))
+        parent->m_wait_block_condition.notify();
+    for_each_thread([](Thread& thread) {
+        if (!thread.tracer())
+            return IterationDecision::Continue;
+        if (auto* tracer = Process::from_pid(thread.tracer()->tracer_pid()))
+            tracer->m_wait_block_condition.notify();
+        return IterationDecision::Continue;
+    });
+}
+
 bool Process::has_tracee_thread(int tracer_pid) const
 {
     bool has_tracee = false;
@@ -31,8 +31,10 @@
 #include <AK/HashMap.h>
 #include <AK/InlineLinkedList.h>
 #include <AK/NonnullOwnPtrVector.h>
+#include <AK/RedBlackTree.h>
 #include <AK/String.h>
 #include <AK/WeakPtr.h>
+#include <Kernel/BlockCondition.h>
 #include <Kernel/FileSystem/InodeMetadata.h>
 #include <Kernel/Forward.h>
 #include <Kernel/Lock.h>
@@ -109,7 +111,7 @@ class Process : public InlineLinkedListNode<Process> {
     friend class Thread;
 
 public:
-    static Process* current;
+    static Process* current();
 
     static Process* create_kernel_process(Thread*& first_thread, String&& name, void (*entry)());
     static Process* create_user_process(Thread*& first_thread, const String& path, uid_t, gid_t, pid_t ppid, int& error, Vector<String>&& arguments = Vector<String>(), Vector<String>&& environment = Vector<String>(), TTY* = nullptr);
@@ -130,6 +132,11 @@ public:
 
     bool is_dead() const { return m_dead; }
 
+    // Threads blocked in waitpid() on this process sit here, and get poked
+    // whenever one of the processes they may be waiting for changes state.
+    BlockCondition& wait_block_condition() { return m_wait_block_condition; }
+    void notify_waiters();
+
     bool is_ring0() const { return m_ring == Ring0; }
     bool is_ring3() const { return m_ring == Ring3; }
 
@@ -202,6 +209,10 @@ public:
     ssize_t sys$read(int fd, u8*, ssize_t);
     ssize_t sys$write(int fd, const u8*, ssize_t);
     ssize_t sys$writev(int fd, const struct iovec* iov, int iov_count);
+    ssize_t sys$readv(int fd, const struct iovec* iov, int iov_count);
+    ssize_t sys$sendfile(const Syscall::SC_sendfile_params*);
+    ssize_t sys$preadv(const Syscall::SC_preadv_params*);
+    ssize_t sys$pwritev(const Syscall::SC_pwritev_params*);
     int sys$fstat(int fd, stat*);
     int sys$stat(const Syscall::SC_stat_params*);
     int sys$lseek(int fd, off_t, int whence);
@@ -218,6 +229,9 @@ public:
     int sys$purge(int mode);
     int sys$select(const Syscall::SC_select_params*);
     int sys$poll(pollfd*, int nfds, int timeout);
+    int sys$epoll_create(int flags);
+    int sys$epoll_ctl(const Syscall::SC_epoll_ctl_params*);
+    int sys$epoll_wait(const Syscall::SC_epoll_wait_params*);
     ssize_t sys$get_dir_entries(int fd, void*, ssize_t);
     int sys$getcwd(char*, ssize_t);
     int sys$chdir(const char*, size_t);
@@ -282,6 +296,8 @@ public:
     int sys$getpeername(const Syscall::SC_getpeername_params*);
     int sys$sched_setparam(pid_t pid, const struct sched_param* param);
     int sys$sched_getparam(pid_t pid, struct sched_param* param);
+    int sys$sched_setaffinity(pid_t tid, size_t cpu_set_size, const cpu_set_t*);
+    int sys$sched_getaffinity(pid_t tid, size_t cpu_set_size, cpu_set_t*);
     int sys$create_thread(void* (*)(void*), const Syscall::SC_create_thread_params*);
     void sys$exit_thread(void*);
     int sys$join_thread(int tid, void** exit_value);
@@ -399,10 +415,10 @@ public:
 
     bool is_superuser() const { return m_euid == 0; }
 
-    Region* allocate_region_with_vmobject(VirtualAddress, size_t, NonnullRefPtr<VMObject>, size_t offset_in_vmobject, const String& name, int prot);
+    Region* allocate_region_with_vmobject(VirtualAddress, size_t, NonnullRefPtr<VMObject>, size_t offset_in_vmobject, const String& name, int prot, bool large_pages = false);
     Region* allocate_region(VirtualAddress, size_t, const String& name, int prot = PROT_READ | PROT_WRITE, bool should_commit = true);
-    Region* allocate_region_with_vmobject(const Range&, NonnullRefPtr<VMObject>, size_t offset_in_vmobject, const String& name, int prot);
-    Region* allocate_region(const Range&, const String& name, int prot = PROT_READ | PROT_WRITE, bool should_commit = true);
+    Region* allocate_region_with_vmobject(const Range&, NonnullRefPtr<VMObject>, size_t offset_in_vmobject, const String& name, int prot, bool large_pages = false);
+    Region* allocate_region(const Range&, const String& name, int prot = PROT_READ | PROT_WRITE, bool should_commit = true, bool large_pages = false);
     bool deallocate_region(Region& region);
 
     Region& allocate_split_region(const Region& source_region, const Range&, size_t offset_in_vmobject);
@@ -462,6 +478,9 @@ private:
 
     int do_exec(NonnullRefPtr<FileDescription> main_program_description, Vector<String> arguments, Vector<String> environment, RefPtr<FileDescription> interpreter_description);
     ssize_t do_write(FileDescription&, const u8*, int data_size);
+    // Copies the iovecs in and validates their buffers, which the kernel is either going to write to (readv) or read from (writev).
+    // Returns the total length of the buffers.
+    KResultOr<size_t> copy_iovecs_from_user(Vector<iovec, 32>&, const iovec* user_iov, int iov_count, bool buffers_are_written);
 
     KResultOr<NonnullRefPtr<FileDescription>> find_elf_interpreter_for_executable(const String& path, char (&first_page)[PAGE_SIZE], int nread, size_t file_size);
 
@@ -519,6 +538,8 @@ private:
     bool m_dead { false };
     bool m_profiling { false };
 
+    BlockCondition m_wait_block_condition;
+
     RefPtr<Custody> m_executable;
     RefPtr<Custody> m_cwd;
     RefPtr<Custody> m_root_directory;
@@ -528,8 +549,11 @@ private:
 
     Region* region_from_range(const Range&);
     Region* region_containing(const Range&);
+    Region* region_containing(VirtualAddress);
 
     NonnullOwnPtrVector<Region> m_regions;
+    // The same regions, ordered by base address for lookups.
+    RedBlackTree<FlatPtr, Region*> m_region_tree;
     struct RegionLookupCache {
         Range range;
         WeakPtr<Region> region;
@@ -577,14 +601,14 @@ public:
     ProcessInspectionHandle(Process& process)
         : m_process(process)
     {
-        if (&process != Process::current) {
+        if (&process != Process::current()) {
             InterruptDisabler disabler;
             m_process.increment_inspector_count({});
         }
     }
     ~ProcessInspectionHandle()
     {
-        if (&m_process != Process::current) {
+        if (&m_process != Process::current()) {
             InterruptDisabler disabler;
             m_process.decrement_inspector_count({});
         }
@@ -644,8 +668,11 @@ inline void Process::for_each_thread(Callback callback) const
     pid_t my_pid = pid();
 
     if (my_pid == 0) {
-        // NOTE: Special case the colonel process, since its main thread is not in the global thread table.
-        callback(*g_colonel);
+        // NOTE: Special case the colonel process, since its threads (one idle thread per processor) are not in the global thread table.
+        Processor::for_each([&](Processor& processor) {
+            if (auto* idle_thread = processor.idle_thread())
+                callback(*idle_thread);
+        });
         return;
     }
 
@@ -696,30 +723,36 @@ inline const LogStream& operator<<(const LogStream& stream, const Process& proce
     return stream << process.name() << '(' << process.pid() << ')';
 }
 
-inline u32 Thread::effective_priority() const
+inline u32 Thread::base_priority() const
+{
+    return m_priority + m_process.priority_boost() + m_priority_boost;
+}
+
+inline Process* Process::current()
 {
-    return m_priority + m_process.priority_boost() + m_priority_boost + m_extra_priority;
+    auto* current_thread = Processor::current_thread();
+    return current_thread ? &current_thread->process() : nullptr;
 }
 
-#define REQUIRE_NO_PROMISES                      \
-    do {                                         \
-        if (Process::current->has_promises()) {  \
-            dbg() << "Has made a promise";       \
-            cli();                               \
-            Process::current->crash(SIGABRT, 0); \
-            ASSERT_NOT_REACHED();                \
-        }                                        \
+#define REQUIRE_NO_PROMISES                        \
+    do {                                           \
+        if (Process::current()->has_promises()) {  \
+            dbg() << "Has made a promise";         \
+            cli();                                 \
+            Process::current()->crash(SIGABRT, 0); \
+            ASSERT_NOT_REACHED();                  \
+        }                                          \
     } while (0)
 
-#define REQUIRE_PROMISE(promise)                                   \
-    do {                                                           \
-        if (Process::current->has_promises()                       \
-            && !Process::current->has_promised(Pledge::promise)) { \
-            dbg() << "Has not pledged " << #promise;               \
-            cli();                                                 \
-            Process::current->crash(SIGABRT, 0);                   \
-            ASSERT_NOT_REACHED();                                  \
-        }                                                          \
+#define REQUIRE_PROMISE(promise)                                     \
+    do {                                                             \
+        if (Process::current()->has_promises()                       \
+            && !Process::current()->has_promised(Pledge::promise)) { \
+            dbg() << "Has not pledged " << #promise;                 \
+            cli();                                                   \
+            Process::current()->crash(SIGABRT, 0);                   \
+            ASSERT_NOT_REACHED();                                    \
+        }                                                            \
     } while (0)
 
 }
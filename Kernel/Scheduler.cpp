@@ -24,9 +24,10 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include <AK/QuickSort.h>
 #include <AK/TemporaryChange.h>
+#include <AK/Time.h>
 #include <Kernel/FileSystem/FileDescription.h>
+#include <Kernel/Interrupts/APIC.h>
 #include <Kernel/Net/Socket.h>
 #include <Kernel/Process.h>
 #include <Kernel/Profiling.h>
@@ -34,6 +35,7 @@
 #include <Kernel/Scheduler.h>
 #include <Kernel/Time/TimeManagement.h>
 #include <Kernel/TimerQueue.h>
+#include <Kernel/VM/PageDirectory.h>
 
 //#define LOG_EVERY_CONTEXT_SWITCH
 //#define SCHEDULER_DEBUG
@@ -43,27 +45,300 @@ namespace Kernel {
 
 SchedulerData* g_scheduler_data;
 timeval g_timeofday;
+SpinLock g_scheduler_lock;
+
+// Scheduler state that every processor has its own copy of.
+struct ProcessorSchedulerData {
+    TSS32 redirection_tss;
+    TSS32 switcher_tss;
+    FarPtr switcher_far_ptr;
+    Thread* switch_target;
+    bool holds_lock;
+    bool task_switch_pending;
+    bool active;
+    volatile bool should_stop_idling;
+};
+
+static ProcessorSchedulerData s_processor_data[MAX_PROCESSORS];
+static u16 s_redirection_selector;
+static u16 s_switcher_selector;
+static volatile bool s_secondary_processors_may_start;
+
+static constexpr size_t switcher_stack_size = 4096;
+alignas(16) static u8 s_switcher_stacks[MAX_PROCESSORS][switcher_stack_size];
+
+static ProcessorSchedulerData& this_processor_data()
+{
+    return s_processor_data[Processor::current().id()];
+}
+
+static bool is_idle_thread(const Thread& thread)
+{
+    return Processor::by_id(thread.cpu()).idle_thread() == &thread;
+}
 
 void Scheduler::init_thread(Thread& thread)
 {
+    // New threads go to whichever processor has the least to do right now.
+    thread.m_cpu = least_loaded_processor_for(thread);
     g_scheduler_data->m_nonrunnable_threads.append(thread);
 }
 
+u32 Scheduler::least_loaded_processor_for(const Thread& thread)
+{
+    auto& data = *g_scheduler_data;
+    Optional<u32> best_cpu;
+    if (thread.may_run_on(Processor::current().id()))
+        best_cpu = Processor::current().id();
+    Processor::for_each([&](Processor& processor) {
+        if (!processor.is_online() || !thread.may_run_on(processor.id()))
+            return;
+        if (!best_cpu.has_value() || data.m_ready_queues[processor.id()].m_thread_count < data.m_ready_queues[best_cpu.value()].m_thread_count)
+            best_cpu = processor.id();
+    });
+    // The mask may only name processors that aren't up (yet), fall back to the BSP.
+    return best_cpu.value_or(0);
+}
+
+void Scheduler::migrate_thread(Thread& thread, u32 cpu)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    if (thread.m_cpu == cpu)
+        return;
+    auto& data = *g_scheduler_data;
+    bool was_ready = data.is_in_ready_queue(thread);
+    if (was_ready)
+        dequeue_ready_thread(thread);
+    thread.m_cpu = cpu;
+    ++thread.m_migration_count;
+    if (was_ready) {
+        enqueue_ready_thread(thread);
+        wake_idle_processor(Processor::by_id(cpu));
+    }
+}
+
+void Scheduler::set_affinity(Thread& thread, u32 mask)
+{
+    InterruptDisabler disabler;
+    thread.m_affinity_mask = mask;
+    if (thread.may_run_on(thread.m_cpu))
+        return;
+    // A thread that is running on another processor right now moves once it
+    // gets off it, see context_switch().
+    if (thread.state() == Thread::Running && &thread != Thread::current())
+        return;
+    migrate_thread(thread, least_loaded_processor_for(thread));
+}
+
+// A thread that wakes up on a processor that is busy goes to one that is
+// idle instead, if it's allowed to run there. This is what spreads a burst
+// of new or woken threads out, rather than waiting for the idle processors
+// to come and steal them one tick at a time.
+void Scheduler::place_woken_thread(Thread& thread)
+{
+    auto& home = Processor::by_id(thread.m_cpu);
+    if (home.is_online() && home.running_thread() == home.idle_thread() && !g_scheduler_data->m_ready_queues[home.id()].m_thread_count)
+        return;
+    Processor* idle_processor = nullptr;
+    Processor::for_each([&](Processor& processor) {
+        if (idle_processor || !processor.is_online() || !thread.may_run_on(processor.id()))
+            return;
+        if (processor.running_thread() == processor.idle_thread() && !g_scheduler_data->m_ready_queues[processor.id()].m_thread_count)
+            idle_processor = &processor;
+    });
+    if (idle_processor)
+        migrate_thread(thread, idle_processor->id());
+}
+
+void Scheduler::enqueue_ready_thread(Thread& thread)
+{
+    auto& queues = g_scheduler_data->ready_queues_for(thread);
+    u32 priority = min(thread.base_priority() + thread.m_extra_priority, (u32)SchedulerData::ready_queue_count - 1);
+    u32 key = priority - queues.m_aging_epoch;
+
+    if (!queues.m_thread_count || (i32)(key - queues.m_highest_key) > 0) {
+        queues.m_highest_key = key;
+    } else if (queues.m_highest_key - key >= SchedulerData::ready_queue_count) {
+        // Threads that have waited this long are all equally overdue. Clamp the
+        // newcomer so it doesn't wrap around the ring into their queue.
+        key = queues.m_highest_key - (SchedulerData::ready_queue_count - 1);
+    }
+
+    thread.m_ready_queue_key = key;
+    auto slot = SchedulerData::ready_queue_slot(key);
+    queues.m_queues[slot].append(thread);
+    queues.m_bitmap[slot / 32] |= 1u << (slot % 32);
+    ++queues.m_thread_count;
+}
+
+void Scheduler::dequeue_ready_thread(Thread& thread)
+{
+    auto& queues = g_scheduler_data->ready_queues_for(thread);
+    auto slot = SchedulerData::ready_queue_slot(thread.m_ready_queue_key);
+    auto& queue = queues.m_queues[slot];
+    ASSERT(queue.contains(thread));
+
+    // Hang on to whatever the thread has aged so far, so it still has it
+    // when it becomes runnable again.
+    u32 priority = thread.m_ready_queue_key + queues.m_aging_epoch;
+    thread.m_extra_priority = priority > thread.base_priority() ? priority - thread.base_priority() : 0;
+
+    queue.remove(thread);
+    if (queue.is_empty())
+        queues.m_bitmap[slot / 32] &= ~(1u << (slot % 32));
+    --queues.m_thread_count;
+}
+
+// Returns how many slots below start_slot (wrapping around the ring) the
+// nearest non-empty ready queue is, or ready_queue_count if there is none.
+static size_t distance_to_next_ready_queue(const SchedulerData::ReadyQueues& queues, size_t start_slot)
+{
+    auto& bitmap = queues.m_bitmap;
+    constexpr size_t word_count = SchedulerData::ready_queue_bitmap_words;
+    size_t start_word = start_slot / 32;
+    u32 low_mask = (start_slot % 32) == 31 ? 0xffffffff : (1u << (start_slot % 32 + 1)) - 1;
+
+    for (size_t i = 0; i <= word_count; ++i) {
+        size_t word_index = (start_word + word_count - (i % word_count)) % word_count;
+        u32 word = bitmap[word_index];
+        if (i == 0)
+            word &= low_mask;
+        else if (i == word_count)
+            word &= ~low_mask;
+        if (!word)
+            continue;
+        size_t slot = word_index * 32 + (31 - __builtin_clz(word));
+        return (start_slot + SchedulerData::ready_queue_count - slot) % SchedulerData::ready_queue_count;
+    }
+    return SchedulerData::ready_queue_count;
+}
+
+static bool is_eligible_to_run(Thread& thread)
+{
+    // Someone else's running thread that was donated a time slice.
+    if (thread.state() == Thread::Running && &thread != Thread::current())
+        return false;
+    if (thread.process().is_being_inspected())
+        return false;
+    if (thread.process().exec_tid() && thread.process().exec_tid() != thread.tid())
+        return false;
+    return true;
+}
+
+template<typename Callback>
+static Thread* highest_priority_thread_in(SchedulerData::ReadyQueues& queues, Callback is_eligible)
+{
+    if (!queues.m_thread_count)
+        return nullptr;
+
+    auto distance = distance_to_next_ready_queue(queues, SchedulerData::ready_queue_slot(queues.m_highest_key));
+    ASSERT(distance < SchedulerData::ready_queue_count);
+    queues.m_highest_key -= distance;
+
+    u32 key = queues.m_highest_key;
+    size_t slots_left = SchedulerData::ready_queue_count;
+    for (;;) {
+        for (auto& thread : queues.m_queues[SchedulerData::ready_queue_slot(key)]) {
+            ASSERT(thread.state() == Thread::Runnable || thread.state() == Thread::Running);
+            if (is_eligible(thread))
+                return &thread;
+        }
+        if (!--slots_left)
+            return nullptr;
+        distance = distance_to_next_ready_queue(queues, SchedulerData::ready_queue_slot(key - 1));
+        if (distance >= slots_left)
+            return nullptr;
+        key -= distance + 1;
+        slots_left -= distance;
+    }
+}
+
+Thread* Scheduler::highest_priority_ready_thread()
+{
+    return highest_priority_thread_in(g_scheduler_data->m_ready_queues[Processor::current().id()], is_eligible_to_run);
+}
+
+// Another processor has work it can't get to yet if its ready queues hold
+// more than the thread it's running.
+bool Scheduler::has_threads_to_steal()
+{
+    auto& current = Processor::current();
+    bool found = false;
+    Processor::for_each([&](Processor& processor) {
+        if (&processor != &current && processor.is_online() && g_scheduler_data->m_ready_queues[processor.id()].m_thread_count > 1)
+            found = true;
+    });
+    return found;
+}
+
+// Called when this processor has nothing of its own to run. Takes the best
+// waiting thread from the processor with the most of them.
+Thread* Scheduler::steal_ready_thread()
+{
+    auto& current = Processor::current();
+    auto& data = *g_scheduler_data;
+    Processor* victim = nullptr;
+    Processor::for_each([&](Processor& processor) {
+        if (&processor == &current || !processor.is_online())
+            return;
+        auto count = data.m_ready_queues[processor.id()].m_thread_count;
+        if (count > 1 && (!victim || count > data.m_ready_queues[victim->id()].m_thread_count))
+            victim = &processor;
+    });
+    if (!victim)
+        return nullptr;
+
+    auto* thread = highest_priority_thread_in(data.m_ready_queues[victim->id()], [&](Thread& thread) {
+        return thread.state() == Thread::Runnable && thread.may_run_on(current.id()) && is_eligible_to_run(thread);
+    });
+    if (!thread)
+        return nullptr;
+
+#ifdef SCHEDULER_DEBUG
+    dbg() << "Scheduler: Processor #" << current.id() << " steals " << *thread << " from processor #" << victim->id();
+#endif
+    migrate_thread(*thread, current.id());
+    return thread;
+}
+
 void Scheduler::update_state_for_thread(Thread& thread)
 {
     ASSERT_INTERRUPTS_DISABLED();
-    auto& list = g_scheduler_data->thread_list_for_state(thread.state());
+    auto& data = *g_scheduler_data;
 
-    if (list.contains(thread))
+    if (Thread::is_runnable_state(thread.state())) {
+        if (!data.is_in_ready_queue(thread)) {
+            place_woken_thread(thread);
+            enqueue_ready_thread(thread);
+            wake_idle_processor(Processor::by_id(thread.m_cpu));
+        }
         return;
+    }
+
+    if (data.is_in_ready_queue(thread))
+        dequeue_ready_thread(thread);
+
+    // Freshly blocked threads and threads skipping scheduler passes need
+    // a look on the next pass. Everyone else waits to be woken up.
+    auto& list = thread.is_blocked() || thread.state() == Thread::Skip1SchedulerPass || thread.state() == Thread::Skip0SchedulerPasses
+        ? data.m_threads_to_reconsider
+        : data.m_nonrunnable_threads;
+    if (!list.contains(thread))
+        list.append(thread);
+}
 
-    list.append(thread);
+u32 Thread::effective_priority() const
+{
+    InterruptDisabler disabler;
+    if (g_scheduler_data->is_in_ready_queue(*this))
+        return m_ready_queue_key + g_scheduler_data->ready_queues_for(*this).m_aging_epoch;
+    return base_priority() + m_extra_priority;
 }
 
 static u32 time_slice_for(const Thread& thread)
 {
     // One time slice unit == 1ms
-    if (&thread == g_colonel)
+    if (is_idle_thread(thread))
         return 1;
     return 10;
 }
@@ -80,16 +355,65 @@ bool g_finalizer_has_work;
 static Process* s_colonel_process;
 u64 g_uptime;
 
-struct TaskRedirectionData {
-    u16 selector;
-    TSS32 tss;
-};
-static TaskRedirectionData s_redirection;
-static bool s_active;
-
 bool Scheduler::is_active()
 {
-    return s_active;
+    return this_processor_data().active;
+}
+
+void Thread::Blocker::begin_blocking(Thread& thread)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    will_block(thread);
+}
+
+void Thread::Blocker::end_blocking(Thread& thread)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    for (auto* block_condition : m_block_conditions)
+        block_condition->remove(thread);
+    m_block_conditions.clear();
+    if (m_timer_id) {
+        TimerQueue::the().cancel_timer(m_timer_id);
+        m_timer_id = 0;
+    }
+}
+
+void Thread::Blocker::add_block_condition(Thread& thread, BlockCondition& block_condition)
+{
+    for (auto* existing_condition : m_block_conditions) {
+        if (existing_condition == &block_condition)
+            return;
+    }
+    m_block_conditions.append(&block_condition);
+    block_condition.add(thread);
+}
+
+void Thread::Blocker::set_timeout(Thread& thread, const timeval& relative_timeout)
+{
+    ASSERT(!m_timer_id);
+    timeval timeout = relative_timeout;
+    m_timer_id = TimerQueue::the().add_timer(timeout, [this, &thread] {
+        m_timer_id = 0;
+        m_timed_out = true;
+        Scheduler::reconsider_blocked_thread(thread);
+    });
+}
+
+void Thread::Blocker::set_wakeup_time(Thread& thread, u64 wakeup_time)
+{
+    ASSERT(!m_timer_id);
+    // Nothing to wait for, the first look at the blocker will let us go.
+    if (wakeup_time <= g_uptime)
+        return;
+    auto timer = make<Timer>();
+    // Timers fire on the first tick after their expiration time.
+    timer->expires = wakeup_time - 1;
+    timer->callback = [this, &thread] {
+        m_timer_id = 0;
+        m_timed_out = true;
+        Scheduler::reconsider_blocked_thread(thread);
+    };
+    m_timer_id = TimerQueue::the().add_timer(move(timer));
 }
 
 Thread::JoinBlocker::JoinBlocker(Thread& joinee, void*& joinee_exit_value)
@@ -97,8 +421,13 @@ Thread::JoinBlocker::JoinBlocker(Thread& joinee, void*& joinee_exit_value)
     , m_joinee_exit_value(joinee_exit_value)
 {
     ASSERT(m_joinee.m_joiner == nullptr);
-    m_joinee.m_joiner = Thread::current;
-    Thread::current->m_joinee = &joinee;
+    m_joinee.m_joiner = Thread::current();
+    Thread::current()->m_joinee = &joinee;
+}
+
+void Thread::JoinBlocker::will_block(Thread&)
+{
+    // Thread::finalize() pokes the joiner directly when the joinee goes away.
 }
 
 bool Thread::JoinBlocker::should_unblock(Thread& joiner, time_t, long)
@@ -116,6 +445,14 @@ const FileDescription& Thread::FileDescriptionBlocker::blocked_description() con
     return m_blocked_description;
 }
 
+void Thread::FileDescriptionBlocker::will_block(Thread& thread)
+{
+    auto& file = m_blocked_description->file();
+    add_block_condition(thread, file.block_condition());
+    if (file.is_readiness_polled())
+        set_needs_polling();
+}
+
 Thread::AcceptBlocker::AcceptBlocker(const FileDescription& description)
     : FileDescriptionBlocker(description)
 {
@@ -143,24 +480,21 @@ Thread::WriteBlocker::WriteBlocker(const FileDescription& description)
 {
     if (description.is_socket()) {
         auto& socket = *description.socket();
-        if (socket.has_send_timeout()) {
-            timeval deadline = Scheduler::time_since_boot();
-            deadline.tv_sec += socket.send_timeout().tv_sec;
-            deadline.tv_usec += socket.send_timeout().tv_usec;
-            deadline.tv_sec += (socket.send_timeout().tv_usec / 1000000) * 1;
-            deadline.tv_usec %= 1000000;
-            m_deadline = deadline;
-        }
+        if (socket.has_send_timeout())
+            m_timeout = socket.send_timeout();
     }
 }
 
-bool Thread::WriteBlocker::should_unblock(Thread&, time_t now_sec, long now_usec)
+void Thread::WriteBlocker::will_block(Thread& thread)
 {
-    if (m_deadline.has_value()) {
-        bool timed_out = now_sec > m_deadline.value().tv_sec || (now_sec == m_deadline.value().tv_sec && now_usec >= m_deadline.value().tv_usec);
-        return timed_out || blocked_description().can_write();
-    }
-    return blocked_description().can_write();
+    FileDescriptionBlocker::will_block(thread);
+    if (m_timeout.has_value())
+        set_timeout(thread, m_timeout.value());
+}
+
+bool Thread::WriteBlocker::should_unblock(Thread&, time_t, long)
+{
+    return has_timed_out() || blocked_description().can_write();
 }
 
 Thread::ReadBlocker::ReadBlocker(const FileDescription& description)
@@ -168,24 +502,27 @@ Thread::ReadBlocker::ReadBlocker(const FileDescription& description)
 {
     if (description.is_socket()) {
         auto& socket = *description.socket();
-        if (socket.has_receive_timeout()) {
-            timeval deadline = Scheduler::time_since_boot();
-            deadline.tv_sec += socket.receive_timeout().tv_sec;
-            deadline.tv_usec += socket.receive_timeout().tv_usec;
-            deadline.tv_sec += (socket.receive_timeout().tv_usec / 1000000) * 1;
-            deadline.tv_usec %= 1000000;
-            m_deadline = deadline;
-        }
+        if (socket.has_receive_timeout())
+            m_timeout = socket.receive_timeout();
     }
 }
 
-bool Thread::ReadBlocker::should_unblock(Thread&, time_t now_sec, long now_usec)
+Thread::ReadBlocker::ReadBlocker(const FileDescription& description, const timeval& timeout)
+    : FileDescriptionBlocker(description)
+    , m_timeout(timeout)
 {
-    if (m_deadline.has_value()) {
-        bool timed_out = now_sec > m_deadline.value().tv_sec || (now_sec == m_deadline.value().tv_sec && now_usec >= m_deadline.value().tv_usec);
-        return timed_out || blocked_description().can_read();
-    }
-    return blocked_description().can_read();
+}
+
+void Thread::ReadBlocker::will_block(Thread& thread)
+{
+    FileDescriptionBlocker::will_block(thread);
+    if (m_timeout.has_value())
+        set_timeout(thread, m_timeout.value());
+}
+
+bool Thread::ReadBlocker::should_unblock(Thread&, time_t, long)
+{
+    return has_timed_out() || blocked_description().can_read();
 }
 
 Thread::ConditionBlocker::ConditionBlocker(const char* state_string, Function<bool()>&& condition)
@@ -195,6 +532,12 @@ Thread::ConditionBlocker::ConditionBlocker(const char* state_string, Function<bo
     ASSERT(m_block_until_condition);
 }
 
+void Thread::ConditionBlocker::will_block(Thread&)
+{
+    // An arbitrary condition can change without anyone telling us.
+    set_needs_polling();
+}
+
 bool Thread::ConditionBlocker::should_unblock(Thread&, time_t, long)
 {
     return m_block_until_condition();
@@ -205,6 +548,11 @@ Thread::SleepBlocker::SleepBlocker(u64 wakeup_time)
 {
 }
 
+void Thread::SleepBlocker::will_block(Thread& thread)
+{
+    set_wakeup_time(thread, m_wakeup_time);
+}
+
 bool Thread::SleepBlocker::should_unblock(Thread&, time_t, long)
 {
     return m_wakeup_time <= g_uptime;
@@ -219,9 +567,38 @@ Thread::SelectBlocker::SelectBlocker(const timeval& tv, bool select_has_timeout,
 {
 }
 
+void Thread::SelectBlocker::will_block(Thread& thread)
+{
+    auto& process = thread.process();
+    auto watch = [&](const FDVector& fds) {
+        for (int fd : fds) {
+            if (!process.m_fds[fd])
+                continue;
+            auto& description = *process.m_fds[fd].description;
+            auto& file = description.file();
+            m_watched_descriptions.append(description);
+            add_block_condition(thread, file.block_condition());
+            if (file.is_readiness_polled())
+                set_needs_polling();
+        }
+    };
+    watch(m_select_read_fds);
+    watch(m_select_write_fds);
+
+    if (m_select_has_timeout) {
+        auto now = Scheduler::time_since_boot();
+        timeval remaining { 0, 0 };
+        if (now.tv_sec < m_select_timeout.tv_sec || (now.tv_sec == m_select_timeout.tv_sec && now.tv_usec < m_select_timeout.tv_usec))
+            timeval_sub(m_select_timeout, now, remaining);
+        set_timeout(thread, remaining);
+    }
+}
+
 bool Thread::SelectBlocker::should_unblock(Thread& thread, time_t now_sec, long now_usec)
 {
     if (m_select_has_timeout) {
+        if (has_timed_out())
+            return true;
         if (now_sec > m_select_timeout.tv_sec || (now_sec == m_select_timeout.tv_sec && now_usec >= m_select_timeout.tv_usec))
             return true;
     }
@@ -249,6 +626,11 @@ Thread::WaitBlocker::WaitBlocker(int wait_options, pid_t& waitee_pid)
 {
 }
 
+void Thread::WaitBlocker::will_block(Thread& thread)
+{
+    add_block_condition(thread, thread.process().wait_block_condition());
+}
+
 bool Thread::WaitBlocker::should_unblock(Thread& thread, time_t, long)
 {
     bool should_unblock = m_wait_options & WNOHANG;
@@ -325,19 +707,36 @@ void Thread::consider_unblock(time_t now_sec, long now_usec)
     }
 }
 
+void Scheduler::reconsider_blocked_thread(Thread& thread)
+{
+    InterruptDisabler disabler;
+    if (thread.state() != Thread::Blocked)
+        return;
+    auto& list = g_scheduler_data->m_threads_to_reconsider;
+    if (!list.contains(thread))
+        list.append(thread);
+    wake_idle_processor(Processor::by_id(thread.m_cpu));
+}
+
 bool Scheduler::pick_next()
 {
     ASSERT_INTERRUPTS_DISABLED();
-    ASSERT(!s_active);
+    auto& processor_data = this_processor_data();
+    ASSERT(!processor_data.active);
 
-    TemporaryChange<bool> change(s_active, true);
+    TemporaryChange<bool> change(processor_data.active, true);
 
-    ASSERT(s_active);
+    auto& idle_thread = *Processor::current().idle_thread();
 
-    if (!Thread::current) {
-        // XXX: The first ever context_switch() goes to the idle process.
+    if (!Thread::current()) {
+        // XXX: The first ever context_switch() goes to the idle thread.
         //      This to setup a reliable place we can return to.
-        return context_switch(*g_colonel);
+        //      We're already running on its stack, so make it the current task
+        //      too, otherwise its state gets lost the first time it switches away.
+        bool did_switch = context_switch(idle_thread);
+        get_gdt_entry(idle_thread.selector()).type = 9;
+        load_task_register(idle_thread.selector());
+        return did_switch;
     }
 
     auto now = time_since_boot();
@@ -345,15 +744,20 @@ bool Scheduler::pick_next()
     auto now_sec = now.tv_sec;
     auto now_usec = now.tv_usec;
 
-    // Check and unblock threads whose wait conditions have been met.
-    Scheduler::for_each_nonrunnable([&](Thread& thread) {
+    // Check and unblock the threads whose wait conditions may have changed since the last pass.
+    // Blocked threads that nobody has poked are left alone.
+    auto& threads_to_reconsider = g_scheduler_data->m_threads_to_reconsider;
+    for (auto it = threads_to_reconsider.begin(); it != threads_to_reconsider.end();) {
+        auto& thread = *it;
+        it = ++it;
         thread.consider_unblock(now_sec, now_usec);
-        return IterationDecision::Continue;
-    });
+        if (thread.is_blocked() && !thread.m_blocker->needs_polling())
+            g_scheduler_data->m_nonrunnable_threads.append(thread);
+    }
 
     Process::for_each([&](Process& process) {
         if (process.is_dead()) {
-            if (Process::current->pid() != process.pid() && (!process.ppid() || !Process::from_pid(process.ppid()))) {
+            if (Process::current()->pid() != process.pid() && (!process.ppid() || !Process::from_pid(process.ppid()))) {
                 auto name = process.name();
                 auto pid = process.pid();
                 auto exit_status = Process::reap(process);
@@ -369,32 +773,41 @@ bool Scheduler::pick_next()
     });
 
     // Dispatch any pending signals.
-    Thread::for_each_living([](Thread& thread) -> IterationDecision {
+    // Copy the set first, since dispatching a signal may take a thread out of it.
+    Vector<Thread*, 16> threads_with_pending_signals;
+    for (auto* thread : g_scheduler_data->m_threads_with_pending_signals)
+        threads_with_pending_signals.append(thread);
+    for (auto* thread_ptr : threads_with_pending_signals) {
+        auto& thread = *thread_ptr;
+        if (thread.state() == Thread::Dead || thread.state() == Thread::Dying)
+            continue;
         if (!thread.has_unmasked_pending_signals())
-            return IterationDecision::Continue;
+            continue;
         // FIXME: It would be nice if the Scheduler didn't have to worry about who is "current"
         //        For now, avoid dispatching signals to "current" and do it in a scheduling pass
         //        while some other process is interrupted. Otherwise a mess will be made.
-        if (&thread == Thread::current)
-            return IterationDecision::Continue;
+        if (&thread == Thread::current())
+            continue;
+        // Threads running on other processors have to wait until they get preempted.
+        if (thread.state() == Thread::Running)
+            continue;
         // We know how to interrupt blocked processes, but if they are just executing
         // at some random point in the kernel, let them continue.
         // Before returning to userspace from a syscall, we will block a thread if it has any
         // pending unmasked signals, allowing it to be dispatched then.
         if (thread.in_kernel() && !thread.is_blocked() && !thread.is_stopped())
-            return IterationDecision::Continue;
+            continue;
         // NOTE: dispatch_one_pending_signal() may unblock the process.
         bool was_blocked = thread.is_blocked();
         if (thread.dispatch_one_pending_signal() == ShouldUnblockThread::No)
-            return IterationDecision::Continue;
+            continue;
         if (was_blocked) {
             dbg() << "Unblock " << thread << " due to signal";
             ASSERT(thread.m_blocker != nullptr);
             thread.m_blocker->set_interrupted_by_signal();
             thread.unblock();
         }
-        return IterationDecision::Continue;
-    });
+    }
 
 #ifdef SCHEDULER_RUNNABLE_DEBUG
     dbg() << "Non-runnables:";
@@ -410,34 +823,21 @@ bool Scheduler::pick_next()
     });
 #endif
 
-    Vector<Thread*, 128> sorted_runnables;
-    for_each_runnable([&sorted_runnables](auto& thread) {
-        sorted_runnables.append(&thread);
-        return IterationDecision::Continue;
-    });
-    quick_sort(sorted_runnables, [](auto& a, auto& b) { return a->effective_priority() >= b->effective_priority(); });
-
-    Thread* thread_to_schedule = nullptr;
-
-    for (auto* thread : sorted_runnables) {
-        if (thread->process().is_being_inspected())
-            continue;
-
-        if (thread->process().exec_tid() && thread->process().exec_tid() != thread->tid())
-            continue;
-
-        ASSERT(thread->state() == Thread::Runnable || thread->state() == Thread::Running);
-
-        if (!thread_to_schedule) {
-            thread->m_extra_priority = 0;
-            thread_to_schedule = thread;
-        } else {
-            thread->m_extra_priority++;
-        }
+    Thread* thread_to_schedule = highest_priority_ready_thread();
+    if (!thread_to_schedule)
+        thread_to_schedule = steal_ready_thread();
+
+    if (thread_to_schedule) {
+        // Everyone that was passed over ages by one priority level, while the
+        // chosen thread starts over from its base priority.
+        dequeue_ready_thread(*thread_to_schedule);
+        ++g_scheduler_data->ready_queues_for(*thread_to_schedule).m_aging_epoch;
+        thread_to_schedule->m_extra_priority = 0;
+        enqueue_ready_thread(*thread_to_schedule);
     }
 
     if (!thread_to_schedule)
-        thread_to_schedule = g_colonel;
+        thread_to_schedule = &idle_thread;
 
 #ifdef SCHEDULER_DEBUG
     dbg() << "Scheduler: Switch to " << *thread_to_schedule << " @ " << String::format("%04x:%08x", thread_to_schedule->tss().cs, thread_to_schedule->tss().eip);
@@ -453,9 +853,12 @@ bool Scheduler::donate_to(Thread* beneficiary, const char* reason)
         return false;
 
     (void)reason;
-    unsigned ticks_left = Thread::current->ticks_left();
+    unsigned ticks_left = Thread::current()->ticks_left();
     if (!beneficiary || beneficiary->state() != Thread::Runnable || ticks_left <= 1)
         return yield();
+    // Only threads from our own ready queues are ours to run.
+    if (beneficiary->m_cpu != Processor::current().id())
+        return yield();
 
     unsigned ticks_to_donate = min(ticks_left - 1, time_slice_for(*beneficiary));
 #ifdef SCHEDULER_DEBUG
@@ -470,7 +873,7 @@ bool Scheduler::donate_to(Thread* beneficiary, const char* reason)
 bool Scheduler::yield()
 {
     InterruptDisabler disabler;
-    ASSERT(Thread::current);
+    ASSERT(Thread::current());
     if (!pick_next())
         return false;
     switch_now();
@@ -486,10 +889,39 @@ void Scheduler::pick_next_and_switch_now()
 
 void Scheduler::switch_now()
 {
-    Descriptor& descriptor = get_gdt_entry(Thread::current->selector());
+    auto& thread = *Thread::current();
+    Descriptor& descriptor = get_gdt_entry(thread.selector());
     descriptor.type = 9;
+
+    if ((thread.tss().cs & 3) == 0) {
+        // The thread we're switching to was in the kernel, and simply takes over the scheduler lock from us.
+        asm("sti\n"
+            "ljmp *(%%eax)\n" ::"a"(&thread.far_ptr()));
+        return;
+    }
+
+    // Userspace doesn't get to run with the scheduler lock held, but we can't let go
+    // of it while we're still on the outgoing thread's stack. Have this processor's
+    // switcher task do it once we're off it.
+    auto& processor_data = this_processor_data();
+    processor_data.switch_target = &thread;
+    get_gdt_entry(s_switcher_selector).type = 9;
     asm("sti\n"
-        "ljmp *(%%eax)\n" ::"a"(&Thread::current->far_ptr()));
+        "ljmp *(%%eax)\n" ::"a"(&processor_data.switcher_far_ptr));
+}
+
+static void write_tss_descriptor(u16 selector, TSS32& tss, u8 type)
+{
+    auto& descriptor = get_gdt_entry(selector);
+    descriptor.set_base(&tss);
+    descriptor.set_limit(sizeof(TSS32));
+    descriptor.dpl = 0;
+    descriptor.segment_present = 1;
+    descriptor.granularity = 0;
+    descriptor.zero = 0;
+    descriptor.operation_size = 1;
+    descriptor.descriptor_type = 0;
+    descriptor.type = type;
 }
 
 bool Scheduler::context_switch(Thread& thread)
@@ -497,75 +929,111 @@ bool Scheduler::context_switch(Thread& thread)
     thread.set_ticks_left(time_slice_for(thread));
     thread.did_schedule();
 
-    if (Thread::current == &thread)
+    if (Thread::current() == &thread)
         return false;
 
-    if (Thread::current) {
+    if (Thread::current()) {
         // If the last process hasn't blocked (still marked as running),
         // mark it as runnable for the next round.
-        if (Thread::current->state() == Thread::Running)
-            Thread::current->set_state(Thread::Runnable);
+        if (Thread::current()->state() == Thread::Running)
+            Thread::current()->set_state(Thread::Runnable);
+
+        // Its affinity mask was changed to exclude this processor while it was running.
+        if (!Thread::current()->may_run_on(Thread::current()->cpu()))
+            migrate_thread(*Thread::current(), least_loaded_processor_for(*Thread::current()));
 
         asm volatile("fxsave %0"
-                     : "=m"(Thread::current->fpu_state()));
+                     : "=m"(Thread::current()->fpu_state()));
 
 #ifdef LOG_EVERY_CONTEXT_SWITCH
-        dbg() << "Scheduler: " << *Thread::current << " -> " << thread << " [" << thread.priority() << "] " << String::format("%w", thread.tss().cs) << ":" << String::format("%x", thread.tss().eip);
+        dbg() << "Scheduler: " << *Thread::current() << " -> " << thread << " [" << thread.priority() << "] " << String::format("%w", thread.tss().cs) << ":" << String::format("%x", thread.tss().eip);
 #endif
     }
 
-    Thread::current = &thread;
-    Process::current = &thread.process();
+    Processor::current().set_current_thread(thread);
 
     thread.set_state(Thread::Running);
 
-    asm volatile("fxrstor %0" ::"m"(Thread::current->fpu_state()));
+    asm volatile("fxrstor %0" ::"m"(Thread::current()->fpu_state()));
 
-    if (!thread.selector()) {
+    if (!thread.selector())
         thread.set_selector(gdt_alloc_entry());
-        auto& descriptor = get_gdt_entry(thread.selector());
-        descriptor.set_base(&thread.tss());
-        descriptor.set_limit(sizeof(TSS32));
-        descriptor.dpl = 0;
-        descriptor.segment_present = 1;
-        descriptor.granularity = 0;
-        descriptor.zero = 0;
-        descriptor.operation_size = 1;
-        descriptor.descriptor_type = 0;
-    }
+
+    // Every processor has its own GDT, and the thread may have last run on a
+    // different one, so always write out its descriptors in full.
+    write_tss_descriptor(thread.selector(), thread.tss(), 11); // Busy TSS
 
     if (!thread.thread_specific_data().is_null()) {
         auto& descriptor = thread_specific_descriptor();
         descriptor.set_base(thread.thread_specific_data().as_ptr());
         descriptor.set_limit(sizeof(ThreadSpecificData*));
+        descriptor.dpl = 3;
+        descriptor.segment_present = 1;
+        descriptor.granularity = 0;
+        descriptor.zero = 0;
+        descriptor.operation_size = 1;
+        descriptor.descriptor_type = 1;
+        descriptor.type = 2;
     }
 
-    auto& descriptor = get_gdt_entry(thread.selector());
-    descriptor.type = 11; // Busy TSS
     return true;
 }
 
-static void initialize_redirection()
+// The switcher is a task of its own that every processor has, for going from
+// kernel code to a thread that resumes in userspace. See switch_now().
+void Scheduler::switcher_task_main()
 {
-    auto& descriptor = get_gdt_entry(s_redirection.selector);
-    descriptor.set_base(&s_redirection.tss);
-    descriptor.set_limit(sizeof(TSS32));
-    descriptor.dpl = 0;
-    descriptor.segment_present = 1;
-    descriptor.granularity = 0;
-    descriptor.zero = 0;
-    descriptor.operation_size = 1;
-    descriptor.descriptor_type = 0;
-    descriptor.type = 9;
-    flush_gdt();
+    for (;;) {
+        auto& processor_data = this_processor_data();
+        auto& thread = *processor_data.switch_target;
+        processor_data.holds_lock = false;
+        g_scheduler_lock.unlock();
+        get_gdt_entry(thread.selector()).type = 9;
+        asm("ljmp *(%%eax)\n" ::"a"(&thread.far_ptr()));
+    }
+}
+
+void Scheduler::initialize_processor_tasks()
+{
+    auto& processor_data = this_processor_data();
+    auto cpu = Processor::current().id();
+
+    write_tss_descriptor(s_redirection_selector, processor_data.redirection_tss, 9);
+
+    auto& tss = processor_data.switcher_tss;
+    memset(&tss, 0, sizeof(TSS32));
+    tss.iomapbase = sizeof(TSS32);
+    tss.eflags = 0x0002;
+    tss.cs = 0x08;
+    tss.ds = 0x10;
+    tss.es = 0x10;
+    tss.gs = 0x10;
+    tss.ss = 0x10;
+    tss.fs = GDT_SELECTOR_PROCESSOR;
+    tss.cr3 = MM.kernel_page_directory().cr3();
+    tss.esp = (FlatPtr)&s_switcher_stacks[cpu][switcher_stack_size];
+    tss.eip = (FlatPtr)&Scheduler::switcher_task_main;
+    write_tss_descriptor(s_switcher_selector, tss, 9);
+    processor_data.switcher_far_ptr.selector = s_switcher_selector;
+    processor_data.switcher_far_ptr.offset = 0;
 }
 
 void Scheduler::prepare_for_iret_to_new_process()
 {
-    auto& descriptor = get_gdt_entry(s_redirection.selector);
-    descriptor.type = 9;
-    s_redirection.tss.backlink = Thread::current->selector();
-    load_task_register(s_redirection.selector);
+    auto& processor_data = this_processor_data();
+    auto& thread = *Thread::current();
+    get_gdt_entry(s_redirection_selector).type = 9;
+
+    // iret only goes back to busy tasks.
+    if ((thread.tss().cs & 3) == 0) {
+        processor_data.redirection_tss.backlink = thread.selector();
+    } else {
+        processor_data.switch_target = &thread;
+        get_gdt_entry(s_switcher_selector).type = 11;
+        processor_data.redirection_tss.backlink = s_switcher_selector;
+    }
+    load_task_register(s_redirection_selector);
+    processor_data.task_switch_pending = true;
 }
 
 void Scheduler::prepare_to_modify_tss(Thread& thread)
@@ -573,8 +1041,10 @@ void Scheduler::prepare_to_modify_tss(Thread& thread)
     // This ensures that a currently running process modifying its own TSS
     // in order to yield() and end up somewhere else doesn't just end up
     // right after the yield().
-    if (Thread::current == &thread)
-        load_task_register(s_redirection.selector);
+    if (Thread::current() == &thread) {
+        get_gdt_entry(s_redirection_selector).type = 9;
+        load_task_register(s_redirection_selector);
+    }
 }
 
 Process* Scheduler::colonel()
@@ -587,40 +1057,86 @@ void Scheduler::initialize()
     g_scheduler_data = new SchedulerData;
     g_finalizer_wait_queue = new WaitQueue;
     g_finalizer_has_work = false;
-    s_redirection.selector = gdt_alloc_entry();
-    initialize_redirection();
+    s_redirection_selector = gdt_alloc_entry();
+    s_switcher_selector = gdt_alloc_entry();
     s_colonel_process = Process::create_kernel_process(g_colonel, "colonel", nullptr);
     g_colonel->set_priority(THREAD_PRIORITY_MIN);
-    load_task_register(s_redirection.selector);
+    auto& processor = Processor::current();
+    processor.set_idle_thread(*g_colonel);
+    processor.set_online();
+    g_scheduler_lock.lock();
+    this_processor_data().holds_lock = true;
+    initialize_processor_tasks();
+}
+
+void Scheduler::release_secondary_processors()
+{
+    AK::atomic_store(&s_secondary_processors_may_start, true);
+}
+
+void Scheduler::start_secondary_processor()
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    while (!AK::atomic_load(&s_secondary_processors_may_start))
+        asm volatile("pause");
+
+    lock_for_kernel_entry();
+
+    auto& processor = Processor::current();
+    auto* idle_thread = new Thread(*s_colonel_process);
+    idle_thread->set_priority(THREAD_PRIORITY_MIN);
+    idle_thread->m_cpu = processor.id();
+    processor.set_idle_thread(*idle_thread);
+    initialize_processor_tasks();
+    processor.set_online();
+    APIC::the().enable_local_timer();
+
+    klog() << "Scheduler: Processor #" << processor.id() << " is online";
+
+    pick_next();
+    idle_loop();
+    ASSERT_NOT_REACHED();
 }
 
 void Scheduler::timer_tick(const RegisterState& regs)
 {
-    if (!Thread::current)
+    if (!Thread::current())
         return;
 
-    ++g_uptime;
-
-    g_timeofday = TimeManagement::now_as_timeval();
+    auto& processor = Processor::current();
+    if (processor.is_bootstrap_processor()) {
+        ++g_uptime;
+        g_timeofday = TimeManagement::now_as_timeval();
+    }
 
-    if (Process::current->is_profiling()) {
+    if (Process::current()->is_profiling()) {
         SmapDisabler disabler;
-        auto backtrace = Thread::current->raw_backtrace(regs.ebp, regs.eip);
+        auto backtrace = Thread::current()->raw_backtrace(regs.ebp, regs.eip);
         auto& sample = Profiling::next_sample_slot();
-        sample.pid = Process::current->pid();
-        sample.tid = Thread::current->tid();
+        sample.pid = Process::current()->pid();
+        sample.tid = Thread::current()->tid();
         sample.timestamp = g_uptime;
         for (size_t i = 0; i < min(backtrace.size(), Profiling::max_stack_frame_count); ++i) {
             sample.frames[i] = backtrace[i];
         }
     }
 
-    TimerQueue::the().fire();
+    if (processor.is_bootstrap_processor())
+        TimerQueue::the().fire();
 
-    if (Thread::current->tick())
+    // The idle thread is never preempted, it gets out of the way by itself when
+    // asked to. On the BSP, that's every tick, to keep the housekeeping in
+    // pick_next() going. Elsewhere, it's when there's work to do or to steal.
+    if (Thread::current() == processor.idle_thread()) {
+        if (processor.is_bootstrap_processor() || g_scheduler_data->m_ready_queues[processor.id()].m_thread_count || has_threads_to_steal())
+            this_processor_data().should_stop_idling = true;
+        return;
+    }
+
+    if (Thread::current()->tick())
         return;
 
-    auto& outgoing_tss = Thread::current->tss();
+    auto& outgoing_tss = Thread::current()->tss();
 
     if (!pick_next())
         return;
@@ -658,24 +1174,73 @@ void Scheduler::timer_tick(const RegisterState& regs)
         "popf\n");
 }
 
-static bool s_should_stop_idling = false;
+bool Scheduler::lock_for_kernel_entry()
+{
+    InterruptDisabler disabler;
+    auto& processor_data = this_processor_data();
+    if (processor_data.holds_lock)
+        return false;
+    while (!g_scheduler_lock.try_lock()) {
+        // Whoever has the lock may be waiting for us to flush our TLB.
+        Processor::current().handle_tlb_flush_request();
+        asm volatile("pause");
+    }
+    processor_data.holds_lock = true;
+    return true;
+}
 
-void Scheduler::stop_idling()
+void Scheduler::unlock_for_kernel_exit(bool took_lock)
 {
-    if (Thread::current != g_colonel)
+    InterruptDisabler disabler;
+    auto& processor_data = this_processor_data();
+    if (processor_data.task_switch_pending) {
+        // The lock goes along to the task timer_tick() arranged for us to switch to.
+        processor_data.task_switch_pending = false;
+        return;
+    }
+    if (!took_lock)
         return;
+    ASSERT(processor_data.holds_lock);
+    processor_data.holds_lock = false;
+    g_scheduler_lock.unlock();
+}
 
-    s_should_stop_idling = true;
+void Scheduler::wake_idle_processor(Processor& processor)
+{
+    if (!processor.is_online() || processor.running_thread() != processor.idle_thread())
+        return;
+    s_processor_data[processor.id()].should_stop_idling = true;
+    if (&processor != &Processor::current())
+        APIC::the().send_ipi(processor.apic_id(), APIC::reschedule_ipi_vector());
+}
+
+void Scheduler::stop_idling()
+{
+    wake_idle_processor(Processor::current());
 }
 
 void Scheduler::idle_loop()
 {
+    // The idle thread holds the scheduler lock like any other kernel code,
+    // except while it's halted, so the other processors can get work done.
     for (;;) {
-        asm("hlt");
-        if (s_should_stop_idling) {
-            s_should_stop_idling = false;
+        cli();
+        auto& processor_data = this_processor_data();
+        if (processor_data.should_stop_idling) {
+            processor_data.should_stop_idling = false;
             yield();
+            continue;
+        }
+        // Nothing else wants this processor, so get pages zeroed before a fault has to wait for it.
+        if (MM.prezero_user_physical_page()) {
+            sti();
+            continue;
         }
+        processor_data.holds_lock = false;
+        g_scheduler_lock.unlock();
+        asm("sti\n"
+            "hlt\n");
+        lock_for_kernel_entry();
     }
 }
 
@@ -30,11 +30,13 @@
 #include <AK/Function.h>
 #include <AK/IntrusiveList.h>
 #include <AK/Types.h>
+#include <Kernel/SpinLock.h>
 #include <Kernel/UnixTypes.h>
 
 namespace Kernel {
 
 class Process;
+class Processor;
 class Thread;
 class WaitQueue;
 struct RegisterState;
@@ -48,9 +50,15 @@ extern u64 g_uptime;
 extern SchedulerData* g_scheduler_data;
 extern timeval g_timeofday;
 
+// Only one processor runs kernel code at a time. It takes this lock on its way into
+// the kernel and lets go of it when it returns to userspace or has nothing to do.
+extern SpinLock g_scheduler_lock;
+
 class Scheduler {
 public:
     static void initialize();
+    [[noreturn]] static void start_secondary_processor();
+    static void release_secondary_processors();
     static void timer_tick(const RegisterState&);
     static bool pick_next();
     static timeval time_since_boot();
@@ -73,10 +81,40 @@ public:
     static inline IterationDecision for_each_nonrunnable(Callback);
 
     static void init_thread(Thread& thread);
+    static void set_affinity(Thread&, u32 mask);
     static void update_state_for_thread(Thread& thread);
+    static void reconsider_blocked_thread(Thread&);
+
+    static bool lock_for_kernel_entry();
+    static void unlock_for_kernel_exit(bool took_lock);
 
 private:
+    static void initialize_processor_tasks();
+    static void switcher_task_main();
+    static void wake_idle_processor(Processor&);
     static void prepare_for_iret_to_new_process();
+    static void enqueue_ready_thread(Thread&);
+    static void dequeue_ready_thread(Thread&);
+    static Thread* highest_priority_ready_thread();
+    static Thread* steal_ready_thread();
+    static bool has_threads_to_steal();
+    static u32 least_loaded_processor_for(const Thread&);
+    static void place_woken_thread(Thread&);
+    static void migrate_thread(Thread&, u32 cpu);
+};
+
+// Held by every way into the kernel: syscalls, exceptions and interrupts.
+// Does nothing if this processor is already running kernel code.
+class SchedulerLockGuard {
+public:
+    SchedulerLockGuard()
+        : m_took_lock(Scheduler::lock_for_kernel_entry())
+    {
+    }
+    ~SchedulerLockGuard() { Scheduler::unlock_for_kernel_exit(m_took_lock); }
+
+private:
+    bool m_took_lock { false };
 };
 
 }
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2020, Andreas Kling <kling@serenityos.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <AK/Atomic.h>
+#include <AK/Types.h>
+
+namespace Kernel {
+
+// A plain busy-waiting lock for data shared between processors.
+// Unlike Lock, it never puts the caller to sleep, so it's fine to use with
+// interrupts disabled, but it should only ever be held for a short while.
+class SpinLock {
+public:
+    ALWAYS_INLINE bool try_lock()
+    {
+        return !m_lock.exchange(1, AK::memory_order_acquire);
+    }
+
+    ALWAYS_INLINE void lock()
+    {
+        while (!try_lock()) {
+            while (m_lock.load(AK::memory_order_relaxed))
+                asm volatile("pause");
+        }
+    }
+
+    ALWAYS_INLINE void unlock()
+    {
+        m_lock.store(0, AK::memory_order_release);
+    }
+
+    bool is_locked() const { return m_lock.load(AK::memory_order_relaxed); }
+
+private:
+    Atomic<u32> m_lock { 0 };
+};
+
+class ScopedSpinLock {
+public:
+    ALWAYS_INLINE explicit ScopedSpinLock(SpinLock& lock)
+        : m_lock(lock)
+    {
+        m_lock.lock();
+    }
+    ALWAYS_INLINE ~ScopedSpinLock() { m_lock.unlock(); }
+
+private:
+    SpinLock& m_lock;
+};
+
+}
@@ -49,6 +49,8 @@ asm(
     "    mov $0x10, %ax\n"
     "    mov %ax, %ds\n"
     "    mov %ax, %es\n"
+    "    mov $0x28, %ax\n"
+    "    mov %ax, %fs\n"
     "    cld\n"
     "    xor %esi, %esi\n"
     "    xor %edi, %edi\n"
@@ -86,8 +88,8 @@ static Handler s_syscall_table[] = {
 int handle(RegisterState& regs, u32 function, u32 arg1, u32 arg2, u32 arg3)
 {
     ASSERT_INTERRUPTS_ENABLED();
-    auto& process = *Process::current;
-    Thread::current->did_syscall();
+    auto& process = *Process::current();
+    Thread::current()->did_syscall();
 
     if (function == SC_exit || function == SC_exit_thread) {
         // These syscalls need special handling since they never return to the caller.
@@ -125,14 +127,16 @@ void syscall_handler(RegisterState& regs)
     // Special handling of the "gettid" syscall since it's extremely hot.
     // FIXME: Remove this hack once userspace locks stop calling it so damn much.
     if (regs.eax == SC_gettid) {
-        regs.eax = Process::current->sys$gettid();
-        Thread::current->did_syscall();
+        regs.eax = Process::current()->sys$gettid();
+        Thread::current()->did_syscall();
         return;
     }
 
-    if (Thread::current->tracer() && Thread::current->tracer()->is_tracing_syscalls()) {
-        Thread::current->tracer()->set_trace_syscalls(false);
-        Thread::current->tracer_trap(regs);
+    SchedulerLockGuard lock_guard;
+
+    if (Thread::current()->tracer() && Thread::current()->tracer()->is_tracing_syscalls()) {
+        Thread::current()->tracer()->set_trace_syscalls(false);
+        Thread::current()->tracer_trap(regs);
     }
 
     // Make sure SMAP protection is enabled on syscall entry.
@@ -144,7 +148,7 @@ void syscall_handler(RegisterState& regs)
     asm volatile(""
                  : "=m"(*ptr));
 
-    auto& process = *Process::current;
+    auto& process = *Process::current();
 
     if (!MM.validate_user_stack(process, VirtualAddress(regs.userspace_esp))) {
         dbg() << "Invalid stack pointer: " << String::format("%p", regs.userspace_esp);
@@ -172,18 +176,18 @@ void syscall_handler(RegisterState& regs)
     u32 arg3 = regs.ebx;
     regs.eax = (u32)Syscall::handle(regs, function, arg1, arg2, arg3);
 
-    if (Thread::current->tracer() && Thread::current->tracer()->is_tracing_syscalls()) {
-        Thread::current->tracer()->set_trace_syscalls(false);
-        Thread::current->tracer_trap(regs);
+    if (Thread::current()->tracer() && Thread::current()->tracer()->is_tracing_syscalls()) {
+        Thread::current()->tracer()->set_trace_syscalls(false);
+        Thread::current()->tracer_trap(regs);
     }
 
     process.big_lock().unlock();
 
     // Check if we're supposed to return to userspace or just die.
-    Thread::current->die_if_needed();
+    Thread::current()->die_if_needed();
 
-    if (Thread::current->has_unmasked_pending_signals())
-        (void)Thread::current->block<Thread::SemiPermanentBlocker>(Thread::SemiPermanentBlocker::Reason::Signal);
+    if (Thread::current()->has_unmasked_pending_signals())
+        (void)Thread::current()->block<Thread::SemiPermanentBlocker>(Thread::SemiPermanentBlocker::Reason::Signal);
 }
 
 }
@@ -39,7 +39,10 @@ struct timeval;
 struct timespec;
 struct sockaddr;
 struct siginfo;
+struct epoll_event;
+struct iovec;
 typedef u32 socklen_t;
+typedef ssize_t off_t;
 }
 
 namespace Kernel {
@@ -188,7 +191,16 @@ namespace Kernel {
     __ENUMERATE_SYSCALL(shutdown)           \
     __ENUMERATE_SYSCALL(get_stack_bounds)   \
     __ENUMERATE_SYSCALL(ptrace)             \
-    __ENUMERATE_SYSCALL(minherit)
+    __ENUMERATE_SYSCALL(minherit)           \
+    __ENUMERATE_SYSCALL(sched_setaffinity)  \
+    __ENUMERATE_SYSCALL(sched_getaffinity)  \
+    __ENUMERATE_SYSCALL(readv)              \
+    __ENUMERATE_SYSCALL(epoll_create)       \
+    __ENUMERATE_SYSCALL(epoll_ctl)          \
+    __ENUMERATE_SYSCALL(epoll_wait)         \
+    __ENUMERATE_SYSCALL(sendfile)           \
+    __ENUMERATE_SYSCALL(preadv)             \
+    __ENUMERATE_SYSCALL(pwritev)
 
 namespace Syscall {
 
@@ -272,6 +284,41 @@ struct SC_select_params {
     struct timeval* timeout;
 };
 
+struct SC_epoll_ctl_params {
+    int epfd;
+    int op;
+    int fd;
+    const struct epoll_event* event;
+};
+
+struct SC_epoll_wait_params {
+    int epfd;
+    struct epoll_event* events;
+    int max_events;
+    int timeout;
+};
+
+struct SC_sendfile_params {
+    int out_fd;
+    int in_fd;
+    off_t* offset;
+    size_t count;
+};
+
+struct SC_preadv_params {
+    int fd;
+    const struct iovec* iov;
+    int iov_count;
+    off_t offset;
+};
+
+struct SC_pwritev_params {
+    int fd;
+    const struct iovec* iov;
+    int iov_count;
+    off_t offset;
+};
+
 struct SC_clock_nanosleep_params {
     int clock_id;
     int flags;
@@ -24,6 +24,7 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <Kernel/Heap/kmalloc.h>
 #include <Kernel/Process.h>
 #include <Kernel/Tasks/FinalizerTask.h>
 
@@ -32,16 +33,17 @@ namespace Kernel {
 void FinalizerTask::spawn()
 {
     Process::create_kernel_process(g_finalizer, "FinalizerTask", [] {
-        Thread::current->set_priority(THREAD_PRIORITY_LOW);
+        Thread::current()->set_priority(THREAD_PRIORITY_LOW);
         for (;;) {
             {
                 InterruptDisabler disabler;
                 if (!g_finalizer_has_work)
-                    Thread::current->wait_on(*g_finalizer_wait_queue);
+                    Thread::current()->wait_on(*g_finalizer_wait_queue);
                 ASSERT(g_finalizer_has_work);
                 g_finalizer_has_work = false;
             }
             Thread::finalize_dying_threads();
+            kmalloc_expand_if_needed();
         }
     });
 }
@@ -46,8 +46,6 @@
 
 namespace Kernel {
 
-Thread* Thread::current;
-
 static FPUState s_clean_fpu_state;
 
 u16 thread_specific_selector()
@@ -119,7 +117,7 @@ Thread::Thread(Process& process)
 
     m_tss.ds = ds;
     m_tss.es = ds;
-    m_tss.fs = ds;
+    m_tss.fs = m_process.is_ring0() ? GDT_SELECTOR_PROCESSOR : ds;
     m_tss.gs = gs;
     m_tss.ss = ss;
     m_tss.cs = cs;
@@ -153,6 +151,7 @@ Thread::~Thread()
     {
         InterruptDisabler disabler;
         thread_table().remove(this);
+        g_scheduler_data->m_threads_with_pending_signals.remove(this);
     }
 
     if (selector())
@@ -165,7 +164,7 @@ Thread::~Thread()
 void Thread::unblock()
 {
     m_blocker = nullptr;
-    if (current == this) {
+    if (Thread::current() == this) {
         if (m_should_die)
             set_state(Thread::Dying);
         else
@@ -210,7 +209,7 @@ void Thread::set_should_die()
 
 void Thread::die_if_needed()
 {
-    ASSERT(current == this);
+    ASSERT(Thread::current() == this);
 
     if (!m_should_die)
         return;
@@ -246,7 +245,7 @@ u64 Thread::sleep(u32 ticks)
 {
     ASSERT(state() == Thread::Running);
     u64 wakeup_time = g_uptime + ticks;
-    auto ret = Thread::current->block<Thread::SleepBlocker>(wakeup_time);
+    auto ret = Thread::current()->block<Thread::SleepBlocker>(wakeup_time);
     if (wakeup_time > g_uptime) {
         ASSERT(ret != Thread::BlockResult::WokeNormally);
     }
@@ -256,7 +255,7 @@ u64 Thread::sleep(u32 ticks)
 u64 Thread::sleep_until(u64 wakeup_time)
 {
     ASSERT(state() == Thread::Running);
-    auto ret = Thread::current->block<Thread::SleepBlocker>(wakeup_time);
+    auto ret = Thread::current()->block<Thread::SleepBlocker>(wakeup_time);
     if (wakeup_time > g_uptime)
         ASSERT(ret != Thread::BlockResult::WokeNormally);
     return wakeup_time;
@@ -294,7 +293,7 @@ const char* Thread::state_string() const
 
 void Thread::finalize()
 {
-    ASSERT(current == g_finalizer);
+    ASSERT(Thread::current() == g_finalizer);
 
 #ifdef THREAD_DEBUG
     dbg() << "Finalizing thread " << *this;
@@ -306,6 +305,7 @@ void Thread::finalize()
         static_cast<JoinBlocker*>(m_joiner->m_blocker)->set_joinee_exit_value(m_exit_value);
         static_cast<JoinBlocker*>(m_joiner->m_blocker)->set_interrupted_by_death();
         m_joiner->m_joinee = nullptr;
+        Scheduler::reconsider_blocked_thread(*m_joiner);
         // NOTE: We clear the joiner pointer here as well, to be tidy.
         m_joiner = nullptr;
     }
@@ -316,7 +316,7 @@ void Thread::finalize()
 
 void Thread::finalize_dying_threads()
 {
-    ASSERT(current == g_finalizer);
+    ASSERT(Thread::current() == g_finalizer);
     Vector<Thread*, 32> dying_threads;
     {
         InterruptDisabler disabler;
@@ -365,6 +365,16 @@ void Thread::send_signal(u8 signal, [[maybe_unused]] Process* sender)
 #endif
 
     m_pending_signals |= 1 << (signal - 1);
+    did_change_pending_signals();
+}
+
+void Thread::did_change_pending_signals()
+{
+    InterruptDisabler disabler;
+    if (m_pending_signals)
+        g_scheduler_data->m_threads_with_pending_signals.set(this);
+    else
+        g_scheduler_data->m_threads_with_pending_signals.remove(this);
 }
 
 // Certain exceptions, such as SIGSEGV and SIGILL, put a
@@ -492,6 +502,7 @@ ShouldUnblockThread Thread::dispatch_signal(u8 signal)
 
     // Mark this signal as handled.
     m_pending_signals &= ~(1 << (signal - 1));
+    did_change_pending_signals();
 
     if (signal == SIGSTOP) {
         if (!is_stopped()) {
@@ -713,6 +724,7 @@ Thread* Thread::clone(Process& process)
     clone->m_signal_mask = m_signal_mask;
     memcpy(clone->m_fpu_state, m_fpu_state, sizeof(FPUState));
     clone->m_thread_specific_data = m_thread_specific_data;
+    Scheduler::set_affinity(*clone, m_affinity_mask);
     return clone;
 }
 
@@ -755,11 +767,15 @@ void Thread::set_state(State new_state)
         m_stop_state = m_state;
     }
 
+    auto previous_state = m_state;
     m_state = new_state;
     if (m_process.pid() != 0) {
         Scheduler::update_state_for_thread(*this);
     }
 
+    if (previous_state == Stopped || new_state == Stopped)
+        m_process.notify_waiters();
+
     if (new_state == Dying) {
         g_finalizer_has_work = true;
         g_finalizer_wait_queue->wake_all();
@@ -807,7 +823,7 @@ String Thread::backtrace_impl() const
     Vector<RecognizedSymbol, 128> recognized_symbols;
 
     u32 start_frame;
-    if (current == this) {
+    if (Thread::current() == this) {
         asm volatile("movl %%ebp, %%eax"
                      : "=a"(start_frame));
     } else {
@@ -886,7 +902,7 @@ Thread::BlockResult Thread::wait_on(WaitQueue& queue, timeval* timeout, Atomic<b
     if (lock)
         *lock = false;
     set_state(State::Queued);
-    queue.enqueue(*current);
+    queue.enqueue(*Thread::current());
 
     TimerId timer_id {};
     if (timeout) {
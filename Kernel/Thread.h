@@ -27,7 +27,9 @@
 #pragma once
 
 #include <AK/Function.h>
+#include <AK/HashTable.h>
 #include <AK/IntrusiveList.h>
+#include <AK/NonnullRefPtrVector.h>
 #include <AK/Optional.h>
 #include <AK/OwnPtr.h>
 #include <AK/String.h>
@@ -71,7 +73,7 @@ class Thread {
     friend class Scheduler;
 
 public:
-    static Thread* current;
+    static Thread* current() { return Processor::current_thread(); }
 
     explicit Thread(Process&);
     ~Thread();
@@ -88,10 +90,15 @@ public:
 
     void set_priority(u32 p) { m_priority = p; }
     u32 priority() const { return m_priority; }
+    u32 cpu() const { return m_cpu; }
+    u32 affinity_mask() const { return m_affinity_mask; }
+    bool may_run_on(u32 cpu) const { return m_affinity_mask & (1u << cpu); }
+    u32 migration_count() const { return m_migration_count; }
 
     void set_priority_boost(u32 boost) { m_priority_boost = boost; }
     u32 priority_boost() const { return m_priority_boost; }
 
+    u32 base_priority() const;
     u32 effective_priority() const;
 
     void set_joinable(bool j) { m_is_joinable = j; }
@@ -132,7 +139,28 @@ public:
         void set_interrupted_by_signal() { m_was_interrupted_while_blocked = true; }
         bool was_interrupted_by_signal() const { return m_was_interrupted_while_blocked; }
 
+        // Blockers whose condition can't be signalled by anyone are re-checked on every scheduler pass.
+        bool needs_polling() const { return m_needs_polling; }
+
+    protected:
+        // Called right after the thread has entered the Blocked state. Subclasses
+        // register with whatever BlockCondition(s) may change their mind.
+        virtual void will_block(Thread&) { }
+
+        void add_block_condition(Thread&, BlockCondition&);
+        void set_timeout(Thread&, const timeval& relative_timeout);
+        void set_wakeup_time(Thread&, u64 wakeup_time);
+        void set_needs_polling() { m_needs_polling = true; }
+        bool has_timed_out() const { return m_timed_out; }
+
     private:
+        void begin_blocking(Thread&);
+        void end_blocking(Thread&);
+
+        Vector<BlockCondition*, 1> m_block_conditions;
+        u64 m_timer_id { 0 };
+        bool m_timed_out { false };
+        bool m_needs_polling { false };
         bool m_was_interrupted_while_blocked { false };
         bool m_was_interrupted_by_death { false };
         friend class Thread;
@@ -145,6 +173,9 @@ public:
         virtual const char* state_string() const override { return "Joining"; }
         void set_joinee_exit_value(void* value) { m_joinee_exit_value = value; }
 
+    protected:
+        virtual void will_block(Thread&) override;
+
     private:
         Thread& m_joinee;
         void*& m_joinee_exit_value;
@@ -156,6 +187,7 @@ public:
 
     protected:
         explicit FileDescriptionBlocker(const FileDescription&);
+        virtual void will_block(Thread&) override;
 
     private:
         NonnullRefPtr<FileDescription> m_blocked_description;
@@ -181,18 +213,25 @@ public:
         virtual bool should_unblock(Thread&, time_t, long) override;
         virtual const char* state_string() const override { return "Writing"; }
 
+    protected:
+        virtual void will_block(Thread&) override;
+
     private:
-        Optional<timeval> m_deadline;
+        Optional<timeval> m_timeout;
     };
 
     class ReadBlocker final : public FileDescriptionBlocker {
     public:
         explicit ReadBlocker(const FileDescription&);
+        ReadBlocker(const FileDescription&, const timeval& timeout);
         virtual bool should_unblock(Thread&, time_t, long) override;
         virtual const char* state_string() const override { return "Reading"; }
 
+    protected:
+        virtual void will_block(Thread&) override;
+
     private:
-        Optional<timeval> m_deadline;
+        Optional<timeval> m_timeout;
     };
 
     class ConditionBlocker final : public Blocker {
@@ -201,6 +240,9 @@ public:
         virtual bool should_unblock(Thread&, time_t, long) override;
         virtual const char* state_string() const override { return m_state_string; }
 
+    protected:
+        virtual void will_block(Thread&) override;
+
     private:
         Function<bool()> m_block_until_condition;
         const char* m_state_string { nullptr };
@@ -212,6 +254,9 @@ public:
         virtual bool should_unblock(Thread&, time_t, long) override;
         virtual const char* state_string() const override { return "Sleeping"; }
 
+    protected:
+        virtual void will_block(Thread&) override;
+
     private:
         u64 m_wakeup_time { 0 };
     };
@@ -223,12 +268,16 @@ public:
         virtual bool should_unblock(Thread&, time_t, long) override;
         virtual const char* state_string() const override { return "Selecting"; }
 
+    protected:
+        virtual void will_block(Thread&) override;
+
     private:
         timeval m_select_timeout;
         bool m_select_has_timeout { false };
         const FDVector& m_select_read_fds;
         const FDVector& m_select_write_fds;
         const FDVector& m_select_exceptional_fds;
+        NonnullRefPtrVector<FileDescription> m_watched_descriptions;
     };
 
     class WaitBlocker final : public Blocker {
@@ -237,6 +286,9 @@ public:
         virtual bool should_unblock(Thread&, time_t, long) override;
         virtual const char* state_string() const override { return "Waiting"; }
 
+    protected:
+        virtual void will_block(Thread&) override;
+
     private:
         int m_wait_options { 0 };
         pid_t& m_waitee_pid;
@@ -306,8 +358,12 @@ public:
         ASSERT(m_blocker == nullptr);
 
         T t(forward<Args>(args)...);
-        m_blocker = &t;
-        set_state(Thread::Blocked);
+        {
+            InterruptDisabler disabler;
+            m_blocker = &t;
+            set_state(Thread::Blocked);
+            t.begin_blocking(*this);
+        }
 
         // Yield to the scheduler, and wait for us to resume unblocked.
         yield_without_holding_big_lock();
@@ -316,7 +372,11 @@ public:
         ASSERT(state() != Thread::Blocked);
 
         // Remove ourselves...
-        m_blocker = nullptr;
+        {
+            InterruptDisabler disabler;
+            t.end_blocking(*this);
+            m_blocker = nullptr;
+        }
 
         if (t.was_interrupted_by_signal())
             return BlockResult::InterruptedBySignal;
@@ -458,6 +518,7 @@ private:
     void relock_process();
     String backtrace_impl() const;
     void reset_fpu_state();
+    void did_change_pending_signals();
 
     Process& m_process;
     int m_tid { -1 };
@@ -500,6 +561,12 @@ private:
     u32 m_priority { THREAD_PRIORITY_NORMAL };
     u32 m_extra_priority { 0 };
     u32 m_priority_boost { 0 };
+    u32 m_ready_queue_key { 0 };
+
+    // The processor whose ready queue this thread goes into.
+    u32 m_cpu { 0 };
+    u32 m_affinity_mask { 0xffffffff };
+    u32 m_migration_count { 0 };
 
     u8 m_stop_signal { 0 };
     State m_stop_state { Invalid };
@@ -554,27 +621,59 @@ const LogStream& operator<<(const LogStream&, const Thread&);
 struct SchedulerData {
     typedef IntrusiveList<Thread, &Thread::m_runnable_list_node> ThreadList;
 
-    ThreadList m_runnable_threads;
+    // Runnable threads live in a ring of ready queues, indexed by their effective
+    // priority minus m_aging_epoch. Bumping the epoch on every scheduling pass ages
+    // all queued threads by one level without touching them, and the bitmap of
+    // non-empty queues lets the scheduler find the best one in constant time.
+    // Every processor has a ring of its own and only ever picks from that.
+    static constexpr size_t ready_queue_count = 256;
+    static constexpr size_t ready_queue_bitmap_words = ready_queue_count / 32;
+
+    struct ReadyQueues {
+        ThreadList m_queues[ready_queue_count];
+        u32 m_bitmap[ready_queue_bitmap_words] {};
+        size_t m_thread_count { 0 };
+        u32 m_highest_key { 0 };
+        u32 m_aging_epoch { 0 };
+
+        bool is_empty(size_t slot) const { return !(m_bitmap[slot / 32] & (1u << (slot % 32))); }
+        bool contains(const Thread& thread) const { return m_queues[ready_queue_slot(thread.m_ready_queue_key)].contains(thread); }
+    };
+
+    ReadyQueues m_ready_queues[MAX_PROCESSORS];
+
     ThreadList m_nonrunnable_threads;
 
-    ThreadList& thread_list_for_state(Thread::State state)
-    {
-        if (Thread::is_runnable_state(state))
-            return m_runnable_threads;
-        return m_nonrunnable_threads;
-    }
+    // Blocked threads only get their blockers evaluated when something they wait on has
+    // changed (or their blocker asked to be polled), instead of on every scheduling pass.
+    ThreadList m_threads_to_reconsider;
+
+    // Only these threads need a look when dispatching signals.
+    HashTable<Thread*> m_threads_with_pending_signals;
+
+    static size_t ready_queue_slot(u32 key) { return key % ready_queue_count; }
+    ReadyQueues& ready_queues_for(const Thread& thread) { return m_ready_queues[thread.m_cpu]; }
+    bool is_in_ready_queue(const Thread& thread) const { return m_ready_queues[thread.m_cpu].contains(thread); }
 };
 
 template<typename Callback>
 inline IterationDecision Scheduler::for_each_runnable(Callback callback)
 {
     ASSERT_INTERRUPTS_DISABLED();
-    auto& tl = g_scheduler_data->m_runnable_threads;
-    for (auto it = tl.begin(); it != tl.end();) {
-        auto& thread = *it;
-        it = ++it;
-        if (callback(thread) == IterationDecision::Break)
-            return IterationDecision::Break;
+    for (auto& ready_queues : g_scheduler_data->m_ready_queues) {
+        if (!ready_queues.m_thread_count)
+            continue;
+        for (size_t slot = 0; slot < SchedulerData::ready_queue_count; ++slot) {
+            if (ready_queues.is_empty(slot))
+                continue;
+            auto& tl = ready_queues.m_queues[slot];
+            for (auto it = tl.begin(); it != tl.end();) {
+                auto& thread = *it;
+                it = ++it;
+                if (callback(thread) == IterationDecision::Break)
+                    return IterationDecision::Break;
+            }
+        }
     }
 
     return IterationDecision::Continue;
@@ -584,12 +683,14 @@ template<typename Callback>
 inline IterationDecision Scheduler::for_each_nonrunnable(Callback callback)
 {
     ASSERT_INTERRUPTS_DISABLED();
-    auto& tl = g_scheduler_data->m_nonrunnable_threads;
-    for (auto it = tl.begin(); it != tl.end();) {
-        auto& thread = *it;
-        it = ++it;
-        if (callback(thread) == IterationDecision::Break)
-            return IterationDecision::Break;
+    SchedulerData::ThreadList* lists[] = { &g_scheduler_data->m_nonrunnable_threads, &g_scheduler_data->m_threads_to_reconsider };
+    for (auto* tl : lists) {
+        for (auto it = tl->begin(); it != tl->end();) {
+            auto& thread = *it;
+            it = ++it;
+            if (callback(thread) == IterationDecision::Break)
+                return IterationDecision::Break;
+        }
     }
 
     return IterationDecision::Continue;
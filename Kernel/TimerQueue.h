@@ -68,7 +68,7 @@ private:
 
     void update_next_timer_due();
 
-    u64 microseconds_to_ticks(u64 micro_seconds) { return micro_seconds * (m_ticks_per_second / 1'000'000); }
+    u64 microseconds_to_ticks(u64 micro_seconds) { return micro_seconds * m_ticks_per_second / 1'000'000; }
     u64 seconds_to_ticks(u64 seconds) { return seconds * m_ticks_per_second; }
 
     u64 m_next_timer_due { 0 };
@@ -35,6 +35,22 @@ NonnullRefPtr<AnonymousVMObject> AnonymousVMObject::create_with_size(size_t size
     return adopt(*new AnonymousVMObject(size));
 }
 
+NonnullRefPtr<AnonymousVMObject> AnonymousVMObject::create_with_large_pages(size_t size)
+{
+    // Back every whole large page with a contiguous run up front. When memory is too
+    // fragmented for that, the rest gets ordinary zero-fill-on-demand pages instead.
+    auto vmobject = create_with_size(size);
+    constexpr size_t pages_per_large_page = LARGE_PAGE_SIZE / PAGE_SIZE;
+    for (size_t first_page = 0; first_page + pages_per_large_page <= vmobject->page_count(); first_page += pages_per_large_page) {
+        auto pages = MM.allocate_contiguous_user_physical_pages(LARGE_PAGE_SIZE);
+        if (pages.is_empty())
+            break;
+        for (size_t i = 0; i < pages_per_large_page; ++i)
+            vmobject->m_physical_pages[first_page + i] = pages[i];
+    }
+    return vmobject;
+}
+
 RefPtr<AnonymousVMObject> AnonymousVMObject::create_for_physical_range(PhysicalAddress paddr, size_t size)
 {
     if (paddr.offset(size) < paddr) {
@@ -51,6 +67,14 @@ NonnullRefPtr<AnonymousVMObject> AnonymousVMObject::create_with_physical_page(Ph
     return vmobject;
 }
 
+NonnullRefPtr<AnonymousVMObject> AnonymousVMObject::create_with_physical_pages(const NonnullRefPtrVector<PhysicalPage>& pages)
+{
+    auto vmobject = create_with_size(pages.size() * PAGE_SIZE);
+    for (size_t i = 0; i < pages.size(); ++i)
+        vmobject->m_physical_pages[i] = pages[i];
+    return vmobject;
+}
+
 AnonymousVMObject::AnonymousVMObject(size_t size)
     : VMObject(size)
 {
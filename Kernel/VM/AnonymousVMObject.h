@@ -36,8 +36,10 @@ public:
     virtual ~AnonymousVMObject() override;
 
     static NonnullRefPtr<AnonymousVMObject> create_with_size(size_t);
+    static NonnullRefPtr<AnonymousVMObject> create_with_large_pages(size_t);
     static RefPtr<AnonymousVMObject> create_for_physical_range(PhysicalAddress, size_t);
     static NonnullRefPtr<AnonymousVMObject> create_with_physical_page(PhysicalPage&);
+    static NonnullRefPtr<AnonymousVMObject> create_with_physical_pages(const NonnullRefPtrVector<PhysicalPage>&);
     virtual NonnullRefPtr<VMObject> clone() override;
 
 protected:
@@ -29,6 +29,9 @@
 #include <Kernel/VM/MemoryManager.h>
 #include <Kernel/VM/Region.h>
 
+#define MIN_READAHEAD_PAGES 4
+#define MAX_READAHEAD_PAGES 32
+
 namespace Kernel {
 
 InodeVMObject::InodeVMObject(Inode& inode, size_t size)
@@ -51,6 +54,21 @@ InodeVMObject::~InodeVMObject()
 {
 }
 
+size_t InodeVMObject::readahead_page_count(size_t page_index, size_t max_page_count)
+{
+    if (page_index == m_next_sequential_page)
+        m_readahead_window = min(max((size_t)MIN_READAHEAD_PAGES, m_readahead_window * 2), (size_t)MAX_READAHEAD_PAGES);
+    else
+        m_readahead_window = MIN_READAHEAD_PAGES;
+
+    size_t count = 0;
+    size_t limit = min(m_readahead_window, min(max_page_count, page_count() - page_index));
+    while (count < limit && m_physical_pages[page_index + count].is_null())
+        ++count;
+    m_next_sequential_page = page_index + count;
+    return count;
+}
+
 size_t InodeVMObject::amount_clean() const
 {
     size_t count = 0;
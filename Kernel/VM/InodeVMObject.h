@@ -50,6 +50,10 @@ public:
     u32 writable_mappings() const;
     u32 executable_mappings() const;
 
+    // How many pages to read in for a fault on page_index, at most max_page_count.
+    // Grows while faults keep coming in sequentially, and stops at the first page that's already present.
+    size_t readahead_page_count(size_t page_index, size_t max_page_count);
+
 protected:
     explicit InodeVMObject(Inode&, size_t);
     explicit InodeVMObject(const InodeVMObject&);
@@ -64,6 +68,9 @@ protected:
 
     NonnullRefPtr<Inode> m_inode;
     Bitmap m_dirty_pages;
+
+    size_t m_readahead_window { 0 };
+    size_t m_next_sequential_page { 0 };
 };
 
 template<>
@@ -29,6 +29,7 @@
 #include <AK/StringView.h>
 #include <Kernel/Arch/i386/CPU.h>
 #include <Kernel/CMOS.h>
+#include <Kernel/CommandLine.h>
 #include <Kernel/FileSystem/Inode.h>
 #include <Kernel/Multiboot.h>
 #include <Kernel/Process.h>
@@ -52,6 +53,9 @@ namespace Kernel {
 
 static MemoryManager* s_the;
 
+// How many pages the idle loop keeps zeroed ahead of zero-fill faults.
+static constexpr size_t zeroed_page_pool_size = 256;
+
 MemoryManager& MM
 {
     return *s_the;
@@ -59,11 +63,15 @@ MemoryManager& MM
 
 MemoryManager::MemoryManager()
 {
+    m_large_pages_enabled = kernel_command_line().lookup("large_pages").value_or("on") != "off";
     m_kernel_page_directory = PageDirectory::create_kernel_page_directory();
     parse_memory_map();
     write_cr3(kernel_page_directory().cr3());
     protect_kernel_image();
+    if (m_large_pages_enabled)
+        map_kernel_heap_with_large_pages();
 
+    m_zeroed_user_physical_pages.ensure_capacity(zeroed_page_pool_size);
     m_shared_zero_page = allocate_user_physical_page();
 }
 
@@ -88,6 +96,25 @@ void MemoryManager::protect_kernel_image()
     }
 }
 
+void MemoryManager::map_kernel_heap_with_large_pages()
+{
+    // boot.S maps the first 8 MiB of physical memory at 0xc0000000 with 4 KiB pages.
+    // Past the kernel image that's kmalloc heap and supervisor pages, none of which ever
+    // gets remapped, so a large page per 2 MiB saves a lot of TLB entries.
+    InterruptDisabler disabler;
+    FlatPtr first_vaddr = ((FlatPtr)&end_of_kernel_bss + LARGE_PAGE_SIZE - 1) & LARGE_PAGE_MASK;
+    for (FlatPtr vaddr = first_vaddr; vaddr < 0xc0000000 + 8 * MB; vaddr += LARGE_PAGE_SIZE) {
+        auto& pde = ensure_large_page_pde(kernel_page_directory(), VirtualAddress(vaddr));
+        pde.set_large_page_base(vaddr - 0xc0000000);
+        pde.set_writable(true);
+        pde.set_user_allowed(false);
+        if (g_cpu_supports_nx)
+            pde.set_execute_disabled(true);
+        pde.set_present(true);
+    }
+    flush_entire_tlb();
+}
+
 void MemoryManager::parse_memory_map()
 {
     RefPtr<PhysicalRegion> region;
@@ -170,7 +197,7 @@ const PageTableEntry* MemoryManager::pte(const PageDirectory& page_directory, Vi
 
     auto* pd = quickmap_pd(const_cast<PageDirectory&>(page_directory), page_directory_table_index);
     const PageDirectoryEntry& pde = pd[page_directory_index];
-    if (!pde.is_present())
+    if (!pde.is_present() || pde.is_huge())
         return nullptr;
 
     return &quickmap_pt(PhysicalAddress((FlatPtr)pde.page_table_base()))[page_table_index];
@@ -184,6 +211,10 @@ PageTableEntry& MemoryManager::ensure_pte(PageDirectory& page_directory, Virtual
     u32 page_table_index = (vaddr.get() >> 12) & 0x1ff;
 
     auto* pd = quickmap_pd(page_directory, page_directory_table_index);
+    if (pd[page_directory_index].is_huge()) {
+        split_large_page(page_directory, vaddr);
+        pd = quickmap_pd(page_directory, page_directory_table_index);
+    }
     PageDirectoryEntry& pde = pd[page_directory_index];
     if (!pde.is_present()) {
 #ifdef MM_DEBUG
@@ -198,12 +229,73 @@ PageTableEntry& MemoryManager::ensure_pte(PageDirectory& page_directory, Virtual
         pde.set_present(true);
         pde.set_writable(true);
         pde.set_global(&page_directory == m_kernel_page_directory.ptr());
-        page_directory.m_physical_pages.set(page_directory_index, move(page_table));
+        page_directory.m_physical_pages.set(vaddr.get() & LARGE_PAGE_MASK, move(page_table));
     }
 
     return quickmap_pt(PhysicalAddress((FlatPtr)pde.page_table_base()))[page_table_index];
 }
 
+PageDirectoryEntry& MemoryManager::pde(PageDirectory& page_directory, VirtualAddress vaddr)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    u32 page_directory_table_index = (vaddr.get() >> 30) & 0x3;
+    u32 page_directory_index = (vaddr.get() >> 21) & 0x1ff;
+    return quickmap_pd(page_directory, page_directory_table_index)[page_directory_index];
+}
+
+PageDirectoryEntry& MemoryManager::ensure_large_page_pde(PageDirectory& page_directory, VirtualAddress vaddr)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    ASSERT(!(vaddr.get() & ~LARGE_PAGE_MASK));
+    auto& pde = this->pde(page_directory, vaddr);
+    // The large page covers everything the page table did, so the table can go.
+    // The caller is responsible for flushing the TLB once the entry is filled in.
+    if (pde.is_present() && !pde.is_huge())
+        page_directory.m_physical_pages.remove(vaddr.get() & LARGE_PAGE_MASK);
+    pde.clear();
+    pde.set_huge(true);
+    pde.set_global(&page_directory == m_kernel_page_directory.ptr());
+    return pde;
+}
+
+void MemoryManager::split_large_page(PageDirectory& page_directory, VirtualAddress vaddr)
+{
+    // Someone wants to change a single page inside a large page, so replace it with
+    // a page table that maps the same memory with the same attributes.
+    ASSERT_INTERRUPTS_DISABLED();
+    auto large_page_vaddr = VirtualAddress(vaddr.get() & LARGE_PAGE_MASK);
+    auto page_table = allocate_user_physical_page(ShouldZeroFill::No);
+    ASSERT(page_table);
+    auto large_pde = pde(page_directory, large_page_vaddr);
+    ASSERT(large_pde.is_huge());
+#ifdef MM_DEBUG
+    dbg() << "MM: Splitting large page at " << large_page_vaddr << " => P" << String::format("%x", large_pde.large_page_base());
+#endif
+
+    auto* page_table_entries = quickmap_pt(page_table->paddr());
+    for (size_t i = 0; i < LARGE_PAGE_SIZE / PAGE_SIZE; ++i) {
+        auto& pte = page_table_entries[i];
+        pte.clear();
+        pte.set_physical_page_base(large_pde.large_page_base() + i * PAGE_SIZE);
+        pte.set_writable(large_pde.is_writable());
+        pte.set_user_allowed(large_pde.is_user_allowed());
+        pte.set_cache_disabled(large_pde.is_cache_disabled());
+        if (g_cpu_supports_nx)
+            pte.set_execute_disabled(large_pde.is_execute_disabled());
+        pte.set_present(true);
+    }
+
+    auto& pde = this->pde(page_directory, large_page_vaddr);
+    pde.clear();
+    pde.set_page_table_base(page_table->paddr().get());
+    pde.set_user_allowed(true);
+    pde.set_present(true);
+    pde.set_writable(true);
+    pde.set_global(&page_directory == m_kernel_page_directory.ptr());
+    page_directory.m_physical_pages.set(large_page_vaddr.get(), move(page_table));
+    flush_tlb(&page_directory, large_page_vaddr);
+}
+
 void MemoryManager::initialize()
 {
     s_the = new MemoryManager;
@@ -220,11 +312,8 @@ Region* MemoryManager::kernel_region_from_vaddr(VirtualAddress vaddr)
 
 Region* MemoryManager::user_region_from_vaddr(Process& process, VirtualAddress vaddr)
 {
-    // FIXME: Use a binary search tree (maybe red/black?) or some other more appropriate data structure!
-    for (auto& region : process.m_regions) {
-        if (region.contains(vaddr))
-            return &region;
-    }
+    if (auto* region = process.region_containing(vaddr))
+        return region;
 #ifdef MM_DEBUG
     dbg() << process << " Couldn't find user region for " << vaddr;
 #endif
@@ -259,8 +348,8 @@ Region* MemoryManager::region_from_vaddr(VirtualAddress vaddr)
 PageFaultResponse MemoryManager::handle_page_fault(const PageFault& fault)
 {
     ASSERT_INTERRUPTS_DISABLED();
-    ASSERT(Thread::current);
-    if (g_in_irq) {
+    ASSERT(Thread::current());
+    if (Processor::current().in_irq()) {
         dbg() << "BUG! Page fault while handling IRQ! code=" << fault.code() << ", vaddr=" << fault.vaddr();
         dump_kernel_regions();
     }
@@ -307,7 +396,11 @@ OwnPtr<Region> MemoryManager::allocate_kernel_region(size_t size, const StringVi
 OwnPtr<Region> MemoryManager::allocate_kernel_region(PhysicalAddress paddr, size_t size, const StringView& name, u8 access, bool user_accessible, bool cacheable)
 {
     ASSERT(!(size % PAGE_SIZE));
-    auto range = kernel_page_directory().range_allocator().allocate_anywhere(size);
+    // Line the range up with the physical memory so it can be mapped with large pages.
+    size_t alignment = PAGE_SIZE;
+    if (m_large_pages_enabled && size >= LARGE_PAGE_SIZE && !(paddr.get() & ~LARGE_PAGE_MASK))
+        alignment = LARGE_PAGE_SIZE;
+    auto range = kernel_page_directory().range_allocator().allocate_anywhere(size, alignment);
     if (!range.is_valid())
         return nullptr;
     auto vmobject = AnonymousVMObject::create_for_physical_range(paddr, size);
@@ -341,8 +434,10 @@ OwnPtr<Region> MemoryManager::allocate_kernel_region_with_vmobject(const Range&
         region = Region::create_user_accessible(range, vmobject, 0, name, access, cacheable);
     else
         region = Region::create_kernel_only(range, vmobject, 0, name, access, cacheable);
-    if (region)
+    if (region) {
+        region->set_large_pages(true);
         region->map(kernel_page_directory());
+    }
     return region;
 }
 
@@ -384,10 +479,40 @@ RefPtr<PhysicalPage> MemoryManager::find_free_user_physical_page()
     return page;
 }
 
-RefPtr<PhysicalPage> MemoryManager::allocate_user_physical_page(ShouldZeroFill should_zero_fill)
+bool MemoryManager::prezero_user_physical_page()
 {
     InterruptDisabler disabler;
+    if (m_zeroed_user_physical_pages.size() >= zeroed_page_pool_size || m_quickmap_in_use)
+        return false;
+
+    // Don't tie up pages in the pool when memory is getting tight.
+    unsigned free_pages = m_user_physical_pages - m_user_physical_pages_used - m_zeroed_user_physical_pages.size();
+    if (free_pages < zeroed_page_pool_size * 2)
+        return false;
+
     auto page = find_free_user_physical_page();
+    if (!page)
+        return false;
+
+    auto* ptr = quickmap_page(*page);
+    fast_u32_fill((u32*)ptr, 0, PAGE_SIZE / sizeof(u32));
+    unquickmap_page();
+    m_zeroed_user_physical_pages.append(page.release_nonnull());
+    return true;
+}
+
+RefPtr<PhysicalPage> MemoryManager::allocate_user_physical_page(ShouldZeroFill should_zero_fill)
+{
+    InterruptDisabler disabler;
+    RefPtr<PhysicalPage> page;
+    if (should_zero_fill == ShouldZeroFill::Yes && !m_zeroed_user_physical_pages.is_empty()) {
+        page = m_zeroed_user_physical_pages.take_last();
+        should_zero_fill = ShouldZeroFill::No;
+    } else {
+        page = find_free_user_physical_page();
+    }
+    if (!page && !m_zeroed_user_physical_pages.is_empty())
+        page = m_zeroed_user_physical_pages.take_last();
 
     if (!page) {
         // We didn't have a single free physical page. Let's try to free something up!
@@ -403,6 +528,16 @@ RefPtr<PhysicalPage> MemoryManager::allocate_user_physical_page(ShouldZeroFill s
             return IterationDecision::Continue;
         });
 
+        if (!page) {
+            // Then we drop the clean inode data nobody has mapped, it can always be read back in.
+            size_t released_page_count = Inode::release_clean_cached_pages();
+            if (released_page_count) {
+                klog() << "MM: Released " << released_page_count << " clean pages from inode page caches";
+                page = find_free_user_physical_page();
+                ASSERT(page);
+            }
+        }
+
         if (!page) {
             klog() << "MM: no user physical pages available";
             return {};
@@ -449,8 +584,8 @@ NonnullRefPtrVector<PhysicalPage> MemoryManager::allocate_contiguous_supervisor_
 
     for (auto& region : m_super_physical_regions) {
         physical_pages = region.take_contiguous_free_pages((count), true);
-        if (physical_pages.is_empty())
-            continue;
+        if (!physical_pages.is_empty())
+            break;
     }
 
     if (physical_pages.is_empty()) {
@@ -469,6 +604,31 @@ NonnullRefPtrVector<PhysicalPage> MemoryManager::allocate_contiguous_supervisor_
     return physical_pages;
 }
 
+NonnullRefPtrVector<PhysicalPage> MemoryManager::allocate_contiguous_user_physical_pages(size_t size)
+{
+    ASSERT(!(size % PAGE_SIZE));
+    InterruptDisabler disabler;
+    size_t count = ceil_div(size, PAGE_SIZE);
+    NonnullRefPtrVector<PhysicalPage> physical_pages;
+
+    for (auto& region : m_user_physical_regions) {
+        physical_pages = region.take_contiguous_free_pages(count, false);
+        if (!physical_pages.is_empty())
+            break;
+    }
+
+    if (physical_pages.is_empty())
+        return {};
+
+    // Count the pages first, they go back through deallocate_user_physical_page() if we bail.
+    m_user_physical_pages_used += count;
+    auto cleanup_region = allocate_kernel_region(physical_pages[0].paddr(), PAGE_SIZE * count, "MemoryManager Allocation Sanitization", Region::Access::Read | Region::Access::Write);
+    if (!cleanup_region)
+        return {};
+    fast_u32_fill((u32*)cleanup_region->vaddr().as_ptr(), 0, (PAGE_SIZE * count) / sizeof(u32));
+    return physical_pages;
+}
+
 RefPtr<PhysicalPage> MemoryManager::allocate_supervisor_physical_page()
 {
     InterruptDisabler disabler;
@@ -476,8 +636,8 @@ RefPtr<PhysicalPage> MemoryManager::allocate_supervisor_physical_page()
 
     for (auto& region : m_super_physical_regions) {
         page = region.take_free_page(true);
-        if (page.is_null())
-            continue;
+        if (!page.is_null())
+            break;
     }
 
     if (!page) {
@@ -501,27 +661,36 @@ RefPtr<PhysicalPage> MemoryManager::allocate_supervisor_physical_page()
 
 void MemoryManager::enter_process_paging_scope(Process& process)
 {
-    ASSERT(Thread::current);
+    ASSERT(Thread::current());
     InterruptDisabler disabler;
 
-    Thread::current->tss().cr3 = process.page_directory().cr3();
+    Thread::current()->tss().cr3 = process.page_directory().cr3();
     write_cr3(process.page_directory().cr3());
 }
 
 void MemoryManager::flush_entire_tlb()
 {
     write_cr3(read_cr3());
+    Processor::flush_tlb_on_other_processors(nullptr, VirtualAddress(), 0);
 }
 
-void MemoryManager::flush_tlb(VirtualAddress vaddr)
+void MemoryManager::flush_tlb_local(VirtualAddress vaddr, size_t page_count)
 {
 #ifdef MM_DEBUG
-    dbg() << "MM: Flush page " << vaddr;
+    dbg() << "MM: Flush " << page_count << " pages at " << vaddr;
 #endif
-    asm volatile("invlpg %0"
-                 :
-                 : "m"(*(char*)vaddr.get())
-                 : "memory");
+    for (size_t i = 0; i < page_count; ++i) {
+        asm volatile("invlpg %0"
+                     :
+                     : "m"(*(char*)vaddr.offset(i * PAGE_SIZE).get())
+                     : "memory");
+    }
+}
+
+void MemoryManager::flush_tlb(const PageDirectory* page_directory, VirtualAddress vaddr, size_t page_count)
+{
+    flush_tlb_local(vaddr, page_count);
+    Processor::flush_tlb_on_other_processors(page_directory, vaddr, page_count);
 }
 
 extern "C" PageTableEntry boot_pd3_pt1023[1024];
@@ -538,8 +707,10 @@ PageDirectoryEntry* MemoryManager::quickmap_pd(PageDirectory& directory, size_t
         pte.set_present(true);
         pte.set_writable(true);
         pte.set_user_allowed(false);
-        flush_tlb(VirtualAddress(0xffe04000));
     }
+    // NOTE: The quickmap PTEs are shared by all processors, so even if the mapping looks right
+    //       this processor may still have a stale translation from before someone else changed it.
+    flush_tlb_local(VirtualAddress(0xffe04000));
     return (PageDirectoryEntry*)0xffe04000;
 }
 
@@ -554,8 +725,8 @@ PageTableEntry* MemoryManager::quickmap_pt(PhysicalAddress pt_paddr)
         pte.set_present(true);
         pte.set_writable(true);
         pte.set_user_allowed(false);
-        flush_tlb(VirtualAddress(0xffe08000));
     }
+    flush_tlb_local(VirtualAddress(0xffe08000));
     return (PageTableEntry*)0xffe08000;
 }
 
@@ -574,8 +745,8 @@ u8* MemoryManager::quickmap_page(PhysicalPage& physical_page)
         pte.set_present(true);
         pte.set_writable(true);
         pte.set_user_allowed(false);
-        flush_tlb(VirtualAddress(0xffe00000));
     }
+    flush_tlb_local(VirtualAddress(0xffe00000));
     return (u8*)0xffe00000;
 }
 
@@ -585,7 +756,7 @@ void MemoryManager::unquickmap_page()
     ASSERT(m_quickmap_in_use);
     auto& pte = boot_pd3_pt1023[0];
     pte.clear();
-    flush_tlb(VirtualAddress(0xffe00000));
+    flush_tlb_local(VirtualAddress(0xffe00000));
     m_quickmap_in_use = false;
 }
 
@@ -640,12 +811,28 @@ bool MemoryManager::can_read_without_faulting(const Process& process, VirtualAdd
 {
     // FIXME: Use the size argument!
     UNUSED_PARAM(size);
+    auto& pde = const_cast<MemoryManager*>(this)->pde(const_cast<Process&>(process).page_directory(), vaddr);
+    if (pde.is_huge())
+        return pde.is_present();
     auto* pte = const_cast<MemoryManager*>(this)->pte(process.page_directory(), vaddr);
     if (!pte)
         return false;
     return pte->is_present();
 }
 
+PhysicalAddress MemoryManager::physical_address_of_kernel_vaddr(VirtualAddress vaddr)
+{
+    ASSERT(!is_user_address(vaddr));
+    InterruptDisabler disabler;
+    auto& pde = this->pde(kernel_page_directory(), vaddr);
+    if (pde.is_huge())
+        return PhysicalAddress(pde.large_page_base()).offset(vaddr.get() & ~LARGE_PAGE_MASK);
+    auto* pte = this->pte(kernel_page_directory(), vaddr);
+    if (!pte || !pte->is_present())
+        return {};
+    return PhysicalAddress((FlatPtr)pte->physical_page_base()).offset(offset_in_page(vaddr.get()));
+}
+
 bool MemoryManager::validate_user_read(const Process& process, VirtualAddress vaddr, size_t size) const
 {
     if (!is_user_address(vaddr))
@@ -93,6 +93,9 @@ public:
 
     bool can_read_without_faulting(const Process&, VirtualAddress, size_t) const;
 
+    // For handing kernel buffers to devices. Returns a null address if the page isn't mapped right now.
+    PhysicalAddress physical_address_of_kernel_vaddr(VirtualAddress);
+
     enum class ShouldZeroFill {
         No,
         Yes
@@ -101,6 +104,8 @@ public:
     RefPtr<PhysicalPage> allocate_user_physical_page(ShouldZeroFill = ShouldZeroFill::Yes);
     RefPtr<PhysicalPage> allocate_supervisor_physical_page();
     NonnullRefPtrVector<PhysicalPage> allocate_contiguous_supervisor_physical_pages(size_t size);
+    // Returns zeroed, physically contiguous user pages aligned to their size, or nothing if no such run is free.
+    NonnullRefPtrVector<PhysicalPage> allocate_contiguous_user_physical_pages(size_t size);
     void deallocate_user_physical_page(PhysicalPage&&);
     void deallocate_supervisor_physical_page(PhysicalPage&&);
 
@@ -116,6 +121,11 @@ public:
     unsigned user_physical_pages_used() const { return m_user_physical_pages_used; }
     unsigned super_physical_pages() const { return m_super_physical_pages; }
     unsigned super_physical_pages_used() const { return m_super_physical_pages_used; }
+    unsigned zeroed_user_physical_pages() const { return m_zeroed_user_physical_pages.size(); }
+
+    // Zeroes one free page ahead of time for the next zero-fill allocation.
+    // Called from the idle loop; returns false when there is nothing to do.
+    bool prezero_user_physical_page();
 
     template<typename Callback>
     static void for_each_vmobject(Callback callback)
@@ -146,6 +156,9 @@ public:
 
     PageDirectory& kernel_page_directory() { return *m_kernel_page_directory; }
 
+    // Can be turned off with the large_pages=off boot option.
+    bool large_pages_enabled() const { return m_large_pages_enabled; }
+
 private:
     MemoryManager();
     ~MemoryManager();
@@ -164,9 +177,11 @@ private:
 
     void detect_cpu_features();
     void protect_kernel_image();
+    void map_kernel_heap_with_large_pages();
     void parse_memory_map();
     void flush_entire_tlb();
-    void flush_tlb(VirtualAddress);
+    void flush_tlb_local(VirtualAddress, size_t page_count = 1);
+    void flush_tlb(const PageDirectory*, VirtualAddress, size_t page_count = 1);
 
     static Region* user_region_from_vaddr(Process&, VirtualAddress);
     static Region* kernel_region_from_vaddr(VirtualAddress);
@@ -182,6 +197,9 @@ private:
 
     const PageTableEntry* pte(const PageDirectory&, VirtualAddress);
     PageTableEntry& ensure_pte(PageDirectory&, VirtualAddress);
+    PageDirectoryEntry& pde(PageDirectory&, VirtualAddress);
+    PageDirectoryEntry& ensure_large_page_pde(PageDirectory&, VirtualAddress);
+    void split_large_page(PageDirectory&, VirtualAddress);
 
     RefPtr<PageDirectory> m_kernel_page_directory;
     RefPtr<PhysicalPage> m_low_page_table;
@@ -195,6 +213,7 @@ private:
 
     NonnullRefPtrVector<PhysicalRegion> m_user_physical_regions;
     NonnullRefPtrVector<PhysicalRegion> m_super_physical_regions;
+    NonnullRefPtrVector<PhysicalPage> m_zeroed_user_physical_pages;
 
     InlineLinkedList<Region> m_user_regions;
     InlineLinkedList<Region> m_kernel_regions;
@@ -202,6 +221,7 @@ private:
     InlineLinkedList<VMObject> m_vmobjects;
 
     bool m_quickmap_in_use { false };
+    bool m_large_pages_enabled { true };
 
     RefPtr<PhysicalPage> m_low_pseudo_identity_mapping_pages[4];
 };
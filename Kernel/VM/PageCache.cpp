@@ -0,0 +1,397 @@
+/*
+ * Copyright (c) 2020, the SerenityOS developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <AK/QuickSort.h>
+#include <AK/StringView.h>
+#include <Kernel/FileSystem/Inode.h>
+#include <Kernel/Scheduler.h>
+#include <Kernel/StdLib.h>
+#include <Kernel/Tasks/WritebackTask.h>
+#include <Kernel/VM/AnonymousVMObject.h>
+#include <Kernel/VM/MemoryManager.h>
+#include <Kernel/VM/PageCache.h>
+#include <Kernel/VM/Region.h>
+
+//#define PAGE_CACHE_DEBUG
+
+// Pages are read, written and copied in runs of at most this many.
+#define MAX_PAGES_PER_CHUNK 16
+// A throttled writer writes back at most this many of its own pages per write.
+#define MAX_PAGES_PER_THROTTLE 256
+
+namespace Kernel {
+
+static size_t s_total_page_count;
+static size_t s_total_dirty_page_count;
+static size_t s_total_writeback_page_count;
+static size_t s_throttled_write_count;
+
+size_t PageCache::total_page_count()
+{
+    return s_total_page_count;
+}
+
+size_t PageCache::total_dirty_page_count()
+{
+    return s_total_dirty_page_count;
+}
+
+size_t PageCache::total_writeback_page_count()
+{
+    return s_total_writeback_page_count;
+}
+
+size_t PageCache::throttled_write_count()
+{
+    return s_throttled_write_count;
+}
+
+PageCache::PageCache(Inode& inode)
+    : m_inode(inode)
+    , m_size_on_disk(inode.size())
+{
+}
+
+PageCache::~PageCache()
+{
+    s_total_page_count -= m_pages.size();
+    s_total_dirty_page_count -= m_dirty_pages.size();
+}
+
+RefPtr<PhysicalPage> PageCache::page(size_t page_index) const
+{
+    auto it = m_pages.find(page_index);
+    if (it == m_pages.end())
+        return nullptr;
+    return it->value;
+}
+
+void PageCache::set_page(size_t page_index, NonnullRefPtr<PhysicalPage> page)
+{
+    if (!m_pages.contains(page_index))
+        ++s_total_page_count;
+    m_pages.set(page_index, move(page));
+}
+
+void PageCache::remove_page(size_t page_index)
+{
+    mark_clean(page_index);
+    if (m_pages.contains(page_index)) {
+        m_pages.remove(page_index);
+        --s_total_page_count;
+    }
+}
+
+void PageCache::mark_dirty(size_t page_index)
+{
+    if (m_dirty_pages.contains(page_index))
+        return;
+    if (m_dirty_pages.is_empty())
+        m_dirty_since = g_uptime;
+    m_dirty_pages.set(page_index);
+    ++s_total_dirty_page_count;
+}
+
+void PageCache::mark_clean(size_t page_index)
+{
+    if (!m_dirty_pages.contains(page_index))
+        return;
+    m_dirty_pages.remove(page_index);
+    --s_total_dirty_page_count;
+}
+
+OwnPtr<Region> PageCache::map_pages(size_t first_page_index, size_t page_count)
+{
+    NonnullRefPtrVector<PhysicalPage> pages;
+    for (size_t i = 0; i < page_count; ++i)
+        pages.append(*page(first_page_index + i));
+    auto vmobject = AnonymousVMObject::create_with_physical_pages(pages);
+    return MM.allocate_kernel_region_with_vmobject(*vmobject, page_count * PAGE_SIZE, "PageCache", Region::Access::Read | Region::Access::Write);
+}
+
+KResult PageCache::page_in(size_t first_page_index, size_t page_count)
+{
+    NonnullRefPtrVector<PhysicalPage> pages;
+    for (size_t i = 0; i < page_count; ++i) {
+        auto page = MM.allocate_user_physical_page(MemoryManager::ShouldZeroFill::No);
+        if (!page)
+            return KResult(-ENOMEM);
+        pages.append(page.release_nonnull());
+    }
+
+    auto vmobject = AnonymousVMObject::create_with_physical_pages(pages);
+    auto region = MM.allocate_kernel_region_with_vmobject(*vmobject, page_count * PAGE_SIZE, "PageCache", Region::Access::Read | Region::Access::Write);
+    if (!region)
+        return KResult(-ENOMEM);
+    auto* buffer = region->vaddr().as_ptr();
+
+    size_t start = first_page_index * PAGE_SIZE;
+    size_t end = start + page_count * PAGE_SIZE;
+    size_t disk_end = min(max(m_size_on_disk, start), end);
+    size_t disk_page_count = ceil_div(disk_end - start, (size_t)PAGE_SIZE);
+
+#ifdef PAGE_CACHE_DEBUG
+    dbg() << "PageCache: Reading " << disk_page_count << " of " << page_count << " pages at " << first_page_index << " for inode " << m_inode.identifier();
+#endif
+
+    if (disk_page_count) {
+        auto result = m_inode.read_pages_from_disk(first_page_index, disk_page_count, buffer);
+        if (result.is_error())
+            return result;
+    }
+    memset(buffer + (disk_end - start), 0, end - disk_end);
+
+    for (size_t i = 0; i < page_count; ++i)
+        set_page(first_page_index + i, pages.ptr_at(i));
+    return KSuccess;
+}
+
+KResult PageCache::populate(size_t first_page_index, size_t page_count)
+{
+    LOCKER(m_inode.m_lock);
+    size_t end_page_index = first_page_index + page_count;
+    for (size_t page_index = first_page_index; page_index < end_page_index;) {
+        if (m_pages.contains(page_index)) {
+            ++page_index;
+            continue;
+        }
+        size_t run_start = page_index;
+        while (page_index < end_page_index && page_index - run_start < MAX_PAGES_PER_CHUNK && !m_pages.contains(page_index))
+            ++page_index;
+        auto result = page_in(run_start, page_index - run_start);
+        if (result.is_error())
+            return result;
+    }
+    return KSuccess;
+}
+
+ssize_t PageCache::read(off_t offset, size_t count, u8* buffer)
+{
+    LOCKER(m_inode.m_lock);
+    ASSERT(offset >= 0);
+    size_t nread = 0;
+    while (nread < count) {
+        size_t position = offset + nread;
+        size_t first_page_index = position / PAGE_SIZE;
+        size_t offset_into_chunk = position % PAGE_SIZE;
+        size_t page_count = min(ceil_div(offset_into_chunk + count - nread, (size_t)PAGE_SIZE), (size_t)MAX_PAGES_PER_CHUNK);
+        size_t chunk_size = min(count - nread, page_count * PAGE_SIZE - offset_into_chunk);
+
+        auto result = populate(first_page_index, page_count);
+        if (result.is_error())
+            return nread ? (ssize_t)nread : result.error();
+        auto region = map_pages(first_page_index, page_count);
+        if (!region)
+            return nread ? (ssize_t)nread : -ENOMEM;
+        memcpy(buffer + nread, region->vaddr().as_ptr() + offset_into_chunk, chunk_size);
+        nread += chunk_size;
+    }
+    return nread;
+}
+
+ssize_t PageCache::read_in_place(off_t offset, size_t count, Function<ssize_t(const u8*, size_t)> callback)
+{
+    ASSERT(offset >= 0);
+    size_t nread = 0;
+    while (nread < count) {
+        size_t position = offset + nread;
+        size_t first_page_index = position / PAGE_SIZE;
+        size_t offset_into_chunk = position % PAGE_SIZE;
+        size_t page_count = min(ceil_div(offset_into_chunk + count - nread, (size_t)PAGE_SIZE), (size_t)MAX_PAGES_PER_CHUNK);
+        size_t chunk_size = min(count - nread, page_count * PAGE_SIZE - offset_into_chunk);
+
+        OwnPtr<Region> region;
+        {
+            LOCKER(m_inode.m_lock);
+            auto result = populate(first_page_index, page_count);
+            if (result.is_error())
+                return nread ? (ssize_t)nread : result.error();
+            region = map_pages(first_page_index, page_count);
+        }
+        if (!region)
+            return nread ? (ssize_t)nread : -ENOMEM;
+
+        ssize_t rc = callback(region->vaddr().as_ptr() + offset_into_chunk, chunk_size);
+        if (rc < 0)
+            return nread ? (ssize_t)nread : rc;
+        nread += rc;
+        if ((size_t)rc < chunk_size)
+            break;
+    }
+    return nread;
+}
+
+ssize_t PageCache::write(off_t offset, size_t count, const u8* data)
+{
+    LOCKER(m_inode.m_lock);
+    ASSERT(offset >= 0);
+    size_t nwritten = 0;
+    while (nwritten < count) {
+        size_t position = offset + nwritten;
+        size_t first_page_index = position / PAGE_SIZE;
+        size_t offset_into_chunk = position % PAGE_SIZE;
+        size_t page_count = min(ceil_div(offset_into_chunk + count - nwritten, (size_t)PAGE_SIZE), (size_t)MAX_PAGES_PER_CHUNK);
+        size_t chunk_size = min(count - nwritten, page_count * PAGE_SIZE - offset_into_chunk);
+
+        // Pages we're about to overwrite completely don't have to be read in first.
+        // Until they are, they hold garbage, so they must not stay cached if we fail.
+        Vector<size_t, MAX_PAGES_PER_CHUNK> unfilled_pages;
+        auto fail = [&](int error) -> ssize_t {
+            for (auto page_index : unfilled_pages)
+                remove_page(page_index);
+            return nwritten ? (ssize_t)nwritten : error;
+        };
+        for (size_t i = 0; i < page_count; ++i) {
+            size_t page_index = first_page_index + i;
+            size_t page_start = page_index * PAGE_SIZE;
+            if (page_start < position || page_start + PAGE_SIZE > position + chunk_size || m_pages.contains(page_index))
+                continue;
+            auto page = MM.allocate_user_physical_page(MemoryManager::ShouldZeroFill::No);
+            if (!page)
+                return fail(-ENOMEM);
+            set_page(page_index, page.release_nonnull());
+            unfilled_pages.append(page_index);
+        }
+
+        auto result = populate(first_page_index, page_count);
+        if (result.is_error())
+            return fail(result.error());
+        auto region = map_pages(first_page_index, page_count);
+        if (!region)
+            return fail(-ENOMEM);
+        memcpy(region->vaddr().as_ptr() + offset_into_chunk, data + nwritten, chunk_size);
+        for (size_t i = 0; i < page_count; ++i)
+            mark_dirty(first_page_index + i);
+        nwritten += chunk_size;
+    }
+    balance_dirty_pages();
+    return nwritten;
+}
+
+bool PageCache::dirty_pages_exceed(unsigned percent)
+{
+    return s_total_dirty_page_count * 100 > MM.user_physical_pages() * percent;
+}
+
+void PageCache::balance_dirty_pages()
+{
+    if (dirty_pages_exceed(WritebackTask::dirty_throttle_percent)) {
+        // Too much of memory is dirty, this writer has to write back some of its own pages before carrying on.
+        // Just a batch, though, the WritebackTask takes care of the rest.
+        ++s_throttled_write_count;
+        WritebackTask::wake();
+        auto result = flush(MAX_PAGES_PER_THROTTLE);
+        if (result.is_error())
+            dbg() << "PageCache: Failed to write back pages of inode " << m_inode.identifier() << ": " << result.error();
+    } else if (dirty_pages_exceed(WritebackTask::dirty_background_percent)) {
+        WritebackTask::wake();
+    }
+}
+
+KResult PageCache::flush(size_t max_page_count)
+{
+    LOCKER(m_inode.m_lock);
+    if (m_dirty_pages.is_empty())
+        return KSuccess;
+
+    Vector<size_t> dirty_pages;
+    dirty_pages.ensure_capacity(m_dirty_pages.size());
+    for (auto page_index : m_dirty_pages)
+        dirty_pages.append(page_index);
+    quick_sort(dirty_pages);
+    if (dirty_pages.size() > max_page_count)
+        dirty_pages.shrink(max_page_count);
+
+    // Write out runs of consecutive pages, so the filesystem can merge them into large writes.
+    for (size_t i = 0; i < dirty_pages.size();) {
+        size_t run_start = i++;
+        while (i < dirty_pages.size() && i - run_start < MAX_PAGES_PER_CHUNK && dirty_pages[i] == dirty_pages[i - 1] + 1)
+            ++i;
+        size_t first_page_index = dirty_pages[run_start];
+        size_t page_count = i - run_start;
+
+        auto region = map_pages(first_page_index, page_count);
+        if (!region)
+            return KResult(-ENOMEM);
+#ifdef PAGE_CACHE_DEBUG
+        dbg() << "PageCache: Writing " << page_count << " pages at " << first_page_index << " for inode " << m_inode.identifier();
+#endif
+        s_total_writeback_page_count += page_count;
+        auto result = m_inode.write_pages_to_disk(first_page_index, page_count, region->vaddr().as_ptr());
+        s_total_writeback_page_count -= page_count;
+        if (result.is_error())
+            return result;
+        for (size_t j = 0; j < page_count; ++j)
+            mark_clean(first_page_index + j);
+
+        size_t start = first_page_index * PAGE_SIZE;
+        if (start <= m_size_on_disk)
+            m_size_on_disk = max(m_size_on_disk, min(start + page_count * PAGE_SIZE, m_inode.size()));
+    }
+    return KSuccess;
+}
+
+void PageCache::resize(size_t new_size)
+{
+    LOCKER(m_inode.m_lock);
+    size_t new_page_count = ceil_div(new_size, (size_t)PAGE_SIZE);
+
+    Vector<size_t> pages_to_remove;
+    for (auto& it : m_pages) {
+        if (it.key >= new_page_count)
+            pages_to_remove.append(it.key);
+    }
+    for (auto page_index : pages_to_remove)
+        remove_page(page_index);
+
+    // Whatever is left past the end of the file in the last page has to read as zeroes,
+    // both now and if the file grows again later.
+    if (new_size % PAGE_SIZE) {
+        if (m_pages.contains(new_size / PAGE_SIZE)) {
+            auto region = map_pages(new_size / PAGE_SIZE, 1);
+            if (region) {
+                size_t offset_into_page = new_size % PAGE_SIZE;
+                memset(region->vaddr().as_ptr() + offset_into_page, 0, PAGE_SIZE - offset_into_page);
+            }
+        }
+    }
+
+    m_size_on_disk = min(m_size_on_disk, new_size);
+}
+
+size_t PageCache::release_clean_pages()
+{
+    Vector<size_t> pages_to_release;
+    for (auto& it : m_pages) {
+        if (it.value->ref_count() == 1 && !m_dirty_pages.contains(it.key))
+            pages_to_release.append(it.key);
+    }
+    for (auto page_index : pages_to_release)
+        remove_page(page_index);
+    return pages_to_release.size();
+}
+
+}
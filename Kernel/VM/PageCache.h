@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2020, the SerenityOS developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <AK/Function.h>
+#include <AK/HashMap.h>
+#include <AK/HashTable.h>
+#include <AK/Noncopyable.h>
+#include <AK/NumericLimits.h>
+#include <AK/OwnPtr.h>
+#include <Kernel/Forward.h>
+#include <Kernel/KResult.h>
+#include <Kernel/VM/PhysicalPage.h>
+
+namespace Kernel {
+
+// The cached contents of an inode, one physical page for every page of the file.
+// read() and write() copy in and out of these pages, and mmap() maps the very same
+// pages, so there's only ever one copy of the data in memory. Dirty pages are only
+// written back by flush(), which the WritebackTask does once they've been dirty for a
+// while. Writers that dirty too much of memory have to flush their own pages.
+class PageCache {
+    AK_MAKE_NONCOPYABLE(PageCache);
+    AK_MAKE_NONMOVABLE(PageCache);
+
+public:
+    explicit PageCache(Inode&);
+    ~PageCache();
+
+    // Makes sure the given pages are cached, reading in the ones that aren't.
+    KResult populate(size_t first_page_index, size_t page_count);
+    RefPtr<PhysicalPage> page(size_t page_index) const;
+
+    ssize_t read(off_t, size_t, u8* buffer);
+    ssize_t write(off_t, size_t, const u8* data);
+
+    // Like read(), but hands the cached pages to the callback one mapped chunk at a time instead of
+    // copying them out. Only the pages are held while the callback runs, not the inode lock, so it may
+    // block. It returns how much of the chunk it used, and we stop early if that wasn't all of it.
+    ssize_t read_in_place(off_t, size_t, Function<ssize_t(const u8*, size_t)>);
+
+    // Writes back the dirty pages, or only the first max_page_count of them.
+    KResult flush(size_t max_page_count = NumericLimits<size_t>::max());
+    void resize(size_t new_size);
+
+    // Drops the clean pages nobody else is holding on to. Returns how many were dropped.
+    size_t release_clean_pages();
+
+    size_t page_count() const { return m_pages.size(); }
+    size_t dirty_page_count() const { return m_dirty_pages.size(); }
+    // When the oldest of the dirty pages was dirtied.
+    u64 dirty_since() const { return m_dirty_since; }
+
+    static size_t total_page_count();
+    static size_t total_dirty_page_count();
+    static size_t total_writeback_page_count();
+    static size_t throttled_write_count();
+    // Whether more than the given share (in percent) of user memory is dirty.
+    static bool dirty_pages_exceed(unsigned percent);
+
+private:
+    KResult page_in(size_t first_page_index, size_t page_count);
+    OwnPtr<Region> map_pages(size_t first_page_index, size_t page_count);
+    void set_page(size_t page_index, NonnullRefPtr<PhysicalPage>);
+    void mark_dirty(size_t page_index);
+    void mark_clean(size_t page_index);
+    void remove_page(size_t page_index);
+    void balance_dirty_pages();
+
+    Inode& m_inode;
+    HashMap<size_t, NonnullRefPtr<PhysicalPage>> m_pages;
+    HashTable<size_t> m_dirty_pages;
+    u64 m_dirty_since { 0 };
+
+    // The disk only holds meaningful data below this offset. Anything past it
+    // (blocks added by growing the file, but never written) reads as zeroes.
+    size_t m_size_on_disk { 0 };
+};
+
+}
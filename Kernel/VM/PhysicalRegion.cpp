@@ -61,61 +61,53 @@ unsigned PhysicalRegion::finalize_capacity()
     m_pages = (m_upper.get() - m_lower.get()) / PAGE_SIZE;
     m_bitmap.grow(m_pages, false);
 
+    if (m_pages) {
+        for (unsigned order = 0; order <= max_order; ++order)
+            m_free_lists[order].heads.grow(slot_of(m_pages - 1, order) + 1, false);
+        free_range(0, m_pages);
+    }
+
     return size();
 }
 
 NonnullRefPtrVector<PhysicalPage> PhysicalRegion::take_contiguous_free_pages(size_t count, bool supervisor)
 {
     ASSERT(m_pages);
-    ASSERT(m_used != m_pages);
+    ASSERT(count != 0);
 
-    NonnullRefPtrVector<PhysicalPage> physical_pages;
-    physical_pages.ensure_capacity(count);
+    unsigned order = 0;
+    while ((1u << order) < count)
+        ++order;
+    if (order > max_order)
+        return {};
+
+    auto first_page = allocate_block(order);
+    if (!first_page.has_value())
+        return {};
 
-    auto first_contiguous_page = find_contiguous_free_pages(count);
+    // Hand the tail of the block that wasn't asked for straight back.
+    unsigned block_size = 1u << order;
+    if (count < block_size)
+        free_range(first_page.value() + count, block_size - count);
+    mark_allocated(first_page.value(), count);
 
+    NonnullRefPtrVector<PhysicalPage> physical_pages;
+    physical_pages.ensure_capacity(count);
     for (size_t index = 0; index < count; index++)
-        physical_pages.append(PhysicalPage::create(m_lower.offset(PAGE_SIZE * (index + first_contiguous_page)), supervisor));
+        physical_pages.append(PhysicalPage::create(m_lower.offset(PAGE_SIZE * (index + first_page.value())), supervisor));
     return physical_pages;
 }
 
-unsigned PhysicalRegion::find_contiguous_free_pages(size_t count)
-{
-    ASSERT(count != 0);
-    // search from the last page we allocated
-    auto range = find_and_allocate_contiguous_range(count);
-    ASSERT(range.has_value());
-    return range.value();
-}
-
-Optional<unsigned> PhysicalRegion::find_and_allocate_contiguous_range(size_t count)
-{
-    ASSERT(count != 0);
-    size_t found_pages_count = 0;
-    auto first_index = m_bitmap.find_longest_range_of_unset_bits(count, found_pages_count);
-    if (!first_index.has_value())
-        return {};
-
-    auto page = first_index.value();
-    if (count == found_pages_count) {
-        for (unsigned page_index = page; page_index < (page + count); page_index++) {
-            m_bitmap.set(page_index, true);
-        }
-        m_used += count;
-        m_last = page + count;
-        return page;
-    }
-    return {};
-}
-
 RefPtr<PhysicalPage> PhysicalRegion::take_free_page(bool supervisor)
 {
     ASSERT(m_pages);
 
-    if (m_used == m_pages)
+    auto page = allocate_block(0);
+    if (!page.has_value())
         return nullptr;
 
-    return PhysicalPage::create(m_lower.offset(find_contiguous_free_pages(1) * PAGE_SIZE), supervisor);
+    mark_allocated(page.value(), 1);
+    return PhysicalPage::create(m_lower.offset(page.value() * PAGE_SIZE), supervisor);
 }
 
 void PhysicalRegion::return_page_at(PhysicalAddress addr)
@@ -131,11 +123,119 @@ void PhysicalRegion::return_page_at(PhysicalAddress addr)
     ASSERT((FlatPtr)local_offset < (FlatPtr)(m_pages * PAGE_SIZE));
 
     auto page = (FlatPtr)local_offset / PAGE_SIZE;
-    if (page < m_last)
-        m_last = page;
+    ASSERT(m_bitmap.get(page));
 
     m_bitmap.set(page, false);
     m_used--;
+    free_block(page, 0);
+}
+
+void PhysicalRegion::mark_allocated(unsigned index, unsigned count)
+{
+    for (unsigned page = index; page < index + count; ++page) {
+        ASSERT(!m_bitmap.get(page));
+        m_bitmap.set(page, true);
+    }
+    m_used += count;
+}
+
+Optional<unsigned> PhysicalRegion::allocate_block(unsigned order)
+{
+    for (unsigned block_order = order; block_order <= max_order; ++block_order) {
+        auto index = pop_free_block(block_order);
+        if (!index.has_value())
+            continue;
+
+        // Split the block down, putting the upper halves back on the lower orders.
+        while (block_order > order) {
+            --block_order;
+            push_free_block(index.value() + (1u << block_order), block_order);
+        }
+        return index;
+    }
+    return {};
+}
+
+void PhysicalRegion::free_block(unsigned index, unsigned order)
+{
+    while (order < max_order) {
+        unsigned buddy_frame = (first_frame() + index) ^ (1u << order);
+        if (buddy_frame < first_frame())
+            break;
+        unsigned buddy = buddy_frame - first_frame();
+        if (buddy + (1u << order) > m_pages || !is_free_block(buddy, order))
+            break;
+        remove_free_block(buddy, order);
+        index = min(index, buddy);
+        ++order;
+    }
+    push_free_block(index, order);
+}
+
+void PhysicalRegion::free_range(unsigned index, unsigned count)
+{
+    // Carve the range into the largest naturally aligned blocks that fit.
+    while (count) {
+        unsigned order = max_order;
+        while (order && (((first_frame() + index) & ((1u << order) - 1)) || (1u << order) > count))
+            --order;
+        free_block(index, order);
+        index += 1u << order;
+        count -= 1u << order;
+    }
+}
+
+void PhysicalRegion::push_free_block(unsigned index, unsigned order)
+{
+    auto& list = m_free_lists[order];
+    ASSERT(!list.heads.get(slot_of(index, order)));
+    list.heads.set(slot_of(index, order), true);
+    list.blocks.append(index);
+    ++list.count;
+}
+
+Optional<unsigned> PhysicalRegion::pop_free_block(unsigned order)
+{
+    auto& list = m_free_lists[order];
+    while (!list.blocks.is_empty()) {
+        auto index = list.blocks.take_last();
+        auto slot = slot_of(index, order);
+        if (!list.heads.get(slot))
+            continue;
+        list.heads.set(slot, false);
+        --list.count;
+        return index;
+    }
+    ASSERT(!list.count);
+    return {};
+}
+
+void PhysicalRegion::remove_free_block(unsigned index, unsigned order)
+{
+    auto& list = m_free_lists[order];
+    list.heads.set(slot_of(index, order), false);
+    --list.count;
+    if (list.blocks.size() > 2 * list.count + 64)
+        compact_free_list(order);
+}
+
+void PhysicalRegion::compact_free_list(unsigned order)
+{
+    auto& list = m_free_lists[order];
+    size_t kept = 0;
+    for (size_t i = 0; i < list.blocks.size(); ++i) {
+        auto index = list.blocks[i];
+        auto slot = slot_of(index, order);
+        if (!list.heads.get(slot))
+            continue;
+        // Clear the bit as we go so a block pushed more than once is only kept once.
+        list.heads.set(slot, false);
+        list.blocks[kept++] = index;
+    }
+    list.blocks.shrink(kept, true);
+    for (auto index : list.blocks)
+        list.heads.set(slot_of(index, order), true);
+    ASSERT(kept == list.count);
 }
 
 }
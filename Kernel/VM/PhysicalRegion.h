@@ -30,6 +30,7 @@
 #include <AK/NonnullRefPtrVector.h>
 #include <AK/Optional.h>
 #include <AK/RefCounted.h>
+#include <AK/Vector.h>
 #include <Kernel/VM/PhysicalPage.h>
 
 namespace Kernel {
@@ -38,6 +39,10 @@ class PhysicalRegion : public RefCounted<PhysicalRegion> {
     AK_MAKE_ETERNAL
 
 public:
+    // Blocks are power-of-two runs of pages, aligned to their size in physical memory.
+    // The largest order covers 4 MiB.
+    static constexpr unsigned max_order = 10;
+
     static NonnullRefPtr<PhysicalRegion> create(PhysicalAddress lower, PhysicalAddress upper);
     ~PhysicalRegion() {}
 
@@ -57,17 +62,36 @@ public:
     void return_page(PhysicalPage&& page) { return_page_at(page.paddr()); }
 
 private:
-    unsigned find_contiguous_free_pages(size_t count);
-    Optional<unsigned> find_and_allocate_contiguous_range(size_t count);
+    // One free list per order. A block is free iff its bit is set in `heads`; `blocks` is a stack
+    // of candidates that may still hold entries for blocks that were merged away since they were
+    // pushed, those are skipped when popped and dropped when the stack grows too stale.
+    struct FreeList {
+        Bitmap heads { Bitmap::create() };
+        Vector<unsigned> blocks;
+        unsigned count { 0 };
+    };
 
     PhysicalRegion(PhysicalAddress lower, PhysicalAddress upper);
 
+    unsigned first_frame() const { return m_lower.get() / PAGE_SIZE; }
+    unsigned slot_of(unsigned index, unsigned order) const { return ((first_frame() + index) >> order) - (first_frame() >> order); }
+    bool is_free_block(unsigned index, unsigned order) const { return m_free_lists[order].heads.get(slot_of(index, order)); }
+
+    Optional<unsigned> allocate_block(unsigned order);
+    void free_block(unsigned index, unsigned order);
+    void free_range(unsigned index, unsigned count);
+    void push_free_block(unsigned index, unsigned order);
+    Optional<unsigned> pop_free_block(unsigned order);
+    void remove_free_block(unsigned index, unsigned order);
+    void compact_free_list(unsigned order);
+    void mark_allocated(unsigned index, unsigned count);
+
     PhysicalAddress m_lower;
     PhysicalAddress m_upper;
     unsigned m_pages { 0 };
     unsigned m_used { 0 };
-    unsigned m_last { 0 };
     Bitmap m_bitmap;
+    FreeList m_free_lists[max_order + 1];
 };
 
 }
@@ -140,23 +140,31 @@ Range RangeAllocator::allocate_specific(VirtualAddress base, size_t size)
         return {};
 
     Range allocated_range(base, size);
-    for (size_t i = 0; i < m_available_ranges.size(); ++i) {
-        auto& available_range = m_available_ranges[i];
-        if (!available_range.contains(base, size))
-            continue;
-        if (available_range == allocated_range) {
-            m_available_ranges.remove(i);
-            return allocated_range;
-        }
-        carve_at_index(i, allocated_range);
-#ifdef VRA_DEBUG
-        dbg() << "VRA: Allocated specific(" << size << "): " << String::format("%x", available_range.base().get());
-        dump();
-#endif
+    // The available ranges are sorted and disjoint, so only the one containing base can fit.
+    int index = 0;
+    auto* available_range = binary_search(
+        m_available_ranges.data(), m_available_ranges.size(), allocated_range, [](auto& a, auto& b) {
+            if (a.base() < b.base())
+                return -1;
+            if (a.base() >= b.end())
+                return 1;
+            return 0;
+        },
+        &index);
+    if (!available_range || !available_range->contains(base, size)) {
+        dbg() << "VRA: Failed to allocate specific range: " << base << "(" << size << ")";
+        return {};
+    }
+    if (*available_range == allocated_range) {
+        m_available_ranges.remove(index);
         return allocated_range;
     }
-    dbg() << "VRA: Failed to allocate specific range: " << base << "(" << size << ")";
-    return {};
+    carve_at_index(index, allocated_range);
+#ifdef VRA_DEBUG
+    dbg() << "VRA: Allocated specific(" << size << "): " << String::format("%x", allocated_range.base().get());
+    dump();
+#endif
+    return allocated_range;
 }
 
 void RangeAllocator::deallocate(Range range)
@@ -30,7 +30,9 @@
 #include <Kernel/Process.h>
 #include <Kernel/Thread.h>
 #include <Kernel/VM/AnonymousVMObject.h>
+#include <Kernel/VM/InodeVMObject.h>
 #include <Kernel/VM/MemoryManager.h>
+#include <Kernel/VM/PageCache.h>
 #include <Kernel/VM/PageDirectory.h>
 #include <Kernel/VM/Region.h>
 #include <Kernel/VM/SharedInodeVMObject.h>
@@ -38,6 +40,9 @@
 //#define MM_DEBUG
 //#define PAGE_FAULT_DEBUG
 
+// How many pages around an inode fault get mapped along with it, if they are already in memory.
+#define FAULT_AROUND_PAGES 16
+
 namespace Kernel {
 
 Region::Region(const Range& range, NonnullRefPtr<VMObject> vmobject, size_t offset_in_vmobject, const String& name, u8 access, bool cacheable, bool kernel)
@@ -67,7 +72,7 @@ Region::~Region()
 
 NonnullOwnPtr<Region> Region::clone()
 {
-    ASSERT(Process::current);
+    ASSERT(Process::current());
 
     if (m_inherit_mode == InheritMode::ZeroedOnFork) {
         ASSERT(m_mmap);
@@ -91,6 +96,7 @@ NonnullOwnPtr<Region> Region::clone()
         auto region = Region::create_user_accessible(m_range, m_vmobject, m_offset_in_vmobject, m_name, m_access);
         region->set_mmap(m_mmap);
         region->set_shared(m_shared);
+        region->set_large_pages(m_large_pages);
         return region;
     }
 
@@ -112,6 +118,7 @@ NonnullOwnPtr<Region> Region::clone()
         clone_region->set_stack(true);
     }
     clone_region->set_mmap(m_mmap);
+    clone_region->set_large_pages(m_large_pages);
     return clone_region;
 }
 
@@ -244,7 +251,61 @@ void Region::map_individual_page_impl(size_t page_index)
         dbg() << "MM: >> region map (PD=" << m_page_directory->cr3() << ", PTE=" << (void*)pte.raw() << "{" << &pte << "}) " << name() << " " << page_vaddr << " => " << page->paddr() << " (@" << page << ")";
 #endif
     }
-    MM.flush_tlb(page_vaddr);
+}
+
+bool Region::can_map_large_page(size_t page_index) const
+{
+    constexpr size_t pages_per_large_page = LARGE_PAGE_SIZE / PAGE_SIZE;
+    if (!m_large_pages || !MM.large_pages_enabled())
+        return false;
+    if (vaddr().offset(page_index * PAGE_SIZE).get() & ~LARGE_PAGE_MASK)
+        return false;
+    if (page_index + pages_per_large_page > page_count())
+        return false;
+    if (!is_readable() && !is_writable())
+        return false;
+    auto* first_page = physical_page(page_index);
+    if (!first_page || (first_page->paddr().get() & ~LARGE_PAGE_MASK))
+        return false;
+    for (size_t i = 0; i < pages_per_large_page; ++i) {
+        auto* page = physical_page(page_index + i);
+        if (!page || page->paddr() != first_page->paddr().offset(i * PAGE_SIZE))
+            return false;
+        // Pages that need their own protection can't share an entry.
+        if (should_cow(page_index + i))
+            return false;
+    }
+    return true;
+}
+
+void Region::map_large_page_impl(size_t page_index)
+{
+    auto page_vaddr = vaddr().offset(page_index * PAGE_SIZE);
+    auto& pde = MM.ensure_large_page_pde(*m_page_directory, page_vaddr);
+    pde.set_large_page_base(physical_page(page_index)->paddr().get());
+    pde.set_cache_disabled(!m_cacheable);
+    pde.set_writable(is_writable());
+    if (g_cpu_supports_nx)
+        pde.set_execute_disabled(!is_executable());
+    pde.set_user_allowed(is_user_accessible());
+    pde.set_present(true);
+#ifdef MM_DEBUG
+    dbg() << "MM: >> region map large page (PD=" << m_page_directory->cr3() << ") " << name() << " " << page_vaddr << " => " << physical_page(page_index)->paddr();
+#endif
+}
+
+size_t Region::large_page_count() const
+{
+    if (!m_large_pages || !m_page_directory)
+        return 0;
+    InterruptDisabler disabler;
+    size_t count = 0;
+    FlatPtr first = (vaddr().get() + LARGE_PAGE_SIZE - 1) & LARGE_PAGE_MASK;
+    for (FlatPtr large_page = first; large_page + LARGE_PAGE_SIZE <= range().end().get(); large_page += LARGE_PAGE_SIZE) {
+        if (MM.pde(const_cast<PageDirectory&>(*m_page_directory), VirtualAddress(large_page)).is_huge())
+            ++count;
+    }
+    return count;
 }
 
 void Region::remap_page(size_t page_index)
@@ -253,6 +314,7 @@ void Region::remap_page(size_t page_index)
     InterruptDisabler disabler;
     ASSERT(physical_page(page_index));
     map_individual_page_impl(page_index);
+    MM.flush_tlb(m_page_directory.ptr(), vaddr().offset(page_index * PAGE_SIZE));
 }
 
 void Region::unmap(ShouldDeallocateVirtualMemoryRange deallocate_range)
@@ -261,14 +323,22 @@ void Region::unmap(ShouldDeallocateVirtualMemoryRange deallocate_range)
     ASSERT(m_page_directory);
     for (size_t i = 0; i < page_count(); ++i) {
         auto vaddr = this->vaddr().offset(i * PAGE_SIZE);
+        if (m_large_pages && !(vaddr.get() & ~LARGE_PAGE_MASK) && i + LARGE_PAGE_SIZE / PAGE_SIZE <= page_count()) {
+            auto& pde = MM.pde(*m_page_directory, vaddr);
+            if (pde.is_huge()) {
+                pde.clear();
+                i += LARGE_PAGE_SIZE / PAGE_SIZE - 1;
+                continue;
+            }
+        }
         auto& pte = MM.ensure_pte(*m_page_directory, vaddr);
         pte.clear();
-        MM.flush_tlb(vaddr);
 #ifdef MM_DEBUG
         auto* page = physical_page(i);
         dbg() << "MM: >> Unmapped " << vaddr << " => P" << String::format("%p", page ? page->paddr().get() : 0) << " <<";
 #endif
     }
+    MM.flush_tlb(m_page_directory.ptr(), vaddr(), page_count());
     if (deallocate_range == ShouldDeallocateVirtualMemoryRange::Yes) {
         if (m_page_directory->range_allocator().contains(range()))
             m_page_directory->range_allocator().deallocate(range());
@@ -291,8 +361,16 @@ void Region::map(PageDirectory& page_directory)
 #ifdef MM_DEBUG
     dbg() << "MM: Region::map() will map VMO pages " << first_page_index() << " - " << last_page_index() << " (VMO page count: " << vmobject().page_count() << ")";
 #endif
-    for (size_t page_index = 0; page_index < page_count(); ++page_index)
+    for (size_t page_index = 0; page_index < page_count();) {
+        if (can_map_large_page(page_index)) {
+            map_large_page_impl(page_index);
+            page_index += LARGE_PAGE_SIZE / PAGE_SIZE;
+            continue;
+        }
         map_individual_page_impl(page_index);
+        ++page_index;
+    }
+    MM.flush_tlb(m_page_directory.ptr(), vaddr(), page_count());
 }
 
 void Region::remap()
@@ -367,8 +445,8 @@ PageFaultResponse Region::handle_zero_fault(size_t page_index_in_region)
         return PageFaultResponse::Continue;
     }
 
-    if (Thread::current)
-        Thread::current->did_zero_fault();
+    if (Thread::current())
+        Thread::current()->did_zero_fault();
 
     auto page = MM.allocate_user_physical_page(MemoryManager::ShouldZeroFill::Yes);
     if (page.is_null()) {
@@ -397,8 +475,8 @@ PageFaultResponse Region::handle_cow_fault(size_t page_index_in_region)
         return PageFaultResponse::Continue;
     }
 
-    if (Thread::current)
-        Thread::current->did_cow_fault();
+    if (Thread::current())
+        Thread::current()->did_cow_fault();
 
 #ifdef PAGE_FAULT_DEBUG
     dbg() << "    >> It's a COW page and it's time to COW!";
@@ -432,51 +510,118 @@ PageFaultResponse Region::handle_inode_fault(size_t page_index_in_region)
     cli();
 
     auto& inode_vmobject = static_cast<InodeVMObject&>(vmobject());
-    auto& vmobject_physical_page_entry = inode_vmobject.physical_pages()[first_page_index() + page_index_in_region];
+    size_t page_index_in_vmobject = first_page_index() + page_index_in_region;
 
 #ifdef PAGE_FAULT_DEBUG
     dbg() << "Inode fault in " << name() << " page index: " << page_index_in_region;
 #endif
 
-    if (!vmobject_physical_page_entry.is_null()) {
+    if (!inode_vmobject.physical_pages()[page_index_in_vmobject].is_null()) {
 #ifdef PAGE_FAULT_DEBUG
         dbg() << ("MM: page_in_from_inode() but page already present. Fine with me!");
 #endif
         remap_page(page_index_in_region);
+        fault_around(page_index_in_region);
         return PageFaultResponse::Continue;
     }
 
-    if (Thread::current)
-        Thread::current->did_inode_fault();
+    if (Thread::current())
+        Thread::current()->did_inode_fault();
+
+    size_t page_count = inode_vmobject.readahead_page_count(page_index_in_vmobject, this->page_count() - page_index_in_region);
+    ASSERT(page_count);
+
+    auto& inode = inode_vmobject.inode();
+    if (inode.uses_page_cache()) {
+        // Map the very pages read() and write() use. Private mappings get them copy-on-write.
+        sti();
+        auto& page_cache = inode.page_cache();
+        auto result = page_cache.populate(page_index_in_vmobject, page_count);
+        cli();
+        if (result.is_error()) {
+            klog() << "MM: handle_inode_fault had error (" << result.error() << ") while reading!";
+            return result.error() == -ENOMEM ? PageFaultResponse::OutOfMemory : PageFaultResponse::ShouldCrash;
+        }
+        bool is_private = inode_vmobject.is_private_inode();
+        for (size_t i = 0; i < page_count; ++i) {
+            auto& slot = inode_vmobject.physical_pages()[page_index_in_vmobject + i];
+            if (!slot.is_null())
+                continue;
+            slot = page_cache.page(page_index_in_vmobject + i);
+            if (slot && is_private)
+                set_should_cow(page_index_in_region + i, true);
+        }
+        // If the page was reclaimed before we could grab it, we'll simply fault on it again.
+        if (inode_vmobject.physical_pages()[page_index_in_vmobject].is_null())
+            return PageFaultResponse::Continue;
+        remap_page(page_index_in_region);
+        fault_around(page_index_in_region);
+        return PageFaultResponse::Continue;
+    }
+
+    NonnullRefPtrVector<PhysicalPage> pages;
+    for (size_t i = 0; i < page_count; ++i) {
+        auto page = MM.allocate_user_physical_page(MemoryManager::ShouldZeroFill::No);
+        if (page.is_null())
+            break;
+        pages.append(page.release_nonnull());
+    }
+    if (pages.is_empty()) {
+        klog() << "MM: handle_inode_fault was unable to allocate a physical page";
+        return PageFaultResponse::OutOfMemory;
+    }
 
 #ifdef MM_DEBUG
-    dbg() << "MM: page_in_from_inode ready to read from inode";
+    dbg() << "MM: page_in_from_inode ready to read " << pages.size() << " page(s) from inode";
 #endif
     sti();
-    u8 page_buffer[PAGE_SIZE];
-    auto& inode = inode_vmobject.inode();
-    auto nread = inode.read_bytes((first_page_index() + page_index_in_region) * PAGE_SIZE, PAGE_SIZE, page_buffer, nullptr);
+    // Map the new pages into the kernel so the inode can read straight into them.
+    auto staging_vmobject = AnonymousVMObject::create_with_physical_pages(pages);
+    auto staging_region = MM.allocate_kernel_region_with_vmobject(*staging_vmobject, pages.size() * PAGE_SIZE, "Inode fault", Region::Access::Read | Region::Access::Write);
+    if (!staging_region) {
+        klog() << "MM: handle_inode_fault was unable to map pages for reading";
+        cli();
+        return PageFaultResponse::OutOfMemory;
+    }
+    auto* buffer = staging_region->vaddr().as_ptr();
+    ssize_t size = pages.size() * PAGE_SIZE;
+    auto nread = inode.read_bytes(page_index_in_vmobject * PAGE_SIZE, size, buffer, nullptr);
     if (nread < 0) {
         klog() << "MM: handle_inode_fault had error (" << nread << ") while reading!";
+        cli();
         return PageFaultResponse::ShouldCrash;
     }
-    if (nread < PAGE_SIZE) {
-        // If we read less than a page, zero out the rest to avoid leaking uninitialized data.
-        memset(page_buffer + nread, 0, PAGE_SIZE - nread);
+    if (nread < size) {
+        // If we read less than we asked for, zero out the rest to avoid leaking uninitialized data.
+        memset(buffer + nread, 0, size - nread);
     }
+    staging_region = nullptr;
     cli();
-    vmobject_physical_page_entry = MM.allocate_user_physical_page(MemoryManager::ShouldZeroFill::No);
-    if (vmobject_physical_page_entry.is_null()) {
-        klog() << "MM: handle_inode_fault was unable to allocate a physical page";
-        return PageFaultResponse::OutOfMemory;
-    }
 
-    u8* dest_ptr = MM.quickmap_page(*vmobject_physical_page_entry);
-    memcpy(dest_ptr, page_buffer, PAGE_SIZE);
-    MM.unquickmap_page();
+    for (size_t i = 0; i < pages.size(); ++i) {
+        auto& slot = inode_vmobject.physical_pages()[page_index_in_vmobject + i];
+        if (slot.is_null())
+            slot = pages[i];
+    }
 
     remap_page(page_index_in_region);
+    fault_around(page_index_in_region);
     return PageFaultResponse::Continue;
 }
 
+void Region::fault_around(size_t page_index_in_region)
+{
+    // Map the neighbors that are already in memory as well, so touching them doesn't fault.
+    // Only pages that aren't mapped at all are touched, so there's nothing to flush from the TLB.
+    size_t first_page = page_index_in_region & ~(FAULT_AROUND_PAGES - 1);
+    size_t end_page = min(first_page + FAULT_AROUND_PAGES, page_count());
+    for (size_t page_index = first_page; page_index < end_page; ++page_index) {
+        if (page_index == page_index_in_region || !physical_page(page_index))
+            continue;
+        auto& pte = MM.ensure_pte(*m_page_directory, vaddr().offset(page_index * PAGE_SIZE));
+        if (!pte.is_present())
+            map_individual_page_impl(page_index);
+    }
+}
+
 }
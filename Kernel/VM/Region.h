@@ -98,6 +98,11 @@ public:
     bool is_kernel() const { return m_kernel || vaddr().get() >= 0xc0000000; }
     void set_kernel(bool kernel) { m_kernel = kernel; }
 
+    // Opt in to mapping naturally aligned, physically contiguous 2 MiB runs with large pages.
+    bool wants_large_pages() const { return m_large_pages; }
+    void set_large_pages(bool large_pages) { m_large_pages = large_pages; }
+    size_t large_page_count() const;
+
     PageFaultResponse handle_fault(const PageFault&);
 
     NonnullOwnPtr<Region> clone();
@@ -198,9 +203,12 @@ private:
 
     PageFaultResponse handle_cow_fault(size_t page_index);
     PageFaultResponse handle_inode_fault(size_t page_index);
+    void fault_around(size_t page_index);
     PageFaultResponse handle_zero_fault(size_t page_index);
 
     void map_individual_page_impl(size_t page_index);
+    bool can_map_large_page(size_t page_index) const;
+    void map_large_page_impl(size_t page_index);
 
     RefPtr<PageDirectory> m_page_directory;
     Range m_range;
@@ -215,6 +223,7 @@ private:
     bool m_stack : 1 { false };
     bool m_mmap : 1 { false };
     bool m_kernel : 1 { false };
+    bool m_large_pages : 1 { false };
     mutable OwnPtr<Bitmap> m_cow_map;
 };
 
@@ -70,7 +70,7 @@
 #include <Kernel/TTY/PTYMultiplexer.h>
 #include <Kernel/TTY/VirtualConsole.h>
 #include <Kernel/Tasks/FinalizerTask.h>
-#include <Kernel/Tasks/SyncTask.h>
+#include <Kernel/Tasks/WritebackTask.h>
 #include <Kernel/Time/TimeManagement.h>
 #include <Kernel/VM/MemoryManager.h>
 
@@ -101,6 +101,9 @@ VirtualConsole* tty0;
 
 extern "C" [[noreturn]] void init()
 {
+    // Everything that wants to know the current thread goes through the per-CPU data, so set that up first.
+    Processor::initialize(0);
+
     setup_serial_debug();
 
     cpu_setup();
@@ -111,8 +114,8 @@ extern "C" [[noreturn]] void init()
     CommandLine::initialize(reinterpret_cast<const char*>(low_physical_to_virtual(multiboot_info_ptr->cmdline)));
 
     MemoryManager::initialize();
+    kmalloc_enable_expansion();
 
-    gdt_init();
     idt_init();
 
     // Invoke all static global constructors in the kernel.
@@ -168,22 +171,20 @@ extern "C" [[noreturn]] void init()
 //
 extern "C" [[noreturn]] void init_ap(u32 cpu)
 {
+    Processor::initialize(cpu);
     APIC::the().enable(cpu);
-    
-#if 0
-    Scheduler::idle_loop();
-#else
-    // FIXME: remove once schedule can handle APs
-    cli();
-    for (;;)
-        asm volatile("hlt");
-#endif
-    ASSERT_NOT_REACHED();
+
+    Scheduler::start_secondary_processor();
 }
 
 void init_stage2()
 {
-    SyncTask::spawn();
+    if (Processor::count() > 1) {
+        APIC::the().calibrate_timer();
+        Scheduler::release_secondary_processors();
+    }
+
+    WritebackTask::spawn();
     FinalizerTask::spawn();
 
     PCI::initialize();
@@ -309,7 +310,7 @@ void init_stage2()
         hang();
     }
 
-    Process::current->set_root_directory(VFS::the().root_custody());
+    Process::current()->set_root_directory(VFS::the().root_custody());
 
     load_kernel_symbol_table();
 
@@ -328,7 +329,7 @@ void init_stage2()
 
     NetworkTask::spawn();
 
-    Process::current->sys$exit(0);
+    Process::current()->sys$exit(0);
     ASSERT_NOT_REACHED();
 }
 
@@ -59,4 +59,16 @@ int sched_getparam(pid_t pid, struct sched_param* param)
     int rc = syscall(SC_sched_getparam, pid, param);
     __RETURN_WITH_ERRNO(rc, rc, -1);
 }
+
+int sched_setaffinity(pid_t tid, size_t cpu_set_size, const cpu_set_t* cpu_set)
+{
+    int rc = syscall(SC_sched_setaffinity, tid, cpu_set_size, cpu_set);
+    __RETURN_WITH_ERRNO(rc, rc, -1);
+}
+
+int sched_getaffinity(pid_t tid, size_t cpu_set_size, cpu_set_t* cpu_set)
+{
+    int rc = syscall(SC_sched_getaffinity, tid, cpu_set_size, cpu_set);
+    __RETURN_WITH_ERRNO(rc, rc, -1);
+}
 }
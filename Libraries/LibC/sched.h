@@ -47,4 +47,19 @@ int sched_get_priority_max(int policy);
 int sched_setparam(pid_t pid, const struct sched_param* param);
 int sched_getparam(pid_t pid, struct sched_param* param);
 
+#define CPU_SETSIZE 32
+
+typedef struct {
+    uint32_t bits;
+} cpu_set_t;
+
+#define CPU_ZERO(set) ((set)->bits = 0)
+#define CPU_SET(cpu, set) ((set)->bits |= (1u << (cpu)))
+#define CPU_CLR(cpu, set) ((set)->bits &= ~(1u << (cpu)))
+#define CPU_ISSET(cpu, set) (((set)->bits & (1u << (cpu))) != 0)
+#define CPU_COUNT(set) __builtin_popcount((set)->bits)
+
+int sched_setaffinity(pid_t tid, size_t cpu_set_size, const cpu_set_t*);
+int sched_getaffinity(pid_t tid, size_t cpu_set_size, cpu_set_t*);
+
 __END_DECLS
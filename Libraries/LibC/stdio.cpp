@@ -39,6 +39,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -124,6 +125,8 @@ private:
 
     // Read some data into the buffer.
     bool read_into_buffer();
+    // Read straight into the caller's memory, and refill the buffer in the same syscall.
+    ssize_t read_past_buffer(u8*, size_t);
     // Flush *some* data from the buffer.
     bool write_from_buffer();
 
@@ -230,6 +233,28 @@ bool FILE::read_into_buffer()
     return true;
 }
 
+ssize_t FILE::read_past_buffer(u8* data, size_t size)
+{
+    m_buffer.realize(m_fd);
+
+    size_t available_size;
+    u8* buffer_data = m_buffer.begin_enqueue(available_size);
+    ASSERT(available_size);
+
+    iovec iov[2] = { { data, size }, { buffer_data, available_size } };
+    ssize_t nread = ::readv(m_fd, iov, 2);
+
+    if (nread < 0) {
+        m_error = errno;
+    } else if (nread == 0) {
+        m_eof = true;
+    } else if ((size_t)nread > size) {
+        m_buffer.did_enqueue(nread - size);
+        nread = size;
+    }
+    return nread;
+}
+
 bool FILE::write_from_buffer()
 {
     size_t size;
@@ -258,6 +283,16 @@ size_t FILE::read(u8* data, size_t size)
             size_t queued_size;
             const u8* queued_data = m_buffer.begin_dequeue(queued_size);
             if (queued_size == 0) {
+                if (size >= BUFSIZ) {
+                    // A big read; skip copying it through the buffer.
+                    ssize_t nread = read_past_buffer(data, size);
+                    if (nread <= 0)
+                        return total_read;
+                    total_read += nread;
+                    data += nread;
+                    size -= nread;
+                    continue;
+                }
                 // Nothing buffered; we're going to have to read some.
                 bool read_some_more = read_into_buffer();
                 if (read_some_more) {
@@ -1,5 +1,5 @@
 /*
- * Copyright (c) 2020, Andreas Kling <kling@serenityos.org>
+ * Copyright (c) 2020, the SerenityOS developers.
  * All rights reserved.
  *
  * Redistribution and use in source and binary forms, with or without
@@ -26,9 +26,13 @@
 
 #pragma once
 
-namespace Kernel {
-class SyncTask {
-public:
-    static void spawn();
-};
-}
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+__BEGIN_DECLS
+
+// Moves up to count bytes from in_fd to out_fd without passing them through userspace.
+// Works between any readable and writable fds: files, pipes, sockets and devices.
+ssize_t sendfile(int out_fd, int in_fd, off_t* offset, size_t count);
+
+__END_DECLS
@@ -41,12 +41,14 @@
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <termios.h>
 #include <unistd.h>
 
 extern "C" {
 
 static __thread int s_cached_tid = 0;
+static int s_cached_pid = 0;
 
 int chown(const char* pathname, uid_t uid, gid_t gid)
 {
@@ -68,8 +70,10 @@ int fchown(int fd, uid_t uid, gid_t gid)
 pid_t fork()
 {
     int rc = syscall(SC_fork);
-    if (rc == 0)
+    if (rc == 0) {
         s_cached_tid = 0;
+        s_cached_pid = 0;
+    }
     __RETURN_WITH_ERRNO(rc, rc, -1);
 }
 
@@ -199,7 +203,9 @@ gid_t getgid()
 
 pid_t getpid()
 {
-    return syscall(SC_getpid);
+    if (!s_cached_pid)
+        s_cached_pid = syscall(SC_getpid);
+    return s_cached_pid;
 }
 
 pid_t getppid()
@@ -709,12 +715,14 @@ int unveil(const char* path, const char* permissions)
 
 ssize_t pread(int fd, void* buf, size_t count, off_t offset)
 {
-    // FIXME: This is not thread safe and should be implemented in the kernel instead.
-    off_t old_offset = lseek(fd, 0, SEEK_CUR);
-    lseek(fd, offset, SEEK_SET);
-    ssize_t nread = read(fd, buf, count);
-    lseek(fd, old_offset, SEEK_SET);
-    return nread;
+    iovec iov { buf, count };
+    return preadv(fd, &iov, 1, offset);
+}
+
+ssize_t pwrite(int fd, const void* buf, size_t count, off_t offset)
+{
+    iovec iov { const_cast<void*>(buf), count };
+    return pwritev(fd, &iov, 1, offset);
 }
 
 char* getpass(const char* prompt)
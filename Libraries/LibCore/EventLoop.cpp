@@ -50,6 +50,12 @@
 #include <time.h>
 #include <unistd.h>
 
+// Serenity and Linux can tell us which fds became ready; everywhere else we rebuild fd_sets for select().
+#if defined(__serenity__) || defined(__linux__)
+#    define EVENTLOOP_USE_EPOLL
+#    include <sys/epoll.h>
+#endif
+
 //#define EVENTLOOP_DEBUG
 //#define DEFERRED_INVOKE_DEBUG
 
@@ -77,8 +83,43 @@ static EventLoop* s_main_event_loop;
 static Vector<EventLoop*>* s_event_loop_stack;
 static NeverDestroyed<IDAllocator> s_id_allocator;
 static HashMap<int, NonnullOwnPtr<EventLoopTimer>>* s_timers;
-static HashTable<Notifier*>* s_notifiers;
+static HashMap<int, Vector<Notifier*, 1>>* s_notifiers;
 int EventLoop::s_wake_pipe_fds[2];
+
+#ifdef EVENTLOOP_USE_EPOLL
+static int s_epoll_fd = -1;
+// A fork()ed child shares the epoll set with its parent, so it has to make its own before touching it.
+static pid_t s_epoll_fd_pid = 0;
+static int s_epoll_wake_fd = -1;
+// Regular files can't be watched with epoll, but they are always ready anyway.
+static HashTable<int>* s_always_ready_fds;
+#endif
+
+#ifdef EVENTLOOP_USE_EPOLL
+static void update_watched_events(int fd);
+
+static void ensure_epoll_fd_is_ours()
+{
+    if (s_epoll_fd_pid == getpid())
+        return;
+    if (s_epoll_fd >= 0)
+        close(s_epoll_fd);
+    s_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    ASSERT(s_epoll_fd >= 0);
+    s_epoll_fd_pid = getpid();
+
+    epoll_event wake_event {};
+    wake_event.events = EPOLLIN;
+    wake_event.data.fd = s_epoll_wake_fd;
+    int rc = epoll_ctl(s_epoll_fd, EPOLL_CTL_ADD, s_epoll_wake_fd, &wake_event);
+    ASSERT(rc == 0);
+
+    // Whatever the parent was watching, we still want to hear about in here.
+    s_always_ready_fds->clear();
+    for (auto& it : *s_notifiers)
+        update_watched_events(it.key);
+}
+#endif
 static RefPtr<LocalServer> s_rpc_server;
 HashMap<int, RefPtr<RPCClient>> s_rpc_clients;
 
@@ -220,7 +261,7 @@ EventLoop::EventLoop()
     if (!s_event_loop_stack) {
         s_event_loop_stack = new Vector<EventLoop*>;
         s_timers = new HashMap<int, NonnullOwnPtr<EventLoopTimer>>;
-        s_notifiers = new HashTable<Notifier*>;
+        s_notifiers = new HashMap<int, Vector<Notifier*, 1>>;
     }
 
     if (!s_main_event_loop) {
@@ -234,6 +275,13 @@ EventLoop::EventLoop()
 
 #endif
         ASSERT(rc == 0);
+
+#ifdef EVENTLOOP_USE_EPOLL
+        s_always_ready_fds = new HashTable<int>;
+        s_epoll_wake_fd = s_wake_pipe_fds[0];
+        ensure_epoll_fd_is_ours();
+#endif
+
         s_event_loop_stack->append(this);
 
         if (!s_rpc_server) {
@@ -411,30 +459,6 @@ void EventLoop::post_event(Object& receiver, NonnullOwnPtr<Event>&& event)
 
 void EventLoop::wait_for_event(WaitMode mode)
 {
-    fd_set rfds;
-    fd_set wfds;
-    FD_ZERO(&rfds);
-    FD_ZERO(&wfds);
-
-    int max_fd = 0;
-    auto add_fd_to_set = [&max_fd](int fd, fd_set& set) {
-        FD_SET(fd, &set);
-        if (fd > max_fd)
-            max_fd = fd;
-    };
-
-    int max_fd_added = -1;
-    add_fd_to_set(s_wake_pipe_fds[0], rfds);
-    max_fd = max(max_fd, max_fd_added);
-    for (auto& notifier : *s_notifiers) {
-        if (notifier->event_mask() & Notifier::Read)
-            add_fd_to_set(notifier->fd(), rfds);
-        if (notifier->event_mask() & Notifier::Write)
-            add_fd_to_set(notifier->fd(), wfds);
-        if (notifier->event_mask() & Notifier::Exceptional)
-            ASSERT_NOT_REACHED();
-    }
-
     bool queued_events_is_empty;
     {
         LOCKER(m_private->lock);
@@ -461,8 +485,51 @@ void EventLoop::wait_for_event(WaitMode mode)
         }
     }
 
+#ifdef EVENTLOOP_USE_EPOLL
+    int timeout_in_ms = -1;
+    if (!s_always_ready_fds->is_empty())
+        timeout_in_ms = 0;
+    else if (!should_wait_forever)
+        timeout_in_ms = timeout.tv_sec * 1000 + (timeout.tv_usec + 999) / 1000;
+
+    ensure_epoll_fd_is_ours();
+    epoll_event events[64];
+    int marked_fd_count = Core::safe_syscall(epoll_wait, s_epoll_fd, events, 64, timeout_in_ms);
+    bool wake_pipe_is_ready = false;
+    for (int i = 0; i < marked_fd_count; ++i) {
+        if (events[i].data.fd == s_wake_pipe_fds[0])
+            wake_pipe_is_ready = true;
+    }
+#else
+    fd_set rfds;
+    fd_set wfds;
+    FD_ZERO(&rfds);
+    FD_ZERO(&wfds);
+
+    int max_fd = 0;
+    auto add_fd_to_set = [&max_fd](int fd, fd_set& set) {
+        FD_SET(fd, &set);
+        if (fd > max_fd)
+            max_fd = fd;
+    };
+
+    add_fd_to_set(s_wake_pipe_fds[0], rfds);
+    for (auto& it : *s_notifiers) {
+        for (auto* notifier : it.value) {
+            if (notifier->event_mask() & Notifier::Read)
+                add_fd_to_set(notifier->fd(), rfds);
+            if (notifier->event_mask() & Notifier::Write)
+                add_fd_to_set(notifier->fd(), wfds);
+            if (notifier->event_mask() & Notifier::Exceptional)
+                ASSERT_NOT_REACHED();
+        }
+    }
+
     int marked_fd_count = Core::safe_syscall(select, max_fd + 1, &rfds, &wfds, nullptr, should_wait_forever ? nullptr : &timeout);
-    if (FD_ISSET(s_wake_pipe_fds[0], &rfds)) {
+    bool wake_pipe_is_ready = FD_ISSET(s_wake_pipe_fds[0], &rfds);
+#endif
+
+    if (wake_pipe_is_ready) {
         char buffer[32];
         auto nread = read(s_wake_pipe_fds[0], buffer, sizeof(buffer));
         if (nread < 0) {
@@ -500,19 +567,34 @@ void EventLoop::wait_for_event(WaitMode mode)
         }
     }
 
+    auto post_notifier_events = [this](int fd, bool is_readable, bool is_writable) {
+        auto it = s_notifiers->find(fd);
+        if (it == s_notifiers->end())
+            return;
+        for (auto* notifier : it->value) {
+            if (is_readable && (notifier->event_mask() & Notifier::Read) && notifier->on_ready_to_read)
+                post_event(*notifier, make<NotifierReadEvent>(fd));
+            if (is_writable && (notifier->event_mask() & Notifier::Write) && notifier->on_ready_to_write)
+                post_event(*notifier, make<NotifierWriteEvent>(fd));
+        }
+    };
+
+#ifdef EVENTLOOP_USE_EPOLL
+    for (int fd : *s_always_ready_fds)
+        post_notifier_events(fd, true, true);
+
+    for (int i = 0; i < marked_fd_count; ++i) {
+        // Like select(), treat errors and hangups as readiness so the notifier finds out through read() or write().
+        bool has_error = events[i].events & (EPOLLERR | EPOLLHUP);
+        post_notifier_events(events[i].data.fd, has_error || (events[i].events & EPOLLIN), has_error || (events[i].events & EPOLLOUT));
+    }
+#else
     if (!marked_fd_count)
         return;
 
-    for (auto& notifier : *s_notifiers) {
-        if (FD_ISSET(notifier->fd(), &rfds)) {
-            if (notifier->on_ready_to_read)
-                post_event(*notifier, make<NotifierReadEvent>(notifier->fd()));
-        }
-        if (FD_ISSET(notifier->fd(), &wfds)) {
-            if (notifier->on_ready_to_write)
-                post_event(*notifier, make<NotifierWriteEvent>(notifier->fd()));
-        }
-    }
+    for (auto& it : *s_notifiers)
+        post_notifier_events(it.key, FD_ISSET(it.key, &rfds), FD_ISSET(it.key, &wfds));
+#endif
 }
 
 bool EventLoopTimer::has_expired(const timeval& now) const
@@ -573,14 +655,75 @@ bool EventLoop::unregister_timer(int timer_id)
     return true;
 }
 
+// Tells the kernel which events the notifiers on this fd want, all together.
+static void update_watched_events(int fd)
+{
+#ifdef EVENTLOOP_USE_EPOLL
+    ensure_epoll_fd_is_ours();
+
+    unsigned event_mask = 0;
+    auto it = s_notifiers->find(fd);
+    if (it != s_notifiers->end()) {
+        for (auto* notifier : it->value)
+            event_mask |= notifier->event_mask();
+    }
+    if (event_mask & Notifier::Exceptional)
+        ASSERT_NOT_REACHED();
+
+    if (!event_mask) {
+        s_always_ready_fds->remove(fd);
+        // The fd may already be closed, which took it off the epoll set for us.
+        epoll_ctl(s_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        return;
+    }
+
+    epoll_event event {};
+    if (event_mask & Notifier::Read)
+        event.events |= EPOLLIN;
+    if (event_mask & Notifier::Write)
+        event.events |= EPOLLOUT;
+    event.data.fd = fd;
+
+    // We don't get to hear about fds being closed and reused, so don't trust what we think is in the set.
+    int rc = epoll_ctl(s_epoll_fd, EPOLL_CTL_MOD, fd, &event);
+    if (rc < 0 && errno == ENOENT)
+        rc = epoll_ctl(s_epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    if (rc < 0 && errno == EPERM) {
+        s_always_ready_fds->set(fd);
+        return;
+    }
+    if (rc < 0)
+        perror("Core::EventLoop: epoll_ctl");
+#else
+    (void)fd;
+#endif
+}
+
 void EventLoop::register_notifier(Badge<Notifier>, Notifier& notifier)
 {
-    s_notifiers->set(&notifier);
+    auto& notifiers = s_notifiers->ensure(notifier.fd());
+    if (!notifiers.contains_slow(&notifier))
+        notifiers.append(&notifier);
+    update_watched_events(notifier.fd());
 }
 
 void EventLoop::unregister_notifier(Badge<Notifier>, Notifier& notifier)
 {
-    s_notifiers->remove(&notifier);
+    auto it = s_notifiers->find(notifier.fd());
+    if (it == s_notifiers->end())
+        return;
+    it->value.remove_first_matching([&](auto* entry) { return entry == &notifier; });
+    if (it->value.is_empty())
+        s_notifiers->remove(it);
+    update_watched_events(notifier.fd());
+}
+
+void EventLoop::notifier_event_mask_did_change(Badge<Notifier>, Notifier& notifier)
+{
+    auto it = s_notifiers->find(notifier.fd());
+    if (it == s_notifiers->end() || !it->value.contains_slow(&notifier))
+        return;
+    update_watched_events(notifier.fd());
 }
 
 void EventLoop::wake()
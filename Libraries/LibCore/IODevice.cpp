@@ -34,10 +34,15 @@
 #include <sys/select.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 namespace Core {
 
+// Big reads from regular files bypass our buffer, and read a little more into it along the way.
+static constexpr size_t large_read_size = 4096;
+static constexpr size_t read_ahead_size = 1024;
+
 IODevice::IODevice(Object* parent)
     : Object(parent)
 {
@@ -82,7 +87,21 @@ ByteBuffer IODevice::read(size_t max_size)
     }
     if (!remaining_buffer_space)
         return buffer;
-    int nread = ::read(m_fd, buffer_ptr, remaining_buffer_space);
+    int nread;
+    if (m_reads_ahead && remaining_buffer_space >= large_read_size) {
+        // Big reads go straight into the caller's buffer, and refill ours in the same call.
+        ASSERT(m_buffered_data.is_empty());
+        m_buffered_data.resize(read_ahead_size);
+        struct iovec iov[2] = {
+            { buffer_ptr, remaining_buffer_space },
+            { m_buffered_data.data(), m_buffered_data.size() },
+        };
+        nread = ::readv(m_fd, iov, 2);
+        m_buffered_data.resize(max(nread - (int)remaining_buffer_space, 0));
+        nread = min(nread, (int)remaining_buffer_space);
+    } else {
+        nread = ::read(m_fd, buffer_ptr, remaining_buffer_space);
+    }
     if (nread < 0) {
         if (taken_from_buffered) {
             buffer.trim(taken_from_buffered);
@@ -155,8 +174,21 @@ ByteBuffer IODevice::read_all()
     }
 
     while (true) {
-        char read_buffer[4096];
-        int nread = ::read(m_fd, read_buffer, sizeof(read_buffer));
+        size_t old_size = data.size();
+        int nread;
+        if ((off_t)old_size < file_size) {
+            // Read straight into the result; if we know how big the file is, that's usually a single read.
+            data.resize(file_size, true);
+            nread = ::read(m_fd, data.data() + old_size, file_size - old_size);
+            data.resize(old_size + max(nread, 0), true);
+        } else {
+            // Past the size we know of, this is usually just the read that finds EOF.
+            // Don't grow the result for it, that would mean copying all of it.
+            u8 buffer[4096];
+            nread = ::read(m_fd, buffer, sizeof(buffer));
+            if (nread > 0)
+                data.append(buffer, nread);
+        }
         if (nread < 0) {
             set_error(errno);
             break;
@@ -165,7 +197,6 @@ ByteBuffer IODevice::read_all()
             set_eof(true);
             break;
         }
-        data.append((const u8*)read_buffer, nread);
     }
     if (data.is_empty())
         return {};
@@ -296,6 +327,9 @@ void IODevice::set_fd(int fd)
         return;
 
     m_fd = fd;
+    // Only regular files, anything we read ahead from a socket or pipe wouldn't show up as readable anymore.
+    struct stat st;
+    m_reads_ahead = fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
     did_update_fd(fd);
 }
 
@@ -100,6 +100,7 @@ private:
     OpenMode m_mode { NotOpen };
     mutable int m_error { 0 };
     mutable bool m_eof { false };
+    bool m_reads_ahead { false };
     mutable Vector<u8> m_buffered_data;
 };
 
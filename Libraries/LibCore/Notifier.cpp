@@ -52,6 +52,12 @@ void Notifier::set_enabled(bool enabled)
         Core::EventLoop::unregister_notifier({}, *this);
 }
 
+void Notifier::set_event_mask(unsigned event_mask)
+{
+    m_event_mask = event_mask;
+    Core::EventLoop::notifier_event_mask_did_change({}, *this);
+}
+
 void Notifier::event(Core::Event& event)
 {
     if (event.type() == Core::Event::NotifierRead && on_ready_to_read) {
@@ -87,6 +87,9 @@ HashMap<pid_t, Core::ProcessStatistics> ProcessStatisticsReader::get_all()
             thread.ticks = thread_object.get("ticks").to_u32();
             thread.priority = thread_object.get("priority").to_u32();
             thread.effective_priority = thread_object.get("effective_priority").to_u32();
+            thread.cpu = thread_object.get("cpu").to_u32();
+            thread.affinity_mask = thread_object.get("affinity_mask").to_u32();
+            thread.migrations = thread_object.get("migrations").to_u32();
             thread.syscall_count = thread_object.get("syscall_count").to_u32();
             thread.inode_faults = thread_object.get("inode_faults").to_u32();
             thread.zero_faults = thread_object.get("zero_faults").to_u32();
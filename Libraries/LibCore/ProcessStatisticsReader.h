@@ -49,6 +49,9 @@ struct ThreadStatistics {
     String state;
     u32 priority;
     u32 effective_priority;
+    u32 cpu;
+    u32 affinity_mask;
+    unsigned migrations;
     String name;
 };
 
@@ -31,7 +31,9 @@
 #include <LibCore/DirIterator.h>
 #include <LibCore/File.h>
 #include <LibHTTP/HttpRequest.h>
+#include <errno.h>
 #include <stdio.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
@@ -119,10 +121,10 @@ void Client::handle_request(ByteBuffer raw_request)
         return;
     }
 
-    send_response(file->read_all(), request);
+    send_file(*file, request);
 }
 
-void Client::send_response(StringView response, const HTTP::HttpRequest& request)
+void Client::send_response_header()
 {
     StringBuilder builder;
     builder.append("HTTP/1.0 200 OK\r\n");
@@ -131,11 +133,37 @@ void Client::send_response(StringView response, const HTTP::HttpRequest& request
     builder.append("\r\n");
 
     m_socket->write(builder.to_string());
+}
+
+void Client::send_response(StringView response, const HTTP::HttpRequest& request)
+{
+    send_response_header();
     m_socket->write(response);
 
     log_response(200, request);
 }
 
+void Client::send_file(Core::File& file, const HTTP::HttpRequest& request)
+{
+    send_response_header();
+
+    // Have the kernel move the file straight from the page cache to the socket,
+    // so big files don't have to fit in our memory.
+    for (;;) {
+        ssize_t nsent = sendfile(m_socket->fd(), file.fd(), nullptr, 64 * KB);
+        if (nsent < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("sendfile");
+            break;
+        }
+        if (nsent == 0)
+            break;
+    }
+
+    log_response(200, request);
+}
+
 void Client::send_redirect(StringView redirect_path, const HTTP::HttpRequest& request)
 {
     StringBuilder builder;
@@ -29,9 +29,9 @@
 #include <AK/StringBuilder.h>
 #include <LibCore/ArgsParser.h>
 #include <LibCore/DirIterator.h>
-#include <assert.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -128,27 +128,15 @@ bool copy_file(String src_path, String dst_path, struct stat src_stat, int src_f
         }
     }
 
+    // Let the kernel move the data across instead of bouncing it through a buffer of ours.
     for (;;) {
-        char buffer[32768];
-        ssize_t nread = read(src_fd, buffer, sizeof(buffer));
-        if (nread < 0) {
-            perror("read src");
+        ssize_t nsent = sendfile(dst_fd, src_fd, nullptr, 1 * MB);
+        if (nsent < 0) {
+            perror("sendfile");
             return false;
         }
-        if (nread == 0)
+        if (nsent == 0)
             break;
-        ssize_t remaining_to_write = nread;
-        char* bufptr = buffer;
-        while (remaining_to_write) {
-            ssize_t nwritten = write(dst_fd, bufptr, remaining_to_write);
-            if (nwritten < 0) {
-                perror("write dst");
-                return false;
-            }
-            assert(nwritten > 0);
-            remaining_to_write -= nwritten;
-            bufptr += nwritten;
-        }
     }
 
     auto my_umask = umask(0);
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2020, the SerenityOS developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <AK/String.h>
+#include <AK/Types.h>
+#include <AK/Vector.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+
+// Measures how long a page fault takes depending on how many regions the process has,
+// since the kernel has to find the faulting region before it can do anything else.
+
+static constexpr size_t page_size = 4096;
+
+static void exit_with_usage(int rc)
+{
+    fprintf(stderr, "Usage: fault_benchmark [-h] [-p pages_per_region] [-f minimum_fault_count] [-n region_count1,region_count2,...]\n");
+    exit(rc);
+}
+
+static u64 now_in_ns()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u64)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void benchmark(int region_count, int pages_per_region, int minimum_fault_count)
+{
+    Vector<u8*> regions;
+    regions.ensure_capacity(region_count);
+
+    u64 total_ns = 0;
+    u64 fault_count = 0;
+    while (fault_count < (u64)minimum_fault_count) {
+        for (int i = 0; i < region_count; ++i) {
+            auto* region = (u8*)mmap(nullptr, pages_per_region * page_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, 0, 0);
+            if (region == MAP_FAILED) {
+                perror("mmap");
+                exit(1);
+            }
+            regions.append(region);
+        }
+
+        // Touch the regions in a scattered order so the lookup can't get lucky with its cache.
+        u64 start = now_in_ns();
+        for (int page = 0; page < pages_per_region; ++page) {
+            for (int i = 0; i < region_count; ++i)
+                regions[(i * 7919) % region_count][page * page_size] = 1;
+        }
+        total_ns += now_in_ns() - start;
+        fault_count += region_count * pages_per_region;
+
+        for (auto* region : regions)
+            munmap(region, pages_per_region * page_size);
+        regions.clear_with_capacity();
+    }
+
+    printf("regions=%d faults=%llu time=%llums ns_per_fault=%llu\n",
+        region_count, fault_count, total_ns / 1000000, total_ns / fault_count);
+}
+
+int main(int argc, char** argv)
+{
+    int pages_per_region = 4;
+    int minimum_fault_count = 100000;
+    Vector<int> region_counts;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "hp:f:n:")) != -1) {
+        switch (opt) {
+        case 'h':
+            exit_with_usage(0);
+            break;
+        case 'p':
+            pages_per_region = atoi(optarg);
+            break;
+        case 'f':
+            minimum_fault_count = atoi(optarg);
+            break;
+        case 'n':
+            for (auto count : String(optarg).split(','))
+                region_counts.append(atoi(count.characters()));
+            break;
+        default:
+            exit_with_usage(1);
+        }
+    }
+
+    if (pages_per_region <= 0 || minimum_fault_count <= 0)
+        exit_with_usage(1);
+
+    if (region_counts.is_empty())
+        region_counts = { 16, 64, 256, 1024, 4096 };
+
+    for (auto region_count : region_counts) {
+        if (region_count <= 0)
+            exit_with_usage(1);
+        benchmark(region_count, pages_per_region, minimum_fault_count);
+    }
+
+    return 0;
+}
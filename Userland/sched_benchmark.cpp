@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2020, the SerenityOS developers.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <AK/String.h>
+#include <AK/Types.h>
+#include <AK/Vector.h>
+#include <LibCore/ElapsedTimer.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+struct Worker {
+    pthread_t thread;
+    u64 yields { 0 };
+};
+
+static volatile bool s_should_stop;
+static int s_blocker_pipe[2];
+
+static void exit_with_usage(int rc)
+{
+    fprintf(stderr, "Usage: sched_benchmark [-h] [-t time_per_benchmark] [-n thread_count1,thread_count2,...] [-b blocked_thread_count]\n");
+    exit(rc);
+}
+
+static void* yield_loop(void* arg)
+{
+    auto& worker = *(Worker*)arg;
+    while (!s_should_stop) {
+        sched_yield();
+        ++worker.yields;
+    }
+    return nullptr;
+}
+
+static void* block_forever(void*)
+{
+    char ch;
+    read(s_blocker_pipe[0], &ch, 1);
+    return nullptr;
+}
+
+static void benchmark(int thread_count, int time_per_benchmark)
+{
+    Vector<Worker> workers;
+    workers.resize(thread_count);
+
+    s_should_stop = false;
+    for (auto& worker : workers) {
+        if (pthread_create(&worker.thread, nullptr, yield_loop, &worker) != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+
+    Core::ElapsedTimer timer;
+    timer.start();
+    sleep(time_per_benchmark);
+    s_should_stop = true;
+
+    u64 total_yields = 0;
+    for (auto& worker : workers) {
+        pthread_join(worker.thread, nullptr);
+        total_yields += worker.yields;
+    }
+    int elapsed = timer.elapsed();
+
+    u64 ns_per_switch = total_yields ? (u64)elapsed * 1000000 / total_yields : 0;
+    printf("threads=%d time=%dms switches=%llu switches_per_second=%llu ns_per_switch=%llu\n",
+        thread_count, elapsed, total_yields, elapsed ? total_yields * 1000 / elapsed : 0, ns_per_switch);
+}
+
+int main(int argc, char** argv)
+{
+    int time_per_benchmark = 2;
+    int blocked_thread_count = 0;
+    Vector<int> thread_counts;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "ht:n:b:")) != -1) {
+        switch (opt) {
+        case 'h':
+            exit_with_usage(0);
+            break;
+        case 't':
+            time_per_benchmark = atoi(optarg);
+            break;
+        case 'n':
+            for (auto count : String(optarg).split(','))
+                thread_counts.append(atoi(count.characters()));
+            break;
+        case 'b':
+            blocked_thread_count = atoi(optarg);
+            break;
+        default:
+            exit_with_usage(1);
+        }
+    }
+
+    if (thread_counts.is_empty())
+        thread_counts = { 1, 2, 4, 8, 16, 32, 64, 128, 256 };
+
+    // Threads that stay blocked for the whole run, to see what idle threads cost each scheduling pass.
+    if (pipe(s_blocker_pipe) < 0) {
+        perror("pipe");
+        return 1;
+    }
+    Vector<pthread_t> blocked_threads;
+    for (int i = 0; i < blocked_thread_count; ++i) {
+        pthread_t thread;
+        if (pthread_create(&thread, nullptr, block_forever, nullptr) != 0) {
+            perror("pthread_create");
+            return 1;
+        }
+        blocked_threads.append(thread);
+    }
+
+    printf("Running with %d blocked threads\n", blocked_thread_count);
+    for (auto thread_count : thread_counts)
+        benchmark(thread_count, time_per_benchmark);
+
+    for (size_t i = 0; i < blocked_threads.size(); ++i)
+        write(s_blocker_pipe[1], "x", 1);
+    for (auto thread : blocked_threads)
+        pthread_join(thread, nullptr);
+
+    return 0;
+}